@@ -4,6 +4,13 @@
 //
 //                           This supports saving and restoring things like
 //                           the WindowPlacement and LogFont structures.
+//
+//                           When a MarkDuplicates.cfg file is found beside
+//                           the program, the blocks are kept in it instead,
+//                           through ConfigFile, so that a portable install
+//                           leaves the registry alone. Where the registry
+//                           cannot be opened, they are kept in the config
+//                           file of the user, at ConfigFile::GetDefaultPath.
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "framework.h"
@@ -16,6 +23,8 @@ ApplicationRegistry::ApplicationRegistry()
 {
 	_hWnd             = 0;
 	_psRegistrySubKey = new wstring(_T(""));
+	_pConfigFile      = NULL;
+	_isInit           = false;
 	_isOK             = true;
 	_LastAPICallLine  = 0;
 	_LastErrorNumber  = 0;
@@ -27,8 +36,9 @@ ApplicationRegistry::ApplicationRegistry()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 BOOL ApplicationRegistry::Init(HWND hWnd)
 {
-	// Check to see if we have been initialized already.
-	if (_hWnd) return true;
+	// Check to see if we have been initialized already. The window handle
+	// may be NULL, for a run without a window.
+	if (_isInit) return true;
 
 	// Save the window handle for later use
 	_hWnd = hWnd;
@@ -56,6 +66,15 @@ BOOL ApplicationRegistry::Init(HWND hWnd)
 	}
 	wstring sModuleFileName = pszModuleFileName;
 	delete[] pszModuleFileName;
+
+	// A config file beside the program selects the portable install, which needs no version resource.
+	wstring sConfigFileName = sModuleFileName.substr(0, sModuleFileName.find_last_of(_T('\\')) + 1) + PORTABLE_CONFIG_FILE;
+	if (GetFileAttributes(sConfigFileName.c_str()) != INVALID_FILE_ATTRIBUTES)
+	{
+		_pConfigFile = new ConfigFile(sConfigFileName);
+		_isInit = true;
+		return true;
+	}
 	//------------------------------------------------------------------------------------------------------------
 	// Retrieve the size of the VS_VERSION resource in the module
 	DWORD dwIgnored;
@@ -256,6 +275,12 @@ BOOL ApplicationRegistry::Init(HWND hWnd)
 	*_psRegistrySubKey = pszRegistrySubkey;
 	delete[] pszRegistrySubkey;
 
+	// Without a registry to open, the blocks are kept in the config file of the user.
+	HKEY hKey;
+	if (RegOpenKeyEx(HKEY_CURRENT_USER, _T("Software"), 0, KEY_READ, &hKey) == ERROR_SUCCESS) RegCloseKey(hKey);
+	else _pConfigFile = new ConfigFile(ConfigFile::GetDefaultPath());
+	_isInit = true;
+
 	return true;
 }
 
@@ -266,13 +291,16 @@ BOOL ApplicationRegistry::LoadMemoryBlock(const wstring& sEntry, BYTE *lpMemoryB
 {
 	// Verify that Init() has been called
 	_LastAPICallLine = __LINE__ + 1;
-	if (_hWnd == 0)
+	if (!_isInit)
 	{
 		_LastErrorNumber = ERROR_APP_INIT_FAILURE;
 		_isOK = false;
 		return false;
 	}
 
+	// A portable install, or one without a registry, keeps the blocks in its config file
+	if (_pConfigFile != NULL) return _pConfigFile->LoadMemoryBlock(sEntry, lpMemoryBlock, cbMemoryBlock);
+
 	// Retrieve the memory block stored size from the
 	// registry and verify that the stored size is correct
 	HKEY hKey;
@@ -312,13 +340,24 @@ BOOL ApplicationRegistry::SaveMemoryBlock(const wstring& sEntry, const BYTE* lpM
 {
 	// Verify that Init() has been called
 	_LastAPICallLine = __LINE__ + 1;
-	if (_hWnd == 0)
+	if (!_isInit)
 	{
 		_LastErrorNumber = ERROR_APP_INIT_FAILURE;
 		_isOK = false;
 		return false;
 	}
 
+	// A portable install, or one without a registry, keeps the blocks in its config file
+	_LastAPICallLine = __LINE__ + 1;
+	if (_pConfigFile != NULL)
+	{
+		if (_pConfigFile->SaveMemoryBlock(sEntry, lpMemoryBlock, cbMemoryBlock)) return TRUE;
+		_isOK = false;
+		_LastErrorNumber = ERROR_WRITE_FAULT;
+		DisplayAPIError();
+		return false;
+	}
+
 	// Save the memory block to the registry
 	HKEY hKey;
 	_LastAPICallLine = __LINE__ + 1;
@@ -1,26 +1,31 @@
 #pragma once
 #include "framework.h"
+#include "ConfigFile.h"
 
 #define MAX_KEYLEN 100
 #define MAX_QUERY_COMPANYNAME_LEN 50
 #define MAX_QUERY_PRODUCTNAME_LEN 50
 #define MAX_QUERY_PRODUCTVERSION_LEN 50
 #define MAX_ERROR_MESSAGE_LEN 100
+#define PORTABLE_CONFIG_FILE _T("MarkDuplicates.cfg") // Beside the program, selects the config file backend.
 
 class ApplicationRegistry
 {
 private:
 	HWND     _hWnd;
 	wstring* _psRegistrySubKey;
+	ConfigFile* _pConfigFile;  // Used instead of the registry when not NULL.
+	BOOL     _isInit;
 	BOOL     _isOK;
 	UINT     _LastAPICallLine;
 	DWORD    _LastErrorNumber;
 public:
 	ApplicationRegistry();
-	~ApplicationRegistry() { delete _psRegistrySubKey; }
+	~ApplicationRegistry() { delete _psRegistrySubKey; delete _pConfigFile; }
 	BOOL Init(HWND hWnd);
 	BOOL LoadMemoryBlock(const wstring& sEntry,       BYTE *lpMemoryBlock, DWORD cbMemoryBlock);
 	BOOL SaveMemoryBlock(const wstring& sEntry, const BYTE *lpMemoryBlock, DWORD cbMemoryBlock);
 	BOOL isOK() { return _isOK; }
+	BOOL isPortable() { return _pConfigFile != NULL; }
 	void DisplayAPIError();
 };
@@ -0,0 +1,524 @@
+///////////////////////////////////////////////////////////////////////////////
+// AsyncReader.cpp - Reads many files at once from one thread, for the
+//                   coroutines of an AsyncScan.
+//
+// An AsyncFile is a FileReader that leaves its offset to its coroutine: the
+// coroutine awaits an AsyncRead at the offset, and moves the offset on by
+// what was read. The file is opened for overlapped reads on Windows, and
+// its holes are found as FileReader finds them, so that the coroutine can
+// hash a hole from zeros without a read.
+//
+// An AsyncQueue holds the reads in flight of one thread. Submit starts a
+// read and returns true, or completes it at once and returns false, when
+// the coroutine goes on without being suspended. Complete waits for at
+// least one read in flight, and resumes the coroutine of each read that
+// has completed, on the thread that waits. Given Milliseconds, it returns
+// after that long at most, even with no read complete, for a caller that
+// has postponed work of its own to look at again.
+//
+// On Windows the queue is an I/O completion port, to which each file is
+// bound once it is opened; a read that completes at once posts nothing to
+// the port, where the system allows it. On Linux it is an io_uring, as the
+// queued engine of FileReader sets it up, with one entry for each read the
+// queue may hold and one for a timeout, which bounds a timed wait: the
+// reads submitted by the coroutines that a wait has resumed are submitted
+// together by the next wait, with one system call.
+// Where neither can be set up, Create returns the sync engine, which reads
+// at once, so the coroutines run one after another.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AsyncReader.h"
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+//=============================================================================
+// PortQueue - The completion port of Windows.
+// RingQueue - The io_uring of Linux.
+//=============================================================================
+
+#ifdef _WIN32
+
+class PortQueue : public AsyncQueue
+{
+private:
+	typedef struct tagRequest
+	{
+		OVERLAPPED Overlapped;
+		AsyncRead* pRead;
+	} *Request;
+	HANDLE   _hPort;
+	Request  _Requests;     // One for each read in flight.
+	int*     _FreeRequests;
+	int      _FreeCount;
+public:
+	PortQueue(int Capacity);
+	virtual ~PortQueue();
+	bool                IsReady() const { return _hPort != NULL; }
+	virtual void        Attach(AsyncFile* pFile);
+	virtual bool        Submit(AsyncRead* pRead);
+	virtual void        Complete(int Milliseconds = -1);
+	virtual const char* GetName() const { return "IOCP"; }
+};
+
+#elif defined(HAVE_IO_URING)
+
+class RingQueue : public AsyncQueue
+{
+private:
+	int        _Ring;
+	void*      _SqMemory;
+	size_t     _SqLength;
+	void*      _CqMemory;
+	size_t     _CqLength;
+	struct io_uring_sqe* _Sqes;
+	size_t     _SqesLength;
+	unsigned*  _SqTail;
+	unsigned*  _SqMask;
+	unsigned*  _SqArray;
+	unsigned*  _CqHead;
+	unsigned*  _CqTail;
+	unsigned*  _CqMask;
+	struct io_uring_cqe* _Cqes;
+	unsigned   _Unsubmitted; // Entries in the submission ring that the kernel has not taken yet.
+	bool       _TimerArmed;  // A timeout of a timed wait is in the ring, or in flight.
+	struct __kernel_timespec _Timeout;
+	void       Push(const struct io_uring_sqe& Sqe);
+public:
+	RingQueue(int Capacity);
+	virtual ~RingQueue();
+	bool                IsReady() const;
+	virtual bool        Submit(AsyncRead* pRead);
+	virtual void        Complete(int Milliseconds = -1);
+	virtual const char* GetName() const { return "io_uring"; }
+};
+
+#endif
+
+//=============================================================================
+// Create - Returns a queue for Capacity reads in flight, of the system's own
+//          kind, or the sync engine if that cannot be set up.
+//=============================================================================
+
+AsyncQueue* AsyncQueue::Create(int Capacity)
+{
+#ifdef _WIN32
+	PortQueue* pQueue = new PortQueue(Capacity);
+	if (pQueue->IsReady()) return pQueue;
+	delete pQueue;
+#elif defined(HAVE_IO_URING)
+	RingQueue* pQueue = new RingQueue(Capacity);
+	if (pQueue->IsReady()) return pQueue;
+	delete pQueue;
+#else
+	(void)Capacity;
+#endif
+	return new AsyncQueue;
+}
+
+//=============================================================================
+// Complete - The sync engine has no reads in flight, so a timed wait only
+//            sleeps.
+//=============================================================================
+
+void AsyncQueue::Complete(int Milliseconds)
+{
+	if (Milliseconds > 0) std::this_thread::sleep_for(std::chrono::milliseconds(Milliseconds));
+}
+
+//=============================================================================
+// AsyncFile  - Opens its files for overlapped reads.
+// GetDataLen - Returns the bytes from the offset up to the next hole, at
+//              most cbMax.
+// Advance    - Moves the offset past the bytes of a read.
+// IsAtEnd    - Whether a read of cbAsk bytes that read cbRead was the last,
+//              which a short read is once the file has been read to its
+//              size.
+//=============================================================================
+
+AsyncFile::AsyncFile(int Options) : FileReader(Options)
+{
+	_Overlapped = true;
+	_Attached = false;
+	_SkipOnSuccess = false;
+}
+
+uint32_t AsyncFile::GetDataLen(uint32_t cbMax)
+{
+	if (!_Sparse) return cbMax;
+	GetHole();
+	return _Offset < _HoleStart && _HoleStart - _Offset < cbMax ? (uint32_t)(_HoleStart - _Offset) : cbMax;
+}
+
+void AsyncFile::Advance(uint32_t cbRead)
+{
+	_Offset += cbRead;
+	DropBehind(false);
+}
+
+bool AsyncFile::IsAtEnd(int64_t cbRead, uint32_t cbAsk) const
+{
+	return cbRead == 0 || (cbRead < cbAsk && _Offset >= _Size);
+}
+
+//=============================================================================
+// AsyncRead - A read of cbRead bytes into pReadBuffer, at the offset of the
+//             file, for the queue to start once the coroutine awaits it.
+//=============================================================================
+
+AsyncRead::AsyncRead(AsyncQueue* pQueue, AsyncFile* pFile, uint8_t* pReadBuffer, uint32_t cbRead)
+{
+	Queue = pQueue;
+	File = pFile;
+	pBuffer = pReadBuffer;
+	cbAsk = cbRead;
+	Result = 0;
+	Error = 0;
+}
+
+bool AsyncRead::await_suspend(std::coroutine_handle<> Caller)
+{
+	Handle = Caller;
+	return Queue->Submit(this);
+}
+
+//=============================================================================
+// Finish - Sets the result of a read from its system error code and the
+//          bytes it read. The end of the file is not an error.
+//=============================================================================
+
+static void Finish(AsyncRead* pRead, uint32_t Error, uint32_t cbRead)
+{
+#ifdef _WIN32
+	if (Error == ERROR_HANDLE_EOF) Error = 0;
+#endif
+	pRead->Error = Error;
+	pRead->Result = Error != 0 ? -1 : (int64_t)cbRead;
+}
+
+#ifdef _WIN32
+
+//=============================================================================
+// Submit - The sync engine: reads at once, and waits for an overlapped read
+//          that the system does not complete at once.
+//=============================================================================
+
+bool AsyncQueue::Submit(AsyncRead* pRead)
+{
+	HANDLE hFile = (HANDLE)pRead->File->_hFile;
+	OVERLAPPED Overlapped;
+	DWORD cbRead = 0;
+	ZeroMemory(&Overlapped, sizeof(Overlapped));
+	Overlapped.Offset = (DWORD)pRead->File->_Offset;
+	Overlapped.OffsetHigh = (DWORD)(pRead->File->_Offset >> 32);
+	BOOL bRead = ReadFile(hFile, pRead->pBuffer, pRead->cbAsk, NULL, &Overlapped) || GetLastError() == ERROR_IO_PENDING;
+	if (bRead) bRead = GetOverlappedResult(hFile, &Overlapped, &cbRead, TRUE);
+	Finish(pRead, bRead ? ERROR_SUCCESS : GetLastError(), cbRead);
+	return false;
+}
+
+PortQueue::PortQueue(int Capacity)
+{
+	_hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	_Requests = new tagRequest[Capacity];
+	_FreeRequests = new int[Capacity];
+	for (int i = 0; i < Capacity; ++i) _FreeRequests[i] = Capacity - 1 - i;
+	_FreeCount = Capacity;
+}
+
+PortQueue::~PortQueue()
+{
+	if (_hPort != NULL) CloseHandle(_hPort);
+	delete[] _FreeRequests;
+	delete[] _Requests;
+}
+
+//=============================================================================
+// Attach - Binds a file that has just been opened to the port. A file that
+//          cannot be bound is read by the sync engine.
+//=============================================================================
+
+void PortQueue::Attach(AsyncFile* pFile)
+{
+	HANDLE hFile = (HANDLE)pFile->_hFile;
+	pFile->_Attached = CreateIoCompletionPort(hFile, _hPort, 0, 0) != NULL;
+	pFile->_SkipOnSuccess = pFile->_Attached && SetFileCompletionNotificationModes(hFile, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS);
+}
+
+//=============================================================================
+// Submit - Starts an overlapped read. A read that completes at once, with
+//          nothing posted to the port, or that fails, is finished here.
+//=============================================================================
+
+bool PortQueue::Submit(AsyncRead* pRead)
+{
+	if (!pRead->File->_Attached) return AsyncQueue::Submit(pRead); // The queue has a request for each file.
+	HANDLE hFile = (HANDLE)pRead->File->_hFile;
+	int Index = _FreeRequests[--_FreeCount];
+	Request pRequest = &_Requests[Index];
+	ZeroMemory(&pRequest->Overlapped, sizeof(OVERLAPPED));
+	pRequest->Overlapped.Offset = (DWORD)pRead->File->_Offset;
+	pRequest->Overlapped.OffsetHigh = (DWORD)(pRead->File->_Offset >> 32);
+	pRequest->pRead = pRead;
+	BOOL bRead = ReadFile(hFile, pRead->pBuffer, pRead->cbAsk, NULL, &pRequest->Overlapped);
+	DWORD dwError = bRead ? ERROR_SUCCESS : GetLastError();
+	if (dwError == ERROR_IO_PENDING || (bRead && !pRead->File->_SkipOnSuccess))
+	{
+		_Pending++;
+		return true;
+	}
+	DWORD cbRead = 0;
+	if (bRead && !GetOverlappedResult(hFile, &pRequest->Overlapped, &cbRead, FALSE)) dwError = GetLastError();
+	Finish(pRead, dwError, cbRead);
+	_FreeRequests[_FreeCount++] = Index;
+	return false;
+}
+
+//=============================================================================
+// Complete - Waits for reads to complete, or for up to Milliseconds if that
+//            is not negative, and resumes their coroutines.
+//=============================================================================
+
+void PortQueue::Complete(int Milliseconds)
+{
+	OVERLAPPED_ENTRY Entries[ASYNC_COMPLETION_BATCH];
+	ULONG Count = 0;
+	if (_Pending == 0)
+	{
+		AsyncQueue::Complete(Milliseconds);
+		return;
+	}
+	DWORD dwTimeout = Milliseconds < 0 ? INFINITE : (DWORD)Milliseconds;
+	if (!GetQueuedCompletionStatusEx(_hPort, Entries, ASYNC_COMPLETION_BATCH, &Count, dwTimeout, FALSE)) return;
+	for (ULONG i = 0; i < Count; ++i)
+	{
+		Request pRequest = CONTAINING_RECORD(Entries[i].lpOverlapped, tagRequest, Overlapped);
+		AsyncRead* pRead = pRequest->pRead;
+		DWORD cbRead = 0, dwError = ERROR_SUCCESS;
+		if (!GetOverlappedResult((HANDLE)pRead->File->_hFile, &pRequest->Overlapped, &cbRead, FALSE)) dwError = GetLastError();
+		Finish(pRead, dwError, cbRead);
+		_FreeRequests[_FreeCount++] = (int)(pRequest - _Requests);
+		_Pending--;
+		pRead->Handle.resume();
+	}
+}
+
+#else
+
+//=============================================================================
+// Submit - The sync engine: reads at once with pread, until the bytes asked
+//          for are read or the file ends.
+//=============================================================================
+
+bool AsyncQueue::Submit(AsyncRead* pRead)
+{
+	uint32_t cbTotal = 0;
+	while (cbTotal < pRead->cbAsk)
+	{
+		ssize_t cbRead = pread(pRead->File->_File, pRead->pBuffer + cbTotal, pRead->cbAsk - cbTotal,
+			(off_t)(pRead->File->_Offset + cbTotal));
+		if (cbRead < 0 && errno == EINTR) continue;
+		if (cbRead < 0)
+		{
+			Finish(pRead, (uint32_t)errno, 0);
+			return false;
+		}
+		if (cbRead == 0) break; // EOF
+		cbTotal += (uint32_t)cbRead;
+	}
+	Finish(pRead, 0, cbTotal);
+	return false;
+}
+
+#ifdef HAVE_IO_URING
+
+RingQueue::RingQueue(int Capacity)
+{
+	_SqMemory = _CqMemory = MAP_FAILED;
+	_Sqes = (struct io_uring_sqe*)MAP_FAILED;
+	_SqLength = _CqLength = _SqesLength = 0;
+	_Unsubmitted = 0;
+	_TimerArmed = false;
+
+	struct io_uring_params Params;
+	memset(&Params, 0, sizeof(Params));
+	_Ring = (int)syscall(__NR_io_uring_setup, (unsigned)Capacity + 1, &Params); // One more for the timeout.
+	if (_Ring < 0) return;
+	if (!(Params.features & IORING_FEAT_RW_CUR_POS)) // Kernels before 5.6 have no IORING_OP_READ.
+	{
+		close(_Ring);
+		_Ring = -1;
+		return;
+	}
+
+	// The submission and completion rings share one mapping on kernels that allow it.
+	_SqLength = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+	_CqLength = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+	if (Params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (_CqLength > _SqLength) _SqLength = _CqLength;
+		_CqLength = 0;
+	}
+	_SqMemory = mmap(NULL, _SqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_SQ_RING);
+	if (_SqMemory == MAP_FAILED) return;
+	void* pCq = _SqMemory;
+	if (_CqLength != 0)
+	{
+		_CqMemory = mmap(NULL, _CqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_CQ_RING);
+		if (_CqMemory == MAP_FAILED) return;
+		pCq = _CqMemory;
+	}
+	_SqesLength = Params.sq_entries * sizeof(struct io_uring_sqe);
+	_Sqes = (struct io_uring_sqe*)mmap(NULL, _SqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_SQES);
+
+	_SqTail  = (unsigned*)((char*)_SqMemory + Params.sq_off.tail);
+	_SqMask  = (unsigned*)((char*)_SqMemory + Params.sq_off.ring_mask);
+	_SqArray = (unsigned*)((char*)_SqMemory + Params.sq_off.array);
+	_CqHead  = (unsigned*)((char*)pCq + Params.cq_off.head);
+	_CqTail  = (unsigned*)((char*)pCq + Params.cq_off.tail);
+	_CqMask  = (unsigned*)((char*)pCq + Params.cq_off.ring_mask);
+	_Cqes    = (struct io_uring_cqe*)((char*)pCq + Params.cq_off.cqes);
+}
+
+RingQueue::~RingQueue()
+{
+	if (_Sqes != MAP_FAILED) munmap(_Sqes, _SqesLength);
+	if (_CqMemory != MAP_FAILED) munmap(_CqMemory, _CqLength);
+	if (_SqMemory != MAP_FAILED) munmap(_SqMemory, _SqLength);
+	if (_Ring >= 0) close(_Ring);
+}
+
+bool RingQueue::IsReady() const
+{
+	return _Ring >= 0 && _SqMemory != MAP_FAILED && (_CqLength == 0 || _CqMemory != MAP_FAILED) && _Sqes != MAP_FAILED;
+}
+
+//=============================================================================
+// Submit - Puts a read in the submission ring, for the next wait to submit.
+//          The ring has an entry for each read the queue may hold, and one
+//          for the timeout, so it is never full.
+// Push   - Puts an entry in the submission ring.
+//=============================================================================
+
+bool RingQueue::Submit(AsyncRead* pRead)
+{
+	struct io_uring_sqe Sqe;
+	memset(&Sqe, 0, sizeof(Sqe));
+	Sqe.opcode = IORING_OP_READ;
+	Sqe.fd = pRead->File->_File;
+	Sqe.addr = (uint64_t)(uintptr_t)pRead->pBuffer;
+	Sqe.len = pRead->cbAsk;
+	Sqe.off = pRead->File->_Offset;
+	Sqe.user_data = (uint64_t)(uintptr_t)pRead;
+	Push(Sqe);
+	_Pending++;
+	return true;
+}
+
+void RingQueue::Push(const struct io_uring_sqe& Sqe)
+{
+	unsigned Tail = *_SqTail;
+	unsigned Index = Tail & *_SqMask;
+	_Sqes[Index] = Sqe;
+	_SqArray[Index] = Index;
+	__atomic_store_n(_SqTail, Tail + 1, __ATOMIC_RELEASE);
+	_Unsubmitted++;
+}
+
+//=============================================================================
+// Complete - Submits the reads put in the ring since the last wait, waits
+//            for at least one read to complete, or for the timeout that a
+//            timed wait arms, and resumes the coroutines of the reads that
+//            have. Every entry the kernel refuses to take is taken back, and
+//            its read fails with the kernel's error, so that the ring has
+//            room again for the reads of the coroutines.
+//=============================================================================
+
+void RingQueue::Complete(int Milliseconds)
+{
+	if (_Pending == 0)
+	{
+		AsyncQueue::Complete(Milliseconds);
+		return;
+	}
+	if (Milliseconds >= 0 && !_TimerArmed)
+	{
+		struct io_uring_sqe Sqe;
+		memset(&Sqe, 0, sizeof(Sqe));
+		_Timeout.tv_sec = Milliseconds / 1000;
+		_Timeout.tv_nsec = (long long)(Milliseconds % 1000) * 1000000;
+		Sqe.opcode = IORING_OP_TIMEOUT;
+		Sqe.fd = -1;
+		Sqe.addr = (uint64_t)(uintptr_t)&_Timeout;
+		Sqe.len = 1;
+		Sqe.user_data = 0; // No read has 0 for its user data.
+		Push(Sqe);
+		_TimerArmed = true;
+	}
+	int Result = (int)syscall(__NR_io_uring_enter, _Ring, _Unsubmitted, 1u, (unsigned)IORING_ENTER_GETEVENTS, NULL, 0);
+	if (Result >= 0) _Unsubmitted -= (unsigned)Result < _Unsubmitted ? (unsigned)Result : _Unsubmitted;
+	else if (errno != EINTR && errno != EAGAIN && errno != EBUSY && _Unsubmitted > 0)
+	{
+		// Take all the entries back from the ring, and fail their reads.
+		int Error = errno;
+		unsigned Tail = *_SqTail;
+		std::vector<AsyncRead*> Refused;
+		while (_Unsubmitted > 0)
+		{
+			Tail--;
+			_Unsubmitted--;
+			AsyncRead* pRead = (AsyncRead*)(uintptr_t)_Sqes[Tail & *_SqMask].user_data;
+			if (pRead == NULL)
+			{
+				_TimerArmed = false;
+				continue;
+			}
+			Finish(pRead, (uint32_t)Error, 0);
+			Refused.push_back(pRead);
+		}
+		__atomic_store_n(_SqTail, Tail, __ATOMIC_RELEASE);
+		_Pending -= (int)Refused.size();
+		for (AsyncRead* pRead : Refused) pRead->Handle.resume();
+		return;
+	}
+
+	// The ring's head is moved on before any coroutine runs, since a coroutine may submit again.
+	AsyncRead* Completed[ASYNC_COMPLETION_BATCH];
+	int Count = 0;
+	unsigned Head = *_CqHead;
+	while (Count < ASYNC_COMPLETION_BATCH && Head != __atomic_load_n(_CqTail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe* pCqe = &_Cqes[Head & *_CqMask];
+		AsyncRead* pRead = (AsyncRead*)(uintptr_t)pCqe->user_data;
+		++Head;
+		if (pRead == NULL)
+		{
+			_TimerArmed = false; // The timeout has expired.
+			continue;
+		}
+		Finish(pRead, pCqe->res < 0 ? (uint32_t)-pCqe->res : 0, pCqe->res < 0 ? 0 : (uint32_t)pCqe->res);
+		Completed[Count++] = pRead;
+	}
+	__atomic_store_n(_CqHead, Head, __ATOMIC_RELEASE);
+	_Pending -= Count;
+	for (int i = 0; i < Count; ++i) Completed[i]->Handle.resume();
+}
+
+#endif
+
+#endif
\ No newline at end of file
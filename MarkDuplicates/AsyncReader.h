@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+// AsyncReader.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "FileReader.h"
+#include <coroutine>
+#include <stdint.h>
+
+#define ASYNC_COMPLETION_BATCH 64 // Most completions taken by one wait.
+
+class AsyncQueue;
+
+// A file read by a coroutine, one read in flight at a time, at offsets it keeps itself.
+class AsyncFile : public FileReader
+{
+	friend class AsyncQueue;
+	friend class PortQueue;
+	friend class RingQueue;
+private:
+	bool     _Attached;      // Bound to a completion port, whose queue waits for its reads.
+	bool     _SkipOnSuccess; // A read that completes at once posts no completion.
+public:
+	AsyncFile(int Options = READ_SEQUENTIAL);
+	uint32_t GetDataLen(uint32_t cbMax);
+	void     Advance(uint32_t cbRead);
+	bool     IsAtEnd(int64_t cbRead, uint32_t cbAsk) const;
+	bool     Retry(uint32_t Error) { return Reopen(Error); }
+};
+
+// Awaits a read of cbAsk bytes at the offset of a file. The coroutine goes on at once when
+// the read completes at once, or else when its queue sees it complete.
+struct AsyncRead
+{
+	AsyncQueue*             Queue;
+	AsyncFile*              File;
+	uint8_t*                pBuffer;
+	uint32_t                cbAsk;
+	int64_t                 Result;   // Bytes read, fewer than asked for only at the end of the file, or -1.
+	uint32_t                Error;    // System error code when Result is -1.
+	std::coroutine_handle<> Handle;
+	AsyncRead(AsyncQueue* pQueue, AsyncFile* pFile, uint8_t* pReadBuffer, uint32_t cbRead);
+	bool    await_ready() const { return false; }
+	bool    await_suspend(std::coroutine_handle<> Caller);
+	int64_t await_resume() const { return Result; }
+};
+
+// The reads in flight of one thread. This is the sync engine, which reads at once; Create
+// returns a completion port on Windows, or an io_uring on Linux, where it can.
+class AsyncQueue
+{
+protected:
+	int _Pending; // Reads in flight.
+public:
+	static AsyncQueue* Create(int Capacity);
+	AsyncQueue() { _Pending = 0; }
+	virtual ~AsyncQueue() {}
+	virtual void        Attach(AsyncFile* pFile) { (void)pFile; }
+	virtual bool        Submit(AsyncRead* pRead);
+	virtual void        Complete(int Milliseconds = -1);
+	virtual const char* GetName() const { return "sync"; }
+	int                 GetPending() const { return _Pending; }
+};
\ No newline at end of file
@@ -0,0 +1,439 @@
+///////////////////////////////////////////////////////////////////////////////
+// AsyncScan.cpp - Hashes the files of a HashedFiles with coroutines, many
+//                 files at once on a few threads.
+//
+// The read and the hash of each file is a coroutine, which awaits each read
+// of the file and hashes what it has read before it reads on. A handful of
+// executors, tasks of the thread pool, run the coroutines, each with an
+// AsyncQueue of its own: a completion port on Windows, or an io_uring on
+// Linux. An executor claims files from HashedFiles, as the readers of the
+// HashPipeline do, and starts a coroutine for each one until it has its
+// share of the files in flight; it then waits for reads to complete, and
+// the coroutines it resumes hash, read on, or finish and make room for the
+// next files. A thousand reads can so be in flight at once, which is what
+// a share with a long round trip needs to be read fast, where the pipeline
+// would need a thread for each.
+//
+// Each file in flight has a buffer of its own, and the buffers together
+// hold PIPELINE_MEMORY_BUDGET bytes, up to READ_SLICE_LEN each. Reads are
+// never shorter than ASYNC_MIN_READ_LEN, since small reads are what the
+// engine is there to avoid, so the files in flight are capped at what the
+// memory holds at that size, and at the files the process may have open.
+// An executor allocates and touches its buffers itself, as a hasher of the
+// pipeline does.
+//
+// Holes of sparse files are hashed from a buffer of zeros without a read.
+// A file is opened on the executor's thread, since Windows cannot open a
+// file without waiting, and the members of a tar archive are hashed by the
+// executor that claims the archive, reading it through once as the pipeline
+// does, while the files it has in flight wait.
+//
+// Nothing waits on the executor's thread but the queue. A file held back by
+// the rate limiter is postponed: the executor starts no file while the opens
+// are capped, resumes the coroutines held back by the byte cap in turn as
+// the cap lets them, and bounds its wait on the queue meanwhile. An open
+// that finds the process or the system out of file handles lowers the files
+// the executor keeps in flight, and is tried again after each wait until a
+// file closes, or is skipped after ASYNC_OPEN_WAIT_MS.
+//
+// The results are those of the pipeline: each hash is saved in HashedFiles
+// as a thread of its own by each executor, and the rate limiter, the
+// background priority, the device counters, the files skipped since they
+// cannot be read, and Abort work as they do there.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AsyncScan.h"
+#include "HashPipeline.h"
+#include <algorithm>
+#include <vector>
+
+//=============================================================================
+// Constructor - The executors are limited to the threads of the pool, and
+//               the files in flight are shared out between them, as many as
+//               the memory of the pipeline holds at the least read size and
+//               the process may have open, with a queue and an archive of
+//               each executor open too. The size of the reads follows from
+//               the files in flight.
+//=============================================================================
+
+AsyncScan::AsyncScan(HashedFiles* pHashedFiles, ThreadPool* pPool, int Executors, int FilesInFlight, int ReadOptions)
+{
+	_HashedFiles = pHashedFiles;
+	_Pool = pPool;
+	_Executors = max(min(Executors, _Pool->GetThreadCount()), 1);
+	FilesInFlight = min(FilesInFlight, MAX_ASYNC_FILES_IN_FLIGHT);
+	FilesInFlight = max(min(FilesInFlight, FileReader::GetOpenLimit(FilesInFlight + 2 * _Executors) - 2 * _Executors), _Executors);
+	_FilesInFlight = FilesInFlight / _Executors;
+	_BufferLen = max(min(PIPELINE_MEMORY_BUDGET / (_FilesInFlight * _Executors), READ_SLICE_LEN) / 4096 * 4096, ASYNC_MIN_READ_LEN);
+	_ReadOptions = ReadOptions;
+	_Limiter = NULL;
+	_Background = false;
+	_Directory = NULL;
+	_ZeroBuffer = (uint8_t*)FileReader::AllocateBuffer(_BufferLen);
+	memset(_ZeroBuffer, 0, _BufferLen);
+	_InFlight = 0;
+	_HoleBytes = 0;
+	_Skipped = 0;
+	_Running = 0;
+	_Abort = false;
+}
+
+//=============================================================================
+// Destructor - Waits for the executors to finish.
+//=============================================================================
+
+AsyncScan::~AsyncScan()
+{
+	Wait();
+	FileReader::FreeBuffer(_ZeroBuffer);
+}
+
+//=============================================================================
+// Start - Each executor hashes as a thread of its own, and claims files
+//         from any device, with no limit on the executors of a device,
+//         since the files in flight, not the threads, load the devices.
+//=============================================================================
+
+void AsyncScan::Start()
+{
+	_HashedFiles->StartHashing(_Executors);
+	for (int i = 0; i < _HashedFiles->GetDeviceCount(); ++i) _HashedFiles->SetDeviceLimit(i, 0);
+	_Running = _Executors;
+	for (int Index = 0; Index < _Executors; ++Index) _Pool->Submit([this, Index] { ExecutorMain(Index); });
+}
+
+//=============================================================================
+// Abort - Stops the executors from starting files, and each coroutine once
+//         its read in flight completes. The files already hashed keep their
+//         hashes.
+//=============================================================================
+
+void AsyncScan::Abort()
+{
+	_Abort = true;
+}
+
+//=============================================================================
+// Wait - Waits until the executors have finished, or for up to Milliseconds
+//        if that is not negative. Returns false on a timeout.
+//=============================================================================
+
+bool AsyncScan::Wait(int Milliseconds)
+{
+	std::unique_lock<std::mutex> Done(_DoneLock);
+	if (Milliseconds < 0)
+	{
+		_Done.wait(Done, [this] { return _Running.load() == 0; });
+		return true;
+	}
+	return _Done.wait_for(Done, std::chrono::milliseconds(Milliseconds), [this] { return _Running.load() == 0; });
+}
+
+//=============================================================================
+// Describe - The executors, the files in flight, and the size of the reads.
+//=============================================================================
+
+void AsyncScan::Describe(TCHAR* pszEngine, int cchEngine) const
+{
+	StringCchPrintf(pszEngine, cchEngine, _T("Executors: %d%s     Files in flight: %d of %d     Reads: %d KB"),
+		_Executors, _Pool->IsPinned() ? _T(" (pinned)") : _T(""), _InFlight.load(), _FilesInFlight * _Executors,
+		_BufferLen / 1024);
+}
+
+//=============================================================================
+// ExecutorMain - Starts a coroutine for each file it claims while it has
+//                fewer than its limit in flight, and otherwise waits for
+//                reads to complete, until the claims are gone and its files
+//                are hashed. A claim is released once its last file is
+//                started. The coroutines it has postponed are resumed when
+//                the rate limiter lets them, or after each wait, and while
+//                any are postponed, or the opens are capped, its waits are
+//                cut short, so that it looks at them again.
+//=============================================================================
+
+void AsyncScan::ExecutorMain(int Index)
+{
+	tagExecutor Executor;
+	Executor.Index = Index;
+	Executor.Queue = AsyncQueue::Create(_FilesInFlight);
+	Executor.Files = new AsyncFile*[_FilesInFlight];
+	Executor.Sha1Files = new sha1file[_FilesInFlight];
+	Executor.Memory = (uint8_t*)FileReader::AllocateBuffer((size_t)_FilesInFlight * _BufferLen);
+	memset(Executor.Memory, 0, (size_t)_FilesInFlight * _BufferLen);
+	Executor.FreeSlots = new int[_FilesInFlight];
+	for (int i = 0; i < _FilesInFlight; ++i)
+	{
+		Executor.Files[i] = new AsyncFile(_ReadOptions);
+		Executor.FreeSlots[i] = _FilesInFlight - 1 - i;
+	}
+	Executor.FreeCount = _FilesInFlight;
+	Executor.Active = 0;
+	Executor.Limit = _FilesInFlight;
+	Executor.ArchiveReader = NULL;
+	Executor.Archive = NULL;
+	Executor.ArchiveActive = false;
+	if (_Background) ThreadPool::SetThreadBackground(true);
+
+	int First = 0, Last = 0, Device = 0;
+	bool bClaim = false, bClaimsLeft = true;
+	for (;;)
+	{
+		// The coroutines held back by the byte cap go on in turn, as it lets them, or at once on an abort.
+		while (!Executor.Throttled.empty() && (_Abort || _Limiter->TryTakeBytes(Executor.Throttled.front().second)))
+		{
+			std::coroutine_handle<> Handle = Executor.Throttled.front().first;
+			Executor.Throttled.pop_front();
+			Handle.resume();
+		}
+		bool bPostponed = !Executor.Throttled.empty() || !Executor.Reopening.empty();
+		while (bClaimsLeft && !_Abort && Executor.Active < Executor.Limit)
+		{
+			if (!bClaim)
+			{
+				if (Executor.ArchiveActive) break; // A claim may be of another archive.
+				if (!_HashedFiles->ClaimFiles(Index, First, Last, Device))
+				{
+					bClaimsLeft = false;
+					break;
+				}
+				bClaim = true;
+			}
+			if (_Limiter != NULL && !_Limiter->TryTakeOpen())
+			{
+				bPostponed = true;
+				break;
+			}
+			int Slot = Executor.FreeSlots[--Executor.FreeCount];
+			Executor.Active++;
+			_InFlight++;
+			if (_HashedFiles->IsClaimedMember(_HashedFiles->GetClaimedNode(First)))
+			{
+				HashArchive(&Executor, Slot, First, Last, Device);
+				bClaim = false;
+				continue;
+			}
+			int Node = _HashedFiles->GetClaimedNode(First++);
+			if (First == Last)
+			{
+				_HashedFiles->ReleaseClaim(Device);
+				bClaim = false;
+			}
+			HashFile(&Executor, Slot, Node, Device);
+		}
+		if (Executor.Active == 0 && (!bClaimsLeft || _Abort)) break;
+		Executor.Queue->Complete(bPostponed ? ASYNC_POSTPONE_MS : -1);
+
+		// The opens that found no file handles are tried again.
+		AsyncPostponed Reopening;
+		Reopening.swap(Executor.Reopening);
+		for (auto& Postponed : Reopening) Postponed.first.resume();
+	}
+	if (bClaim) _HashedFiles->ReleaseClaim(Device);
+
+	if (_Background) ThreadPool::SetThreadBackground(false);
+	for (int i = 0; i < _FilesInFlight; ++i)
+	{
+		_HoleBytes += Executor.Files[i]->GetHoleBytes();
+		delete Executor.Files[i];
+	}
+	delete Executor.Archive;
+	delete Executor.ArchiveReader;
+	delete[] Executor.FreeSlots;
+	FileReader::FreeBuffer(Executor.Memory);
+	delete[] Executor.Sha1Files;
+	delete[] Executor.Files;
+	delete Executor.Queue;
+
+	if (_Running.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> Done(_DoneLock);
+		_Done.notify_all();
+	}
+}
+
+//=============================================================================
+// HashFile - The coroutine of a file. It opens the file, then reads it into
+//            the buffer of its slot and hashes each read, awaiting the reads
+//            that do not complete at once, and hashes a hole from zeros. A
+//            read that the volume refuses unbuffered is read again through
+//            the cache, and a file that cannot be opened or read is
+//            skipped. The slot is freed once the hash is saved. An open that
+//            finds no file handles, and a read over the byte cap, postpone
+//            the coroutine.
+//=============================================================================
+
+AsyncTask AsyncScan::HashFile(Executor pExecutor, int Slot, int Node, int Device)
+{
+	AsyncFile* pFile = pExecutor->Files[Slot];
+	sha1file& Sha1File = pExecutor->Sha1Files[Slot];
+	uint8_t* pBuffer = pExecutor->Memory + (size_t)Slot * _BufferLen;
+	const wstring& FileName = _HashedFiles->GetClaimedFile(Node);
+	auto Since = std::chrono::steady_clock::now();
+	bool bSkip = !pFile->Open(FileName, _Directory);
+	while (bSkip && !_Abort && IsOutOfHandles(pExecutor, pFile->GetError(), Since))
+	{
+		co_await AsyncPostpone{&pExecutor->Reopening, 0};
+		bSkip = !pFile->Open(FileName, _Directory);
+	}
+	uint32_t Error = bSkip ? pFile->GetError() : 0;
+	if (!bSkip) pExecutor->Queue->Attach(pFile);
+	Sha1File.Begin();
+	while (!bSkip && !_Abort)
+	{
+		uint64_t Hole = pFile->GetHole();
+		if (Hole > 0)
+		{
+			DWORD cbHole = Hole < (uint64_t)_BufferLen ? (DWORD)Hole : (DWORD)_BufferLen;
+			pFile->SkipHole(cbHole);
+			Sha1File.Input(_ZeroBuffer, cbHole);
+			continue;
+		}
+		AsyncRead Read(pExecutor->Queue, pFile, pBuffer, pFile->GetDataLen(_BufferLen));
+		int64_t cbRead = co_await Read;
+		if (cbRead < 0)
+		{
+			if (pFile->Retry(Read.Error))
+			{
+				pExecutor->Queue->Attach(pFile);
+				continue;
+			}
+			bSkip = true;
+			Error = Read.Error;
+			break;
+		}
+		pFile->Advance((uint32_t)cbRead);
+		_HashedFiles->AddDeviceBytes(Device, cbRead);
+		Sha1File.Input(pBuffer, (DWORD)cbRead);
+		if (_Limiter != NULL && !_Limiter->TryTakeBytes(cbRead)) co_await AsyncPostpone{&pExecutor->Throttled, (uint64_t)cbRead};
+		if (pFile->IsAtEnd(cbRead, Read.cbAsk)) break;
+	}
+	pFile->Close();
+	TCHAR szFileHash[SHA_DIGEST_LEN * 3];
+	Sha1File.End(szFileHash);
+	if (bSkip && !_Abort) SkipFile(FileName, Error);
+	else if (!_Abort) _HashedFiles->SaveHash(pExecutor->Index, Node, szFileHash);
+	pExecutor->FreeSlots[pExecutor->FreeCount++] = Slot;
+	pExecutor->Active--;
+	_InFlight--;
+}
+
+//=============================================================================
+// IsOutOfHandles - Whether an open failed only since the process or the
+//                  system has no file handles to spare, and may be tried
+//                  again after a wait: the executor keeps fewer files in
+//                  flight from then on, and the open is given up once it
+//                  has waited ASYNC_OPEN_WAIT_MS since Since.
+//=============================================================================
+
+bool AsyncScan::IsOutOfHandles(Executor pExecutor, uint32_t Error, const std::chrono::steady_clock::time_point& Since)
+{
+	if (!FileReader::IsOutOfHandles(Error)) return false;
+	if (std::chrono::steady_clock::now() - Since >= std::chrono::milliseconds(ASYNC_OPEN_WAIT_MS)) return false;
+	pExecutor->Limit = max(min(pExecutor->Limit, pExecutor->Active - 1), 1);
+	return true;
+}
+
+//=============================================================================
+// SkipFile - Counts a file that cannot be opened or read, which is left
+//            unhashed, and logs it.
+//=============================================================================
+
+void AsyncScan::SkipFile(const wstring& FileName, uint32_t Error)
+{
+	TCHAR szSkipped[MAX_PATH + 60];
+	_Skipped++;
+	StringCchPrintf(szSkipped, MAX_PATH + 60, _T("MarkDuplicates: skipped %s, error %u\n"), FileName.c_str(), Error);
+	OutputDebugString(szSkipped);
+}
+
+//=============================================================================
+// HashArchive - The coroutine of an archive. It reads the archive once, from
+//               start to end, into the buffer of its slot with a reader of
+//               the sync engine, and hashes the members of the claim as they
+//               pass, each known by where it starts, as the pipeline does.
+//               Its headers and the data read past are charged too, and the
+//               members from where a damaged archive fails on are skipped.
+//               The claim is released and the slot freed at the end.
+//=============================================================================
+
+AsyncTask AsyncScan::HashArchive(Executor pExecutor, int Slot, int First, int Last, int Device)
+{
+	pExecutor->ArchiveActive = true;
+	std::vector<std::pair<uint64_t, int>> Members; // Where each member starts, and its node, in archive order.
+	for (int Position = First; Position < Last; ++Position)
+	{
+		int Node = _HashedFiles->GetClaimedNode(Position);
+		Members.push_back(std::make_pair(_HashedFiles->GetClaimedLocation(Node), Node));
+	}
+	std::sort(Members.begin(), Members.end());
+	if (pExecutor->Archive == NULL)
+	{
+		pExecutor->ArchiveReader = FileReader::Create(READ_ENGINE_SYNC, 1, _ReadOptions);
+		pExecutor->Archive = new TarArchive(pExecutor->ArchiveReader, _BufferLen, false);
+	}
+	TarArchive* pArchive = pExecutor->Archive;
+	uint8_t* pBuffer = pExecutor->Memory + (size_t)Slot * _BufferLen;
+	sha1file& Sha1File = pExecutor->Sha1Files[Slot];
+	const wstring& FirstName = _HashedFiles->GetClaimedFile(Members[0].second);
+	wstring ArchiveName = FirstName.substr(0, TarArchive::FindMember(FirstName));
+	auto Since = std::chrono::steady_clock::now();
+	bool bOpen = pArchive->Open(ArchiveName, _Directory); // An archive that does not open has no members to pass.
+	while (!bOpen && !_Abort && IsOutOfHandles(pExecutor, pArchive->GetError(), Since))
+	{
+		co_await AsyncPostpone{&pExecutor->Reopening, 0};
+		bOpen = pArchive->Open(ArchiveName, _Directory);
+	}
+
+	// Counts what the archive has been read up to, headers and skipped data included, and returns
+	// the bytes to charge to the byte cap.
+	uint64_t Counted = 0;
+	auto Count = [&]()
+	{
+		uint64_t Bytes = pArchive->GetOffset() - Counted;
+		Counted += Bytes;
+		_HashedFiles->AddDeviceBytes(Device, Bytes);
+		return Bytes;
+	};
+
+	TCHAR szFileHash[SHA_DIGEST_LEN * 3];
+	TarMember Member;
+	size_t Next = 0;
+	while (Next < Members.size() && !_Abort)
+	{
+		bool bMember = pArchive->Next(Member, &_Abort);
+		uint64_t Bytes = Count();
+		if (_Limiter != NULL && !_Limiter->TryTakeBytes(Bytes)) co_await AsyncPostpone{&pExecutor->Throttled, Bytes};
+		if (!bMember || Member.Offset > Members[Next].first) break;
+		if (Member.Offset < Members[Next].first) continue;
+		int Node = Members[Next].second;
+		Sha1File.Begin();
+		int64_t cbRead;
+		do
+		{
+			cbRead = pArchive->Read(pBuffer, _BufferLen, &_Abort);
+			Bytes = Count();
+			if (_Limiter != NULL && !_Limiter->TryTakeBytes(Bytes)) co_await AsyncPostpone{&pExecutor->Throttled, Bytes};
+			if (cbRead < 0) break;
+			Sha1File.Input(pBuffer, (DWORD)cbRead);
+		} while (cbRead == _BufferLen && !_Abort);
+		Sha1File.End(szFileHash);
+		if (cbRead < 0) break;
+		if (!_Abort) _HashedFiles->SaveHash(pExecutor->Index, Node, szFileHash);
+		Next++;
+	}
+	if (Next < Members.size() && !_Abort)
+	{
+		TCHAR szSkipped[MAX_PATH + 80];
+		_Skipped += Members.size() - Next;
+		StringCchPrintf(szSkipped, MAX_PATH + 80, _T("MarkDuplicates: %llu members of %s skipped, error %u\n"),
+			(uint64_t)(Members.size() - Next), ArchiveName.c_str(),
+			pArchive->GetError() != 0 ? pArchive->GetError() : (uint32_t)ERROR_FILE_NOT_FOUND);
+		OutputDebugString(szSkipped);
+	}
+	pArchive->Close();
+	_HashedFiles->ReleaseClaim(Device);
+	pExecutor->ArchiveActive = false;
+	pExecutor->FreeSlots[pExecutor->FreeCount++] = Slot;
+	pExecutor->Active--;
+	_InFlight--;
+}
\ No newline at end of file
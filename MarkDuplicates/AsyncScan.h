@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+// AsyncScan.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "framework.h"
+#include "HashEngine.h"
+#include "HashedFiles.h"
+#include "HashPipeline.h"
+#include "ThreadPool.h"
+#include "AsyncReader.h"
+#include "TarArchive.h"
+#include "sha1file.h"
+#include <deque>
+#include <exception>
+
+#define ASYNC_FILES_IN_FLIGHT 256         // Files read at once by all the executors, by default.
+#define ASYNC_MIN_READ_LEN (64 * 1024)    // Least bytes of a read, which caps the files in flight.
+#define MAX_ASYNC_FILES_IN_FLIGHT (PIPELINE_MEMORY_BUDGET / ASYNC_MIN_READ_LEN)
+#define ASYNC_POSTPONE_MS 10              // Longest wait of an executor with files postponed.
+#define ASYNC_OPEN_WAIT_MS 5000           // Longest an open waits for file handles, before its file is skipped.
+
+// The coroutine of a file. It starts at once, runs until its first read is in flight, and
+// frees itself once the file is hashed, so the executor keeps no handle to it.
+struct AsyncTask
+{
+	struct promise_type
+	{
+		AsyncTask           get_return_object() { return AsyncTask(); }
+		std::suspend_never  initial_suspend() noexcept { return std::suspend_never(); }
+		std::suspend_never  final_suspend() noexcept { return std::suspend_never(); }
+		void                return_void() {}
+		void                unhandled_exception() { std::terminate(); }
+	};
+};
+
+// Coroutines held back by their executor, each with the bytes the rate limiter must let
+// through before it goes on.
+typedef std::deque<std::pair<std::coroutine_handle<>, uint64_t>> AsyncPostponed;
+
+// Suspends a coroutine on a list of its executor, which resumes it in its own time.
+struct AsyncPostpone
+{
+	AsyncPostponed* List;
+	uint64_t        Bytes;
+	bool            await_ready() const { return false; }
+	void            await_suspend(std::coroutine_handle<> Caller) { List->push_back(std::make_pair(Caller, Bytes)); }
+	void            await_resume() const {}
+};
+
+class AsyncScan : public HashEngine
+{
+private:
+	typedef struct tagExecutor // The state of one executor, which only its own thread touches.
+	{
+		int          Index;       // The thread of the executor in HashedFiles.
+		AsyncQueue*  Queue;       // Its reads in flight.
+		AsyncFile**  Files;       // One per file in flight, reused by the files that follow.
+		sha1file*    Sha1Files;   // The SHA-1 context of each file in flight.
+		uint8_t*     Memory;      // The buffer of each file in flight, first touched by the executor.
+		int*         FreeSlots;   // Files, Sha1Files and buffers not in use.
+		int          FreeCount;
+		int          Active;      // Files in flight.
+		int          Limit;       // Files it may have in flight, lowered when the file handles run out.
+		AsyncPostponed Throttled; // Coroutines waiting on the byte cap, in the order they read.
+		AsyncPostponed Reopening; // Coroutines waiting to open their file again, for handles to be freed.
+		FileReader*  ArchiveReader; // Reads the archives, once one is claimed.
+		TarArchive*  Archive;
+		bool         ArchiveActive; // An archive is being hashed; the next waits for it.
+	} *Executor;
+	HashedFiles*            _HashedFiles;
+	ThreadPool*             _Pool;
+	int                     _Executors;
+	int                     _FilesInFlight;   // Files each executor keeps in flight.
+	int                     _BufferLen;       // Bytes of each read.
+	int                     _ReadOptions;     // READ_ flags of the files.
+	RateLimiter*            _Limiter;         // Caps the reads and the opens of all the executors, or NULL.
+	bool                    _Background;      // The executors run with the lowest I/O priority.
+	const DirectoryEnumerator* _Directory;    // The directory the names of the files are relative to, or NULL.
+	uint8_t*                _ZeroBuffer;      // _BufferLen zeros, hashed for the holes of sparse files.
+	std::atomic<int>        _InFlight;        // Files in flight over all the executors.
+	std::atomic<uint64_t>   _HoleBytes;       // Bytes of holes hashed without a read.
+	std::atomic<uint64_t>   _Skipped;         // Files left unhashed, since they could not be read.
+	std::atomic<int>        _Running;         // Executors that have not finished.
+	std::atomic<bool>       _Abort;
+	std::mutex              _DoneLock;
+	std::condition_variable _Done;
+	void      ExecutorMain(int Index);
+	AsyncTask HashFile(Executor pExecutor, int Slot, int Node, int Device);
+	AsyncTask HashArchive(Executor pExecutor, int Slot, int First, int Last, int Device);
+	bool      IsOutOfHandles(Executor pExecutor, uint32_t Error, const std::chrono::steady_clock::time_point& Since);
+	void      SkipFile(const wstring& FileName, uint32_t Error);
+public:
+	AsyncScan(HashedFiles* pHashedFiles, ThreadPool* pPool, int Executors,
+	          int FilesInFlight = ASYNC_FILES_IN_FLIGHT, int ReadOptions = READ_SEQUENTIAL);
+	~AsyncScan();
+	int  GetExecutors() const { return _Executors; }
+	int  GetFilesInFlight() const { return _InFlight; }
+	int  GetBufferLen() const { return _BufferLen; }
+	virtual void SetLimiter(RateLimiter* pLimiter, bool Background) { _Limiter = pLimiter; _Background = Background; }
+	virtual void SetDirectory(const DirectoryEnumerator* pDirectory) { _Directory = pDirectory; }
+	virtual uint64_t GetHoleBytes() const { return _HoleBytes; }
+	virtual uint64_t GetSkipped() const { return _Skipped; }
+	virtual void Start();
+	virtual void Abort();
+	virtual bool Wait(int Milliseconds = -1);
+	virtual void Describe(TCHAR* pszEngine, int cchEngine) const;
+};
\ No newline at end of file
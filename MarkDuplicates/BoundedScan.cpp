@@ -0,0 +1,228 @@
+///////////////////////////////////////////////////////////////////////////////
+// BoundedScan.cpp - Scans a directory too large to keep in memory, holding
+//                   the process to a memory limit.
+//
+// The listed files are not kept in a HashedFiles. They go to a SpillSorter
+// in size order, which spills them to runs on disk as memory fills. The
+// merge of the runs then brings the files of one size together, and a file
+// whose size no other file has cannot have a duplicate, so only the files
+// that share their size are hashed. They are loaded into a HashedFiles a
+// batch at a time, for a HashPipeline to hash, and the hashed files go to a
+// second SpillSorter, in hash order. Its merge brings the files of one hash
+// together, each after the one before it in the order of the view's hash
+// sort, so the results stream out with the duplicates marked as SortAndCheck
+// marks them: every file of a hash but the first. Files of one size may be
+// hashed in different batches; the hash runs join them again.
+//
+// The memory left by the limit, once the process as it is now and
+// BOUNDED_RESERVED_BYTES for the pipeline and the merges are set aside, is
+// shared by the size runs, a batch, and the hash runs, which each spill or
+// end a batch at their share. Those sizes are estimates, so every
+// BOUNDED_CHECK_INTERVAL records the memory the process has in use is
+// looked at, and while it is within an eighth of the limit, or over it,
+// the records in memory are spilled at once and the shares are cut by a
+// quarter, down to BOUNDED_MIN_SHARE. At the least shares the records are
+// still spilled at each look over the target, and a process that stays
+// over the limit itself for BOUNDED_OVER_LIMIT_CHECKS looks in a row,
+// with nothing left to spill, ends the scan with ENOMEM. The headroom
+// covers the growth between two looks, but the limit is a target rather
+// than a hard cap: the memory a look sees lags what the process has just
+// allocated.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BoundedScan.h"
+
+//=============================================================================
+// Constructor - MemoryLimit is the most memory the process should have in
+//               use. DeviceName is the storage device of the directory, and
+//               the runs are written to TempDirectory. Check IsUsable: a
+//               limit too close to the memory in use leaves no share.
+//=============================================================================
+
+BoundedScan::BoundedScan(uint64_t MemoryLimit, const std::wstring& DeviceName, const std::wstring& TempDirectory)
+{
+	uint64_t Reserved = SpillSorter::GetResidentBytes() + BOUNDED_RESERVED_BYTES;
+	_MemoryLimit = MemoryLimit;
+	_MemoryTarget = MemoryLimit - MemoryLimit / BOUNDED_HEADROOM_DIVISOR;
+	_OverLimit = 0;
+	_Share = MemoryLimit > Reserved ? (MemoryLimit - Reserved) / 3 : 0;
+	_DeviceName = DeviceName;
+	_BySize = new SpillSorter(SPILL_BY_SIZE, HashedFiles::FileCompare, _Share, TempDirectory);
+	_ByHash = new SpillSorter(SPILL_BY_HASH, HashedFiles::FileCompare, _Share, TempDirectory);
+	_Batch = new HashedFiles(BOUNDED_NODE_INCREMENT);
+	_HaveAhead = false;
+	_PreviousBytes = 0;
+	_HavePrevious = false;
+	_Files = 0;
+	_Candidates = 0;
+	_Batches = 0;
+	_Squeezes = 0;
+	_Results = 0;
+	_Duplicates = 0;
+	_DuplicateBytes = 0;
+	_Checked = 0;
+}
+
+BoundedScan::~BoundedScan()
+{
+	delete _Batch;
+	delete _ByHash;
+	delete _BySize;
+}
+
+//=============================================================================
+// AddFile - Adds a listed file to the size runs. A member of an archive is
+//           added with where it starts in the archive, and Member set.
+//=============================================================================
+
+bool BoundedScan::AddFile(const DirectoryEntry& Entry, uint64_t Location, bool Member)
+{
+	SpillRecord Record;
+	Record.Bytes = Entry.Size;
+	Record.WriteTime = Entry.WriteTime;
+	Record.Location = Location;
+	Record.Member = Member;
+	Record.FileName = Entry.Name;
+	_Files++;
+	return _BySize->Add(Record) && CheckMemory(_BySize);
+}
+
+//=============================================================================
+// FinishListing - Ends the listing, and starts the merge of the size runs.
+//=============================================================================
+
+bool BoundedScan::FinishListing()
+{
+	if (!_BySize->Finish()) return false;
+	_HaveAhead = _BySize->Next(_Ahead);
+	return true;
+}
+
+//=============================================================================
+// NextBatch - Loads the next files that share their size into the batch,
+//             up to a share of memory, and returns it for hashing. Returns
+//             NULL when every such file has been loaded.
+//=============================================================================
+
+HashedFiles* BoundedScan::NextBatch()
+{
+	_Batch->Reset(BOUNDED_NODE_INCREMENT);
+	_Batch->AddDevice(_DeviceName);
+	uint64_t Cost = 0;
+	SpillRecord Record;
+	while (Cost < _Share && NextCandidate(Record))
+	{
+		Cost += SpillSorter::GetCost(Record) + BOUNDED_NODE_OVERHEAD;
+		_Batch->AddNode(_T(""), Record.WriteTime, Record.Bytes, Record.FileName, 0, Record.Location, Record.Member);
+		_Candidates++;
+		if (++_Checked < BOUNDED_CHECK_INTERVAL) continue;
+		_Checked = 0;
+		if (SpillSorter::GetResidentBytes() > _MemoryTarget) break; // The batch ends short.
+	}
+	if (_Batch->GetNodeCount() == 0) return NULL;
+	_Batches++;
+	return _Batch;
+}
+
+//=============================================================================
+// SaveBatch - Moves the hashed files of the batch to the hash runs, and
+//             frees the batch. Files left unhashed by an abort are dropped.
+//=============================================================================
+
+bool BoundedScan::SaveBatch()
+{
+	for (int i = 0; i < _Batch->GetNodeCount(); ++i)
+	{
+		HashedFiles::FileRow Row;
+		_Batch->GetRow(i, Row);
+		if (Row.FileHash->empty()) continue;
+		SpillRecord Record;
+		Record.Bytes = Row.FileSize;
+		Record.WriteTime = Row.WriteTime;
+		Record.Location = 0;
+		Record.Member = false;
+		Record.FileHash = *Row.FileHash;
+		Record.FileName = *Row.FileName;
+		if (!_ByHash->Add(Record) || !CheckMemory(_ByHash)) return false;
+	}
+	_Batch->Reset(BOUNDED_NODE_INCREMENT);
+	return true;
+}
+
+//=============================================================================
+// FinishHashing - Ends the hashing, and starts the merge of the hash runs.
+//=============================================================================
+
+bool BoundedScan::FinishHashing()
+{
+	return _BySize->GetError() == 0 && _ByHash->Finish();
+}
+
+//=============================================================================
+// NextResult - Returns the next hashed file in hash order, and whether it is
+//              a duplicate of the file before it. Returns false at the end.
+//=============================================================================
+
+bool BoundedScan::NextResult(SpillRecord& Record, BOOL& Duplicate)
+{
+	if (!_ByHash->Next(Record)) return false;
+	Duplicate = _Results > 0 && Record.FileHash == _PreviousHash;
+	_PreviousHash = Record.FileHash;
+	_Results++;
+	if (Duplicate)
+	{
+		_Duplicates++;
+		_DuplicateBytes += Record.Bytes;
+	}
+	return true;
+}
+
+//=============================================================================
+// NextCandidate - Returns the next file, in size order, that shares its size
+//                 with the file before it or the file after it.
+//=============================================================================
+
+bool BoundedScan::NextCandidate(SpillRecord& Record)
+{
+	while (_HaveAhead)
+	{
+		Record = std::move(_Ahead);
+		_HaveAhead = _BySize->Next(_Ahead);
+		bool bCandidate = (_HavePrevious && _PreviousBytes == Record.Bytes) || (_HaveAhead && _Ahead.Bytes == Record.Bytes);
+		_PreviousBytes = Record.Bytes;
+		_HavePrevious = true;
+		if (bCandidate) return true;
+	}
+	return false;
+}
+
+//=============================================================================
+// CheckMemory - Every BOUNDED_CHECK_INTERVAL records, spills the records of
+//               pSorter if the process is over its target, and cuts the
+//               shares until they are at their least. Returns false if the
+//               spill failed, as Add does, or if the process stays over the
+//               limit at the least shares, when IsOverLimit is true.
+//=============================================================================
+
+bool BoundedScan::CheckMemory(SpillSorter* pSorter)
+{
+	if (++_Checked < BOUNDED_CHECK_INTERVAL) return true;
+	_Checked = 0;
+	uint64_t Resident = SpillSorter::GetResidentBytes();
+	if (Resident <= _MemoryTarget)
+	{
+		_OverLimit = 0;
+		return true;
+	}
+	if (!pSorter->Spill()) return false;
+	_Squeezes++;
+	if (_Share > BOUNDED_MIN_SHARE)
+	{
+		_Share = _Share / 4 * 3 > BOUNDED_MIN_SHARE ? _Share / 4 * 3 : BOUNDED_MIN_SHARE;
+		_BySize->SetMemory(_Share);
+		_ByHash->SetMemory(_Share);
+		return true;
+	}
+	_OverLimit = Resident > _MemoryLimit ? _OverLimit + 1 : 0;
+	return !IsOverLimit();
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+// BoundedScan.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "HashedFiles.h"
+#include "HashPipeline.h"
+#include "SpillSorter.h"
+#include "DirectoryEnumerator.h"
+#include <errno.h>
+
+#define BOUNDED_MIN_SHARE (4 * 1024 * 1024) // Least memory for each of the size runs, a batch, and the hash runs.
+#define BOUNDED_RESERVED_BYTES (PIPELINE_MEMORY_BUDGET + MAX_PIPELINE_READERS * (SMALL_FILE_LEN + 64 * 1024) + \
+                                2 * MAX_SPILL_MERGE * SPILL_IO_BUFFER_LEN) // Buffers and stacks of the pipeline, and the merges.
+#define BOUNDED_NODE_OVERHEAD 160           // Bytes a node of a batch costs in HashedFiles besides its record.
+#define BOUNDED_NODE_INCREMENT 65536        // Nodes a batch grows by.
+#define BOUNDED_CHECK_INTERVAL 4096         // Records between looks at the memory the process has in use.
+#define BOUNDED_HEADROOM_DIVISOR 8          // The memory is squeezed once within an eighth of the limit.
+#define BOUNDED_OVER_LIMIT_CHECKS 4         // Looks in a row over the limit, at the least shares, before the scan gives up.
+
+class BoundedScan
+{
+private:
+	uint64_t     _MemoryLimit;
+	uint64_t     _MemoryTarget;     // The limit less its headroom, above which the memory is squeezed.
+	int          _OverLimit;        // Looks in a row that found the process over the limit at the least shares.
+	uint64_t     _Share;            // Bytes for each of the size runs, a batch, and the hash runs.
+	std::wstring _DeviceName;
+	SpillSorter* _BySize;
+	SpillSorter* _ByHash;
+	HashedFiles* _Batch;
+	SpillRecord  _Ahead;            // The next record in size order, read ahead to find the sizes of one file.
+	bool         _HaveAhead;
+	uint64_t     _PreviousBytes;    // Size of the record before, in size order.
+	bool         _HavePrevious;
+	std::wstring _PreviousHash;     // Hash of the result before, in hash order.
+	uint64_t     _Files;
+	uint64_t     _Candidates;       // Files that share their size, so were hashed.
+	int          _Batches;
+	int          _Squeezes;         // Times the process was found over its target.
+	uint64_t     _Results;
+	uint64_t     _Duplicates;
+	uint64_t     _DuplicateBytes;
+	uint64_t     _Checked;          // Records since the memory was last looked at.
+	bool         CheckMemory(SpillSorter* pSorter);
+	bool         NextCandidate(SpillRecord& Record);
+public:
+	BoundedScan(uint64_t MemoryLimit, const std::wstring& DeviceName, const std::wstring& TempDirectory);
+	~BoundedScan();
+	bool         AddFile(const DirectoryEntry& Entry, uint64_t Location = 0, bool Member = false);
+	bool         FinishListing();
+	HashedFiles* NextBatch();
+	bool         SaveBatch();
+	bool         FinishHashing();
+	bool         NextResult(SpillRecord& Record, BOOL& Duplicate);
+	bool         IsUsable() const { return _Share >= BOUNDED_MIN_SHARE; }
+	uint64_t     GetShare() const { return _Share; }
+	uint64_t     GetFiles() const { return _Files; }
+	uint64_t     GetCandidates() const { return _Candidates; }
+	int          GetBatches() const { return _Batches; }
+	int          GetSqueezes() const { return _Squeezes; }
+	int          GetRuns() const { return _BySize->GetRunsWritten() + _ByHash->GetRunsWritten(); }
+	uint64_t     GetSpilledBytes() const { return _BySize->GetSpilledBytes() + _ByHash->GetSpilledBytes(); }
+	uint64_t     GetResults() const { return _Results; }
+	uint64_t     GetDuplicates() const { return _Duplicates; }
+	uint64_t     GetDuplicateBytes() const { return _DuplicateBytes; }
+	bool         IsOverLimit() const { return _OverLimit >= BOUNDED_OVER_LIMIT_CHECKS; }
+	int          GetError() const { return IsOverLimit() ? ENOMEM : _BySize->GetError() != 0 ? _BySize->GetError() : _ByHash->GetError(); }
+	static uint64_t GetMinimumLimit() { return SpillSorter::GetResidentBytes() + BOUNDED_RESERVED_BYTES + 3 * (uint64_t)BOUNDED_MIN_SHARE; }
+};
\ No newline at end of file
@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+// ConcurrencyController.cpp - Picks the number of readers by hill climbing.
+//
+// Every interval the owner reports the bytes per second read and the
+// average time a read took. While the throughput rises the controller keeps
+// moving the way it last moved, with a step that doubles each time, and
+// when it falls the controller undoes its last change with a step of one.
+// A change within CONTROL_TOLERANCE is taken as no gain, and then the read
+// latency decides. Reads that slowed down are a sign of a queue building
+// up in the device, so a reader is removed, since a reader that adds
+// nothing there only adds seeking and memory; reads that kept their speed
+// after a reader was removed show that it was only queueing too, so
+// another is removed; otherwise the count is held. So the count climbs until the
+// device is saturated, backs off the readers that only queue, and settles
+// around the fewest readers that keep the storage busy: one or two for a
+// spinning disk, and dozens for a fast SSD or a distant share.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ConcurrencyController.h"
+
+//=============================================================================
+// Constructor - Starts at Start readers, kept within Min and Max.
+//=============================================================================
+
+ConcurrencyController::ConcurrencyController(int Min, int Max, int Start)
+{
+	_Min = Min < 1 ? 1 : Min;
+	_Max = Max < _Min ? _Min : Max;
+	_Current = Start < _Min ? _Min : Start > _Max ? _Max : Start;
+	_LastMove = 1;
+	_Step = 1;
+	_LastThroughput = -1;
+	_LastLatency = 0;
+	_Decision = "start";
+}
+
+//=============================================================================
+// Update - Takes the throughput, in bytes per second, and the average read
+//          latency, in seconds, of the last interval, and returns the
+//          number of readers for the next one.
+//=============================================================================
+
+int ConcurrencyController::Update(double Throughput, double Latency)
+{
+	if (_LastThroughput < 0) Move(1, "first sample, probe up");
+	else if (Throughput > _LastThroughput * (1 + CONTROL_TOLERANCE))
+	{
+		_Step = _Step * 2 > CONTROL_MAX_STEP ? CONTROL_MAX_STEP : _Step * 2;
+		Move(_LastMove, "throughput rose, keep going");
+	}
+	else if (Throughput < _LastThroughput * (1 - CONTROL_TOLERANCE))
+	{
+		_Step = 1;
+		Move(-_LastMove, "throughput fell, turn back");
+	}
+	else if (Latency > _LastLatency * (1 + CONTROL_TOLERANCE))
+	{
+		_Step = 1;
+		Move(-1, "latency rose, no gain, remove a reader");
+	}
+	else if (_LastMove < 0)
+	{
+		_Step = 1;
+		Move(-1, "no loss, remove another");
+	}
+	else
+	{
+		_Step = 1;
+		_Decision = "no gain, hold";
+	}
+	_LastThroughput = Throughput;
+	_LastLatency = Latency;
+	return _Current;
+}
+
+//=============================================================================
+// Move - Moves the count by the step in a direction, within Min and Max.
+//        Only a move that changes the count sets the way it last moved, so
+//        that a move held at a limit is never taken for a step.
+//=============================================================================
+
+void ConcurrencyController::Move(int Direction, const char* Decision)
+{
+	int Previous = _Current;
+	_Decision = Decision;
+	_Current += Direction * _Step;
+	if (_Current > _Max) _Current = _Max;
+	if (_Current < _Min) _Current = _Min;
+	if (_Current != Previous) _LastMove = _Current > Previous ? 1 : -1;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////////
+// ConcurrencyController.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#define CONTROL_TOLERANCE 0.10 // Change in throughput, as a fraction, taken as noise.
+#define CONTROL_MAX_STEP 8     // Most readers added or removed at a time.
+
+class ConcurrencyController
+{
+private:
+	int         _Min;
+	int         _Max;
+	int         _Current;
+	int         _LastMove;       // +1 or -1, the way the count last actually changed.
+	int         _Step;
+	double      _LastThroughput; // Negative before the first sample.
+	double      _LastLatency;
+	const char* _Decision;
+	void        Move(int Direction, const char* Decision);
+public:
+	ConcurrencyController(int Min, int Max, int Start);
+	int         Update(double Throughput, double Latency);
+	int         GetCurrent() const { return _Current; }
+	const char* GetDecision() const { return _Decision; }
+};
\ No newline at end of file
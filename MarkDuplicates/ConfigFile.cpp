@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////////////////////
+// ConfigFile.cpp - Saves and restores blocks of memory in a text file, the
+//                  same way ApplicationRegistry does in the registry, for
+//                  a portable install and for systems without a registry.
+//
+// Each line holds one entry, the name in UTF-8, an equals sign, and the
+// bytes of the block in hex. Lines starting with # are comments, and are
+// kept when an entry is saved. A save writes the whole file to a temporary
+// file first and then renames it, so a crash leaves the old file whole.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ConfigFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <limits.h>
+#endif
+
+//=============================================================================
+// ToUtf8 - Converts a name to UTF-8.
+//=============================================================================
+
+static std::string ToUtf8(const std::wstring& s)
+{
+	std::string Utf8;
+	for (size_t i = 0; i < s.length(); ++i)
+	{
+		uint32_t c = (uint32_t)s[i];
+		if (c >= 0xD800 && c < 0xDC00 && i + 1 < s.length()) // A UTF-16 surrogate pair.
+			c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)s[++i] - 0xDC00);
+		if (c < 0x80) Utf8 += (char)c;
+		else if (c < 0x800) { Utf8 += (char)(0xC0 | c >> 6); Utf8 += (char)(0x80 | (c & 0x3F)); }
+		else if (c < 0x10000) { Utf8 += (char)(0xE0 | c >> 12); Utf8 += (char)(0x80 | (c >> 6 & 0x3F)); Utf8 += (char)(0x80 | (c & 0x3F)); }
+		else
+		{
+			Utf8 += (char)(0xF0 | c >> 18); Utf8 += (char)(0x80 | (c >> 12 & 0x3F));
+			Utf8 += (char)(0x80 | (c >> 6 & 0x3F)); Utf8 += (char)(0x80 | (c & 0x3F));
+		}
+	}
+	return Utf8;
+}
+
+#ifndef _WIN32
+//=============================================================================
+// ToNarrow - Converts a path to the multibyte encoding of the locale.
+//=============================================================================
+
+static std::string ToNarrow(const std::wstring& Path)
+{
+	std::string NarrowPath(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Path.c_str(), NarrowPath.length());
+	NarrowPath.resize(cbPath == (size_t)-1 ? 0 : cbPath);
+	return NarrowPath;
+}
+#endif
+
+//=============================================================================
+// OpenFile - fopen for a wide path.
+//=============================================================================
+
+static FILE* OpenFile(const std::wstring& Path, const wchar_t* pszMode)
+{
+#ifdef _WIN32
+	FILE* pFile = NULL;
+	return _wfopen_s(&pFile, Path.c_str(), pszMode) == 0 ? pFile : NULL;
+#else
+	std::string Mode(pszMode, pszMode + wcslen(pszMode));
+	return fopen(ToNarrow(Path).c_str(), Mode.c_str());
+#endif
+}
+
+//=============================================================================
+// ReadLines - Reads the lines of the file, without their line ends. A file
+//             that does not exist has no lines.
+//=============================================================================
+
+static std::vector<std::string> ReadLines(const std::wstring& Path)
+{
+	std::vector<std::string> Lines;
+	FILE* pFile = OpenFile(Path, L"rb");
+	if (pFile == NULL) return Lines;
+	std::string Line;
+	int c;
+	while ((c = fgetc(pFile)) != EOF)
+	{
+		if (c == '\n')
+		{
+			if (!Line.empty() && Line.back() == '\r') Line.pop_back();
+			Lines.push_back(Line);
+			Line.clear();
+		}
+		else Line += (char)c;
+	}
+	if (!Line.empty()) Lines.push_back(Line);
+	fclose(pFile);
+	return Lines;
+}
+
+//=============================================================================
+// LoadMemoryBlock - Loads the named block. Fails, leaving the memory as it
+//                   was, if there is no such entry or its size differs.
+//=============================================================================
+
+bool ConfigFile::LoadMemoryBlock(const std::wstring& sEntry, uint8_t* lpMemoryBlock, uint32_t cbMemoryBlock) const
+{
+	std::string Prefix = ToUtf8(sEntry) + "=";
+	std::vector<std::string> Lines = ReadLines(_Path);
+	for (size_t i = 0; i < Lines.size(); ++i)
+	{
+		const std::string& Line = Lines[i];
+		if (Line.compare(0, Prefix.length(), Prefix) != 0) continue;
+		if (Line.length() - Prefix.length() != (size_t)cbMemoryBlock * 2) return false;
+		std::vector<uint8_t> Block(cbMemoryBlock);
+		for (uint32_t b = 0; b < cbMemoryBlock; ++b)
+		{
+			char szByte[3] = { Line[Prefix.length() + b * 2], Line[Prefix.length() + b * 2 + 1], 0 };
+			char* pszEnd;
+			Block[b] = (uint8_t)strtoul(szByte, &pszEnd, 16);
+			if (*pszEnd != 0) return false;
+		}
+		if (cbMemoryBlock > 0) memcpy(lpMemoryBlock, &Block[0], cbMemoryBlock);
+		return true;
+	}
+	return false;
+}
+
+//=============================================================================
+// SaveMemoryBlock - Saves the named block, replacing the entry if it is in
+//                   the file already.
+//=============================================================================
+
+bool ConfigFile::SaveMemoryBlock(const std::wstring& sEntry, const uint8_t* lpMemoryBlock, uint32_t cbMemoryBlock) const
+{
+	std::string Prefix = ToUtf8(sEntry) + "=";
+	std::string Entry = Prefix;
+	static const char Hex[] = "0123456789ABCDEF";
+	for (uint32_t b = 0; b < cbMemoryBlock; ++b)
+	{
+		Entry += Hex[lpMemoryBlock[b] >> 4];
+		Entry += Hex[lpMemoryBlock[b] & 15];
+	}
+
+	std::vector<std::string> Lines = ReadLines(_Path);
+	size_t i = 0;
+	while (i < Lines.size() && Lines[i].compare(0, Prefix.length(), Prefix) != 0) ++i;
+	if (i < Lines.size()) Lines[i] = Entry;
+	else Lines.push_back(Entry);
+
+	std::wstring TempPath = _Path + L".tmp";
+	FILE* pFile = OpenFile(TempPath, L"wb");
+	if (pFile == NULL) return false;
+	bool bWritten = true;
+	for (i = 0; i < Lines.size() && bWritten; ++i)
+		bWritten = fputs(Lines[i].c_str(), pFile) >= 0 && fputc('\n', pFile) != EOF;
+	bWritten = fclose(pFile) == 0 && bWritten;
+	if (!bWritten) return false;
+#ifdef _WIN32
+	return MoveFileExW(TempPath.c_str(), _Path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(ToNarrow(TempPath).c_str(), ToNarrow(_Path).c_str()) == 0;
+#endif
+}
+
+//=============================================================================
+// GetDefaultPath - Windows: MarkDuplicates.cfg in %APPDATA%. Linux:
+//                  MarkDuplicates.cfg in $XDG_CONFIG_HOME, else in
+//                  ~/.config.
+//=============================================================================
+
+std::wstring ConfigFile::GetDefaultPath()
+{
+#ifdef _WIN32
+	wchar_t* pszAppData = NULL;
+	size_t cchAppData;
+	std::wstring Path = L".";
+	if (_wdupenv_s(&pszAppData, &cchAppData, L"APPDATA") == 0 && pszAppData != NULL) Path = pszAppData;
+	free(pszAppData);
+	return Path + L"\\MarkDuplicates.cfg";
+#else
+	const char* pszConfig = getenv("XDG_CONFIG_HOME");
+	std::string Path = pszConfig != NULL && *pszConfig != 0 ? pszConfig : "";
+	if (Path.empty())
+	{
+		const char* pszHome = getenv("HOME");
+		Path = std::string(pszHome != NULL ? pszHome : ".") + "/.config";
+	}
+	Path += "/MarkDuplicates.cfg";
+	std::wstring WidePath(Path.length() + 1, L'\0');
+	size_t cchPath = mbstowcs(&WidePath[0], Path.c_str(), WidePath.length());
+	WidePath.resize(cchPath == (size_t)-1 ? 0 : cchPath);
+	return WidePath;
+#endif
+}
\ No newline at end of file
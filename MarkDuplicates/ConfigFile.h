@@ -0,0 +1,18 @@
+///////////////////////////////////////////////////////////////////////////////
+// ConfigFile.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <string>
+
+class ConfigFile
+{
+private:
+	std::wstring _Path;
+public:
+	ConfigFile(const std::wstring& Path) { _Path = Path; }
+	const std::wstring& GetPath() const { return _Path; }
+	bool LoadMemoryBlock(const std::wstring& sEntry,       uint8_t* lpMemoryBlock, uint32_t cbMemoryBlock) const;
+	bool SaveMemoryBlock(const std::wstring& sEntry, const uint8_t* lpMemoryBlock, uint32_t cbMemoryBlock) const;
+	static std::wstring GetDefaultPath();
+};
\ No newline at end of file
@@ -0,0 +1,230 @@
+///////////////////////////////////////////////////////////////////////////////
+// DirectoryEnumerator.cpp - Lists the files of one directory, with their
+//                           sizes and write times, without changing the
+//                           current directory of the process.
+//
+// The names are relative to the directory, which the enumerator holds open,
+// so that the readers open the files relative to it and several scans can
+// run at once. On Windows the listing is FindFirstFileEx with
+// FindExInfoBasic, which leaves out the short names, and
+// FIND_FIRST_EX_LARGE_FETCH, which fetches the entries in larger batches.
+// Windows has no open relative to a directory handle, so GetPath joins the
+// names to the directory instead. On Linux the listing is getdents64 into a
+// DIRECTORY_BUFFER_LEN buffer, and d_type skips the directories, links and
+// devices without a stat. Each regular file of a batch is then looked up
+// with statx, relative to the directory, asking only for the size, the
+// write time and the inode number, and without syncing a network file
+// system. An entry of a file system that does not fill in d_type is looked
+// up to find its type as well.
+//
+// Next returns the regular files only, as the scan did before; on Windows
+// the reparse points among them, such as OneDrive placeholders, are kept.
+// Next returns false at the end of the directory, or on an error, whose
+// system error code GetError returns.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DirectoryEnumerator.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+//=============================================================================
+// Constructor
+//=============================================================================
+
+DirectoryEnumerator::DirectoryEnumerator()
+{
+	_Error = 0;
+	_Entries = 0;
+	_hFind = INVALID_HANDLE_VALUE;
+	_pFindData = new WIN32_FIND_DATAW;
+	_Pending = false;
+}
+
+DirectoryEnumerator::~DirectoryEnumerator()
+{
+	Close();
+	delete _pFindData;
+}
+
+//=============================================================================
+// Open - Starts the listing of Directory, and fetches its first entries.
+//=============================================================================
+
+bool DirectoryEnumerator::Open(const std::wstring& Directory)
+{
+	Close();
+	_Directory = Directory;
+	if (!_Directory.empty() && _Directory.back() != L'\\' && _Directory.back() != L'/') _Directory += L'\\';
+	_Error = 0;
+	_Entries = 0;
+	_hFind = FindFirstFileExW((_Directory + L"*").c_str(), FindExInfoBasic, _pFindData,
+		FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (_hFind == INVALID_HANDLE_VALUE)
+	{
+		_Error = GetLastError();
+		return false;
+	}
+	_Pending = true;
+	return true;
+}
+
+//=============================================================================
+// Next - Returns the next file of the directory in Entry.
+//=============================================================================
+
+bool DirectoryEnumerator::Next(DirectoryEntry& Entry)
+{
+	while (_hFind != INVALID_HANDLE_VALUE)
+	{
+		if (!_Pending && !FindNextFileW(_hFind, _pFindData))
+		{
+			DWORD dwError = GetLastError();
+			if (dwError != ERROR_NO_MORE_FILES) _Error = dwError;
+			FindClose(_hFind);
+			_hFind = INVALID_HANDLE_VALUE;
+			return false;
+		}
+		_Pending = false;
+		_Entries++;
+		if (_pFindData->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+		Entry.Name = _pFindData->cFileName;
+		Entry.Size = (uint64_t)_pFindData->nFileSizeHigh << 32 | _pFindData->nFileSizeLow;
+		Entry.WriteTime = (uint64_t)_pFindData->ftLastWriteTime.dwHighDateTime << 32 | _pFindData->ftLastWriteTime.dwLowDateTime;
+		Entry.FileId = 0;
+		return true;
+	}
+	return false;
+}
+
+void DirectoryEnumerator::Close()
+{
+	if (_hFind != INVALID_HANDLE_VALUE) FindClose(_hFind);
+	_hFind = INVALID_HANDLE_VALUE;
+	_Pending = false;
+}
+
+#else
+
+struct LinuxDirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[1];
+};
+
+//=============================================================================
+// Constructor
+//=============================================================================
+
+DirectoryEnumerator::DirectoryEnumerator()
+{
+	_Error = 0;
+	_Entries = 0;
+	_DirectoryFd = -1;
+	_pBuffer = new char[DIRECTORY_BUFFER_LEN];
+	_cbBuffer = 0;
+	_Position = 0;
+}
+
+DirectoryEnumerator::~DirectoryEnumerator()
+{
+	Close();
+	delete[] _pBuffer;
+}
+
+//=============================================================================
+// Open - Opens Directory, which stays open until Close, for the opens
+//        relative to it.
+//=============================================================================
+
+bool DirectoryEnumerator::Open(const std::wstring& Directory)
+{
+	Close();
+	_Directory = Directory;
+	if (!_Directory.empty() && _Directory.back() != L'/') _Directory += L'/';
+	_Error = 0;
+	_Entries = 0;
+	std::string NarrowPath(Directory.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Directory.c_str(), NarrowPath.length());
+	if (cbPath == (size_t)-1)
+	{
+		_Error = EILSEQ;
+		return false;
+	}
+	NarrowPath.resize(cbPath);
+	_DirectoryFd = open(NarrowPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (_DirectoryFd < 0)
+	{
+		_Error = errno;
+		return false;
+	}
+	return true;
+}
+
+//=============================================================================
+// Next - Returns the next file of the directory in Entry, refilling the
+//        buffer from getdents64 when it runs out.
+//=============================================================================
+
+bool DirectoryEnumerator::Next(DirectoryEntry& Entry)
+{
+	if (_DirectoryFd < 0) return false;
+	for (;;)
+	{
+		if (_Position >= _cbBuffer)
+		{
+			long cbRead = syscall(SYS_getdents64, _DirectoryFd, _pBuffer, DIRECTORY_BUFFER_LEN);
+			if (cbRead < 0) _Error = errno;
+			if (cbRead <= 0) return false;
+			_cbBuffer = (int)cbRead;
+			_Position = 0;
+		}
+		const LinuxDirent64* pEntry = (const LinuxDirent64*)(_pBuffer + _Position);
+		_Position += pEntry->d_reclen;
+		_Entries++;
+		if (pEntry->d_type != DT_REG && pEntry->d_type != DT_UNKNOWN) continue;
+		if (pEntry->d_name[0] == '.' && (pEntry->d_name[1] == 0 || (pEntry->d_name[1] == '.' && pEntry->d_name[2] == 0))) continue;
+
+		// Only what the scan uses is asked for; a file removed since the listing is skipped.
+		struct statx Statx;
+		unsigned Mask = STATX_SIZE | STATX_MTIME | STATX_INO | (pEntry->d_type == DT_UNKNOWN ? STATX_TYPE : 0);
+		if (statx(_DirectoryFd, pEntry->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, Mask, &Statx) != 0) continue;
+		if (pEntry->d_type == DT_UNKNOWN && !S_ISREG(Statx.stx_mode)) continue;
+
+		size_t cchName = strlen(pEntry->d_name);
+		Entry.Name.resize(cchName + 1);
+		cchName = mbstowcs(&Entry.Name[0], pEntry->d_name, Entry.Name.length());
+		if (cchName == (size_t)-1) continue; // Not a name of the current locale.
+		Entry.Name.resize(cchName);
+		Entry.Size = Statx.stx_size;
+		Entry.WriteTime = ((uint64_t)Statx.stx_mtime.tv_sec + 11644473600ULL) * 10000000 + Statx.stx_mtime.tv_nsec / 100;
+		Entry.FileId = Statx.stx_ino;
+		return true;
+	}
+}
+
+void DirectoryEnumerator::Close()
+{
+	if (_DirectoryFd >= 0) close(_DirectoryFd);
+	_DirectoryFd = -1;
+	_cbBuffer = 0;
+	_Position = 0;
+}
+
+#endif
\ No newline at end of file
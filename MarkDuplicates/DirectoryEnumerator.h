@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+// DirectoryEnumerator.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <string>
+
+#define DIRECTORY_BUFFER_LEN (1024 * 1024) // Bytes of entries fetched by one getdents64.
+
+struct DirectoryEntry
+{
+	std::wstring Name;      // Relative to the directory.
+	uint64_t     Size;
+	uint64_t     WriteTime; // 100 nanosecond ticks since 1601, as in a FILETIME.
+	uint64_t     FileId;    // The inode number, or 0 where the listing does not give it.
+};
+
+#ifdef _WIN32
+struct _WIN32_FIND_DATAW;
+#endif
+
+class DirectoryEnumerator
+{
+private:
+	std::wstring              _Directory;  // With a trailing separator.
+	uint32_t                  _Error;      // System error code of the last failure, 0 if none.
+	uint64_t                  _Entries;    // Entries listed, including those skipped.
+#ifdef _WIN32
+	void*                     _hFind;
+	struct _WIN32_FIND_DATAW* _pFindData;
+	bool                      _Pending;    // _pFindData holds an entry not yet returned.
+#else
+	int                       _DirectoryFd;
+	char*                     _pBuffer;
+	int                       _cbBuffer;   // Bytes from the last getdents64.
+	int                       _Position;   // Offset of the next entry in _pBuffer.
+#endif
+public:
+	DirectoryEnumerator();
+	~DirectoryEnumerator();
+	bool                Open(const std::wstring& Directory);
+	bool                Next(DirectoryEntry& Entry);
+	void                Close();
+	std::wstring        GetPath(const std::wstring& Name) const { return _Directory + Name; }
+	const std::wstring& GetDirectory() const { return _Directory; }
+	uint64_t            GetEntries() const { return _Entries; }
+	uint32_t            GetError() const { return _Error; }
+#ifndef _WIN32
+	int                 GetDirectoryFd() const { return _DirectoryFd; }
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,823 @@
+///////////////////////////////////////////////////////////////////////////////
+// FileReader.cpp - Reads a file from start to end for the hash pipeline,
+//                  with one of two engines behind the same interface.
+//
+// FileReader itself is the sync engine: one read at a time, ReadFile on
+// Windows and pread elsewhere, which works everywhere. The queued engine
+// splits each buffer into READ_SLICE_LEN slices and keeps up to the queue
+// depth of them in flight at once, so that a fast SSD, whose throughput
+// comes from deep queues, is kept busy by a few readers. On Windows the
+// slices are overlapped reads; on Linux they are submitted together to an
+// io_uring of the reader, one ring per reader, with a single system call
+// for the whole batch. Where io_uring cannot be set up, Create returns the
+// sync engine instead.
+//
+// Open takes a name relative to the directory of a DirectoryEnumerator,
+// opened with openat on Linux and joined to the directory on Windows, or
+// without one, a path.
+//
+// Read returns the bytes read, fewer than asked for only at the end of the
+// file or once pCancel is set, or -1 on an error, whose system error code
+// GetError returns.
+//
+// The READ_ options keep a scan from disturbing the rest of the machine.
+// READ_SEQUENTIAL is FILE_FLAG_SEQUENTIAL_SCAN, or POSIX_FADV_SEQUENTIAL.
+// READ_NOATIME is O_NOATIME, which only the owner of a file may use, so
+// it is dropped for other files; Windows leaves access times to the
+// setting of the volume. READ_DROPBEHIND drops the pages behind the read
+// cursor with POSIX_FADV_DONTNEED; Windows already recycles the pages of a
+// sequential scan early. READ_UNBUFFERED is FILE_FLAG_NO_BUFFERING, or
+// O_DIRECT, into buffers from AllocateBuffer; a volume that refuses it is
+// read through the cache instead.
+//
+// The holes of a sparse file are found when it is opened, with
+// FSCTL_QUERY_ALLOCATED_RANGES on Windows, for a file marked sparse, and
+// with SEEK_HOLE and SEEK_DATA on Linux, for a file with fewer blocks than
+// its size. Read zero fills them without I/O, and GetHole and SkipHole let
+// the hash pipeline hash a long hole from a buffer of zeros it shares
+// between its readers. The bytes are the same either way, so the digest is
+// that of a plain read.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FileReader.h"
+#include "DirectoryEnumerator.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <winioctl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+//=============================================================================
+// QueuedReader - The queued engine.
+//=============================================================================
+
+class QueuedReader : public FileReader
+{
+private:
+	int      _QueueDepth;
+#ifdef _WIN32
+	HANDLE   _Events[MAX_READ_QUEUE_DEPTH];
+#elif defined(HAVE_IO_URING)
+	int      _Ring;
+	bool     _RingFailed; // The ring refused a batch; the reads go through pread from then on.
+	void*    _SqMemory;
+	size_t   _SqLength;
+	void*    _CqMemory;
+	size_t   _CqLength;
+	struct io_uring_sqe* _Sqes;
+	size_t   _SqesLength;
+	unsigned* _SqTail;
+	unsigned* _SqMask;
+	unsigned* _SqArray;
+	unsigned* _CqHead;
+	unsigned* _CqTail;
+	unsigned* _CqMask;
+	struct io_uring_cqe* _Cqes;
+#endif
+protected:
+	virtual int64_t ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel);
+public:
+	QueuedReader(int QueueDepth, int Options);
+	virtual ~QueuedReader();
+	bool            IsReady() const;
+	virtual int     GetEngine() const { return READ_ENGINE_QUEUED; }
+};
+
+//=============================================================================
+// Create - Returns a reader of the engine asked for, or the sync engine if
+//          the queued engine is not available, or a QueueDepth below 2.
+//=============================================================================
+
+FileReader* FileReader::Create(int Engine, int QueueDepth, int Options)
+{
+	if (Engine == READ_ENGINE_QUEUED && QueueDepth > 1)
+	{
+		QueuedReader* pReader = new QueuedReader(QueueDepth < MAX_READ_QUEUE_DEPTH ? QueueDepth : MAX_READ_QUEUE_DEPTH, Options);
+		if (pReader->IsReady()) return pReader;
+		delete pReader;
+	}
+	return new FileReader(Options);
+}
+
+//=============================================================================
+// Read - Reads the next cbBuffer bytes of the file into pBuffer. The holes
+//        of a sparse file are zero filled instead of read, and the engine
+//        reads only the data between them.
+//=============================================================================
+
+int64_t FileReader::Read(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	if (!_Sparse) return ReadData(pBuffer, cbBuffer, pCancel);
+	uint32_t cbTotal = 0;
+	while (cbTotal < cbBuffer)
+	{
+		if (_Offset >= _HoleEnd) FindHole();
+		uint32_t cbLeft = cbBuffer - cbTotal;
+		if (_Offset >= _HoleStart)
+		{
+			uint32_t cbZero = _HoleEnd - _Offset < cbLeft ? (uint32_t)(_HoleEnd - _Offset) : cbLeft;
+			memset(pBuffer + cbTotal, 0, cbZero);
+			_Offset += cbZero;
+			_HoleBytes += cbZero;
+			cbTotal += cbZero;
+			continue;
+		}
+		uint32_t cbData = _HoleStart - _Offset < cbLeft ? (uint32_t)(_HoleStart - _Offset) : cbLeft;
+		int64_t cbRead = ReadData(pBuffer + cbTotal, cbData, pCancel);
+		if (cbRead < 0) return -1;
+		cbTotal += (uint32_t)cbRead;
+		if (cbRead < cbData) break; // EOF, or cancelled.
+	}
+	return cbTotal;
+}
+
+//=============================================================================
+// GetHole  - Returns the bytes of the hole at the offset, 0 in data, so
+//            that a caller can hash a long hole from zeros it already has.
+// SkipHole - Moves the offset past Bytes of that hole, without a read.
+// Skip     - Moves the offset past Bytes of the file, without a read. An
+//            unbuffered reader must skip whole sectors.
+//=============================================================================
+
+uint64_t FileReader::GetHole()
+{
+	if (!_Sparse) return 0;
+	if (_Offset >= _HoleEnd) FindHole();
+	return _Offset >= _HoleStart ? _HoleEnd - _Offset : 0;
+}
+
+void FileReader::SkipHole(uint64_t Bytes)
+{
+	uint64_t Hole = GetHole();
+	Bytes = Bytes < Hole ? Bytes : Hole;
+	_Offset += Bytes;
+	_HoleBytes += Bytes;
+}
+
+//=============================================================================
+// The parts for each system. Reopen retries an unbuffered read that the
+// volume refuses, by opening the file again through the cache at the same
+// offset, and returns false for any other error. DropBehind drops what has
+// been read, or with All the whole file, from the cache. FindHole finds
+// the next hole at or after the offset. GetCacheBytes returns the size of
+// the system's file cache, to see what a scan adds. GetOpenLimit returns
+// how many of Files can be open at once, raising the process's limit of
+// open files toward it where the system has one, and IsOutOfHandles tells
+// whether an open failed only because the process or the system has run
+// out of file handles.
+//=============================================================================
+
+#ifdef _WIN32
+
+FileReader::FileReader(int Options)
+{
+	_Error = 0;
+	_Offset = 0;
+	_Dropped = 0;
+	_Options = Options;
+	_Overlapped = false;
+	_Directory = NULL;
+	_Size = 0;
+	_Sparse = false;
+	_HoleStart = 0;
+	_HoleEnd = 0;
+	_HoleBytes = 0;
+	_hFile = INVALID_HANDLE_VALUE;
+}
+
+FileReader::~FileReader()
+{
+	Close();
+}
+
+bool FileReader::Open(const std::wstring& FileName, const DirectoryEnumerator* pDirectory)
+{
+	Close();
+	_FileName = FileName;
+	_Directory = pDirectory;
+	_Offset = 0;
+	_Dropped = 0;
+	DWORD dwFlags = FILE_ATTRIBUTE_NORMAL;
+	if (_Options & READ_SEQUENTIAL) dwFlags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	if (_Options & READ_UNBUFFERED) dwFlags |= FILE_FLAG_NO_BUFFERING;
+	if (_Overlapped) dwFlags |= FILE_FLAG_OVERLAPPED;
+	_hFile = CreateFileW(pDirectory != NULL ? pDirectory->GetPath(FileName).c_str() : FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, dwFlags, NULL);
+	if (_hFile == INVALID_HANDLE_VALUE)
+	{
+		_Error = GetLastError();
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION Information;
+	_Size = 0;
+	_Sparse = false;
+	if (GetFileInformationByHandle((HANDLE)_hFile, &Information))
+	{
+		_Size = (uint64_t)Information.nFileSizeHigh << 32 | Information.nFileSizeLow;
+		_Sparse = (Information.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+	}
+	_HoleStart = 0;
+	_HoleEnd = 0;
+	return true;
+}
+
+int64_t FileReader::ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	uint32_t cbTotal = 0;
+	DWORD cbRead;
+	while (cbTotal < cbBuffer)
+	{
+		if (pCancel != NULL && pCancel->load(std::memory_order_relaxed)) break;
+		DWORD cbAsk = cbBuffer - cbTotal < READ_SLICE_LEN ? cbBuffer - cbTotal : READ_SLICE_LEN;
+		OVERLAPPED Overlapped; // The offset is given, so that a reopened file carries on where it was.
+		ZeroMemory(&Overlapped, sizeof(Overlapped));
+		Overlapped.Offset = (DWORD)(_Offset + cbTotal);
+		Overlapped.OffsetHigh = (DWORD)((_Offset + cbTotal) >> 32);
+		if (!ReadFile((HANDLE)_hFile, pBuffer + cbTotal, cbAsk, &cbRead, &Overlapped))
+		{
+			DWORD dwError = GetLastError();
+			if (dwError == ERROR_HANDLE_EOF) break;
+			if (Reopen(dwError)) continue;
+			_Error = dwError;
+			return -1;
+		}
+		if (cbRead == 0) break; // EOF
+		cbTotal += cbRead;
+	}
+	_Offset += cbTotal;
+	return cbTotal;
+}
+
+void FileReader::Close()
+{
+	if (_hFile != INVALID_HANDLE_VALUE) CloseHandle((HANDLE)_hFile);
+	_hFile = INVALID_HANDLE_VALUE;
+}
+
+bool FileReader::Reopen(uint32_t Error)
+{
+	if (!(_Options & READ_UNBUFFERED) || Error != ERROR_INVALID_PARAMETER) return false;
+	uint64_t Offset = _Offset;
+	std::wstring FileName = _FileName;
+	_Options &= ~READ_UNBUFFERED;
+	if (!Open(FileName, _Directory)) return false;
+	_Offset = Offset;
+	return true;
+}
+
+void FileReader::DropBehind(bool All)
+{
+	(void)All; // Windows recycles the pages of a sequential scan by itself.
+}
+
+void FileReader::FindHole()
+{
+	// Each query returns the first allocated range from the offset on. ERROR_MORE_DATA
+	// only says that more ranges follow. A volume that cannot answer is read as data.
+	// A file opened for overlapped reads waits on an event, whose low bit keeps the
+	// query off the completion port that the file may be bound to.
+	_HoleStart = UINT64_MAX;
+	_HoleEnd = UINT64_MAX;
+	HANDLE hEvent = _Overlapped ? CreateEventW(NULL, TRUE, FALSE, NULL) : NULL;
+	uint64_t Offset = _Offset;
+	while (Offset < _Size)
+	{
+		FILE_ALLOCATED_RANGE_BUFFER Query, Range;
+		OVERLAPPED Overlapped; // Needed when the file is opened for overlapped reads, ignored otherwise.
+		DWORD cbReturned = 0;
+		ZeroMemory(&Overlapped, sizeof(Overlapped));
+		Overlapped.hEvent = hEvent != NULL ? (HANDLE)((ULONG_PTR)hEvent | 1) : NULL;
+		Query.FileOffset.QuadPart = (LONGLONG)Offset;
+		Query.Length.QuadPart = (LONGLONG)(_Size - Offset);
+		if (!DeviceIoControl((HANDLE)_hFile, FSCTL_QUERY_ALLOCATED_RANGES, &Query, sizeof(Query),
+			&Range, sizeof(Range), &cbReturned, &Overlapped))
+		{
+			DWORD dwError = GetLastError();
+			if (dwError == ERROR_IO_PENDING)
+			{
+				if (hEvent != NULL) WaitForSingleObject(hEvent, INFINITE);
+				if (GetOverlappedResult((HANDLE)_hFile, &Overlapped, &cbReturned, hEvent == NULL)) dwError = 0;
+				else dwError = GetLastError();
+			}
+			if (dwError != 0 && dwError != ERROR_MORE_DATA) break;
+		}
+		uint64_t DataStart = cbReturned < sizeof(Range) ? _Size : (uint64_t)Range.FileOffset.QuadPart;
+		if (DataStart > Offset)
+		{
+			_HoleStart = Offset;
+			_HoleEnd = DataStart;
+			break;
+		}
+		Offset = (uint64_t)Range.FileOffset.QuadPart + (uint64_t)Range.Length.QuadPart;
+	}
+	if (hEvent != NULL) CloseHandle(hEvent);
+}
+
+void* FileReader::AllocateBuffer(size_t cbBuffer)
+{
+	return _aligned_malloc(cbBuffer, READ_ALIGNMENT);
+}
+
+void FileReader::FreeBuffer(void* pBuffer)
+{
+	_aligned_free(pBuffer);
+}
+
+uint64_t FileReader::GetCacheBytes()
+{
+	PERFORMANCE_INFORMATION Information;
+	if (!GetPerformanceInfo(&Information, sizeof(Information))) return 0;
+	return (uint64_t)Information.SystemCache * Information.PageSize;
+}
+
+int FileReader::GetOpenLimit(int Files)
+{
+	return Files; // Handles of CreateFile have no limit of their own.
+}
+
+bool FileReader::IsOutOfHandles(uint32_t Error)
+{
+	return Error == ERROR_TOO_MANY_OPEN_FILES || Error == ERROR_NO_SYSTEM_RESOURCES;
+}
+
+QueuedReader::QueuedReader(int QueueDepth, int Options) : FileReader(Options)
+{
+	_QueueDepth = QueueDepth;
+	_Overlapped = true;
+	for (int i = 0; i < _QueueDepth; ++i) _Events[i] = CreateEventW(NULL, TRUE, FALSE, NULL);
+}
+
+QueuedReader::~QueuedReader()
+{
+	Close();
+	for (int i = 0; i < _QueueDepth; ++i) if (_Events[i] != NULL) CloseHandle(_Events[i]);
+}
+
+bool QueuedReader::IsReady() const
+{
+	for (int i = 0; i < _QueueDepth; ++i) if (_Events[i] == NULL) return false;
+	return true;
+}
+
+//=============================================================================
+// Read - Issues a batch of slices, then waits for all of them. Every slice
+//        issued is waited for, even after an error, so that no read is left
+//        writing into the buffer. The slices after a short one are read
+//        again by the next batch, and a batch that reads nothing is the end
+//        of the file.
+//=============================================================================
+
+int64_t QueuedReader::ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	uint32_t cbTotal = 0;
+	OVERLAPPED Overlapped[MAX_READ_QUEUE_DEPTH];
+	BOOL bIssued[MAX_READ_QUEUE_DEPTH];
+	DWORD Results[MAX_READ_QUEUE_DEPTH];
+	while (cbTotal < cbBuffer)
+	{
+		if (pCancel != NULL && pCancel->load(std::memory_order_relaxed)) break;
+
+		int Slices = 0;
+		DWORD dwError = ERROR_SUCCESS;
+		for (uint32_t cbSlice = cbTotal; cbSlice < cbBuffer && Slices < _QueueDepth; cbSlice += READ_SLICE_LEN, ++Slices)
+		{
+			uint64_t Offset = _Offset + cbSlice;
+			DWORD cbAsk = cbBuffer - cbSlice < READ_SLICE_LEN ? cbBuffer - cbSlice : READ_SLICE_LEN;
+			memset(&Overlapped[Slices], 0, sizeof(OVERLAPPED));
+			Overlapped[Slices].Offset = (DWORD)Offset;
+			Overlapped[Slices].OffsetHigh = (DWORD)(Offset >> 32);
+			Overlapped[Slices].hEvent = _Events[Slices];
+			Results[Slices] = 0;
+			bIssued[Slices] = ReadFile((HANDLE)_hFile, pBuffer + cbSlice, cbAsk, NULL, &Overlapped[Slices]);
+			if (!bIssued[Slices])
+			{
+				DWORD dwIssue = GetLastError();
+				if (dwIssue == ERROR_IO_PENDING) bIssued[Slices] = true;
+				else if (dwIssue != ERROR_HANDLE_EOF && dwError == ERROR_SUCCESS) dwError = dwIssue;
+			}
+		}
+
+		for (int i = 0; i < Slices; ++i)
+		{
+			if (!bIssued[i]) continue;
+			if (!GetOverlappedResult((HANDLE)_hFile, &Overlapped[i], &Results[i], TRUE))
+			{
+				DWORD dwResult = GetLastError();
+				if (dwResult != ERROR_HANDLE_EOF && dwError == ERROR_SUCCESS) dwError = dwResult;
+				Results[i] = 0;
+			}
+		}
+		if (dwError != ERROR_SUCCESS)
+		{
+			if (Reopen(dwError)) continue;
+			_Error = dwError;
+			return -1;
+		}
+
+		uint32_t cbBefore = cbTotal;
+		for (int i = 0; i < Slices; ++i)
+		{
+			uint32_t cbAsk = cbBuffer - cbTotal < READ_SLICE_LEN ? cbBuffer - cbTotal : READ_SLICE_LEN;
+			cbTotal += Results[i];
+			if (Results[i] < cbAsk) break;
+		}
+		if (cbTotal == cbBefore) break; // EOF
+	}
+	_Offset += cbTotal;
+	return cbTotal;
+}
+
+#else
+
+FileReader::FileReader(int Options)
+{
+	_Error = 0;
+	_Offset = 0;
+	_Dropped = 0;
+	_Options = Options;
+	_Overlapped = false;
+	_Directory = NULL;
+	_Size = 0;
+	_Sparse = false;
+	_HoleStart = 0;
+	_HoleEnd = 0;
+	_HoleBytes = 0;
+	_File = -1;
+}
+
+FileReader::~FileReader()
+{
+	Close();
+}
+
+bool FileReader::Open(const std::wstring& FileName, const DirectoryEnumerator* pDirectory)
+{
+	Close();
+	_FileName = FileName;
+	_Directory = pDirectory;
+	_Offset = 0;
+	_Dropped = 0;
+	std::string NarrowPath(FileName.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], FileName.c_str(), NarrowPath.length());
+	if (cbPath == (size_t)-1)
+	{
+		_Error = EILSEQ;
+		return false;
+	}
+	NarrowPath.resize(cbPath);
+	int Flags = O_RDONLY | O_CLOEXEC;
+	if (_Options & READ_NOATIME) Flags |= O_NOATIME;
+	if (_Options & READ_UNBUFFERED) Flags |= O_DIRECT;
+	int DirectoryFd = pDirectory != NULL ? pDirectory->GetDirectoryFd() : AT_FDCWD;
+	_File = openat(DirectoryFd, NarrowPath.c_str(), Flags);
+	if (_File < 0 && errno == EPERM && (Flags & O_NOATIME)) // Only the owner of a file may use O_NOATIME.
+	{
+		Flags &= ~O_NOATIME;
+		_File = openat(DirectoryFd, NarrowPath.c_str(), Flags);
+	}
+	if (_File < 0 && errno == EINVAL && (Flags & O_DIRECT)) // Some file systems, such as tmpfs, refuse O_DIRECT.
+	{
+		Flags &= ~O_DIRECT;
+		_Options &= ~READ_UNBUFFERED;
+		_File = openat(DirectoryFd, NarrowPath.c_str(), Flags);
+	}
+	if (_File < 0)
+	{
+		_Error = errno;
+		return false;
+	}
+	if (_Options & READ_SEQUENTIAL) posix_fadvise(_File, 0, 0, POSIX_FADV_SEQUENTIAL);
+	struct stat Stat;
+	_Size = 0;
+	_Sparse = false;
+	if (fstat(_File, &Stat) == 0)
+	{
+		_Size = (uint64_t)Stat.st_size;
+		_Sparse = (uint64_t)Stat.st_blocks * 512 < _Size;
+	}
+	_HoleStart = 0;
+	_HoleEnd = 0;
+	return true;
+}
+
+int64_t FileReader::ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	uint32_t cbTotal = 0;
+	while (cbTotal < cbBuffer)
+	{
+		if (pCancel != NULL && pCancel->load(std::memory_order_relaxed)) break;
+		uint32_t cbAsk = cbBuffer - cbTotal < READ_SLICE_LEN ? cbBuffer - cbTotal : READ_SLICE_LEN;
+		ssize_t cbRead = pread(_File, pBuffer + cbTotal, cbAsk, (off_t)(_Offset + cbTotal));
+		if (cbRead < 0)
+		{
+			if (errno == EINTR || Reopen(errno)) continue;
+			_Error = errno;
+			return -1;
+		}
+		if (cbRead == 0) break; // EOF
+		cbTotal += (uint32_t)cbRead;
+	}
+	_Offset += cbTotal;
+	DropBehind(false);
+	return cbTotal;
+}
+
+void FileReader::Close()
+{
+	if (_File < 0) return;
+	DropBehind(true);
+	close(_File);
+	_File = -1;
+}
+
+bool FileReader::Reopen(uint32_t Error)
+{
+	if (!(_Options & READ_UNBUFFERED) || Error != EINVAL) return false;
+	uint64_t Offset = _Offset;
+	std::wstring FileName = _FileName;
+	_Options &= ~READ_UNBUFFERED;
+	if (!Open(FileName, _Directory)) return false;
+	_Offset = Offset;
+	_Dropped = Offset;
+	return true;
+}
+
+void FileReader::DropBehind(bool All)
+{
+	// Pages that were only just read may still be held by the kernel for a
+	// moment and are then kept, so each drop stays a window behind the reads,
+	// and the last one, when the file is closed, covers the whole file.
+	if (!(_Options & READ_DROPBEHIND)) return;
+	if (All)
+	{
+		posix_fadvise(_File, 0, 0, POSIX_FADV_DONTNEED);
+		_Dropped = _Offset;
+		return;
+	}
+	if (_Offset < _Dropped + DROP_BEHIND_LAG) return;
+	uint64_t DropTo = _Offset - DROP_BEHIND_LAG / 2;
+	posix_fadvise(_File, (off_t)_Dropped, (off_t)(DropTo - _Dropped), POSIX_FADV_DONTNEED);
+	_Dropped = DropTo;
+}
+
+void FileReader::FindHole()
+{
+	// SEEK_HOLE finds the end of the file when there is no hole, or when the file
+	// system does not track them, and SEEK_DATA fails when the hole runs to the end.
+	_HoleStart = UINT64_MAX;
+	_HoleEnd = UINT64_MAX;
+	off_t Hole = lseek(_File, (off_t)_Offset, SEEK_HOLE);
+	if (Hole < 0 || (uint64_t)Hole >= _Size) return;
+	off_t Data = lseek(_File, Hole, SEEK_DATA);
+	_HoleStart = (uint64_t)Hole;
+	_HoleEnd = Data < 0 || (uint64_t)Data > _Size ? _Size : (uint64_t)Data;
+}
+
+void* FileReader::AllocateBuffer(size_t cbBuffer)
+{
+	void* pBuffer = NULL;
+	return posix_memalign(&pBuffer, READ_ALIGNMENT, cbBuffer) == 0 ? pBuffer : NULL;
+}
+
+void FileReader::FreeBuffer(void* pBuffer)
+{
+	free(pBuffer);
+}
+
+uint64_t FileReader::GetCacheBytes()
+{
+	FILE* pMeminfo = fopen("/proc/meminfo", "r");
+	if (pMeminfo == NULL) return 0;
+	char szLine[128];
+	unsigned long long Kilobytes = 0;
+	while (fgets(szLine, sizeof(szLine), pMeminfo) != NULL)
+		if (sscanf(szLine, "Cached: %llu kB", &Kilobytes) == 1) break;
+	fclose(pMeminfo);
+	return (uint64_t)Kilobytes * 1024;
+}
+
+int FileReader::GetOpenLimit(int Files)
+{
+	struct rlimit Limit;
+	if (getrlimit(RLIMIT_NOFILE, &Limit) != 0) return Files;
+	rlim_t Wanted = (rlim_t)Files + READ_HANDLE_RESERVE;
+	if (Limit.rlim_cur != RLIM_INFINITY && Limit.rlim_cur < Wanted)
+	{
+		Limit.rlim_cur = Limit.rlim_max == RLIM_INFINITY || Limit.rlim_max > Wanted ? Wanted : Limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &Limit);
+		getrlimit(RLIMIT_NOFILE, &Limit);
+	}
+	if (Limit.rlim_cur == RLIM_INFINITY || Limit.rlim_cur >= Wanted) return Files;
+	return Limit.rlim_cur > READ_HANDLE_RESERVE ? (int)(Limit.rlim_cur - READ_HANDLE_RESERVE) : 1;
+}
+
+bool FileReader::IsOutOfHandles(uint32_t Error)
+{
+	return Error == EMFILE || Error == ENFILE;
+}
+
+#ifdef HAVE_IO_URING
+
+QueuedReader::QueuedReader(int QueueDepth, int Options) : FileReader(Options)
+{
+	_QueueDepth = QueueDepth;
+	_RingFailed = false;
+	_SqMemory = _CqMemory = MAP_FAILED;
+	_Sqes = (struct io_uring_sqe*)MAP_FAILED;
+	_SqLength = _CqLength = _SqesLength = 0;
+
+	struct io_uring_params Params;
+	memset(&Params, 0, sizeof(Params));
+	_Ring = (int)syscall(__NR_io_uring_setup, (unsigned)_QueueDepth, &Params);
+	if (_Ring < 0) return;
+	if (!(Params.features & IORING_FEAT_RW_CUR_POS)) // Kernels before 5.6 have no IORING_OP_READ.
+	{
+		close(_Ring);
+		_Ring = -1;
+		return;
+	}
+
+	// The submission and completion rings share one mapping on kernels that allow it.
+	_SqLength = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+	_CqLength = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+	if (Params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (_CqLength > _SqLength) _SqLength = _CqLength;
+		_CqLength = 0;
+	}
+	_SqMemory = mmap(NULL, _SqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_SQ_RING);
+	if (_SqMemory == MAP_FAILED) return;
+	void* pCq = _SqMemory;
+	if (_CqLength != 0)
+	{
+		_CqMemory = mmap(NULL, _CqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_CQ_RING);
+		if (_CqMemory == MAP_FAILED) return;
+		pCq = _CqMemory;
+	}
+	_SqesLength = Params.sq_entries * sizeof(struct io_uring_sqe);
+	_Sqes = (struct io_uring_sqe*)mmap(NULL, _SqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _Ring, IORING_OFF_SQES);
+
+	_SqTail  = (unsigned*)((char*)_SqMemory + Params.sq_off.tail);
+	_SqMask  = (unsigned*)((char*)_SqMemory + Params.sq_off.ring_mask);
+	_SqArray = (unsigned*)((char*)_SqMemory + Params.sq_off.array);
+	_CqHead  = (unsigned*)((char*)pCq + Params.cq_off.head);
+	_CqTail  = (unsigned*)((char*)pCq + Params.cq_off.tail);
+	_CqMask  = (unsigned*)((char*)pCq + Params.cq_off.ring_mask);
+	_Cqes    = (struct io_uring_cqe*)((char*)pCq + Params.cq_off.cqes);
+}
+
+QueuedReader::~QueuedReader()
+{
+	Close();
+	if (_Sqes != MAP_FAILED) munmap(_Sqes, _SqesLength);
+	if (_CqMemory != MAP_FAILED) munmap(_CqMemory, _CqLength);
+	if (_SqMemory != MAP_FAILED) munmap(_SqMemory, _SqLength);
+	if (_Ring >= 0) close(_Ring);
+}
+
+bool QueuedReader::IsReady() const
+{
+	return _Ring >= 0 && _SqMemory != MAP_FAILED && (_CqLength == 0 || _CqMemory != MAP_FAILED) && _Sqes != MAP_FAILED;
+}
+
+//=============================================================================
+// Read - Submits a batch of slices with one io_uring_enter, which also waits
+//        for all of them to complete. The slices after a short one are read
+//        again by the next batch, and a batch that reads nothing is the end
+//        of the file. Once the ring fails, the slices in flight are reaped,
+//        and the sync engine reads the rest of the scan.
+//=============================================================================
+
+int64_t QueuedReader::ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	if (_RingFailed) return FileReader::ReadData(pBuffer, cbBuffer, pCancel);
+	uint32_t cbTotal = 0;
+	int32_t Results[MAX_READ_QUEUE_DEPTH];
+	while (cbTotal < cbBuffer)
+	{
+		if (pCancel != NULL && pCancel->load(std::memory_order_relaxed)) break;
+
+		unsigned Tail = *_SqTail, Mask = *_SqMask;
+		int Slices = 0;
+		for (uint32_t cbSlice = cbTotal; cbSlice < cbBuffer && Slices < _QueueDepth; cbSlice += READ_SLICE_LEN, ++Slices)
+		{
+			unsigned Index = (Tail + Slices) & Mask;
+			struct io_uring_sqe* pSqe = &_Sqes[Index];
+			memset(pSqe, 0, sizeof(*pSqe));
+			pSqe->opcode = IORING_OP_READ;
+			pSqe->fd = _File;
+			pSqe->addr = (uint64_t)(uintptr_t)(pBuffer + cbSlice);
+			pSqe->len = cbBuffer - cbSlice < READ_SLICE_LEN ? cbBuffer - cbSlice : READ_SLICE_LEN;
+			pSqe->off = _Offset + cbSlice;
+			pSqe->user_data = (uint64_t)Slices;
+			_SqArray[Index] = Index;
+		}
+		__atomic_store_n(_SqTail, Tail + Slices, __ATOMIC_RELEASE);
+
+		// Submit the batch and wait for all of it; an interrupted or busy call is tried again. On any
+		// other error the slices not yet submitted are taken back, and those in flight are reaped before
+		// the buffer is given back, since they still write it: waited for, or if the ring cannot wait
+		// either, looked for in the completion ring until they have all completed.
+		int Submitted = 0, Completed = 0, Failed = 0;
+		while (Completed < Slices)
+		{
+			int Result = (int)syscall(__NR_io_uring_enter, _Ring, (unsigned)(Slices - Submitted), (unsigned)(Slices - Completed),
+				(unsigned)IORING_ENTER_GETEVENTS, NULL, 0);
+			if (Result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				if (Failed == 0)
+				{
+					Failed = errno;
+					__atomic_store_n(_SqTail, Tail + Submitted, __ATOMIC_RELEASE);
+					Slices = Submitted;
+					continue;
+				}
+				usleep(1000);
+			}
+			if (Result > 0) Submitted += Result;
+			unsigned Head = *_CqHead;
+			while (Head != __atomic_load_n(_CqTail, __ATOMIC_ACQUIRE))
+			{
+				struct io_uring_cqe* pCqe = &_Cqes[Head & *_CqMask];
+				Results[pCqe->user_data] = pCqe->res;
+				++Head;
+				++Completed;
+			}
+			__atomic_store_n(_CqHead, Head, __ATOMIC_RELEASE);
+		}
+		if (Failed != 0)
+		{
+			// Nothing is in flight now; the rest of the buffer is read with pread, as are the reads after it.
+			_RingFailed = true;
+			_Offset += cbTotal;
+			int64_t cbRest = FileReader::ReadData(pBuffer + cbTotal, cbBuffer - cbTotal, pCancel);
+			return cbRest < 0 ? -1 : cbTotal + cbRest;
+		}
+
+		uint32_t cbBefore = cbTotal, Error = 0;
+		for (int i = 0; i < Slices; ++i)
+		{
+			if (Results[i] < 0)
+			{
+				Error = (uint32_t)-Results[i];
+				break;
+			}
+			uint32_t cbAsk = cbBuffer - cbTotal < READ_SLICE_LEN ? cbBuffer - cbTotal : READ_SLICE_LEN;
+			cbTotal += (uint32_t)Results[i];
+			if ((uint32_t)Results[i] < cbAsk) break;
+		}
+		if (Error != 0)
+		{
+			if (Reopen(Error)) continue; // The slices read before the error are kept.
+			_Error = Error;
+			return -1;
+		}
+		if (cbTotal == cbBefore) break; // EOF
+	}
+	_Offset += cbTotal;
+	DropBehind(false);
+	return cbTotal;
+}
+
+#else
+
+QueuedReader::QueuedReader(int QueueDepth, int Options) : FileReader(Options)
+{
+	_QueueDepth = QueueDepth;
+}
+
+QueuedReader::~QueuedReader()
+{
+}
+
+bool QueuedReader::IsReady() const
+{
+	return false;
+}
+
+int64_t QueuedReader::ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	return FileReader::ReadData(pBuffer, cbBuffer, pCancel);
+}
+
+#endif
+
+#endif
\ No newline at end of file
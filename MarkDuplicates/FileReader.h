@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+// FileReader.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+#define READ_ENGINE_SYNC     0            // One read at a time: ReadFile, or pread.
+#define READ_ENGINE_QUEUED   1            // Several reads at a time: overlapped ReadFile, or io_uring.
+#define READ_QUEUE_DEPTH     1            // Reads in flight for a file by default, which is the sync engine.
+#define MAX_READ_QUEUE_DEPTH 32
+#define READ_SLICE_LEN       (256 * 1024) // Most bytes asked for by one read.
+#define READ_ALIGNMENT       4096         // Alignment of the buffers, and of the reads when unbuffered.
+#define DROP_BEHIND_LAG      (8 * 1024 * 1024) // Bytes read before some are dropped from the file cache.
+#define READ_HANDLE_RESERVE  64           // Open files GetOpenLimit leaves to the rest of the process.
+
+#define READ_SEQUENTIAL      0x1          // Tell the system that the file is read from start to end.
+#define READ_NOATIME         0x2          // Leave the access time of the file alone, where permitted.
+#define READ_DROPBEHIND      0x4          // Drop what has been read from the file cache.
+#define READ_UNBUFFERED      0x8          // Bypass the file cache, into READ_ALIGNMENT aligned buffers.
+
+class DirectoryEnumerator;
+
+class FileReader
+{
+protected:
+	uint32_t                   _Error;      // System error code of the last failure, 0 if none.
+	uint64_t                   _Offset;     // Where the next read starts.
+	uint64_t                   _Dropped;    // Bytes from the start already dropped from the file cache.
+	int                        _Options;    // READ_ flags.
+	bool                       _Overlapped; // The file is opened for overlapped reads.
+	std::wstring               _FileName;
+	const DirectoryEnumerator* _Directory;  // The directory FileName is relative to, or NULL.
+	uint64_t                   _Size;       // Size of the file when it was opened.
+	bool                       _Sparse;     // The file may have holes.
+	uint64_t                   _HoleStart;  // The next hole at or after the offset, from the start
+	uint64_t                   _HoleEnd;    // to the end; both UINT64_MAX when there are no more.
+	uint64_t                   _HoleBytes;  // Bytes of holes zero filled or skipped, over all files.
+#ifdef _WIN32
+	void*                      _hFile;
+#else
+	int                        _File;
+#endif
+	bool                       Reopen(uint32_t Error);
+	void                       DropBehind(bool All);
+	void                       FindHole();
+	virtual int64_t            ReadData(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel);
+public:
+	static FileReader* Create(int Engine, int QueueDepth = READ_QUEUE_DEPTH, int Options = READ_SEQUENTIAL);
+	static void*    AllocateBuffer(size_t cbBuffer);
+	static void     FreeBuffer(void* pBuffer);
+	static uint64_t GetCacheBytes();
+	static int      GetOpenLimit(int Files);
+	static bool     IsOutOfHandles(uint32_t Error);
+	FileReader(int Options = READ_SEQUENTIAL);
+	virtual ~FileReader();
+	bool            Open(const std::wstring& FileName, const DirectoryEnumerator* pDirectory = NULL);
+	int64_t         Read(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel = NULL);
+	uint64_t        GetHole();
+	void            SkipHole(uint64_t Bytes);
+	void            Skip(uint64_t Bytes) { _Offset += Bytes; }
+	void            Close();
+	virtual int     GetEngine() const { return READ_ENGINE_SYNC; }
+	int             GetOptions() const { return _Options; }
+	uint32_t        GetError() const { return _Error; }
+	uint64_t        GetHoleBytes() const { return _HoleBytes; }
+};
\ No newline at end of file
@@ -0,0 +1,22 @@
+///////////////////////////////////////////////////////////////////////////////
+// HashEngine.h - What a scan asks of the engine that hashes its files: the
+//                HashPipeline, or the AsyncScan.
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "framework.h"
+#include "RateLimiter.h"
+#include "DirectoryEnumerator.h"
+
+class HashEngine
+{
+public:
+	virtual ~HashEngine() {}
+	virtual void     SetLimiter(RateLimiter* pLimiter, bool Background) = 0;
+	virtual void     SetDirectory(const DirectoryEnumerator* pDirectory) = 0;
+	virtual void     Start() = 0;
+	virtual void     Abort() = 0;
+	virtual bool     Wait(int Milliseconds = -1) = 0;
+	virtual uint64_t GetHoleBytes() const = 0;
+	virtual uint64_t GetSkipped() const = 0; // Files left unhashed, since they could not be read.
+	virtual void     Describe(TCHAR* pszEngine, int cchEngine) const = 0; // Its threads and reads, for the progress line.
+};
\ No newline at end of file
@@ -0,0 +1,640 @@
+///////////////////////////////////////////////////////////////////////////////
+// HashPipeline.cpp - Hashes the files of a HashedFiles in two stages.
+//
+// Reader threads claim files from HashedFiles, read them into buffers taken
+// from a fixed pool, and queue the buffers for the hashers. The hashers run
+// as tasks of the thread pool, one queue each, and return the buffers to
+// the pool once hashed. Since the pool holds PIPELINE_MEMORY_BUDGET bytes
+// at most, and each queue holds a limited number of chunks, a reader that
+// gets ahead of the hashers waits, and a reader reads its next file while
+// the hashers are still working on the one before. The readers are plain
+// threads, since they mostly wait for the disk, so their number can be set
+// apart from the number of hashers, which need a processor each.
+//
+// A reader sends all of the chunks of a file to one hasher, in order, and a
+// hasher keeps one SHA-1 context per reader, so chunks of different files
+// may be interleaved in a queue.
+//
+// Each hasher owns an equal share of the buffers. It allocates them and
+// touches them before any reader may take one, so that on a NUMA machine
+// they lie in the memory beside the processor the hasher runs on, which
+// stays put when the pool pins its workers. A reader takes the buffers of
+// a file from its hasher, the one with the most buffers free.
+//
+// With Readers = 0 the number of readers is adapted while the scan runs.
+// MAX_PIPELINE_READERS readers are started, and only the first
+// _ReaderLimit of them claim files while the others wait their turn. A
+// control thread measures the throughput and the read latency every
+// CONTROL_INTERVAL_MS, lets a ConcurrencyController pick the limit, and
+// logs each decision with OutputDebugString.
+//
+// The readers read through a FileReader. With a QueueDepth above 1, each
+// reader keeps that many slices of a buffer in flight, with overlapped
+// reads on Windows or an io_uring of its own on Linux.
+//
+// A RateLimiter, when one is set, is shared by all the readers: each takes
+// a token before it opens a file and pays for the bytes of each chunk once
+// the chunk is queued, so the caps hold for the scan as a whole.
+//
+// A hole of a sparse file, which FileReader finds without reading it, is
+// not read at all when it fills a whole buffer: the reader queues a chunk
+// of _ZeroBuffer instead, which no reader writes and the hasher does not
+// return to the pool. It is not charged to the limiter or to the device,
+// and a shorter hole is zero filled by FileReader within the read.
+//
+// A file that cannot be opened or read, deleted or locked since it was
+// listed, is skipped: it is left unhashed, counted, and logged with
+// OutputDebugString, and the scan goes on. A file that fails partway sends
+// a last chunk marked Skip, so that its hasher drops what it has.
+//
+// A file below SMALL_FILE_LEN, as listed, is read and hashed by its reader,
+// in one read into a buffer of the reader's own, and never queued: for a
+// small file, taking a buffer, queueing it and waking a hasher cost more
+// than the hash. The reader opens it with a reader of the sync engine and
+// without the sequential hint, which gain nothing for one read, and saves
+// its hash as a thread of its own, after the hashers, in HashedFiles.
+//
+// The members of a tar archive come in one claim per archive, which its
+// reader reads once from start to end through a TarArchive of its own,
+// hashing the claimed members as they pass as if each were a file, and
+// charging the headers and the data it reads past to the limiter too.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "HashPipeline.h"
+#include <algorithm>
+#include <vector>
+
+//=============================================================================
+// Constructor - Allocates the buffers and the queues. The hashers are
+//               limited to the threads of the pool, so that every queue has
+//               a hasher running. Readers = 0 adapts the readers, starting
+//               at StartReaders. BufferLen is the size of each read, a
+//               multiple of 4 KB, from a tuning profile or the default.
+//               QueueDepth is the number of reads each reader keeps in
+//               flight, and ReadOptions the READ_ flags of the readers.
+//=============================================================================
+
+HashPipeline::HashPipeline(HashedFiles* pHashedFiles, ThreadPool* pPool, int Readers, int Hashers,
+                           int BufferLen, int StartReaders, int QueueDepth, int ReadOptions)
+{
+	_HashedFiles = pHashedFiles;
+	_Pool = pPool;
+	_Controller = Readers <= 0 ? new ConcurrencyController(1, MAX_PIPELINE_READERS, StartReaders) : NULL;
+	_Readers = _Controller != NULL ? MAX_PIPELINE_READERS : min(Readers, MAX_PIPELINE_READERS);
+	_ReaderLimit = _Controller != NULL ? _Controller->GetCurrent() : _Readers;
+	_Hashers = max(min(Hashers, _Pool->GetThreadCount()), 1);
+
+	// Adapted readers beyond what the buffers feed only wait, and the controller removes them.
+	// The buffers are shared out between the hashers, which allocate their own.
+	_BufferLen = max(min(BufferLen, MAX_PIPELINE_BUFFER_LEN) / 4096 * 4096, 4096);
+	_BufferCount = max(PIPELINE_MEMORY_BUDGET / _BufferLen, 2 * (_Controller != NULL ? _ReaderLimit.load() : _Readers));
+	_BufferCount = max(_BufferCount / _Hashers, 2);
+	_QueueDepth = max(min(QueueDepth, MAX_READ_QUEUE_DEPTH), 1);
+	_ReadOptions = ReadOptions;
+	_Limiter = NULL;
+	_Background = false;
+	_Directory = NULL;
+	_ZeroBuffer = (uint8_t*)FileReader::AllocateBuffer(_BufferLen);
+	memset(_ZeroBuffer, 0, _BufferLen);
+
+	_QueueLimit = _BufferCount;
+	_Queues = new tagQueue[_Hashers];
+	for (int i = 0; i < _Hashers; ++i)
+	{
+		_Queues[i].Memory = NULL;
+		_Queues[i].FreeBuffers = new uint8_t*[_BufferCount];
+		_Queues[i].FreeCount = 0;
+	}
+
+	_ReaderThreads = new std::thread[_Readers];
+	_ReadersRunning = 0;
+	_Running = 0;
+	_Abort = false;
+	_ClaimsDone = false;
+	_BytesRead = 0;
+	_ReadTime = 0;
+	_ReadCount = 0;
+	_HoleBytes = 0;
+	_Skipped = 0;
+}
+
+//=============================================================================
+// Destructor - Waits for the readers and the hashers to finish.
+//=============================================================================
+
+HashPipeline::~HashPipeline()
+{
+	Wait();
+	if (_ControlThread.joinable()) _ControlThread.join();
+	for (int i = 0; i < _Readers; ++i) if (_ReaderThreads[i].joinable()) _ReaderThreads[i].join();
+	delete _Controller;
+	delete[] _ReaderThreads;
+	for (int i = 0; i < _Hashers; ++i)
+	{
+		delete[] _Queues[i].FreeBuffers;
+		FileReader::FreeBuffer(_Queues[i].Memory);
+	}
+	delete[] _Queues;
+	FileReader::FreeBuffer(_ZeroBuffer);
+}
+
+//=============================================================================
+// Start - Claims are cut for the hashers, whose progress HashedFiles keeps,
+//         and a fixed number of readers is shared out between the devices,
+//         or for disk order one reader reads each device, then the readers,
+//         the hashers, and the control thread are started. A device whose
+//         limit was set before, from its tuning profile, keeps it, except
+//         in disk order.
+//=============================================================================
+
+void HashPipeline::Start()
+{
+	_HashedFiles->StartHashing(_Hashers + _Readers);
+	int Devices = _HashedFiles->GetDeviceCount();
+	int Limit = _HashedFiles->GetHashOrder() == HASH_BY_LOCATION ? 1 :
+		_Controller != NULL ? 0 : (_Readers + Devices - 1) / Devices;
+	for (int i = 0; i < Devices; ++i) if (Limit == 1 || _HashedFiles->GetDeviceLimit(i) == 0) _HashedFiles->SetDeviceLimit(i, Limit);
+	_ReadersRunning = _Readers;
+	_Running = _Readers + _Hashers;
+	for (int Hasher = 0; Hasher < _Hashers; ++Hasher) _Pool->Submit([this, Hasher] { HasherMain(Hasher); });
+	for (int Reader = 0; Reader < _Readers; ++Reader) _ReaderThreads[Reader] = std::thread(&HashPipeline::ReaderMain, this, Reader);
+	if (_Controller != NULL) _ControlThread = std::thread(&HashPipeline::ControlMain, this);
+}
+
+//=============================================================================
+// Abort - Stops the readers within a slice of their current read, and the
+//         hashers within the chunk they are hashing; what is queued is
+//         dropped unhashed. The files already hashed keep their hashes.
+//=============================================================================
+
+void HashPipeline::Abort()
+{
+	_Abort = true;
+	std::lock_guard<std::mutex> Lock(_TurnLock);
+	_TurnChanged.notify_all();
+}
+
+//=============================================================================
+// Wait - Waits until the readers and the hashers have finished, or for up to
+//        Milliseconds if that is not negative. Returns false on a timeout.
+//=============================================================================
+
+bool HashPipeline::Wait(int Milliseconds)
+{
+	std::unique_lock<std::mutex> Done(_DoneLock);
+	if (Milliseconds < 0)
+	{
+		_Done.wait(Done, [this] { return _Running.load() == 0; });
+		return true;
+	}
+	return _Done.wait_for(Done, std::chrono::milliseconds(Milliseconds), [this] { return _Running.load() == 0; });
+}
+
+//=============================================================================
+// Describe - The readers, the hashers, and the size and depth of the reads.
+//=============================================================================
+
+void HashPipeline::Describe(TCHAR* pszEngine, int cchEngine) const
+{
+	StringCchPrintf(pszEngine, cchEngine, _T("Readers: %d%s     Hashers: %d%s     Reads: %d KB x %d"),
+		GetReaders(), IsAdaptive() ? _T(" (adapting)") : _T(""), _Hashers, _Pool->IsPinned() ? _T(" (pinned)") : _T(""),
+		_BufferLen / 1024, _QueueDepth);
+}
+
+//=============================================================================
+// ReaderMain - Claims files, from whichever device has a reader slot free,
+//              and reads each one into buffers for a hasher, the hasher
+//              with the most buffers free, or hashes a small file itself.
+//              Like the workers of the pool, the reader is kept to the
+//              pool's set of processors, and in the background its I/O has
+//              the lowest priority.
+//=============================================================================
+
+void HashPipeline::ReaderMain(int Reader)
+{
+	sha1file Sha1File; // Hashes the small files, and the small members of archives.
+	FileReader* pReader = FileReader::Create(_QueueDepth > 1 ? READ_ENGINE_QUEUED : READ_ENGINE_SYNC, _QueueDepth, _ReadOptions);
+	FileReader* pSmallReader = FileReader::Create(READ_ENGINE_SYNC, 1, _ReadOptions & ~READ_SEQUENTIAL);
+	uint8_t* pSmallBuffer = (uint8_t*)FileReader::AllocateBuffer(SMALL_FILE_LEN);
+	TarArchive* pArchive = NULL; // Reads the archives through pReader, once one is claimed.
+	int First, Last, Device;
+	if (_Pool->GetCpuSet() != 0) ThreadPool::SetThreadCpus(_Pool->GetCpuSet());
+	if (_Background) ThreadPool::SetThreadBackground(true);
+	while (WaitForTurn(Reader) && _HashedFiles->ClaimFiles(Reader, First, Last, Device))
+	{
+		if (_HashedFiles->IsClaimedMember(_HashedFiles->GetClaimedNode(First)))
+		{
+			if (pArchive == NULL) pArchive = new TarArchive(pReader, _BufferLen, false);
+			HashArchive(Reader, First, Last, Device, pArchive, pSmallBuffer, Sha1File);
+			_HashedFiles->ReleaseClaim(Device);
+			continue;
+		}
+		for (int Position = First; Position < Last && !_Abort; ++Position)
+		{
+			int Node = _HashedFiles->GetClaimedNode(Position);
+			const wstring& FileName = _HashedFiles->GetClaimedFile(Node);
+			if (_Limiter != NULL && !_Limiter->TakeOpen(&_Abort)) break;
+			if (_HashedFiles->GetClaimedBytes(Node) < SMALL_FILE_LEN)
+			{
+				HashSmallFile(Reader, Node, Device, pSmallReader, pSmallBuffer, Sha1File);
+				continue;
+			}
+			if (!pReader->Open(FileName, _Directory))
+			{
+				SkipFile(FileName, pReader->GetError());
+				continue;
+			}
+			int Hasher = FreestQueue();
+			Chunk chunk;
+			chunk.Node = Node;
+			chunk.Reader = Reader;
+			chunk.First = true;
+			chunk.Skip = false;
+			do
+			{
+				if (pReader->GetHole() >= (uint64_t)_BufferLen)
+				{
+					pReader->SkipHole(_BufferLen);
+					chunk.pData = _ZeroBuffer;
+					chunk.cbData = _BufferLen;
+					chunk.Last = _Abort;
+					Push(Hasher, chunk);
+					chunk.First = false;
+					continue;
+				}
+				chunk.pData = TakeBuffer(Hasher);
+				auto ReadStart = std::chrono::steady_clock::now();
+				int64_t cbRead = pReader->Read(chunk.pData, _BufferLen, &_Abort);
+				chunk.Skip = cbRead < 0; // The hasher drops what it has of the file.
+				chunk.cbData = chunk.Skip ? 0 : (DWORD)cbRead;
+				_ReadTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ReadStart).count();
+				_ReadCount++;
+				_BytesRead += chunk.cbData;
+				chunk.Last = chunk.Skip || chunk.cbData < (DWORD)_BufferLen || _Abort;
+				_HashedFiles->AddDeviceBytes(Device, chunk.cbData);
+				Push(Hasher, chunk);
+				if (_Limiter != NULL) _Limiter->TakeBytes(chunk.cbData, &_Abort); // The hasher has the chunk while the reader waits.
+				chunk.First = false;
+			} while (!chunk.Last);
+			if (chunk.Skip) SkipFile(FileName, pReader->GetError());
+			pReader->Close();
+		}
+		_HashedFiles->ReleaseClaim(Device);
+	}
+	_HoleBytes += pReader->GetHoleBytes();
+	delete pArchive;
+	delete pReader;
+	delete pSmallReader;
+	FileReader::FreeBuffer(pSmallBuffer);
+
+	// The claims are gone, so the readers waiting their turn, and the control thread, finish too.
+	{
+		std::lock_guard<std::mutex> Lock(_TurnLock);
+		_ClaimsDone = true;
+		_TurnChanged.notify_all();
+	}
+
+	// The last reader out wakes the hashers, which stop once their queues are empty.
+	if (_ReadersRunning.fetch_sub(1) == 1)
+	{
+		for (int i = 0; i < _Hashers; ++i)
+		{
+			std::lock_guard<std::mutex> Lock(_Queues[i].Lock);
+			_Queues[i].Changed.notify_all();
+		}
+	}
+	Finished();
+}
+
+//=============================================================================
+// HashSmallFile - Reads a small file into the reader's buffer and hashes it
+//                 on the reader's thread. It takes one read, unless the file
+//                 has grown since it was listed, when it takes as many as
+//                 it needs. A file that cannot be opened or read is skipped.
+//=============================================================================
+
+void HashPipeline::HashSmallFile(int Reader, int Node, int Device, FileReader* pReader, uint8_t* pBuffer, sha1file& Sha1File)
+{
+	const wstring& FileName = _HashedFiles->GetClaimedFile(Node);
+	TCHAR szFileHash[SHA_DIGEST_LEN * 3];
+	if (!pReader->Open(FileName, _Directory))
+	{
+		SkipFile(FileName, pReader->GetError());
+		return;
+	}
+	Sha1File.Begin();
+	int64_t cbRead;
+	do
+	{
+		auto ReadStart = std::chrono::steady_clock::now();
+		cbRead = pReader->Read(pBuffer, SMALL_FILE_LEN, &_Abort);
+		if (cbRead < 0)
+		{
+			SkipFile(FileName, pReader->GetError());
+			pReader->Close();
+			return;
+		}
+		_ReadTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ReadStart).count();
+		_ReadCount++;
+		_BytesRead += cbRead;
+		_HashedFiles->AddDeviceBytes(Device, cbRead);
+		Sha1File.Input(pBuffer, (DWORD)cbRead);
+		if (_Limiter != NULL) _Limiter->TakeBytes(cbRead, &_Abort);
+	} while (cbRead == SMALL_FILE_LEN && !_Abort);
+	pReader->Close();
+	Sha1File.End(szFileHash);
+	if (!_Abort) _HashedFiles->SaveHash(_Hashers + Reader, Node, szFileHash);
+}
+
+//=============================================================================
+// SkipFile - Counts a file that cannot be opened or read, which is left
+//            unhashed, and logs it.
+//=============================================================================
+
+void HashPipeline::SkipFile(const wstring& FileName, uint32_t Error)
+{
+	TCHAR szSkipped[MAX_PATH + 60];
+	_Skipped++;
+	StringCchPrintf(szSkipped, MAX_PATH + 60, _T("MarkDuplicates: skipped %s, error %u\n"), FileName.c_str(), Error);
+	OutputDebugString(szSkipped);
+}
+
+//=============================================================================
+// HashArchive - Reads an archive once, from start to end, and hashes the
+//               members of the claim as they pass, each known by where it
+//               starts: a small one on the reader's thread, and a larger one
+//               in chunks for a hasher, as a file is. The members that are
+//               not in the claim are read past. An archive that cannot be
+//               opened, is cut off or damaged, or has changed since it was
+//               listed is input like any other: the members from where it
+//               fails on are left unhashed and counted as skipped.
+//=============================================================================
+
+void HashPipeline::HashArchive(int Reader, int First, int Last, int Device, TarArchive* pArchive,
+                               uint8_t* pSmallBuffer, sha1file& Sha1File)
+{
+	std::vector<std::pair<uint64_t, int>> Members; // Where each member starts, and its node, in archive order.
+	for (int Position = First; Position < Last; ++Position)
+	{
+		int Node = _HashedFiles->GetClaimedNode(Position);
+		Members.push_back(std::make_pair(_HashedFiles->GetClaimedLocation(Node), Node));
+	}
+	std::sort(Members.begin(), Members.end());
+	const wstring& FirstName = _HashedFiles->GetClaimedFile(Members[0].second);
+	wstring ArchiveName = FirstName.substr(0, TarArchive::FindMember(FirstName));
+	if (_Limiter != NULL && !_Limiter->TakeOpen(&_Abort)) return;
+	pArchive->Open(ArchiveName, _Directory); // An archive that does not open has no members to pass.
+
+	// Counts what the archive has been read up to, headers and skipped data included.
+	uint64_t Counted = 0;
+	auto Count = [&](std::chrono::steady_clock::time_point ReadStart)
+	{
+		uint64_t Bytes = pArchive->GetOffset() - Counted;
+		Counted += Bytes;
+		_ReadTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ReadStart).count();
+		_ReadCount++;
+		_BytesRead += Bytes;
+		_HashedFiles->AddDeviceBytes(Device, Bytes);
+		if (_Limiter != NULL) _Limiter->TakeBytes(Bytes, &_Abort);
+	};
+
+	TCHAR szFileHash[SHA_DIGEST_LEN * 3];
+	TarMember Member;
+	size_t Next = 0;
+	while (Next < Members.size() && !_Abort)
+	{
+		auto ReadStart = std::chrono::steady_clock::now();
+		bool bMember = pArchive->Next(Member, &_Abort);
+		Count(ReadStart);
+		if (!bMember || Member.Offset > Members[Next].first) break;
+		if (Member.Offset < Members[Next].first) continue;
+		int Node = Members[Next].second;
+		if (Member.Size < SMALL_FILE_LEN)
+		{
+			ReadStart = std::chrono::steady_clock::now();
+			int64_t cbRead = pArchive->Read(pSmallBuffer, SMALL_FILE_LEN, &_Abort);
+			Count(ReadStart);
+			if (cbRead < 0) break;
+			Sha1File.Begin();
+			Sha1File.Input(pSmallBuffer, (DWORD)cbRead);
+			Sha1File.End(szFileHash);
+			if (!_Abort) _HashedFiles->SaveHash(_Hashers + Reader, Node, szFileHash);
+			Next++;
+			continue;
+		}
+		int Hasher = FreestQueue();
+		Chunk chunk;
+		chunk.Node = Node;
+		chunk.Reader = Reader;
+		chunk.First = true;
+		do
+		{
+			chunk.pData = TakeBuffer(Hasher);
+			ReadStart = std::chrono::steady_clock::now();
+			int64_t cbRead = pArchive->Read(chunk.pData, _BufferLen, &_Abort);
+			chunk.Skip = cbRead < 0; // The hasher drops what it has of the member.
+			chunk.cbData = chunk.Skip ? 0 : (DWORD)cbRead;
+			chunk.Last = chunk.Skip || chunk.cbData < (DWORD)_BufferLen || _Abort;
+			Push(Hasher, chunk);
+			Count(ReadStart); // The hasher has the chunk while the reader waits.
+			chunk.First = false;
+		} while (!chunk.Last);
+		if (chunk.Skip) break;
+		Next++;
+	}
+	if (Next < Members.size() && !_Abort)
+	{
+		TCHAR szSkipped[MAX_PATH + 80];
+		_Skipped += Members.size() - Next;
+		StringCchPrintf(szSkipped, MAX_PATH + 80, _T("MarkDuplicates: %llu members of %s skipped, error %u\n"),
+			(uint64_t)(Members.size() - Next), ArchiveName.c_str(),
+			pArchive->GetError() != 0 ? pArchive->GetError() : (uint32_t)ERROR_FILE_NOT_FOUND);
+		OutputDebugString(szSkipped);
+	}
+	pArchive->Close();
+}
+
+//=============================================================================
+// WaitForTurn - Waits while the reader is beyond the limit of adapted
+//               readers. Returns false on an abort or once the claims are
+//               gone.
+//=============================================================================
+
+BOOL HashPipeline::WaitForTurn(int Reader)
+{
+	if (Reader < _ReaderLimit.load()) return !_Abort;
+	std::unique_lock<std::mutex> Lock(_TurnLock);
+	_TurnChanged.wait(Lock, [this, Reader] { return Reader < _ReaderLimit.load() || _Abort || _ClaimsDone; });
+	return !_Abort && !_ClaimsDone;
+}
+
+//=============================================================================
+// ControlMain - Every CONTROL_INTERVAL_MS, passes the throughput and the
+//               average read latency of the interval to the controller,
+//               sets the limit of readers it returns, and logs the decision.
+//=============================================================================
+
+void HashPipeline::ControlMain()
+{
+	if (_Pool->GetCpuSet() != 0) ThreadPool::SetThreadCpus(_Pool->GetCpuSet());
+	auto Then = std::chrono::steady_clock::now();
+	uint64_t BytesThen = 0, TimeThen = 0, CountThen = 0;
+	std::unique_lock<std::mutex> Lock(_TurnLock);
+	while (!_TurnChanged.wait_for(Lock, std::chrono::milliseconds(CONTROL_INTERVAL_MS), [this] { return _Abort || _ClaimsDone; }))
+	{
+		auto Now = std::chrono::steady_clock::now();
+		uint64_t Bytes = _BytesRead.load(), Time = _ReadTime.load(), Count = _ReadCount.load();
+		double Seconds = std::chrono::duration<double>(Now - Then).count();
+		double Throughput = (Bytes - BytesThen) / max(Seconds, 1e-3);
+		double Latency = Count > CountThen ? (Time - TimeThen) / 1e9 / (Count - CountThen) : 0;
+		Then = Now;
+		BytesThen = Bytes;
+		TimeThen = Time;
+		CountThen = Count;
+
+		int OldLimit = _ReaderLimit.load();
+		int NewLimit = _Controller->Update(Throughput, Latency);
+		_ReaderLimit = NewLimit;
+		if (NewLimit > OldLimit) _TurnChanged.notify_all();
+
+		TCHAR szDecision[160];
+		StringCchPrintf(szDecision, 160, _T("MarkDuplicates: readers %d -> %d at %.1f MB/s, %.2f ms per read: %hs\n"),
+			OldLimit, NewLimit, Throughput / 1048576, Latency * 1000, _Controller->GetDecision());
+		OutputDebugString(szDecision);
+	}
+}
+
+//=============================================================================
+// HasherMain - Allocates and touches the hasher's buffers, so that their
+//              pages are placed beside the processor it runs on, hands them
+//              to the readers, and hashes the chunks of its queue until the
+//              readers are done.
+//=============================================================================
+
+void HashPipeline::HasherMain(int Hasher)
+{
+	Queue pQueue = &_Queues[Hasher];
+	uint8_t* pMemory = (uint8_t*)FileReader::AllocateBuffer((size_t)_BufferCount * _BufferLen);
+	memset(pMemory, 0, (size_t)_BufferCount * _BufferLen);
+	{
+		std::lock_guard<std::mutex> Lock(pQueue->Lock);
+		pQueue->Memory = pMemory;
+		for (int i = 0; i < _BufferCount; ++i) pQueue->FreeBuffers[i] = pMemory + (size_t)i * _BufferLen;
+		pQueue->FreeCount = _BufferCount;
+	}
+	pQueue->BufferFreed.notify_all();
+
+	sha1file* pSha1Files = new sha1file[_Readers];
+	TCHAR* pszFileHash = new TCHAR[pSha1Files[0].GetMessageDigestLength() * 3 + 1];
+	Chunk chunk;
+	while (Pop(Hasher, chunk))
+	{
+		sha1file& Sha1File = pSha1Files[chunk.Reader];
+		if (_Abort) // Drain the queue without hashing, so that the readers are not kept waiting.
+		{
+			if (chunk.pData != _ZeroBuffer) ReturnBuffer(Hasher, chunk.pData);
+			continue;
+		}
+		if (chunk.First) Sha1File.Begin();
+		Sha1File.Input(chunk.pData, chunk.cbData);
+		if (chunk.pData != _ZeroBuffer) ReturnBuffer(Hasher, chunk.pData);
+		if (!chunk.Last) continue;
+		Sha1File.End(pszFileHash);
+		if (!_Abort && !chunk.Skip) _HashedFiles->SaveHash(Hasher, chunk.Node, pszFileHash);
+	}
+	delete[] pszFileHash;
+	delete[] pSha1Files;
+	Finished();
+}
+
+//=============================================================================
+// TakeBuffer - Takes a buffer of a hasher, waiting for one if all of them
+//              are in use, or if the hasher has not yet allocated them.
+//=============================================================================
+
+uint8_t* HashPipeline::TakeBuffer(int Hasher)
+{
+	Queue pQueue = &_Queues[Hasher];
+	std::unique_lock<std::mutex> Lock(pQueue->Lock);
+	pQueue->BufferFreed.wait(Lock, [pQueue] { return pQueue->FreeCount.load() > 0; });
+	int Free = pQueue->FreeCount.load() - 1;
+	pQueue->FreeCount = Free;
+	return pQueue->FreeBuffers[Free];
+}
+
+//=============================================================================
+// ReturnBuffer - Returns a buffer to its hasher.
+//=============================================================================
+
+void HashPipeline::ReturnBuffer(int Hasher, uint8_t* pBuffer)
+{
+	Queue pQueue = &_Queues[Hasher];
+	{
+		std::lock_guard<std::mutex> Lock(pQueue->Lock);
+		int Free = pQueue->FreeCount.load();
+		pQueue->FreeBuffers[Free] = pBuffer;
+		pQueue->FreeCount = Free + 1;
+	}
+	pQueue->BufferFreed.notify_one();
+}
+
+//=============================================================================
+// FreestQueue - Returns the hasher with the most buffers free, which is the
+//               one with the least work waiting.
+//=============================================================================
+
+int HashPipeline::FreestQueue() const
+{
+	int Freest = 0;
+	for (int i = 1; i < _Hashers; ++i)
+		if (_Queues[i].FreeCount.load(std::memory_order_relaxed) > _Queues[Freest].FreeCount.load(std::memory_order_relaxed))
+			Freest = i;
+	return Freest;
+}
+
+//=============================================================================
+// Push - Queues a chunk for a hasher, waiting while its queue is full.
+//=============================================================================
+
+void HashPipeline::Push(int Hasher, const Chunk& chunk)
+{
+	Queue pQueue = &_Queues[Hasher];
+	{
+		std::unique_lock<std::mutex> Lock(pQueue->Lock);
+		pQueue->Changed.wait(Lock, [this, pQueue] { return (int)pQueue->Chunks.size() < _QueueLimit; });
+		pQueue->Chunks.push_back(chunk);
+	}
+	pQueue->Changed.notify_all();
+}
+
+//=============================================================================
+// Pop - Takes the next chunk of a hasher's queue, waiting for one. Returns
+//       false once the queue is empty and the readers are done.
+//=============================================================================
+
+BOOL HashPipeline::Pop(int Hasher, Chunk& chunk)
+{
+	Queue pQueue = &_Queues[Hasher];
+	{
+		std::unique_lock<std::mutex> Lock(pQueue->Lock);
+		pQueue->Changed.wait(Lock, [this, pQueue] { return !pQueue->Chunks.empty() || _ReadersRunning.load() == 0; });
+		if (pQueue->Chunks.empty()) return false;
+		chunk = pQueue->Chunks.front();
+		pQueue->Chunks.pop_front();
+	}
+	pQueue->Changed.notify_all();
+	return true;
+}
+
+//=============================================================================
+// Finished - Called as each reader and hasher finishes.
+//=============================================================================
+
+void HashPipeline::Finished()
+{
+	if (_Running.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> Done(_DoneLock);
+		_Done.notify_all();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+// HashPipeline.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "framework.h"
+#include "HashEngine.h"
+#include "HashedFiles.h"
+#include "ThreadPool.h"
+#include "ConcurrencyController.h"
+#include "FileReader.h"
+#include "RateLimiter.h"
+#include "DirectoryEnumerator.h"
+#include "TarArchive.h"
+#include "sha1file.h"
+
+#define PIPELINE_BUFFER_LEN (1024 * 1024)         // Default bytes read into a buffer at a time.
+#define PIPELINE_MEMORY_BUDGET (64 * 1024 * 1024) // Bytes of all of the buffers.
+#define PIPELINE_READERS 4                        // Readers at the start when they are adapted.
+#define MAX_PIPELINE_READERS 64
+#define MAX_PIPELINE_BUFFER_LEN (4 * 1024 * 1024)
+#define CONTROL_INTERVAL_MS 500                   // Time between changes to the adapted readers.
+#define SMALL_FILE_LEN (64 * 1024)                // Files below this are hashed by their reader, in one read.
+
+class HashPipeline : public HashEngine
+{
+private:
+	typedef struct tagChunk
+	{
+		int      Node;   // Index in the node list of HashedFiles.
+		int      Reader; // The reader of the file, which selects the hasher's context.
+		BOOL     First;  // First chunk of the file.
+		BOOL     Last;   // Last chunk of the file; may be the first, and may be empty.
+		BOOL     Skip;   // The file could not be read to its end, so its hash is dropped.
+		DWORD    cbData;
+		uint8_t* pData;  // A buffer from the pool, or _ZeroBuffer for a hole.
+	} Chunk;
+	typedef struct tagQueue // Chunks waiting for one hasher, and the buffers the hasher owns.
+	{
+		std::mutex              Lock;
+		std::condition_variable Changed;
+		std::deque<Chunk>       Chunks;
+		uint8_t*                Memory;      // Allocated, aligned for unbuffered reads, and first touched by the hasher.
+		uint8_t**               FreeBuffers;
+		std::atomic<int>        FreeCount;
+		std::condition_variable BufferFreed;
+	} *Queue;
+	HashedFiles*            _HashedFiles;
+	ThreadPool*             _Pool;
+	int                     _Readers;
+	int                     _Hashers;
+	int                     _QueueLimit;     // Chunks a queue holds before its readers wait.
+	int                     _BufferLen;      // Bytes read into a buffer at a time.
+	int                     _QueueDepth;     // Reads in flight for each reader, 1 for the sync engine.
+	int                     _ReadOptions;    // READ_ flags of the readers' files.
+	RateLimiter*            _Limiter;        // Caps the reads and the opens of all the readers, or NULL.
+	bool                    _Background;     // The readers run with the lowest I/O priority.
+	const DirectoryEnumerator* _Directory;   // The directory the names of the files are relative to, or NULL.
+	int                     _BufferCount;    // Buffers of each hasher.
+	uint8_t*                _ZeroBuffer;     // _BufferLen zeros, shared by the chunks of the holes.
+	Queue                   _Queues;
+	std::thread*            _ReaderThreads;
+	std::atomic<int>        _ReadersRunning;
+	ConcurrencyController*  _Controller;     // Adapts the readers, or NULL for a fixed number.
+	std::thread             _ControlThread;
+	std::atomic<int>        _ReaderLimit;    // Readers 0 up to this may claim files.
+	std::atomic<bool>       _ClaimsDone;
+	std::mutex              _TurnLock;
+	std::condition_variable _TurnChanged;
+	std::atomic<uint64_t>   _BytesRead;
+	std::atomic<uint64_t>   _ReadTime;       // Nanoseconds the readers spent waiting on FileReader reads.
+	std::atomic<uint64_t>   _ReadCount;
+	std::atomic<uint64_t>   _HoleBytes;      // Bytes of holes hashed without a read.
+	std::atomic<uint64_t>   _Skipped;        // Files left unhashed, since they could not be read.
+	std::atomic<int>        _Running;        // Readers and hashers that have not finished.
+	std::atomic<bool>       _Abort;
+	std::mutex              _DoneLock;
+	std::condition_variable _Done;
+	void     ReaderMain(int Reader);
+	void     HashSmallFile(int Reader, int Node, int Device, FileReader* pReader, uint8_t* pBuffer, sha1file& Sha1File);
+	void     SkipFile(const wstring& FileName, uint32_t Error);
+	void     HashArchive(int Reader, int First, int Last, int Device, TarArchive* pArchive,
+	                     uint8_t* pSmallBuffer, sha1file& Sha1File);
+	BOOL     WaitForTurn(int Reader);
+	void     ControlMain();
+	void     HasherMain(int Hasher);
+	uint8_t* TakeBuffer(int Hasher);
+	void     ReturnBuffer(int Hasher, uint8_t* pBuffer);
+	int      FreestQueue() const;
+	void     Push(int Hasher, const Chunk& chunk);
+	BOOL     Pop(int Hasher, Chunk& chunk);
+	void     Finished();
+public:
+	HashPipeline(HashedFiles* pHashedFiles, ThreadPool* pPool, int Readers, int Hashers,
+	             int BufferLen = PIPELINE_BUFFER_LEN, int StartReaders = PIPELINE_READERS,
+	             int QueueDepth = READ_QUEUE_DEPTH, int ReadOptions = READ_SEQUENTIAL);
+	~HashPipeline();
+	int  GetReaders() const { return _Controller != NULL ? _ReaderLimit.load() : _Readers; }
+	int  GetHashers() const { return _Hashers; }
+	int  GetBufferLen() const { return _BufferLen; }
+	int  GetQueueDepth() const { return _QueueDepth; }
+	int  GetReadOptions() const { return _ReadOptions; }
+	BOOL IsAdaptive() const { return _Controller != NULL; }
+	virtual void SetLimiter(RateLimiter* pLimiter, bool Background) { _Limiter = pLimiter; _Background = Background; }
+	bool IsBackground() const { return _Background; }
+	virtual void SetDirectory(const DirectoryEnumerator* pDirectory) { _Directory = pDirectory; }
+	virtual uint64_t GetHoleBytes() const { return _HoleBytes; }
+	virtual uint64_t GetSkipped() const { return _Skipped; }
+	virtual void Start();
+	virtual void Abort();
+	virtual bool Wait(int Milliseconds = -1);
+	virtual void Describe(TCHAR* pszEngine, int cchEngine) const;
+};
\ No newline at end of file
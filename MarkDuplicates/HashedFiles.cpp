@@ -2,17 +2,33 @@
 // HashedFiles.cpp - Implementation of the class HashedFiles.
 //
 // This is an array of pointers to nodes containing a Duplicate flag,
-// a FileHash, a FileDate, a FileTime, a FileSize, and a FileName. The
+// a FileHash, a write time, a file size, and a FileName. The
 // length of the array is dynamically allocated in chunks of Increment
 // pointers. This represents the files in a directory specified by the
 // user. Various sorting options are available. The base sort option is
 // by FileHash, then by FileName, which places identical files together
-// with the second and subsequent file(s) marked as duplicates. Save and
-// Load methods are provided to save the class and load it back later.
+// with the second and subsequent file(s) marked as duplicates. Sorting
+// does not move the nodes; each sort mode builds a permutation of node
+// indexes the first time it is selected, and the view reads through the
+// permutation of the current mode, so switching back to a mode that has
+// been used before is instant. Files with the same hash also form a
+// duplicate group, which carries the member count, the size of each
+// member and the bytes that the marked members would reclaim. The totals
+// are kept current as the user overrides the Duplicate flags. Save and
+// Load methods are provided to save the class, including the
+// permutations, and load it back later. The write time and size are kept
+// as numbers and only formatted for the rows that are painted, through a
+// small cache, so the time zone they are shown in is a display setting.
+// The line height of every row is kept in a RowLayout, so the display can
+// map between rows and lines without walking the rows.
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "framework.h"
 #include "HashedFiles.h"
+#include "TarArchive.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 //=============================================================================
 // Constructor - Initialize and allocate <increment> nodes.
@@ -23,20 +39,45 @@ HashedFiles::HashedFiles(int Increment)
 	_NodeList = new FileNode[Increment];
 	_NodeCount = 0;
 	_Allocated = _Increment = Increment;
-	_NextNode = 0;
-	_NodesProcessed = 0;
-	_BytesProcessed = 0;
+	_ClaimOrder = NULL;
+	_ClaimList = NULL;
+	_ClaimCount = 0;
+	_DeviceCount = 0;
+	_HashOrder = HASH_BY_SCAN;
+	_HashLanes = false;
+	_Progress = NULL;
+	_Threads = 0;
+	_Pool = NULL;
+	for (int i = 0; i < SORT_MODES; ++i) _SortIndex[i] = NULL;
+	_SortMode = 0;
+	_DupsMarked = false;
+	_HashSaved = false;
+	_GroupList = NULL;
+	_GroupCount = 0;
+	_GroupOrder = NULL;
+	_DupCount = 0;
+	_DupBytes = 0;
+	_FormatCache = new tagRowFormat[FORMAT_CACHE_SIZE];
+	_LocalTime = true;
+	ResetFormatCache();
 }
 
 //=============================================================================
-// AddNode - Allocate nodes if needed and load FileHash, DateTime, FileSize,
+// AddNode - Allocate nodes if needed and load FileHash, WriteTime, FileSize,
 //           and FileName. Note that the FileHash is being initialized as a
 //           zero-length string with final load being done by SaveHash.
+//           Member marks a member of an archive, as the listing found it,
+//           rather than a file whose name only looks like one. Any sort
+//           permutations and groups no longer cover every node, so they
+//           are discarded.
 //=============================================================================
-void HashedFiles::AddNode
-	(const wstring& FileHash, const wstring& FileDate, const wstring& FileTime,
-	 const wstring& FileSize, const wstring& FileName)
+void HashedFiles::AddNode(const wstring& FileHash, uint64_t WriteTime, uint64_t FileSize, const wstring& FileName,
+                          int Device, uint64_t Location, BOOL Member)
 {
+	ResetSortIndex();
+	ResetGroups();
+	_Layout.Reset(0);
+
 	if (_NodeCount == _Allocated)
 	{
 		// Allocate the pointers.
@@ -50,78 +91,317 @@ void HashedFiles::AddNode
 	// Allocate and load the node
 	_NodeList[_NodeCount]            = new tagFileNode;
 	_NodeList[_NodeCount]->Duplicate = false;
+	_NodeList[_NodeCount]->Member    = Member;
+	_NodeList[_NodeCount]->WriteTime = WriteTime;
+	_NodeList[_NodeCount]->Bytes     = FileSize;
+	_NodeList[_NodeCount]->Group     = -1;
+	_NodeList[_NodeCount]->NextGroup = 0;
+	_NodeList[_NodeCount]->Device    = max(min(Device, MAX_DEVICES - 1), 0);
+	_NodeList[_NodeCount]->Location  = Location;
 	_NodeList[_NodeCount]->FileHash  = new wstring(FileHash);
-	_NodeList[_NodeCount]->FileDate  = new wstring(FileDate);
-	_NodeList[_NodeCount]->FileTime  = new wstring(FileTime);
-	_NodeList[_NodeCount]->FileSize  = new wstring(FileSize);
 	_NodeList[_NodeCount]->FileName  = new wstring(FileName);
 	_NodeCount++;
 }
 
 //=============================================================================
-// SortAndCheck - Called after adding and processing all the nodes, sorts by
-//                FileHash and then by FileName.  After sorting, marks each
-//                duplicated file for ultimate deletion by the user.
+// SortAndCheck - Called after adding and processing all the nodes, selects
+//                the sort order that the view reads through. The nodes are
+//                not moved; the permutation for the mode is built the first
+//                time the mode is selected and reused after that. Editing
+//                the Duplicate flags does not change any sort key, so the
+//                permutations stay valid until the next AddNode or Reset.
+//                A hash saved since they were built may move any node, so
+//                then they are rebuilt, with the groups and the duplicates.
 //
-//                Mode controls the sort: 0 means sort by hash and file and
-//                then mark duplicates, 1 means sort by file alone, 2 means
-//                sort by date and file, and 3 means sort by size and file.
-//                If Mode > 0, then the duplicate checking is bypassed.
+//                Mode controls the sort: 0 means sort by hash and file, 1
+//                means sort by file alone, 2 means sort by date and file,
+//                3 means sort by size and file, and 4 means sort the groups
+//                by wasted bytes, largest first, then by file. The hash
+//                order is always built first, since it marks the duplicates
+//                and defines the groups. The duplicates are marked only
+//                once, after a scan, so the X/O overrides made by the user
+//                survive switching between sort modes.
 //=============================================================================
 
 void HashedFiles::SortAndCheck(int SortMode)
 {
-	// Shell Sort
-	BOOL swap;
-	tagFileNode* TempNode;
-	int i, j, diff = 0;
-	for (j = _NodeCount / 2; j > 0; j /= 2)
+	if (SortMode < 0 || SortMode >= SORT_MODES) return;
+
+	if (_HashSaved)
+	{
+		ResetSortIndex();
+		ResetGroups();
+		_DupsMarked = false;
+		_HashSaved = false;
+	}
+	if (_SortIndex[0] == NULL) BuildSortIndex(0);
+
+	// Scan for duplicate hashes and mark them. Each node is only compared
+	// with the node before it, so the pool can mark the nodes in parallel;
+	// the totals are then counted once.
+	if (!_DupsMarked)
 	{
-		swap = true;
-		while (swap)
+		int* SortIndex = _SortIndex[0];
+		auto Mark = [this, SortIndex](int First, int Last)
 		{
-			swap = false;
-			for (i = 0; i + j < _NodeCount; ++i)
+			for (int i = First; i < Last; ++i)
 			{
-				switch (SortMode)
-				{
-				case 0: // By FileHash, then by FileName
-					diff =                HashCompare(_NodeList[i]->FileHash->c_str(), _NodeList[i + j]->FileHash->c_str());
-					if (diff == 0) diff = FileCompare(_NodeList[i]->FileName->c_str(), _NodeList[i + j]->FileName->c_str());
-					break;
-				case 1: // By FileName alone
-					diff =                FileCompare(_NodeList[i]->FileName->c_str(), _NodeList[i + j]->FileName->c_str());
-					break;
-				case 2: // By FileDate, then by FileTime, then by FileName
-					diff =                DateCompare(_NodeList[i]->FileDate->c_str(), _NodeList[i + j]->FileDate->c_str());
-					if (diff == 0) diff = TimeCompare(_NodeList[i]->FileTime->c_str(), _NodeList[i + j]->FileTime->c_str());
-					if (diff == 0) diff = FileCompare(_NodeList[i]->FileName->c_str(), _NodeList[i + j]->FileName->c_str());
-					break;
-				case 3: // By FileSize, then by FileName
-					diff =                SizeCompare(_NodeList[i]->FileSize->c_str(), _NodeList[i + j]->FileSize->c_str());
-					if (diff == 0) diff = FileCompare(_NodeList[i]->FileName->c_str(), _NodeList[i + j]->FileName->c_str());
-					break;
-				}
+				_NodeList[SortIndex[i]]->Duplicate = i > 0 &&
+					_NodeList[SortIndex[i]]->FileHash->compare(*_NodeList[SortIndex[i - 1]]->FileHash) == 0;
+			}
+		};
+		if (_Pool != NULL) _Pool->ParallelFor(0, _NodeCount, PARALLEL_GRAIN, Mark);
+		else               Mark(0, _NodeCount);
+
+		_DupCount = 0;
+		_DupBytes = 0;
+		for (int i = 0; i < _NodeCount; ++i)
+		{
+			if (!_NodeList[i]->Duplicate) continue;
+			_DupCount++;
+			_DupBytes += _NodeList[i]->Bytes;
+		}
+		_DupsMarked = true;
+	}
 
-				if (diff > 0)
+	if (_GroupList == NULL) BuildGroups();
+	if (_SortIndex[SortMode] == NULL) BuildSortIndex(SortMode);
+	_SortMode = SortMode;
+	BuildLayout();
+}
+
+//=============================================================================
+// BuildSortIndex - Builds the permutation of _NodeList for the sort mode.
+//                  With a pool, runs of PARALLEL_GRAIN nodes are sorted in
+//                  parallel and then merged in pairs, each round of merges
+//                  also in parallel.
+//=============================================================================
+void HashedFiles::BuildSortIndex(int SortMode)
+{
+	int* SortIndex = new int[max(_NodeCount, 1)];
+	for (int i = 0; i < _NodeCount; ++i) SortIndex[i] = i;
+	auto Less = [this, SortMode](int Node1, int Node2) { return NodeCompare(SortMode, Node1, Node2) < 0; };
+	if (_Pool == NULL || _NodeCount <= PARALLEL_GRAIN)
+	{
+		std::sort(SortIndex, SortIndex + _NodeCount, Less);
+	}
+	else
+	{
+		int Runs = (_NodeCount + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN;
+		_Pool->ParallelFor(0, Runs, 1, [this, SortIndex, &Less](int First, int Last)
+			{
+				for (int Run = First; Run < Last; ++Run)
+					std::sort(SortIndex + Run * PARALLEL_GRAIN,
+						SortIndex + min((Run + 1) * PARALLEL_GRAIN, _NodeCount), Less);
+			});
+		for (int Width = PARALLEL_GRAIN; Width < _NodeCount; Width *= 2)
+		{
+			int Pairs = (_NodeCount + 2 * Width - 1) / (2 * Width);
+			_Pool->ParallelFor(0, Pairs, 1, [this, SortIndex, &Less, Width](int First, int Last)
 				{
-					swap = true;
-					TempNode = _NodeList[i];
-					_NodeList[i] = _NodeList[i + j];
-					_NodeList[i + j] = TempNode;
-				}
-			}
+					for (int Pair = First; Pair < Last; ++Pair)
+					{
+						int Begin = Pair * 2 * Width;
+						int Middle = min(Begin + Width, _NodeCount);
+						int End = (int)min((int64_t)Begin + 2 * Width, (int64_t)_NodeCount);
+						std::inplace_merge(SortIndex + Begin, SortIndex + Middle, SortIndex + End, Less);
+					}
+				});
 		}
 	}
+	delete[] _SortIndex[SortMode];
+	_SortIndex[SortMode] = SortIndex;
+	if (_GroupList != NULL) LocateGroups(SortMode);
+}
 
-	// Scan for duplicate hashes and mark them.
-	if (SortMode == 0)
+//=============================================================================
+// SetNodeDuplicate - Sets the Duplicate flag of a node and keeps the
+//                    duplicate count, the reclaimable bytes, and the marked
+//                    count of the node's group current.
+//=============================================================================
+void HashedFiles::SetNodeDuplicate(FileNode pNode, BOOL Duplicate)
+{
+	Duplicate = Duplicate ? true : false;
+	if (pNode->Duplicate == Duplicate) return;
+	pNode->Duplicate = Duplicate;
+	int Delta = Duplicate ? 1 : -1;
+	_DupCount += Delta;
+	if (Duplicate) _DupBytes += pNode->Bytes; else _DupBytes -= pNode->Bytes;
+	if (pNode->Group >= 0) _GroupList[pNode->Group].Marked += Delta;
+}
+
+//=============================================================================
+// SetDuplicate - Sets the Duplicate flag of the node at a view position and
+//                updates the height of its row.
+//=============================================================================
+void HashedFiles::SetDuplicate(int Node, BOOL Duplicate)
+{
+	if (Node < 0 || Node > _NodeCount - 1) return;
+	SetNodeDuplicate(ViewNode(Node), Duplicate);
+	_Layout.SetHeight(Node, RowHeight(ViewNode(Node)->Duplicate));
+}
+
+//=============================================================================
+// BuildLayout - Builds the row heights for the current sort mode. A file
+//               marked as a duplicate follows the file it duplicates, so
+//               it takes one line; in the modes that show groups, other
+//               files also take a blank line to separate them.
+//=============================================================================
+void HashedFiles::BuildLayout()
+{
+	_Layout.Reset(_NodeCount);
+	for (int i = 0; i < _NodeCount; ++i) _Layout.LoadHeight(i, RowHeight(ViewNode(i)->Duplicate));
+	_Layout.Build();
+}
+
+//=============================================================================
+// NodeCompare - Orders two nodes, by index, according to the sort mode.
+//=============================================================================
+int HashedFiles::NodeCompare(int SortMode, int Node1, int Node2) const
+{
+	const tagFileNode* p1 = _NodeList[Node1];
+	const tagFileNode* p2 = _NodeList[Node2];
+	int diff = 0;
+	switch (SortMode)
+	{
+	case 0: // By FileHash, then by FileName
+		diff =                HashCompare(*p1->FileHash, *p2->FileHash);
+		if (diff == 0) diff = FileCompare(*p1->FileName, *p2->FileName);
+		break;
+	case 1: // By FileName alone
+		diff =                FileCompare(*p1->FileName, *p2->FileName);
+		break;
+	case 2: // By WriteTime (to the minute, as displayed), then by FileName
+		diff = p1->WriteTime / 600000000 < p2->WriteTime / 600000000 ? -1 :
+		       p1->WriteTime / 600000000 > p2->WriteTime / 600000000 ? +1 : 0;
+		if (diff == 0) diff = FileCompare(*p1->FileName, *p2->FileName);
+		break;
+	case 3: // By FileSize, then by FileName
+		diff = p1->Bytes < p2->Bytes ? -1 : p1->Bytes > p2->Bytes ? +1 : 0;
+		if (diff == 0) diff = FileCompare(*p1->FileName, *p2->FileName);
+		break;
+	case 4: // By group rank (wasted bytes), files in no group last, then by FileHash, then by FileName
+		if (p1->Group != p2->Group)
+		{
+			if (p1->Group < 0) return +1;
+			if (p2->Group < 0) return -1;
+			return _GroupList[p1->Group].Rank < _GroupList[p2->Group].Rank ? -1 : +1;
+		}
+		diff =                HashCompare(*p1->FileHash, *p2->FileHash);
+		if (diff == 0) diff = FileCompare(*p1->FileName, *p2->FileName);
+		break;
+	}
+	return diff;
+}
+
+//=============================================================================
+// ResetSortIndex - Discards all of the sort permutations.
+//=============================================================================
+void HashedFiles::ResetSortIndex()
+{
+	for (int i = 0; i < SORT_MODES; ++i)
+	{
+		delete[] _SortIndex[i];
+		_SortIndex[i] = NULL;
+	}
+}
+
+//=============================================================================
+// BuildGroups - Walks the hash order and makes a group of each run of two or
+//               more files with the same hash. Groups are numbered in hash
+//               order and then ranked by wasted bytes, i.e. the bytes held
+//               by all but one member, largest first.
+//=============================================================================
+void HashedFiles::BuildGroups()
+{
+	ResetGroups();
+	if (_SortIndex[0] == NULL) BuildSortIndex(0);
+	int* SortIndex = _SortIndex[0];
+
+	// Count the groups.
+	int GroupCount = 0;
+	for (int i = 0, j; i < _NodeCount; i = j)
 	{
-		for (i = 1; i < _NodeCount; ++i)
+		for (j = i + 1; j < _NodeCount &&
+			_NodeList[SortIndex[j]]->FileHash->compare(*_NodeList[SortIndex[i]]->FileHash) == 0; ++j);
+		if (j - i > 1 && !_NodeList[SortIndex[i]]->FileHash->empty()) ++GroupCount;
+	}
+
+	// Load the groups and point each node at its group.
+	_GroupList = new tagFileGroup[max(GroupCount, 1)];
+	for (int i = 0, j; i < _NodeCount; i = j)
+	{
+		for (j = i + 1; j < _NodeCount &&
+			_NodeList[SortIndex[j]]->FileHash->compare(*_NodeList[SortIndex[i]]->FileHash) == 0; ++j);
+		if (j - i < 2 || _NodeList[SortIndex[i]]->FileHash->empty())
 		{
-			if (_NodeList[i]->FileHash->compare(_NodeList[i - 1]->FileHash->c_str()) == 0)
-				_NodeList[i]->Duplicate = true; else _NodeList[i]->Duplicate = false;
+			for (int k = i; k < j; ++k)
+			{
+				_NodeList[SortIndex[k]]->Group     = -1;
+				_NodeList[SortIndex[k]]->NextGroup = _GroupCount;
+			}
+			continue;
 		}
+		FileGroup pGroup = &_GroupList[_GroupCount];
+		pGroup->Members = j - i;
+		pGroup->Marked  = 0;
+		pGroup->Bytes   = _NodeList[SortIndex[i]]->Bytes;
+		for (int k = i; k < j; ++k)
+		{
+			_NodeList[SortIndex[k]]->Group     = _GroupCount;
+			_NodeList[SortIndex[k]]->NextGroup = _GroupCount + 1;
+			if (_NodeList[SortIndex[k]]->Duplicate) pGroup->Marked++;
+		}
+		_GroupCount++;
+	}
+
+	// Rank the groups by wasted bytes.
+	_GroupOrder = new int[max(_GroupCount, 1)];
+	for (int g = 0; g < _GroupCount; ++g) _GroupOrder[g] = g;
+	std::sort(_GroupOrder, _GroupOrder + _GroupCount, [this](int Group1, int Group2)
+		{
+			uint64_t Wasted1 = (_GroupList[Group1].Members - 1) * _GroupList[Group1].Bytes;
+			uint64_t Wasted2 = (_GroupList[Group2].Members - 1) * _GroupList[Group2].Bytes;
+			return Wasted1 != Wasted2 ? Wasted1 > Wasted2 : Group1 < Group2;
+		});
+	for (int r = 0; r < _GroupCount; ++r) _GroupList[_GroupOrder[r]].Rank = r;
+
+	// The wasted bytes order depends on the ranks, so it is rebuilt if it exists.
+	if (_SortIndex[SORT_BY_WASTE] != NULL) BuildSortIndex(SORT_BY_WASTE);
+	for (int Mode = 0; Mode < SORT_MODES; ++Mode)
+		if (_SortIndex[Mode] != NULL) LocateGroups(Mode);
+}
+
+//=============================================================================
+// LocateGroups - Records where the first member of each group is in the view
+//                of the sort mode, so that jumping to a group takes no search.
+//=============================================================================
+void HashedFiles::LocateGroups(int SortMode)
+{
+	for (int g = 0; g < _GroupCount; ++g) _GroupList[g].First[SortMode] = -1;
+	for (int i = _NodeCount - 1; i >= 0; --i)
+	{
+		int Group = _NodeList[_SortIndex[SortMode] ? _SortIndex[SortMode][i] : i]->Group;
+		if (Group >= 0) _GroupList[Group].First[SortMode] = i;
+	}
+}
+
+//=============================================================================
+// ResetGroups - Discards the groups, and the nodes' links to them. The
+//               Duplicate flags and totals are kept.
+//=============================================================================
+void HashedFiles::ResetGroups()
+{
+	if (_GroupList == NULL) return;
+	delete[] _GroupList;
+	delete[] _GroupOrder;
+	_GroupList = NULL;
+	_GroupOrder = NULL;
+	_GroupCount = 0;
+	for (int i = 0; i < _NodeCount; ++i)
+	{
+		_NodeList[i]->Group = -1;
+		_NodeList[i]->NextGroup = 0;
 	}
 }
 
@@ -138,7 +418,7 @@ int HashedFiles::HashCompare(const wstring& string1, const wstring& string2) con
 // characters, i.e. in the filename, as '~' so the sort is in the right order.
 // Also, this routine is case-insensitive.
 //=============================================================================
-int HashedFiles::FileCompare(const wstring& string1, const wstring& string2) const
+int HashedFiles::FileCompare(const wstring& string1, const wstring& string2)
 {
 	WCHAR char1, char2;
 	for (UINT i = 0; i < min(string1.length(), string2.length()); ++i)
@@ -164,65 +444,197 @@ int HashedFiles::FileCompare(const wstring& string1, const wstring& string2) con
 }
 
 //=============================================================================
-// DateCompare - Similar to wstring::compare, but sorts
-// dates that look like "mm/dd/yyyy" as "yyyymm/dd".
+// GetNode - Called after calling AddNode and SaveHash for each file along with
+// SortAndCheck, to retrieve the sorted and marked FileHashes, FileDates,
+// FileSizes, and FileNames. Node is the position in the current sort order.
 //=============================================================================
-int HashedFiles::DateCompare(const wstring& string1, const wstring& string2) const
+
+BOOL HashedFiles::GetNode
+(int Node, BOOL& Duplicate, wstring& FileHash, wstring& FileDate,
+	wstring& FileTime, wstring& FileSize, wstring& FileName) const
 {
-	int diff;
-		diff = string1.substr(6,4).compare(string2.substr(6,4)); // sort yyyy first
-	if (diff == 0)
-		diff = string1.substr(0,5).compare(string2.substr(0,5)); // sort mm/dd second
-	return diff;
+	if (Node < 0 || Node > _NodeCount - 1) return false;
+	FileNode pNode = ViewNode(Node);
+	RowFormat pFormat = FormatNode(_SortIndex[_SortMode] ? _SortIndex[_SortMode][Node] : Node);
+	Duplicate = pNode->Duplicate;
+	FileHash  = pNode->FileHash->c_str();
+	FileDate  = pFormat->FileDate;
+	FileTime  = pFormat->FileTime;
+	FileSize  = pFormat->FileSize;
+	FileName  = pNode->FileName->c_str();
+	return true;
 }
 
 //=============================================================================
-// TimeCompare - Identical to wstring::compare.
+// GetNode - An overload of GetNode, which returns only the duplicate flag.
 //=============================================================================
-int HashedFiles::TimeCompare(const wstring& string1, const wstring& string2) const
+
+BOOL HashedFiles::GetNode(int Node, BOOL& Duplicate) const
 {
-	return string1.compare(string2);
+	if (Node < 0 || Node > _NodeCount - 1) return false;
+	Duplicate = ViewNode(Node)->Duplicate;
+	return true;
 }
 
 //=============================================================================
-// SizeCompare - Identical to wstring::compare.
+// GetRow - Like GetNode, but points at the node's strings instead of copying
+//          them, and leaves the write time and size unformatted, so the
+//          caller can read a row without any allocation.
 //=============================================================================
-int HashedFiles::SizeCompare(const wstring& string1, const wstring& string2) const
+
+BOOL HashedFiles::GetRow(int Node, FileRow& Row) const
 {
-	return string1.compare(string2);
+	if (Node < 0 || Node > _NodeCount - 1) return false;
+	Row.Node      = _SortIndex[_SortMode] ? _SortIndex[_SortMode][Node] : Node;
+	FileNode pNode = _NodeList[Row.Node];
+	Row.Duplicate = pNode->Duplicate;
+	Row.WriteTime = pNode->WriteTime;
+	Row.FileSize  = pNode->Bytes;
+	Row.FileHash  = pNode->FileHash;
+	Row.FileName  = pNode->FileName;
+	return true;
 }
 
 //=============================================================================
-// GetNode - Called after calling AddNode and SaveHash for each file along with
-// SortAndCheck, to retrieve the sorted and marked FileHashes, FileDates,
-// FileSizes, and FileNames.
+// FormatRow - Formats a row as a display line into the caller's buffer. The
+//             buffer keeps its capacity, so once it has grown to the longest
+//             line, formatting does no allocation. The date, time, and size
+//             text comes from the format cache.
 //=============================================================================
 
-BOOL HashedFiles::GetNode
-(int Node, BOOL& Duplicate, wstring& FileHash, wstring& FileDate,
-	wstring& FileTime, wstring& FileSize, wstring& FileName) const
+void HashedFiles::FormatRow(const FileRow& Row, wstring& Line) const
 {
-	if (Node < 0 || Node > _NodeCount - 1) return false;
-	Duplicate = _NodeList[Node]->Duplicate;
-	FileHash  = _NodeList[Node]->FileHash->c_str();
-	FileDate  = _NodeList[Node]->FileDate->c_str();
-	FileTime  = _NodeList[Node]->FileTime->c_str();
-	FileSize  = _NodeList[Node]->FileSize->c_str();
-	FileName  = _NodeList[Node]->FileName->c_str();
-	return true;
+	RowFormat pFormat = FormatNode(Row.Node);
+	Line.clear();
+	Line += *Row.FileHash;    Line += _T("   ");
+	Line += pFormat->FileDate; Line += _T("   ");
+	Line += pFormat->FileTime; Line += _T("   ");
+	Line += pFormat->FileSize; Line += _T("   ");
+	Line += Row.Duplicate ? _T("X   ") : _T("O   ");
+	Line += *Row.FileName;
 }
 
 //=============================================================================
-// GetNode - An overload of GetNode, which returns only the duplicate flag.
+// FormatNode - Returns the date, time, and size text of a node, by index in
+//              _NodeList, formatting it only if it is not in the cache.
 //=============================================================================
 
-BOOL HashedFiles::GetNode(int Node, BOOL& Duplicate) const
+HashedFiles::RowFormat HashedFiles::FormatNode(int Node) const
 {
-	if (Node < 0 || Node > _NodeCount - 1) return false;
-	Duplicate = _NodeList[Node]->Duplicate;
+	RowFormat pFormat = &_FormatCache[Node & (FORMAT_CACHE_SIZE - 1)];
+	if (pFormat->Node == Node) return pFormat;
+
+	// Convert the write time to the display time zone.
+	FILETIME FileTime, DisplayFileTime;
+	SYSTEMTIME SystemTime;
+	FileTime.dwLowDateTime  = (DWORD)(_NodeList[Node]->WriteTime);
+	FileTime.dwHighDateTime = (DWORD)(_NodeList[Node]->WriteTime >> 32);
+	if (_LocalTime) FileTimeToLocalFileTime(&FileTime, &DisplayFileTime);
+	else            DisplayFileTime = FileTime;
+	FileTimeToSystemTime(&DisplayFileTime, &SystemTime);
+
+	StringCchPrintf(pFormat->FileDate, FORMATTED_FILE_DATE_LEN, _T("%02d/%02d/%04d"),
+	                SystemTime.wMonth, SystemTime.wDay, SystemTime.wYear);
+	StringCchPrintf(pFormat->FileTime, FORMATTED_FILE_TIME_LEN, _T("%02d:%02d"),
+	                SystemTime.wHour, SystemTime.wMinute);
+	StringCchPrintf(pFormat->FileSize, FORMATTED_FILE_SIZE_LEN, _T("%9llu"), _NodeList[Node]->Bytes);
+	pFormat->Node = Node;
+	return pFormat;
+}
+
+//=============================================================================
+// ResetFormatCache - Empties the format cache.
+//=============================================================================
+
+void HashedFiles::ResetFormatCache()
+{
+	for (int i = 0; i < FORMAT_CACHE_SIZE; ++i) _FormatCache[i].Node = -1;
+}
+
+//=============================================================================
+// SetLocalTime - Selects the time zone for displaying write times: the local
+//                time zone if true, else UTC.
+//=============================================================================
+
+void HashedFiles::SetLocalTime(BOOL LocalTime)
+{
+	_LocalTime = LocalTime;
+	ResetFormatCache();
+}
+
+//=============================================================================
+// GetGroup - Returns the member count, the size of each member, and the bytes
+//            the members currently marked as duplicates would reclaim.
+//=============================================================================
+
+BOOL HashedFiles::GetGroup(int Group, int& Members, uint64_t& Bytes, uint64_t& Reclaimable) const
+{
+	if (Group < 0 || Group > _GroupCount - 1) return false;
+	Members     = _GroupList[Group].Members;
+	Bytes       = _GroupList[Group].Bytes;
+	Reclaimable = _GroupList[Group].Marked * _GroupList[Group].Bytes;
 	return true;
 }
 
+//=============================================================================
+// GetNodeGroup - Returns the group of the node, or -1 if it has no duplicate.
+//=============================================================================
+
+int HashedFiles::GetNodeGroup(int Node) const
+{
+	if (Node < 0 || Node > _NodeCount - 1) return -1;
+	return ViewNode(Node)->Group;
+}
+
+//=============================================================================
+// GetNextGroup - Returns the view position of the first member of the group
+//                after the one holding Node, or -1 if there is none. Groups
+//                follow hash order, or wasted bytes order in that sort mode.
+//=============================================================================
+
+int HashedFiles::GetNextGroup(int Node) const
+{
+	if (Node < 0 || Node > _NodeCount - 1 || _GroupCount == 0) return -1;
+	FileNode pNode = ViewNode(Node);
+	int Group;
+	if (_SortMode == SORT_BY_WASTE)
+	{
+		int Rank = pNode->Group >= 0 ? _GroupList[pNode->Group].Rank + 1 : _GroupCount;
+		if (Rank >= _GroupCount) return -1;
+		Group = _GroupOrder[Rank];
+	}
+	else
+	{
+		Group = pNode->Group >= 0 ? pNode->Group + 1 : pNode->NextGroup;
+		if (Group >= _GroupCount) return -1;
+	}
+	return _GroupList[Group].First[_SortMode];
+}
+
+//=============================================================================
+// GetPrevGroup - Like GetNextGroup, but for the group before the one holding
+//                Node. The files in no group follow the last group.
+//=============================================================================
+
+int HashedFiles::GetPrevGroup(int Node) const
+{
+	if (Node < 0 || Node > _NodeCount - 1 || _GroupCount == 0) return -1;
+	FileNode pNode = ViewNode(Node);
+	int Group;
+	if (_SortMode == SORT_BY_WASTE)
+	{
+		int Rank = pNode->Group >= 0 ? _GroupList[pNode->Group].Rank - 1 : _GroupCount - 1;
+		if (Rank < 0) return -1;
+		Group = _GroupOrder[Rank];
+	}
+	else
+	{
+		Group = pNode->Group >= 0 ? pNode->Group - 1 : pNode->NextGroup - 1;
+		if (Group < 0) return -1;
+	}
+	return _GroupList[Group].First[_SortMode];
+}
+
 //=============================================================================
 // GetFile - Similar to GetNode, but returns only the FileName.
 //=============================================================================
@@ -230,41 +642,316 @@ BOOL HashedFiles::GetNode(int Node, BOOL& Duplicate) const
 BOOL HashedFiles::GetFile(int Node, wstring& FileName) const
 {
 	if (Node < 0 || Node > _NodeCount - 1) return false;
-	FileName = _NodeList[Node]->FileName->c_str();
+	FileName = ViewNode(Node)->FileName->c_str();
 	return true;
 }
 
 //=============================================================================
-// GetNextFile - Similar to GetFile, gets the next file, and updates
-//               the "next" index. Called from the worker thread.
+// AddDevice - Returns the index of the named storage device, adding it if it
+//             is new. Devices past MAX_DEVICES share the last index.
+//=============================================================================
+int HashedFiles::AddDevice(const wstring& Name)
+{
+	for (int i = 0; i < _DeviceCount; ++i) if (_DeviceList[i].Name == Name) return i;
+	if (_DeviceCount == MAX_DEVICES) return MAX_DEVICES - 1;
+	Device pDevice = &_DeviceList[_DeviceCount];
+	pDevice->Name = Name;
+	pDevice->First = pDevice->Split = pDevice->Last = 0;
+	pDevice->NextClaim[0] = pDevice->NextClaim[1] = 0;
+	pDevice->Active = 0;
+	pDevice->Limit = 0;
+	pDevice->BytesRead = 0;
+	return _DeviceCount++;
+}
+
+//=============================================================================
+// SetDeviceLimit - Sets the most readers that may read from a device at a
+//                  time, 0 for no limit.
+//=============================================================================
+void HashedFiles::SetDeviceLimit(int Device, int Limit)
+{
+	if (Device < 0 || Device > _DeviceCount - 1) return;
+	_DeviceList[Device].Limit = max(Limit, 0);
+}
+
+//=============================================================================
+// GetDevice - Returns the name of a device and the bytes read from it by
+//             the current or last hashing.
 //=============================================================================
-BOOL HashedFiles::GetNextFile(int& Node, wstring& FileName)
+BOOL HashedFiles::GetDevice(int Device, wstring& Name, uint64_t& BytesRead) const
 {
-	if (_NextNode > _NodeCount - 1) return false;
-	FileName = _NodeList[_NextNode]->FileName->c_str();
-	Node = _NextNode;
-	_NextNode++;
+	if (Device < 0 || Device > _DeviceCount - 1) return false;
+	Name = _DeviceList[Device].Name;
+	BytesRead = _DeviceList[Device].BytesRead.load(std::memory_order_relaxed);
 	return true;
+}
+
+//=============================================================================
+// SortClaims - Sorts _ClaimOrder from First up to but not including Last in
+//              the hash order. HASH_BY_LARGEST starts the longest reads
+//              first, so that the scan is not left waiting on one large
+//              file at the end. HASH_BY_SMALLEST finishes the most files
+//              early. HASH_BY_NAME keeps the files of a directory together,
+//              and HASH_BY_LOCATION reads a spinning disk with few seeks.
+//              Ties, and HASH_BY_SCAN, keep the order of the scan.
+//=============================================================================
+void HashedFiles::SortClaims(int First, int Last) const
+{
+	switch (_HashOrder)
+	{
+	case HASH_BY_LARGEST:
+		std::stable_sort(_ClaimOrder + First, _ClaimOrder + Last,
+			[this](int a, int b) { return _NodeList[a]->Bytes > _NodeList[b]->Bytes; });
+		break;
+	case HASH_BY_SMALLEST:
+		std::stable_sort(_ClaimOrder + First, _ClaimOrder + Last,
+			[this](int a, int b) { return _NodeList[a]->Bytes < _NodeList[b]->Bytes; });
+		break;
+	case HASH_BY_NAME:
+		std::stable_sort(_ClaimOrder + First, _ClaimOrder + Last,
+			[this](int a, int b) { return FileCompare(*_NodeList[a]->FileName, *_NodeList[b]->FileName) < 0; });
+		break;
+	case HASH_BY_LOCATION:
+		std::stable_sort(_ClaimOrder + First, _ClaimOrder + Last,
+			[this](int a, int b) { return _NodeList[a]->Location < _NodeList[b]->Location; });
+		break;
+	}
+}
+
+//=============================================================================
+// StartHashing - Called after adding all the nodes and before starting the
+//                worker threads. Orders the nodes by device, and within a
+//                device by the hash order. With lanes on, the small files
+//                of a device are queued apart from its large files, so that
+//                they are never stuck behind a large file; lanes are not
+//                used in disk order, which must stay sequential. Then cuts
+//                the nodes of each lane into claims of about the same cost,
+//                counting CLAIM_FILE_BYTES for opening each file, so that a
+//                worker takes many small files, or one large file, at a
+//                time. The claims are smaller when there is little work, so
+//                that every thread gets a share. The members of archives go
+//                after the large files, in one claim per archive, since an
+//                archive is read once from start to end. Also allocates one
+//                progress counter per thread.
+//=============================================================================
+void HashedFiles::StartHashing(int Threads)
+{
+	ResetHashing();
+	Threads = max(Threads, 1);
+	if (_DeviceCount == 0) AddDevice(_T(""));
+
+	uint64_t TotalCost = 0;
+	for (int i = 0; i < _NodeCount; ++i) TotalCost += _NodeList[i]->Bytes + CLAIM_FILE_BYTES;
+	uint64_t ClaimCost = min((uint64_t)CLAIM_BATCH_BYTES,
+		max(TotalCost / ((uint64_t)Threads * 4), (uint64_t)CLAIM_FILE_BYTES));
+
+	// Group the nodes by device, keeping their order within a device.
+	int DeviceStart[MAX_DEVICES + 1] = { 0 };
+	for (int i = 0; i < _NodeCount; ++i) DeviceStart[min(_NodeList[i]->Device, _DeviceCount - 1) + 1]++;
+	for (int d = 0; d < _DeviceCount; ++d) DeviceStart[d + 1] += DeviceStart[d];
+	_ClaimOrder = new int[max(_NodeCount, 1)];
+	for (int i = 0; i < _NodeCount; ++i) _ClaimOrder[DeviceStart[min(_NodeList[i]->Device, _DeviceCount - 1)]++] = i;
+
+	// Split each device into its lanes, sort them, and cut the claims, which never span two lanes.
+	// The members of archives are moved to the end of the large file lane, grouped by archive.
+	BOOL bLanes = _HashLanes && _HashOrder != HASH_BY_LOCATION;
+	auto ArchiveLess = [this](int a, int b)
+	{
+		const wstring& Name1 = *_NodeList[a]->FileName;
+		const wstring& Name2 = *_NodeList[b]->FileName;
+		return Name1.compare(0, TarArchive::FindMember(Name1), Name2, 0, TarArchive::FindMember(Name2)) < 0;
+	};
+	_ClaimList = new int[_NodeCount + 1];
+	for (int d = 0, Position = 0; d < _DeviceCount; ++d)
+	{
+		Device pDevice = &_DeviceList[d];
+		int Members = (int)(std::stable_partition(_ClaimOrder + Position, _ClaimOrder + DeviceStart[d],
+			[this](int a) { return !_NodeList[a]->Member; }) - _ClaimOrder);
+		std::stable_sort(_ClaimOrder + Members, _ClaimOrder + DeviceStart[d], ArchiveLess);
+		int Split = Members;
+		if (bLanes)
+		{
+			Split = (int)(std::stable_partition(_ClaimOrder + Position, _ClaimOrder + Members,
+				[this](int a) { return _NodeList[a]->Bytes < HASH_LANE_BYTES; }) - _ClaimOrder);
+		}
+		SortClaims(Position, Split);
+		SortClaims(Split, Members);
+
+		pDevice->First = _ClaimCount;
+		uint64_t Cost = 0;
+		for (; Position < Members; ++Position)
+		{
+			if (Position == Split)
+			{
+				pDevice->Split = _ClaimCount;
+				Cost = 0;
+			}
+			if (Cost == 0) _ClaimList[_ClaimCount++] = Position;
+			Cost += _NodeList[_ClaimOrder[Position]]->Bytes + CLAIM_FILE_BYTES;
+			if (Cost >= ClaimCost) Cost = 0;
+		}
+		if (Split == Members) pDevice->Split = _ClaimCount;
+		for (; Position < DeviceStart[d]; ++Position)
+		{
+			if (Position == Members || ArchiveLess(_ClaimOrder[Position - 1], _ClaimOrder[Position]))
+				_ClaimList[_ClaimCount++] = Position;
+		}
+		pDevice->Last = _ClaimCount;
+		pDevice->NextClaim[0] = pDevice->First;
+		pDevice->NextClaim[1] = pDevice->Split;
+		pDevice->Active = 0;
+		pDevice->BytesRead = 0;
+	}
+	_ClaimList[_ClaimCount] = _NodeCount;
+
+	_Progress = new tagProgress[Threads];
+	_Threads = Threads;
+	for (int i = 0; i < _Threads; ++i)
+	{
+		_Progress[i].Nodes = 0;
+		_Progress[i].Bytes = 0;
+	}
+}
+
+//=============================================================================
+// ClaimFiles - Claims the next batch of files for a reader, from the first
+//              device, starting with a device picked by the reader, that
+//              has claims left and is below its limit of readers. Within
+//              the device the reader prefers one lane, alternating between
+//              the readers of the device, and takes from the other lane
+//              once its own is empty. First up to but not including Last
+//              are positions for GetClaimedNode. Lock free: a reader slot
+//              and a claim are each taken with an atomic operation. Waits
+//              while every device with claims left is at its limit. Call
+//              ReleaseClaim(Device) when done.
+//=============================================================================
+BOOL HashedFiles::ClaimFiles(int Reader, int& First, int& Last, int& DeviceIndex)
+{
+	Reader = max(Reader, 0);
+	for (;;)
+	{
+		BOOL bWorkLeft = false;
+		for (int i = 0; i < _DeviceCount; ++i)
+		{
+			int d = (Reader + i) % _DeviceCount;
+			Device pDevice = &_DeviceList[d];
+			int LaneEnd[2] = { pDevice->Split, pDevice->Last };
+			if (pDevice->NextClaim[0].load() >= LaneEnd[0] && pDevice->NextClaim[1].load() >= LaneEnd[1]) continue;
+			bWorkLeft = true;
+
+			// Take a reader slot on the device, if it has one free.
+			int Active = pDevice->Active.load();
+			do if (pDevice->Limit > 0 && Active >= pDevice->Limit) break;
+			while (!pDevice->Active.compare_exchange_weak(Active, Active + 1));
+			if (pDevice->Limit > 0 && Active >= pDevice->Limit) continue;
 
+			for (int l = 0; l < 2; ++l)
+			{
+				int Lane = (Reader / _DeviceCount + l) & 1;
+				if (pDevice->NextClaim[Lane].load() >= LaneEnd[Lane]) continue;
+				int Claim = pDevice->NextClaim[Lane].fetch_add(1);
+				if (Claim >= LaneEnd[Lane]) continue; // Another reader took the last claim.
+				First = _ClaimList[Claim];
+				Last = _ClaimList[Claim + 1];
+				DeviceIndex = d;
+				return true;
+			}
+			pDevice->Active.fetch_sub(1);
+		}
+		if (!bWorkLeft) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
 }
 
 //=============================================================================
-// SaveHash - Updates FileHash. Called after GetFile from the worker thread.
-//            Updates statistics.
+// SaveHash - Updates FileHash. Called by the thread that hashed the file.
+//            Updates the statistics of the thread, which only that thread
+//            writes, so a plain store is enough. Flags the permutations as
+//            stale, for SortAndCheck to rebuild; the flag is read before it
+//            is set, so the threads do not all write its cache line.
 //=============================================================================
 
-BOOL HashedFiles::SaveHash(int Node, TCHAR* pszFileHash)
+BOOL HashedFiles::SaveHash(int Thread, int Node, TCHAR* pszFileHash)
 {
 	if (Node < 0 || Node > _NodeCount - 1) return false;
-	*(_NodeList[Node]->FileHash) = _T("");
-	for (int i = 0; i < lstrlen(pszFileHash); ++i)
-		*(_NodeList[Node]->FileHash) += pszFileHash[i];
-	_NodesProcessed++;
-	
-	_BytesProcessed += _wtoi((const TCHAR*)(_NodeList[Node]->FileSize->c_str()));
+	if (Thread < 0 || Thread > _Threads - 1) return false;
+	_NodeList[Node]->FileHash->assign(pszFileHash);
+	if (!_HashSaved.load(std::memory_order_relaxed)) _HashSaved.store(true, std::memory_order_relaxed);
+
+	Progress pProgress = &_Progress[Thread];
+	pProgress->Nodes.store(pProgress->Nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	pProgress->Bytes.store(pProgress->Bytes.load(std::memory_order_relaxed) + _NodeList[Node]->Bytes,
+		std::memory_order_relaxed);
 	return true;
 }
 
+//=============================================================================
+// RemoveUnhashed - After an aborted scan, or one that skipped files it could
+//                  not read, removes the files that were not hashed, so
+//                  that the files that were can still be sorted and
+//                  checked. A hashed file never has an empty FileHash, not
+//                  even an empty file. Returns the files removed.
+//=============================================================================
+int HashedFiles::RemoveUnhashed()
+{
+	ResetSortIndex();
+	ResetGroups();
+	ResetHashing();
+	ResetFormatCache();
+	_Layout.Reset(0);
+
+	int Kept = 0;
+	for (int i = 0; i < _NodeCount; ++i)
+	{
+		if (_NodeList[i]->FileHash->empty())
+		{
+			delete _NodeList[i]->FileHash;
+			delete _NodeList[i]->FileName;
+			delete _NodeList[i];
+			continue;
+		}
+		_NodeList[Kept++] = _NodeList[i];
+	}
+	int Removed = _NodeCount - Kept;
+	_NodeCount = Kept;
+	return Removed;
+}
+
+//=============================================================================
+// GetNodesProcessed - Sums the files hashed by all of the threads.
+//=============================================================================
+int HashedFiles::GetNodesProcessed() const
+{
+	int Nodes = 0;
+	for (int i = 0; i < _Threads; ++i) Nodes += _Progress[i].Nodes.load(std::memory_order_relaxed);
+	return Nodes;
+}
+
+//=============================================================================
+// GetBytesProcessed - Sums the bytes hashed by all of the threads.
+//=============================================================================
+uint64_t HashedFiles::GetBytesProcessed() const
+{
+	uint64_t Bytes = 0;
+	for (int i = 0; i < _Threads; ++i) Bytes += _Progress[i].Bytes.load(std::memory_order_relaxed);
+	return Bytes;
+}
+
+//=============================================================================
+// ResetHashing - Discards the claims and the progress counters.
+//=============================================================================
+void HashedFiles::ResetHashing()
+{
+	delete[] _ClaimOrder;
+	delete[] _ClaimList;
+	delete[] _Progress;
+	_ClaimOrder = NULL;
+	_ClaimList = NULL;
+	_ClaimCount = 0;
+	_Progress = NULL;
+	_Threads = 0;
+}
+
 //=============================================================================
 // Reset - Called by the destructor with Increment = 0. Optionally also
 // called with increment > 0 to reset the class to the initial state.
@@ -273,32 +960,40 @@ BOOL HashedFiles::SaveHash(int Node, TCHAR* pszFileHash)
 void HashedFiles::Reset(int Increment)
 {
 	// Destructor or Init call - Delete everything.
+	ResetSortIndex();
+	ResetGroups();
+	ResetHashing();
+	_Layout.Reset(0);
 	for (int i = 0; i < _NodeCount; ++i)
 	{
 		delete _NodeList[i]->FileHash;
-		delete _NodeList[i]->FileDate;
-		delete _NodeList[i]->FileTime;
-		delete _NodeList[i]->FileSize;
 		delete _NodeList[i]->FileName;
 		delete _NodeList[i];
 	}
 	delete[] _NodeList;
+	if (Increment == 0) delete[] _FormatCache;
 
 	// Init call - Reset to the as-constructed state.
 	if (Increment != 0)
 	{
+		ResetFormatCache();
 		_NodeList = new FileNode[Increment];
 		_NodeCount = 0;
 		_Allocated = _Increment = Increment;
-		_NextNode = 0;
-		_NodesProcessed = 0;
-		_BytesProcessed = 0;
+		_SortMode = 0;
+		_DupsMarked = false;
+		_HashSaved = false;
+		_DupCount = 0;
+		_DupBytes = 0;
+		_DeviceCount = 0;
 	}
 }
 
 //=============================================================================
 // Save - Saves the class, along with three parameters
 // and the selected directory, to a user specified file.
+// The nodes are written in _NodeList order, followed
+// by the sort permutations that have been built.
 //=============================================================================
 BOOL HashedFiles::Save(HWND hWnd, const int& iStartNode, const int& iSelectedFile,
 	                   const int& iSortMode, const TCHAR* pszDirectoryName) const
@@ -345,13 +1040,7 @@ BOOL HashedFiles::Save(HWND hWnd, const int& iStartNode, const int& iSelectedFil
 	wstring line;
 
 	// Write the header line.
-	line = _T("");
-	TCHAR sz[16];
-	_itow_s(iStartNode,    sz, 16, 10); line += sz; line += _T("|");
-	_itow_s(iSelectedFile, sz, 16, 10); line += sz; line += _T("|");
-	_itow_s(iSortMode,     sz, 16, 10); line += sz; line += _T("|");
-	for (int i = 0; i < lstrlen(pszDirectoryName); ++i) line += *(&pszDirectoryName[i]);
-	line += _T("\r\n");
+	FormatHeaderLine(line, iStartNode, iSelectedFile, iSortMode, pszDirectoryName);
 	LastAPICallLine = __LINE__ + 1;
 	if (!WriteFile(hFile, line.c_str(), (DWORD)line.length() * sizeof(TCHAR), NULL, NULL))
 	{
@@ -366,13 +1055,33 @@ BOOL HashedFiles::Save(HWND hWnd, const int& iStartNode, const int& iSelectedFil
 	// Write the detail lines.
 	for (int i = 0; i < _NodeCount; ++i)
 	{
-		line = _T("");
-		line += _NodeList[i]->FileHash->c_str(); line += _T("|");
-		line += _NodeList[i]->FileDate->c_str(); line += _T("|");
-		line += _NodeList[i]->FileTime->c_str(); line += _T("|");
-		line += _NodeList[i]->FileSize->c_str(); line += _T("|");
-		line += _NodeList[i]->Duplicate ? _T("X|") : _T("O|");
-		line += _NodeList[i]->FileName->c_str(); line += _T("\r\n");
+		FormatDetailLine(line, *_NodeList[i]->FileHash, _NodeList[i]->WriteTime, _NodeList[i]->Bytes,
+		                 _NodeList[i]->Duplicate, *_NodeList[i]->FileName);
+		LastAPICallLine = __LINE__ + 1;
+		if (!WriteFile(hFile, line.c_str(), (DWORD)line.length() * sizeof(TCHAR), NULL, NULL))
+		{
+			StringCchPrintf(szErrorMessage, MAX_ERROR_MESSAGE_LEN,
+				_T("API Error occurred in WriteFile() at line %ld error code %ld"), LastAPICallLine, GetLastError());
+			MessageBeep(MB_ICONSTOP);
+			MessageBox(hWnd, szErrorMessage, _T("HashedFiles.cpp"), MB_OK + MB_ICONSTOP);
+			CloseHandle(hFile);
+			return false;
+		}
+	}
+
+	// Write the sort permutation lines, "#mode|index|index|...", one for
+	// each sort mode that has been built, so a loaded class sorts instantly.
+	for (int Mode = 0; Mode < SORT_MODES; ++Mode)
+	{
+		if (_SortIndex[Mode] == NULL) continue;
+		TCHAR sz[24];
+		line = _T("#");
+		_itow_s(Mode, sz, 24, 10); line += sz;
+		for (int i = 0; i < _NodeCount; ++i)
+		{
+			_itow_s(_SortIndex[Mode][i], sz, 24, 10); line += _T("|"); line += sz;
+		}
+		line += _T("\r\n");
 		LastAPICallLine = __LINE__ + 1;
 		if (!WriteFile(hFile, line.c_str(), (DWORD)line.length() * sizeof(TCHAR), NULL, NULL))
 		{
@@ -398,6 +1107,35 @@ BOOL HashedFiles::Save(HWND hWnd, const int& iStartNode, const int& iSelectedFil
 
 	return true;
 }
+//=============================================================================
+// FormatHeaderLine - Formats the header line of a saved class,
+// "start|selected|sort mode|directory".
+// FormatDetailLine - Formats the line of one file. The write time is saved
+// as a UTC FILETIME, flagged by "UTC" in the field that older files use for
+// the local time.
+//=============================================================================
+void HashedFiles::FormatHeaderLine(wstring& Line, int iStartNode, int iSelectedFile, int iSortMode, const TCHAR* pszDirectoryName)
+{
+	TCHAR sz[24];
+	Line = _T("");
+	_itow_s(iStartNode,    sz, 24, 10); Line += sz; Line += _T("|");
+	_itow_s(iSelectedFile, sz, 24, 10); Line += sz; Line += _T("|");
+	_itow_s(iSortMode,     sz, 24, 10); Line += sz; Line += _T("|");
+	Line += pszDirectoryName;
+	Line += _T("\r\n");
+}
+
+void HashedFiles::FormatDetailLine(wstring& Line, const wstring& FileHash, uint64_t WriteTime, uint64_t Bytes,
+                                   BOOL Duplicate, const wstring& FileName)
+{
+	TCHAR sz[24];
+	Line = FileHash; Line += _T("|");
+	_ui64tow_s(WriteTime, sz, 24, 10); Line += sz; Line += _T("|UTC|");
+	_ui64tow_s(Bytes,     sz, 24, 10); Line += sz; Line += _T("|");
+	Line += Duplicate ? _T("X|") : _T("O|");
+	Line += FileName; Line += _T("\r\n");
+}
+
 //=============================================================================
 // Load - Loads the class, the selected directory, along
 // with three parameters, from a user specified file.
@@ -496,6 +1234,7 @@ BOOL HashedFiles::Load(HWND hWnd, int& iStartNode, int& iSelectedFile, int& iSor
 	// Read and process the detail lines
 	wstring Hash, Date, Time, Size, Dup, Name;
 	BOOL bReadAhead = false;
+	DWORD dwBytesRead = 0;
 
 	for (;;)
 	{
@@ -549,13 +1288,30 @@ BOOL HashedFiles::Load(HWND hWnd, int& iStartNode, int& iSelectedFile, int& iSor
 			} while (chr != L'|' && chr != L'\n');
 		}
 		
+		// Convert the write time. Older files hold the local time as "mm/dd/yyyy" and "hh:mm".
+		uint64_t WriteTime = 0;
+		if (Time.compare(_T("UTC")) == 0) WriteTime = _wcstoui64(Date.c_str(), NULL, 10);
+		else if (Date.length() == 10 && Time.length() == 5)
+		{
+			SYSTEMTIME LocalSystemTime;
+			FILETIME LocalFileTime, FileTime;
+			ZeroMemory(&LocalSystemTime, sizeof(LocalSystemTime));
+			LocalSystemTime.wMonth  = (WORD)_wtoi(Date.substr(0, 2).c_str());
+			LocalSystemTime.wDay    = (WORD)_wtoi(Date.substr(3, 2).c_str());
+			LocalSystemTime.wYear   = (WORD)_wtoi(Date.substr(6, 4).c_str());
+			LocalSystemTime.wHour   = (WORD)_wtoi(Time.substr(0, 2).c_str());
+			LocalSystemTime.wMinute = (WORD)_wtoi(Time.substr(3, 2).c_str());
+			if (SystemTimeToFileTime(&LocalSystemTime, &LocalFileTime) &&
+			    LocalFileTimeToFileTime(&LocalFileTime, &FileTime))
+				WriteTime = (uint64_t)FileTime.dwHighDateTime << 32 | FileTime.dwLowDateTime;
+		}
+
 		// Insert the node.
-		AddNode(Hash, Date, Time, Size, Name);
+		AddNode(Hash, WriteTime, _wcstoui64(Size.c_str(), NULL, 10), Name);
 		BOOL bDup = Dup.compare(_T("X")) == 0 ? true : false;
-		SetDuplicate(_NodeCount - 1, bDup);
+		SetNodeDuplicate(_NodeList[_NodeCount - 1], bDup);
 
 		// Read the next character or EOF
-		DWORD dwBytesRead;
 		LastAPICallLine = __LINE__ + 1;
 		if (!ReadFile(hFile, &chr, sizeof(TCHAR), &dwBytesRead, NULL))
 		{
@@ -565,12 +1321,86 @@ BOOL HashedFiles::Load(HWND hWnd, int& iStartNode, int& iSelectedFile, int& iSor
 			MessageBox(hWnd, szErrorMessage, _T("HashedFiles.cpp"), MB_OK + MB_ICONSTOP);
 			return false;
 		}
-		// Handle End-Of-File
-		if (dwBytesRead == 0) break;
+		// Handle End-Of-File and the start of the sort permutation lines.
+		if (dwBytesRead == 0 || chr == L'#') break;
 
 		bReadAhead = true; // Flag character already read and loop.
 	}
 
+	// Read and process the sort permutation lines, "#mode|index|index|...".
+	// Each index must name a node once; a damaged line is dropped.
+	BOOL  bPermutations = dwBytesRead != 0 && chr == L'#';
+	BOOL* Seen = new BOOL[max(_NodeCount, 1)];
+	while (dwBytesRead != 0 && chr == L'#')
+	{
+		int  Mode = -1, Count = 0;
+		BOOL bValid = true;
+		int* SortIndex = new int[max(_NodeCount, 1)];
+		for (int i = 0; i < _NodeCount; ++i) Seen[i] = false;
+		token = _T("");
+		for (;;)
+		{
+			LastAPICallLine = __LINE__ + 1;
+			if (!ReadFile(hFile, &chr, sizeof(TCHAR), &dwBytesRead, NULL))
+			{
+				StringCchPrintf(szErrorMessage, MAX_ERROR_MESSAGE_LEN,
+					_T("API Error occurred in ReadFile() at line %ld error code %ld"), LastAPICallLine, GetLastError());
+				MessageBeep(MB_ICONSTOP);
+				MessageBox(hWnd, szErrorMessage, _T("HashedFiles.cpp"), MB_OK + MB_ICONSTOP);
+				delete[] SortIndex;
+				delete[] Seen;
+				return false;
+			}
+			if (dwBytesRead != 0 && chr == L'\r') continue;
+			if (dwBytesRead != 0 && chr != L'|' && chr != L'\n') { token += chr; continue; }
+
+			// End of a token.
+			int Value = _wtoi(token.c_str());
+			token = _T("");
+			if (Mode < 0) Mode = Value;
+			else if (Count < _NodeCount && Value >= 0 && Value < _NodeCount && !Seen[Value])
+			{
+				Seen[Value] = true;
+				SortIndex[Count++] = Value;
+			}
+			else bValid = false;
+			if (dwBytesRead == 0 || chr == L'\n') break;
+		}
+
+		// Keep the permutation only if it is complete.
+		if (bValid && Count == _NodeCount && Mode >= 0 && Mode < SORT_MODES && _SortIndex[Mode] == NULL)
+			_SortIndex[Mode] = SortIndex;
+		else delete[] SortIndex;
+
+		// Read the next character or EOF
+		if (dwBytesRead == 0) break;
+		LastAPICallLine = __LINE__ + 1;
+		if (!ReadFile(hFile, &chr, sizeof(TCHAR), &dwBytesRead, NULL))
+		{
+			StringCchPrintf(szErrorMessage, MAX_ERROR_MESSAGE_LEN,
+				_T("API Error occurred in ReadFile() at line %ld error code %ld"), LastAPICallLine, GetLastError());
+			MessageBeep(MB_ICONSTOP);
+			MessageBox(hWnd, szErrorMessage, _T("HashedFiles.cpp"), MB_OK + MB_ICONSTOP);
+			delete[] Seen;
+			return false;
+		}
+	}
+	delete[] Seen;
+
+	// A file saved without permutations holds the nodes in the saved sort
+	// order. With permutations, a saved order that was dropped is rebuilt.
+	if (iSortMode < 0 || iSortMode >= SORT_MODES) iSortMode = 0;
+	if (_SortIndex[iSortMode] == NULL && !bPermutations)
+	{
+		_SortIndex[iSortMode] = new int[max(_NodeCount, 1)];
+		for (int i = 0; i < _NodeCount; ++i) _SortIndex[iSortMode][i] = i;
+	}
+	_SortMode = iSortMode;
+	_DupsMarked = true; // The saved X/O flags are kept as they are.
+	BuildGroups();
+	if (_SortIndex[iSortMode] == NULL) BuildSortIndex(iSortMode);
+	BuildLayout();
+
 	// Close the file.
 	LastAPICallLine = __LINE__ + 1;
 	if (!CloseHandle(hFile))
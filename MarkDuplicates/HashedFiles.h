@@ -3,9 +3,29 @@
 ///////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "framework.h"
+#include "RowLayout.h"
+#include "ThreadPool.h"
+#include <atomic>
 
 #define NODE_ALLOCATION_INCREMENT 100
 #define MAX_ERROR_MESSAGE_LEN 100
+#define SORT_MODES 5
+#define SORT_BY_WASTE 4
+#define FORMAT_CACHE_SIZE 256 // Rows whose date, time, and size text is kept. A power of two.
+#define FORMATTED_FILE_DATE_LEN 11
+#define FORMATTED_FILE_TIME_LEN 6
+#define FORMATTED_FILE_SIZE_LEN 21
+#define CLAIM_BATCH_BYTES (8 * 1024 * 1024) // Most bytes a worker claims at a time.
+#define CLAIM_FILE_BYTES (64 * 1024)        // Cost of opening a file, counted as bytes when sizing claims.
+#define CACHE_LINE_SIZE 64
+#define PARALLEL_GRAIN 16384                // Nodes per task when the pool marks or sorts.
+#define MAX_DEVICES 32                      // Devices queued apart; further devices share the last queue.
+#define HASH_BY_SCAN 0                      // Orders in which each device's files are hashed.
+#define HASH_BY_LARGEST 1
+#define HASH_BY_SMALLEST 2
+#define HASH_BY_NAME 3
+#define HASH_BY_LOCATION 4
+#define HASH_LANE_BYTES (1024 * 1024)       // Files below this go to the small file lane, when lanes are on.
 
 class HashedFiles
 {
@@ -13,42 +33,153 @@ private:
 	typedef struct tagFileNode
 	{
 		BOOL     Duplicate;
+		BOOL     Member;    // A member of an archive, listed from its headers.
+		uint64_t WriteTime; // Last write time, a UTC FILETIME.
+		uint64_t Bytes;     // File size.
+		int      Group;     // Duplicate group, or -1 if the file has no duplicate.
+		int      NextGroup; // First group after this file in hash order.
+		int      Device;    // Storage device, for queueing the hashing.
+		uint64_t Location;  // Where the file starts on its device, 0 if unknown; for a member of an archive, where it starts in the archive.
 		wstring* FileHash;
-		wstring* FileDate;
-		wstring* FileTime;
-		wstring* FileSize;
 		wstring* FileName;
 	} *FileNode;
+	typedef struct tagRowFormat // Display text of a row, formatted when the row is first painted.
+	{
+		int      Node;
+		TCHAR    FileDate[FORMATTED_FILE_DATE_LEN];
+		TCHAR    FileTime[FORMATTED_FILE_TIME_LEN];
+		TCHAR    FileSize[FORMATTED_FILE_SIZE_LEN];
+	} *RowFormat;
+	typedef struct tagFileGroup
+	{
+		int      Members;            // Files with this hash.
+		int      Marked;             // Members currently marked as duplicates.
+		uint64_t Bytes;              // Size of each member.
+		int      Rank;               // Position in the wasted bytes order.
+		int      First[SORT_MODES];  // View position of the first member, per sort mode.
+	} *FileGroup;
+	typedef struct tagDevice // The claims of the files on one storage device.
+	{
+		wstring               Name;
+		int                   First;     // First claim in _ClaimList.
+		int                   Split;     // First claim of the large file lane.
+		int                   Last;      // Claim after the last.
+		std::atomic<int>      NextClaim[2]; // Per lane, small then large.
+		std::atomic<int>      Active;    // Readers working on a claim of the device.
+		int                   Limit;     // Most readers at a time, 0 for no limit.
+		std::atomic<uint64_t> BytesRead;
+	} *Device;
+	typedef struct tagProgress // Written only by its own worker thread.
+	{
+		std::atomic<int>      Nodes;
+		std::atomic<uint64_t> Bytes;
+		char                  Pad[CACHE_LINE_SIZE]; // Keeps the counters of two threads off one cache line.
+	} *Progress;
 	FileNode*    _NodeList;
 	int          _NodeCount;
 	int          _Allocated;
 	int          _Increment;
-	volatile int _NextNode;
-	volatile int _NodesProcessed;
-	volatile uint64_t _BytesProcessed;
+	int*         _ClaimOrder;            // Node indexes, grouped by device.
+	int*         _ClaimList;             // First position in _ClaimOrder of each claim, then _NodeCount.
+	int          _ClaimCount;
+	tagDevice    _DeviceList[MAX_DEVICES];
+	int          _DeviceCount;
+	int          _HashOrder;             // HASH_BY_ order of each device's files.
+	BOOL         _HashLanes;             // Claim small and large files apart.
+	Progress     _Progress;              // Per worker thread.
+	int          _Threads;
+	ThreadPool*  _Pool;                  // Used for sorting and marking, if set.
+	int*         _SortIndex[SORT_MODES]; // Per sort mode permutation of _NodeList, built on first use.
+	int          _SortMode;              // The permutation the view reads through.
+	BOOL         _DupsMarked;            // Duplicate flags have been set by a scan or a load.
+	std::atomic<bool> _HashSaved;        // A hash has been saved since the permutations were built.
+	FileGroup    _GroupList;             // Duplicate groups in hash order, built with the hash order.
+	int          _GroupCount;
+	int*         _GroupOrder;            // Group ids by wasted bytes, largest first.
+	int          _DupCount;              // Files marked as duplicates, kept current by SetDuplicate.
+	uint64_t     _DupBytes;              // Bytes of the files marked as duplicates.
+	RowFormat    _FormatCache;           // Direct mapped by node index.
+	BOOL         _LocalTime;             // Display times in the local time zone, else in UTC.
+	RowLayout    _Layout;                // Line heights of the rows, in the view order.
+	FileNode     ViewNode(int Node) const { return _NodeList[_SortIndex[_SortMode] ? _SortIndex[_SortMode][Node] : Node]; }
+	void         SetNodeDuplicate(FileNode pNode, BOOL Duplicate);
+	void         BuildSortIndex(int SortMode);
+	int          NodeCompare(int SortMode, int Node1, int Node2) const;
+	void         ResetSortIndex();
+	void         BuildGroups();
+	void         LocateGroups(int SortMode);
+	void         ResetGroups();
+	RowFormat    FormatNode(int Node) const;
+	void         ResetFormatCache();
+	void         BuildLayout();
+	void         ResetHashing();
+	int          RowHeight(BOOL Duplicate) const { return Duplicate ? 1 : GetRowSpacing(); }
+	void         SortClaims(int First, int Last) const;
 	int          HashCompare(const wstring& string1, const wstring& string2) const;
-	int          FileCompare(const wstring& string1, const wstring& string2) const;
-	int          DateCompare(const wstring& string1, const wstring& string2) const;
-	int          TimeCompare(const wstring& string1, const wstring& string2) const;
-	int          SizeCompare(const wstring& string1, const wstring& string2) const;
 public:
+	typedef struct tagFileRow // Read-only view of a node, valid until the next AddNode or Reset.
+	{
+		BOOL           Duplicate;
+		int            Node;      // Index in _NodeList.
+		uint64_t       WriteTime; // UTC FILETIME.
+		uint64_t       FileSize;
+		const wstring* FileHash;
+		const wstring* FileName;
+	} FileRow;
 	HashedFiles(int Increment = NODE_ALLOCATION_INCREMENT);
 	~HashedFiles() { Reset(0); }
-	void AddNode(const wstring& FileHash, const wstring& FileDate, const wstring& FileTime,
-	             const wstring& FileSize, const wstring& FileName);
+	void AddNode(const wstring& FileHash, uint64_t WriteTime, uint64_t FileSize, const wstring& FileName,
+	             int Device = 0, uint64_t Location = 0, BOOL Member = false);
+	int  AddDevice(const wstring& Name);
+	void SetDeviceLimit(int Device, int Limit);
+	int  GetDeviceLimit(int Device) const { return _DeviceList[Device].Limit; }
+	int  GetDeviceCount() const { return _DeviceCount; }
+	BOOL GetDevice(int Device, wstring& Name, uint64_t& BytesRead) const;
+	void SetHashOrder(int Order) { _HashOrder = Order >= HASH_BY_SCAN && Order <= HASH_BY_LOCATION ? Order : HASH_BY_SCAN; }
+	int  GetHashOrder() const { return _HashOrder; }
+	void SetHashLanes(BOOL HashLanes) { _HashLanes = HashLanes; }
+	BOOL GetHashLanes() const { return _HashLanes; }
 	void SortAndCheck(int Mode);
 	int  GetNodeCount() const { return _NodeCount; }
 	BOOL GetNode(int Node, BOOL& Duplicate, wstring& FileHash, wstring& FileDate,
 	             wstring& FileTime, wstring& FileSize, wstring& FileName) const;
-	void SetDuplicate(int Node, BOOL Duplicate) { _NodeList[Node]->Duplicate = Duplicate; }
+	void SetDuplicate(int Node, BOOL Duplicate);
 	BOOL GetFile(int Node, wstring& FileName) const;
-	BOOL GetNextFile(int& Node, wstring& FileName);
-	BOOL SaveHash(int Node, TCHAR* pszFileHash);
-	int  GetNodesProcessed() const { return _NodesProcessed; }
-	uint64_t GetBytesProcessed() const { return _BytesProcessed; }
+	void StartHashing(int Threads);
+	BOOL ClaimFiles(int Reader, int& First, int& Last, int& Device);
+	void ReleaseClaim(int Device) { _DeviceList[Device].Active.fetch_sub(1); }
+	int  GetClaimedNode(int Position) const { return _ClaimOrder[Position]; }
+	const wstring& GetClaimedFile(int Node) const { return *_NodeList[Node]->FileName; }
+	uint64_t GetClaimedBytes(int Node) const { return _NodeList[Node]->Bytes; }
+	uint64_t GetClaimedLocation(int Node) const { return _NodeList[Node]->Location; }
+	void SetClaimedLocation(int Node, uint64_t Location) { _NodeList[Node]->Location = Location; }
+	BOOL IsClaimedMember(int Node) const { return _NodeList[Node]->Member; }
+	void AddDeviceBytes(int Device, uint64_t Bytes) { _DeviceList[Device].BytesRead.fetch_add(Bytes, std::memory_order_relaxed); }
+	BOOL SaveHash(int Thread, int Node, TCHAR* pszFileHash);
+	int  RemoveUnhashed();
+	int  GetNodesProcessed() const;
+	uint64_t GetBytesProcessed() const;
 	BOOL GetNode(int Node, BOOL& Duplicate) const;
+	BOOL GetRow(int Node, FileRow& Row) const;
+	void FormatRow(const FileRow& Row, wstring& Line) const;
+	void SetLocalTime(BOOL LocalTime);
+	BOOL GetLocalTime() const { return _LocalTime; }
+	int  GetDuplicateCount() const { return _DupCount; }
+	uint64_t GetReclaimableBytes() const { return _DupBytes; }
+	int  GetGroupCount() const { return _GroupCount; }
+	BOOL GetGroup(int Group, int& Members, uint64_t& Bytes, uint64_t& Reclaimable) const;
+	int  GetNodeGroup(int Node) const;
+	int  GetNextGroup(int Node) const;
+	int  GetPrevGroup(int Node) const;
+	int  GetRowSpacing() const { return _SortMode == 0 || _SortMode == SORT_BY_WASTE ? 2 : 1; }
+	const RowLayout& GetLayout() const { return _Layout; }
+	void SetThreadPool(ThreadPool* Pool) { _Pool = Pool; }
 	void Reset(int Increment = NODE_ALLOCATION_INCREMENT);
 	BOOL Save(HWND hWnd, const int& iStartNode, const int& iSelectedFile,
 	          const int& iSortMode, const TCHAR* pszDirectoryName) const;
 	BOOL Load(HWND hWnd, int& iStartNode, int& iSelectedFile, int& iSortMode, TCHAR* pszDirectoryName);
+	static int  FileCompare(const wstring& string1, const wstring& string2);
+	static void FormatHeaderLine(wstring& Line, int iStartNode, int iSelectedFile, int iSortMode, const TCHAR* pszDirectoryName);
+	static void FormatDetailLine(wstring& Line, const wstring& FileHash, uint64_t WriteTime, uint64_t Bytes,
+	                             BOOL Duplicate, const wstring& FileName);
 };
\ No newline at end of file
@@ -14,14 +14,18 @@
 // While looking at the list of files, the user can examine a file by
 // pressing Enter, Space or double clicking, using a Shell Open process.
 //
+// Identical files form duplicate groups, which <Sort><By Wasted Bytes>
+// ranks by the space they would free, and N and P step through.
+//
 // In addition to this marking, the user can initiate a test sequence
 // which tests the SHA-1 implementation with the four tests described
 // in RFC-3174, along with a fifth test of my own, a large PDF file.
 //
-// The user can change the font and color of the display, and that
-// will be saved to the registry. Initially, the columns of the display
-// do not line up, but changing to a fixed pitch font, such as Courier
-// will fix that. I like Courier Bold 12 Green best.
+// The user can change the font and color of the display, and whether
+// write times are shown in local time or UTC, and that will be saved
+// to the registry. Initially, the columns of the display do not line
+// up, but changing to a fixed pitch font, such as Courier will fix
+// that. I like Courier Bold 12 Green best.
 //
 // Saves and restores the window placement in the registry at
 // HKCU/Software/Alex Sokolek/Mark Duplicates/1.0.0.7/WindowPlacement.
@@ -33,12 +37,42 @@
 // Demonstrates using a class to wrap a set of C functions implementing
 // the SHA-1 Secure Message Digest algorithm described in RFC-3174.
 //
-// Uses a thread pool of 12 threads to process the hashes.The machine
-// used for development and testing has 12 logical processors, hence
-// the choice of 12 threads.This will still work on a machine that
-// has fewer processors - It will just be slower - To take advantage
-// of a machine with more processors, see line 103, "int Threads = 12",
-// or adjust the threads with <Edit><Threads>.
+// A pool of worker threads, created once, hashes and sorts, fed by
+// reader threads per storage device whose number adapts as a scan runs.
+//
+// <Edit><Hash Order> picks the order in which the files of each disk
+// are hashed, and can hash the small files apart from the large ones.
+//
+// Pressing ESC stops a scan, keeping the files hashed by then, or a mark.
+//
+// <Edit><Threads> can also keep a scan to a set of CPUs, set the reads
+// each reader keeps in flight, and cap the read and open rates.
+//
+// <File><Calibrate> measures how a volume is best read, and keeps the
+// result as a profile of the volume. Settings can live in a .cfg file.
+//
+// <Edit><Read Options> sets how much else a scan disturbs, such as the
+// access times of the files and the file cache.
+//
+// The holes of sparse files are hashed as zeros without being read.
+//
+// A scan opens the files relative to the directory scanned, and leaves
+// the current directory of the program alone.
+//
+// A directory too large for memory can be scanned within a memory
+// limit, to an index file that Load reads.
+//
+// The members of .tar archives are scanned as files of their own.
+//
+// With /paths, the files of a list are hashed without the window, and
+// their duplicate groups are written out for a shell pipeline:
+//
+//     MarkDuplicates /paths <list|-> [/null] [/jsonl] [/output <file|->] [/inflight <files>]
+//
+// Files in flight, or /inflight, hashes with coroutines over an I/O
+// completion port or io_uring instead of the reader pipeline.
+//
+// README.md describes each of these in full.
 //
 // It is suggested that a backup copy of the directory in question be
 // made, in case something goes wrong.
@@ -79,9 +113,18 @@
 #include "ApplicationRegistry.h"
 #include "sha1file.h"
 #include "HashedFiles.h"
-#include "OpenFiles.h"
+#include "ThreadPool.h"
+#include "HashPipeline.h"
+#include "AsyncScan.h"
+#include "StorageDevice.h"
+#include "StorageCalibration.h"
+#include "BoundedScan.h"
+#include "TarArchive.h"
+#include "PathListScan.h"
 
 #define MAX_LOADSTRING 100
+#define MARK_TASK_FILES 64                      // Duplicates renamed by one task of the mark
+#define LOCATION_TASK_FILES 256                 // Files located on disk by one task of a disk order scan
 
 // Global Variables:
 HINSTANCE hInst;                                // current instance
@@ -93,25 +136,49 @@ BOOL bChooseFont = false;                       // The result of calling ChooseF
 HFONT hFont = 0, hOldFont = 0;                  // Old and new fonts for the paint procedure
 HashedFiles* pCHashedFiles;                     // Hashed Files class
 TCHAR szDirectoryName[MAX_PATH];                // Directory for hashed files
-TCHAR szOldDirectoryName[MAX_PATH];             // Original current directory
 BOOL bMarked = false;                           // Flag indicating that the files have already been marked
 int iSortMode = 0;                              // Sort mode: Hash, Name, Date, Size
-OpenFiles* pCOpenFiles;                         // The OpenFiles class, for double click open
-wstring* pDblClickFile;                         // Needed by the OpenFiles class
+wstring* pDblClickFile;                         // The file to open, copy, or launch
+wstring* pPaintLine;                            // Line buffer reused by every paint, so painting does not allocate
 int iSelectedFile;                              // The file in the window that is selected
 int iNode;                                      // The node that is selected by single click
+int iLineHeight = 0;                            // Height of a line in the last paint
+int iPageLines = 0;                             // Lines between the header and the status bar in the last paint
+int iLastNode = -1;                             // The last node drawn by the last paint
 HWND hWndProgressBox;                           // The handle of the modeless progress dialog box
 uint64_t BytesProcessed;                        // Total bytes processed
-int Threads = 12;                               // The initial size of the thread pool
+int Threads = 0;                                // The size of the thread pool, by default one per processor
+ThreadPool* pThreadPool;                        // Worker threads shared by hashing, sorting, and marking
+uint64_t CpuSet = 0;                            // Processors the scan may run on, 0 for all
+BOOL bPinThreads = false;                       // Pin each worker thread to one processor of CpuSet
+int Readers = 0;                                // Threads reading the files for the hashing threads, 0 to adapt
+int QueueDepth = READ_QUEUE_DEPTH;              // Reads each reader keeps in flight, 1 for one at a time
+int FilesInFlight = 0;                          // Files the coroutine engine keeps in flight, 0 for the pipeline
+BOOL bLocalTime = true;                         // Show write times in the local time zone, else in UTC
+int iHashOrder = HASH_BY_SCAN;                  // Order in which the files of each disk are hashed
+BOOL bHashLanes = false;                        // Hash small files apart from large ones
+int iReadOptions = 0;                           // READ_NOATIME, READ_DROPBEHIND and READ_UNBUFFERED, from the menu
+double MaxMBytesPerSecond = 0;                  // Cap on the read rate of a scan, 0 for none
+double MaxOpensPerSecond = 0;                   // Cap on the files a scan opens per second, 0 for none
+BOOL bLowPriority = false;                      // Scan with the lowest I/O priority
+int MaxMemoryMB = 0;                            // Memory limit of a scan, which then writes an index file, 0 for none
 
 // Forward declarations of functions included in this code module:
 ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
-DWORD WINAPI        FileHashWorkerThread(LPVOID lpParam);
 INT_PTR CALLBACK    About(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    Parameters(HWND, UINT, WPARAM, LPARAM);
 TCHAR*              iTos(int);
+wstring             FullPath(const wstring&);
+HashEngine*         CreateHashEngine(HashedFiles*, ThreadPool*, int, int, int, int);
+void                LoadScanSettings(ApplicationRegistry*);
+void                SaveScanSettings(ApplicationRegistry*);
+BOOL                ScanBounded(HWND, DirectoryEnumerator*, const TuningProfile*);
+int                 RunPathList();
+int                 SortSpacing();
+int                 NodeFromY(int Y, int iStartNode);
+int                 PageNode(int iStartNode, int iPages);
 INT_PTR CALLBACK    MDBoxProc(HWND, UINT, WPARAM, LPARAM);
 
 int APIENTRY wWinMain(_In_     HINSTANCE hInstance,
@@ -134,6 +201,10 @@ int APIENTRY wWinMain(_In_     HINSTANCE hInstance,
 	LoadString(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
 	LoadString(hInstance, IDC_MARKDUPLICATES, szWindowClass, MAX_LOADSTRING);
 
+	// A scan of a path list runs without the window, so it may run beside the instance that has one.
+	int iExitCode = RunPathList();
+	if (iExitCode >= 0) return iExitCode;
+
 	// Allow only one instance of this application to run at the same time.
 	// If not, find and activate the other window and then exit.
 	HANDLE hMutex = CreateMutex(NULL, false, _T("{5A769DB2-14AC-4DA5-AEC7-881CA944045A}"));
@@ -170,9 +241,10 @@ int APIENTRY wWinMain(_In_     HINSTANCE hInstance,
 
 	CloseHandle(hMutex);
 
+	delete pThreadPool;
 	delete pCHashedFiles;
-	delete pCOpenFiles;
 	delete pDblClickFile;
+	delete pPaintLine;
 
 	// Check for memory leaks. (Debug only.)
 	#ifdef _DEBUG
@@ -236,8 +308,11 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 	hInst = hInstance; // Store instance handle in our global variable
 
 	pCHashedFiles = new HashedFiles;
-	pCOpenFiles   = new OpenFiles;
+	pThreadPool   = new ThreadPool(Threads, CpuSet, bPinThreads != 0);
+	Threads       = pThreadPool->GetThreadCount();
+	pCHashedFiles->SetThreadPool(pThreadPool);
 	pDblClickFile = new wstring;
+	pPaintLine    = new wstring;
 	iSelectedFile = 0;
 
 	HWND hWnd = CreateWindowW(szWindowClass, szTitle, WS_OVERLAPPEDWINDOW | WS_VSCROLL,
@@ -280,6 +355,32 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 			bChooseFont = true;
 		}
 	}
+	// Load/restore the time zone used to show write times from the registry
+	pAppReg->LoadMemoryBlock(_T("LocalTime"), (LPBYTE)&bLocalTime, sizeof(bLocalTime));
+	pCHashedFiles->SetLocalTime(bLocalTime);
+	CheckMenuItem(GetMenu(hWnd), ID_EDIT_LOCALTIME, MF_BYCOMMAND | (bLocalTime ? MF_CHECKED : MF_UNCHECKED));
+	// Load/restore the hashing order from the registry
+	pAppReg->LoadMemoryBlock(_T("HashOrder"), (LPBYTE)&iHashOrder, sizeof(iHashOrder));
+	pAppReg->LoadMemoryBlock(_T("HashLanes"), (LPBYTE)&bHashLanes, sizeof(bHashLanes));
+	pCHashedFiles->SetHashOrder(iHashOrder);
+	pCHashedFiles->SetHashLanes(bHashLanes);
+	iHashOrder = pCHashedFiles->GetHashOrder();
+	CheckMenuRadioItem(GetMenu(hWnd), ID_HASHORDER_SCAN, ID_HASHORDER_DISK, ID_HASHORDER_SCAN + iHashOrder, MF_BYCOMMAND);
+	CheckMenuItem(GetMenu(hWnd), ID_HASHORDER_LANES, MF_BYCOMMAND | (bHashLanes ? MF_CHECKED : MF_UNCHECKED));
+	pAppReg->LoadMemoryBlock(_T("ReadOptions"), (LPBYTE)&iReadOptions, sizeof(iReadOptions));
+	iReadOptions &= READ_NOATIME | READ_DROPBEHIND | READ_UNBUFFERED;
+	CheckMenuItem(GetMenu(hWnd), ID_READOPTIONS_NOATIME, MF_BYCOMMAND | (iReadOptions & READ_NOATIME ? MF_CHECKED : MF_UNCHECKED));
+	CheckMenuItem(GetMenu(hWnd), ID_READOPTIONS_DROPBEHIND, MF_BYCOMMAND | (iReadOptions & READ_DROPBEHIND ? MF_CHECKED : MF_UNCHECKED));
+	CheckMenuItem(GetMenu(hWnd), ID_READOPTIONS_UNBUFFERED, MF_BYCOMMAND | (iReadOptions & READ_UNBUFFERED ? MF_CHECKED : MF_UNCHECKED));
+	// Load/restore the settings of <Edit><Threads> from the registry, and rebuild the pool to them
+	LoadScanSettings(pAppReg);
+	if (Threads != pThreadPool->GetThreadCount() || CpuSet != 0 || bPinThreads)
+	{
+		delete pThreadPool;
+		pThreadPool = new ThreadPool(Threads, CpuSet, bPinThreads != 0);
+		pCHashedFiles->SetThreadPool(pThreadPool);
+		Threads = pThreadPool->GetThreadCount();
+	}
 	delete pAppReg;
 
 	return TRUE;
@@ -355,6 +456,44 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			}
 			break;
 
+		case ID_EDIT_LOCALTIME: // Toggles showing write times in the local time zone or in UTC.
+			bLocalTime = !bLocalTime;
+			pCHashedFiles->SetLocalTime(bLocalTime);
+			CheckMenuItem(GetMenu(hWnd), ID_EDIT_LOCALTIME, MF_BYCOMMAND | (bLocalTime ? MF_CHECKED : MF_UNCHECKED));
+			pAppReg->SaveMemoryBlock(_T("LocalTime"), (LPBYTE)&bLocalTime, sizeof(bLocalTime));
+			InvalidateRect(hWnd, NULL, true);
+			break;
+
+		case ID_HASHORDER_SCAN:     // Selects the order in which the files of each disk are hashed. Disk order
+		case ID_HASHORDER_LARGEST:  // reads one file at a time per disk, for spinning disks.
+		case ID_HASHORDER_SMALLEST:
+		case ID_HASHORDER_NAME:
+		case ID_HASHORDER_DISK:
+			iHashOrder = wmId - ID_HASHORDER_SCAN;
+			pCHashedFiles->SetHashOrder(iHashOrder);
+			CheckMenuRadioItem(GetMenu(hWnd), ID_HASHORDER_SCAN, ID_HASHORDER_DISK, wmId, MF_BYCOMMAND);
+			pAppReg->SaveMemoryBlock(_T("HashOrder"), (LPBYTE)&iHashOrder, sizeof(iHashOrder));
+			break;
+
+		case ID_HASHORDER_LANES: // Toggles hashing small files apart from large ones.
+			bHashLanes = !bHashLanes;
+			pCHashedFiles->SetHashLanes(bHashLanes);
+			CheckMenuItem(GetMenu(hWnd), ID_HASHORDER_LANES, MF_BYCOMMAND | (bHashLanes ? MF_CHECKED : MF_UNCHECKED));
+			pAppReg->SaveMemoryBlock(_T("HashLanes"), (LPBYTE)&bHashLanes, sizeof(bHashLanes));
+			break;
+
+		case ID_READOPTIONS_NOATIME:    // Toggles how the files are read: leaving their access times alone,
+		case ID_READOPTIONS_DROPBEHIND: // dropping what has been read from the file cache, or bypassing
+		case ID_READOPTIONS_UNBUFFERED: // the file cache altogether.
+			{
+				int Option = wmId == ID_READOPTIONS_NOATIME ? READ_NOATIME :
+				             wmId == ID_READOPTIONS_DROPBEHIND ? READ_DROPBEHIND : READ_UNBUFFERED;
+				iReadOptions ^= Option;
+				CheckMenuItem(GetMenu(hWnd), wmId, MF_BYCOMMAND | (iReadOptions & Option ? MF_CHECKED : MF_UNCHECKED));
+				pAppReg->SaveMemoryBlock(_T("ReadOptions"), (LPBYTE)&iReadOptions, sizeof(iReadOptions));
+			}
+			break;
+
 		case ID_FILE_TEST:
 			{
 				/////////////////////////////////////////////////////////////////////////////////////////////////
@@ -402,8 +541,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				ofn.lpstrFile = pszOpenFileName;
 				ofn.nMaxFile = MAX_PATH;
 
-				// Save original current directory.
-				GetCurrentDirectory(MAX_PATH, szOldDirectoryName);
+				ofn.Flags = OFN_NOCHANGEDIR; // The current directory of the process is left alone.
 
 				int LastAPICallLine = __LINE__ + 1;
 				if (!GetOpenFileName(&ofn)) // Retrieves the fully qualified file name that was selected.
@@ -427,128 +565,124 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				QueryPerformanceCounter(&liStart); // 100 nanosecond ticks.
 				double dStart = (double)liStart.QuadPart / liFrequency.QuadPart; // Convert to seconds
 
-				WIN32_FIND_DATA Win32FindData;
-
-				FILETIME LocalFileTime;
-				SYSTEMTIME LocalSystemTime;
-
-				#define FORMATTED_FILE_DATE_LEN 11
-				TCHAR* pszFileDate = new TCHAR[FORMATTED_FILE_DATE_LEN];
-
-				#define FORMATTED_FILE_TIME_LEN 6
-				TCHAR* pszFileTime = new TCHAR[FORMATTED_FILE_TIME_LEN];
-
-				#define FORMATTED_FILE_SIZE_LEN 21
-				TCHAR* pszFileSize = new TCHAR[FORMATTED_FILE_SIZE_LEN];
-
 				pCHashedFiles->Reset();
 
-				// Save directory name in global array for use by other routines
+				// Save directory name in global array for use by other routines. The current
+				// directory is left alone; the files are named relative to the directory.
 				StringCchCopy(szDirectoryName, MAX_PATH, ofn.lpstrFile);
-				SetCurrentDirectory(ofn.lpstrFile);
+				int iDevice = pCHashedFiles->AddDevice(StorageDevice::GetName(szDirectoryName));
+
+				// Start from the tuning profile of the volume, if it has been calibrated.
+				TuningProfile Profile;
+				BOOL bProfile = pAppReg->LoadMemoryBlock(StorageCalibration::GetProfileName(
+					StorageDevice::GetVolumeId(szDirectoryName)), (LPBYTE)&Profile, sizeof(Profile));
+
+				// List the directory. The enumerator holds it open for the readers, which open
+				// the files relative to it.
+				DirectoryEnumerator* pEnumerator = new DirectoryEnumerator;
+				if (!pEnumerator->Open(szDirectoryName))
+				{
+					delete pEnumerator;
+					delete[] pszOpenFileName;
+					break;
+				}
 
-				// Count the files in the directory.
-				int iTotalFiles = 0;
-				HANDLE hFind = FindFirstFile(_T(".\\*.*"), &Win32FindData);
-				if (hFind == INVALID_HANDLE_VALUE) break;
-				do iTotalFiles += Win32FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? 0 : 1;
-				while (FindNextFile(hFind, &Win32FindData) != 0);
-				FindClose(hFind);
+				// With a memory limit, the scan is bounded and writes an index file instead of filling
+				// the view. <File><Load> opens the index.
+				if (MaxMemoryMB > 0)
+				{
+					BOOL bDone = ScanBounded(hWnd, pEnumerator, bProfile ? &Profile : NULL);
+					delete pEnumerator;
+					delete[] pszOpenFileName;
+					bMarked = false;
+					iStartNode = 0;
+					iSelectedFile = 0;
+					InvalidateRect(hWnd, NULL, true);
+					uiTimer = SetTimer(hWnd, 1, bDone ? 3000 : 30, NULL);
+					break;
+				}
 
 				// Setup to use the modeless dialog box to display progress.
 				dc = GetDC(hWndProgressBox);
 				TCHAR szFilesProcessed[100];
-				TCHAR szSecondsElapsed[100];
+				TCHAR szSecondsElapsed[160];
+				TCHAR szDevices[100];
 				RECT WindowRect;
 				GetWindowRect(hWnd, &WindowRect);
 				ShowWindow(hWndProgressBox, SW_SHOW);
 				SetWindowPos(hWndProgressBox, HWND_NOTOPMOST, WindowRect.left+50, WindowRect.top+50, 0, 0, SWP_NOSIZE | SWP_SHOWWINDOW);
-				uint64_t FileSize;
-
-				// Get the first file in the directory
-				hFind = FindFirstFile(_T(".\\*.*"), &Win32FindData);
-				if (hFind == INVALID_HANDLE_VALUE)
-				{
-					ShowWindow(hWndProgressBox, SW_HIDE);
-					delete[] pszFileDate;
-					delete[] pszFileTime;
-					delete[] pszFileSize;
-					delete[] pszOpenFileName;
-					break;
-				}
 
 				BOOL bAbort = false;
 				BytesProcessed = 0;
 
-				do
+				// The enumerator skips the subdirectories. The write times are formatted when painted.
+				// The members of a tar archive are listed from their headers too, as files named
+				// "archive.tar!/path/in/archive" that start where their header does.
+				DirectoryEntry Entry;
+				FileReader* pListReader = FileReader::Create(READ_ENGINE_SYNC, 1, iReadOptions & READ_NOATIME);
+				TarArchive* pLister = new TarArchive(pListReader, TAR_LIST_BUFFER_LEN, true);
+				while (pEnumerator->Next(Entry))
 				{
-					// Ignore subdirectories.
-					if (Win32FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
-
-					// Get the last write time and format the local time equivalent of it.
-					FileTimeToLocalFileTime(&Win32FindData.ftLastWriteTime, &LocalFileTime);
-					FileTimeToSystemTime(&LocalFileTime, &LocalSystemTime);
-					StringCchPrintf(pszFileDate, FORMATTED_FILE_DATE_LEN, _T("%02d/%02d/%04d"),
-					                LocalSystemTime.wMonth, LocalSystemTime.wDay, LocalSystemTime.wYear);
-					StringCchPrintf(pszFileTime, FORMATTED_FILE_TIME_LEN, _T("%02d:%02d"),
-					                LocalSystemTime.wHour, LocalSystemTime.wMinute);
-
-					// Get the file size and format it.
-					FileSize = (uint64_t)Win32FindData.nFileSizeHigh * ((uint64_t)MAXDWORD + 1) +
-					           (uint64_t)Win32FindData.nFileSizeLow;
-					StringCchPrintf(pszFileSize, FORMATTED_FILE_SIZE_LEN, _T("%9llu"), FileSize);
-					BytesProcessed += FileSize;
+					BytesProcessed += Entry.Size;
 
 					// Add the file information to the HashedFiles class. Note that FileHash is null.
-					pCHashedFiles->AddNode(_T(""), pszFileDate, pszFileTime, pszFileSize, Win32FindData.cFileName);
-
-				} while (FindNextFile(hFind, &Win32FindData) != 0); // Process all files in the directory.
-				FindClose(hFind);
-
-				// Parameters for each thread.
-				HANDLE hcsMutex = CreateMutex(NULL, true, _T("{B0DBEB02-3839-43DD-8D4C-D217B7F4EB9D}"));
-				typedef struct ThreadProcParameters
-				{
-					HANDLE       hcsMutex;
-					BOOL*        pbAbort;
-					HashedFiles* pCHashedFiles;
-				} THREADPROCPARAMETERS, *PTHREADPROCPARAMETERS;
-				PTHREADPROCPARAMETERS* pThreadProcParameters = new PTHREADPROCPARAMETERS[Threads];
-				HANDLE* phThreadArray = new HANDLE[Threads];
-
-				// Initialize and instantiate the Worker Thread Pool
-				for (int Thread = 0; Thread < Threads; ++Thread)
-				{
-					// Allocate the parameter structure for this thread.
-					pThreadProcParameters[Thread] =
-						(PTHREADPROCPARAMETERS)HeapAlloc(GetProcessHeap(),
-							HEAP_ZERO_MEMORY, sizeof(THREADPROCPARAMETERS));
-					if (pThreadProcParameters[Thread] == NULL) ExitProcess(2);
-
-					// Initialize the parameters for this thread.
-					pThreadProcParameters[Thread]->hcsMutex = hcsMutex;
-					pThreadProcParameters[Thread]->pbAbort = &bAbort;
-					pThreadProcParameters[Thread]->pCHashedFiles = pCHashedFiles;
-
-					// Create and launch this thread, initially stalled waiting for the mutex.
-					phThreadArray[Thread] = CreateThread
-					(NULL, 0, FileHashWorkerThread, pThreadProcParameters[Thread], 0, NULL);
-					if (phThreadArray[Thread] == NULL)
+					pCHashedFiles->AddNode(_T(""), Entry.WriteTime, Entry.Size, Entry.Name, iDevice);
+					if (!TarArchive::IsArchive(Entry.Name) || !pLister->Open(Entry.Name, pEnumerator)) continue;
+					TarMember Member;
+					while (pLister->Next(Member))
 					{
-						MessageBeep(MB_ICONEXCLAMATION);
-						MessageBox(hWnd, _T("CreateThread"), szTitle, MB_OK | MB_ICONEXCLAMATION);
-						ExitProcess(3);
+						BytesProcessed += Member.Size;
+						pCHashedFiles->AddNode(_T(""), Member.WriteTime, Member.Size, Entry.Name + TAR_SEPARATOR + Member.Name,
+							iDevice, Member.Offset, true);
 					}
+					pLister->Close();
 				}
+				delete pLister;
+				delete pListReader;
+				int iTotalFiles = pCHashedFiles->GetNodeCount();
 
-				// Release the held threads.
-				ReleaseMutex(hcsMutex);
-
-				// Wait for all threads to terminate.
+				// For disk order, finding where a file starts opens it, so the files are located on the
+				// pool once they are listed. A member of an archive already has its place in the archive.
+				if (iHashOrder == HASH_BY_LOCATION)
+				{
+					pThreadPool->ParallelFor(0, iTotalFiles, LOCATION_TASK_FILES, [pEnumerator](int First, int Last)
+					{
+						for (int i = First; i < Last; ++i)
+						{
+							if (pCHashedFiles->IsClaimedMember(i)) continue;
+							pCHashedFiles->SetClaimedLocation(i, StorageDevice::GetLocation(pEnumerator->GetPath(pCHashedFiles->GetClaimedFile(i))));
+						}
+					});
+				}
+				QueryPerformanceCounter(&liEnd);
+				double dListSeconds = (double)liEnd.QuadPart / liFrequency.QuadPart - dStart;
+				TCHAR szListed[100];
+				StringCchPrintf(szListed, 100, _T("Listed %d files of %llu entries in %.3f seconds, %.0f entries/s\n"),
+					iTotalFiles, pEnumerator->GetEntries(), dListSeconds, dListSeconds > 0 ? pEnumerator->GetEntries() / dListSeconds : 0.0);
+				OutputDebugString(szListed);
+
+				// Hash the files. Reader threads read them into buffers and the
+				// workers of the pool hash the buffers, or with files in flight set,
+				// coroutines read and hash many files at once. The files are read from start to
+				// end, and a calibrated volume that reads faster unbuffered is read that way.
+				// The growth of the file cache is shown at the end. The readers share one
+				// rate limiter, whose caps + and - change while the scan runs.
+				int ReadOptions = iReadOptions | READ_SEQUENTIAL | (bProfile && Profile.Unbuffered ? READ_UNBUFFERED : 0);
+				uint64_t CacheBytes = FileReader::GetCacheBytes();
+				HashEngine* pHashEngine = CreateHashEngine(pCHashedFiles, pThreadPool, Threads,
+					bProfile ? Profile.ReadSize : PIPELINE_BUFFER_LEN, bProfile ? Profile.Readers : PIPELINE_READERS, ReadOptions);
+				RateLimiter* pLimiter = new RateLimiter(MaxMBytesPerSecond * 1048576, MaxOpensPerSecond);
+				pHashEngine->SetLimiter(pLimiter, bLowPriority != 0);
+				pHashEngine->SetDirectory(pEnumerator);
+				pHashEngine->Start();
+				double dSampleStart = dStart, dMBytesPerSecond = 0, dOpensPerSecond = 0;
+				uint64_t SampleBytes = 0, SampleOpens = 0;
+
+				// Wait for the readers and hashers to finish.
 				for (;;)
 				{
 					// Wait for up to fifty milliseconds.
-					if (WaitForMultipleObjects(Threads, phThreadArray, TRUE, 50) == WAIT_OBJECT_0) break;
+					if (pHashEngine->Wait(50)) break;
 
 					// Snapshot the elapsed time and calculate the elapsed seconds.
 					QueryPerformanceCounter(&liEnd);
@@ -562,41 +696,98 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 						_T("Files processed: %u     %d%% of %d     MBytes processed: %llu"),
 						pCHashedFiles->GetNodesProcessed(), iPercent,
 						iTotalFiles, pCHashedFiles->GetBytesProcessed() / 1024 / 1024);
-					StringCchPrintf(szSecondsElapsed, 100,
-						_T("Elapsed Time: %.3f seconds     Threads: %d"), dElapsedSeconds, Threads);
+					TCHAR szEngine[120];
+					pHashEngine->Describe(szEngine, 120);
+					StringCchPrintf(szSecondsElapsed, 160, _T("Elapsed Time: %.3f seconds     %s"), dElapsedSeconds, szEngine);
+
+					// The read rate of each device.
+					szDevices[0] = 0;
+					for (int i = 0; i < pCHashedFiles->GetDeviceCount(); ++i)
+					{
+						wstring DeviceName;
+						uint64_t DeviceBytes;
+						TCHAR szDevice[100];
+						pCHashedFiles->GetDevice(i, DeviceName, DeviceBytes);
+						StringCchPrintf(szDevice, 100, _T("%s: %.1f MB/s     "), DeviceName.c_str(),
+							dElapsedSeconds > 0 ? DeviceBytes / 1048576.0 / dElapsedSeconds : 0.0);
+						StringCchCat(szDevices, 100, szDevice);
+					}
 					SetBkColor(dc, RGB(240, 240, 240));
 					TextOut(dc, 16, 16, szFilesProcessed, lstrlen(szFilesProcessed));
 					TextOut(dc, 16, 36, szSecondsElapsed, lstrlen(szSecondsElapsed));
-					TextOut(dc, 16, 76, _T("Press ESC to abort."), 19);
+					TextOut(dc, 16, 56, szDevices, lstrlen(szDevices));
 
-					// Check for ESC pressed - Abort if so.
+					// The actual rates over the last second or so, against the caps.
+					if (dEnd - dSampleStart >= 1)
+					{
+						dMBytesPerSecond = (pLimiter->GetBytes() - SampleBytes) / 1048576.0 / (dEnd - dSampleStart);
+						dOpensPerSecond = (pLimiter->GetOpens() - SampleOpens) / (dEnd - dSampleStart);
+						SampleBytes = pLimiter->GetBytes();
+						SampleOpens = pLimiter->GetOpens();
+						dSampleStart = dEnd;
+					}
+					TCHAR szLimits[160], szByteCap[32], szOpenCap[32];
+					StringCchPrintf(szByteCap, 32, MaxMBytesPerSecond > 0 ? _T("cap %.1f") : _T("no cap"), MaxMBytesPerSecond);
+					StringCchPrintf(szOpenCap, 32, MaxOpensPerSecond > 0 ? _T("cap %.0f") : _T("no cap"), MaxOpensPerSecond);
+					StringCchPrintf(szLimits, 160, _T("Reading %.1f MB/s (%s)     Opening %.0f files/s (%s)%s          "),
+						dMBytesPerSecond, szByteCap, dOpensPerSecond, szOpenCap, bLowPriority ? _T("     (background)") : _T(""));
+					TextOut(dc, 16, 76, szLimits, lstrlen(szLimits));
+					TextOut(dc, 16, 96, _T("Press ESC to abort, + or - to change the caps."), 46);
+
+					// Check for ESC pressed - Abort if so. + and - double and halve the caps; - with
+					// no cap set caps the read rate at half of what it is.
 					MSG msg;
 					if (!PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) continue;
+					if (msg.message == WM_KEYDOWN && (msg.wParam == VK_ADD || msg.wParam == VK_OEM_PLUS ||
+						msg.wParam == VK_SUBTRACT || msg.wParam == VK_OEM_MINUS))
+					{
+						double dScale = msg.wParam == VK_ADD || msg.wParam == VK_OEM_PLUS ? 2 : 0.5;
+						if (dScale < 1 && MaxMBytesPerSecond <= 0 && MaxOpensPerSecond <= 0)
+							MaxMBytesPerSecond = max(dMBytesPerSecond, 2.0);
+						MaxMBytesPerSecond *= dScale;
+						MaxOpensPerSecond *= dScale;
+						pLimiter->SetRates(MaxMBytesPerSecond * 1048576, MaxOpensPerSecond);
+						continue;
+					}
 					if (msg.message != WM_KEYDOWN || msg.wParam != VK_ESCAPE) continue;
+					// The engine stops within a read slice, so the wait is short even in a large file.
+					// The files already hashed are kept, and the rest are dropped from the list.
 					bAbort = true;
-					WaitForMultipleObjects(Threads, phThreadArray, true, INFINITE);
-					pCHashedFiles->Reset();
+					pHashEngine->Abort();
+					pHashEngine->Wait();
+					pCHashedFiles->RemoveUnhashed();
 					break;
 				}
-
-				// Delete the critical section mutex
-				CloseHandle(hcsMutex);
-
-				// Deallocate the thread arrays and structures.
-				for (int Thread = 0; Thread < Threads; ++Thread)
-				{
-					CloseHandle(phThreadArray[Thread]);
-					HeapFree(GetProcessHeap(), 0, pThreadProcParameters[Thread]);
-				}
-				delete[] phThreadArray;
-				delete[] pThreadProcParameters;
+				uint64_t HoleBytes = pHashEngine->GetHoleBytes();
+				uint64_t Skipped = pHashEngine->GetSkipped();
+				delete pHashEngine;
+
+				// The files that could not be read, such as the members of a damaged archive, have no
+				// hash, and are dropped from the list as an abort drops the files it did not reach.
+				if (Skipped > 0 && !bAbort) pCHashedFiles->RemoveUnhashed();
+				delete pLimiter;
+				delete pEnumerator;
+
+				// Show how much the scan added to the file cache, the holes of sparse files that it
+				// did not have to read, and the files it could not read, over the ESC line.
+				TCHAR szCache[160], szHoles[48] = _T(""), szSkipped[48] = _T("");
+				if (HoleBytes > 0) StringCchPrintf(szHoles, 48, _T(" Skipped %llu MB of holes."), HoleBytes / 1048576);
+				if (Skipped > 0) StringCchPrintf(szSkipped, 48, _T(" Skipped %llu unreadable files."), Skipped);
+				StringCchPrintf(szCache, 160, _T("File cache grew by %lld MB%s%s%s\n"),
+					((int64_t)FileReader::GetCacheBytes() - (int64_t)CacheBytes) / 1048576,
+					ReadOptions & READ_UNBUFFERED ? _T(", reading unbuffered.") :
+					ReadOptions & READ_DROPBEHIND ? _T(", sparing the cache.") : _T("."), szHoles, szSkipped);
+				OutputDebugString(szCache);
+				TCHAR szCacheLine[160];
+				StringCchPrintf(szCacheLine, 160, _T("%-50.*s"), lstrlen(szCache) - 1, szCache);
+				TextOut(dc, 16, 96, szCacheLine, lstrlen(szCacheLine));
 
 				MessageBeep(MB_ICONASTERISK);
 				ReleaseDC(hWnd, dc);
 
 				// Sort by hash then file.
 				iSortMode = 0;
-				if (!bAbort) pCHashedFiles->SortAndCheck(iSortMode);
+				pCHashedFiles->SortAndCheck(iSortMode);
 				
 				// Setup initial view.
 				bMarked = false;
@@ -604,20 +795,86 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				iSelectedFile = 0;
 				InvalidateRect(hWnd, NULL, true); // Generate paint message.
 
-				delete[] pszFileDate;
-				delete[] pszFileTime;
-				delete[] pszFileSize;
 				delete[] pszOpenFileName;
 
-				// Restore original current directory.
-				SetCurrentDirectory(szOldDirectoryName);
-
 				// Set a 3 second timer to close the modeless dialog box.
 				if (!bAbort) uiTimer = SetTimer(hWnd, 1, 3000, NULL);
 				else         uiTimer = SetTimer(hWnd, 1, 30,   NULL); // Quick close on Abort
 			}
 		break;
 
+		case ID_FILE_CALIBRATE:
+			/////////////////////////////////////////////////////////////////////////////////////////////////
+			// Select a directory and measure how its volume is best read. The tuning profile is saved
+			// for the volume, and later scans of the volume start from it.
+			/////////////////////////////////////////////////////////////////////////////////////////////////
+			{
+				MessageBox(hWnd, _T("Navigate to a directory on the volume to calibrate and double\n"
+				                    "click on any file. The largest files of the directory are read."), szTitle, MB_OK);
+
+				OPENFILENAME ofn;
+				ZeroMemory(&ofn, sizeof(ofn));
+				TCHAR* pszOpenFileName = new TCHAR[MAX_PATH];
+				ZeroMemory(pszOpenFileName, MAX_PATH * sizeof(TCHAR));
+				ofn.lStructSize = sizeof(OPENFILENAME);
+				ofn.hwndOwner = hWnd;
+				ofn.lpstrFile = pszOpenFileName;
+				ofn.nMaxFile = MAX_PATH;
+				ofn.Flags = OFN_NOCHANGEDIR; // The current directory of the process is left alone.
+
+				int LastAPICallLine = __LINE__ + 1;
+				if (!GetOpenFileName(&ofn))
+				{
+					if (CommDlgExtendedError() != 0)
+					{
+						TCHAR sz[MAX_ERROR_MESSAGE_LEN];
+						StringCchPrintf(sz, MAX_ERROR_MESSAGE_LEN,
+							_T("API Error occurred at line %ld error code %ld"), LastAPICallLine, CommDlgExtendedError());
+						MessageBox(hWnd, sz, _T("MarkDuplicates.cpp"), MB_OK + MB_ICONSTOP);
+					}
+					delete[] pszOpenFileName;
+					break;
+				}
+				ofn.lpstrFile[ofn.nFileOffset] = TCHAR('\0'); // Only the path.
+
+				// Show each trial in the progress box, and stop on ESC.
+				dc = GetDC(hWndProgressBox);
+				RECT WindowRect;
+				GetWindowRect(hWnd, &WindowRect);
+				ShowWindow(hWndProgressBox, SW_SHOW);
+				SetWindowPos(hWndProgressBox, HWND_NOTOPMOST, WindowRect.left+50, WindowRect.top+50, 0, 0, SWP_NOSIZE | SWP_SHOWWINDOW);
+				StorageCalibration Calibration(ofn.lpstrFile);
+				TuningProfile Profile;
+				BOOL bCalibrated = Calibration.Run(Profile, [&](const wstring& Trial)
+				{
+					TCHAR szTrial[100];
+					StringCchPrintf(szTrial, 100, _T("Calibrating: %-60s"), Trial.c_str());
+					SetBkColor(dc, RGB(240, 240, 240));
+					TextOut(dc, 16, 16, szTrial, lstrlen(szTrial));
+					TextOut(dc, 16, 76, _T("Press ESC to abort."), 19);
+					MSG msg;
+					return !(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) && msg.message == WM_KEYDOWN && msg.wParam == VK_ESCAPE);
+				});
+				ReleaseDC(hWndProgressBox, dc);
+				ShowWindow(hWndProgressBox, SW_HIDE);
+
+				// Save the profile, and show what each trial measured.
+				wstring Report;
+				for (size_t i = 0; i < Calibration.GetReport().size(); ++i) Report += Calibration.GetReport()[i] + _T("\n");
+				if (bCalibrated)
+				{
+					wstring VolumeId = StorageDevice::GetVolumeId(ofn.lpstrFile);
+					pAppReg->SaveMemoryBlock(StorageCalibration::GetProfileName(VolumeId), (LPBYTE)&Profile, sizeof(Profile));
+					TCHAR szProfile[MAX_PATH + 100];
+					StringCchPrintf(szProfile, MAX_PATH + 100, _T("\nSaved for %s: %d KB reads, %d readers, %s."),
+						VolumeId.c_str(), Profile.ReadSize / 1024, Profile.Readers, Profile.Unbuffered ? _T("unbuffered") : _T("buffered"));
+					Report += szProfile;
+				}
+				MessageBox(hWnd, Report.c_str(), _T("Calibrate"), MB_OK | (bCalibrated ? MB_ICONINFORMATION : MB_ICONEXCLAMATION));
+				delete[] pszOpenFileName;
+			}
+			break;
+
 		case ID_FILE_MARK:
 			/////////////////////////////////////////////////////////////////////////////////////////////////
 			// Mark duplicates by renaming them with ".DELETE" in the name before the extension
@@ -636,36 +893,72 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			if (MessageBox(hWnd, _T("Are you sure you want to mark the duplicates for deletion?"),
 				szTitle, MB_YESNO | MB_DEFBUTTON2) != IDYES) break;
 
-			GetCurrentDirectory(MAX_PATH, szOldDirectoryName);
-			SetCurrentDirectory(szDirectoryName);
+			// The duplicates to rename. A member of an archive stays as it is.
+			std::vector<wstring> Files;
 			for (int i = 0; i < pCHashedFiles->GetNodeCount(); ++i)
 			{
-				BOOL dup;
-				wstring hash, date, time, size, file;
-				wstring line, base, ext, newfile;
-
-				pCHashedFiles->GetNode(i, dup, hash, date, time, size, file); // Process each file
-				if (!dup) continue; // Ignore non duplicates.
+				HashedFiles::FileRow row;
+				pCHashedFiles->GetRow(i, row); // Process each file
+				if (!row.Duplicate) continue; // Ignore non duplicates.
+				if (TarArchive::FindMember(*row.FileName) != wstring::npos) continue;
+				Files.push_back(*row.FileName);
+			}
 
-				size_t iDot = file.find_last_of(TCHAR('.')); // Find the extension
-				if (iDot == wstring::npos) // case of no extension
-				{
-					newfile = file + _T(".DELETE"); // just add .DELETE to the end of the file name.
-				}
-				else // case of extension found
+			// Rename the files on the pool, MARK_TASK_FILES to a task, while the progress box counts
+			// them. ESC stops the tasks after the renames under way; the rest keep their names.
+			std::atomic<int> Renamed(0), Failed(0);
+			std::atomic<bool> bStop(false);
+			for (int First = 0; First < (int)Files.size(); First += MARK_TASK_FILES)
+			{
+				int Last = min(First + MARK_TASK_FILES, (int)Files.size());
+				pThreadPool->Submit([&Files, &Renamed, &Failed, &bStop, First, Last]
 				{
-					// Add .DELETE before the extension, i.e. "base.DELETE.ext"
-					base = file.substr(0, iDot);
-					ext = file.substr(iDot);
-					newfile = base + _T(".DELETE") + ext;
-				}
-
-				// Rename file.
-				MoveFile(file.c_str(), newfile.c_str());
+					for (int i = First; i < Last && !bStop.load(); ++i)
+					{
+						const wstring& file = Files[i];
+						wstring newfile;
+						size_t iDot = file.find_last_of(TCHAR('.')); // Find the extension
+						if (iDot == wstring::npos) // case of no extension
+						{
+							newfile = file + _T(".DELETE"); // just add .DELETE to the end of the file name.
+						}
+						else // case of extension found
+						{
+							// Add .DELETE before the extension, i.e. "base.DELETE.ext"
+							newfile = file.substr(0, iDot) + _T(".DELETE") + file.substr(iDot);
+						}
+
+						// Rename file.
+						if (MoveFile(FullPath(file).c_str(), FullPath(newfile).c_str())) Renamed.fetch_add(1);
+						else Failed.fetch_add(1);
+					}
+				});
 			}
+			dc = GetDC(hWndProgressBox);
+			RECT WindowRect;
+			GetWindowRect(hWnd, &WindowRect);
+			ShowWindow(hWndProgressBox, SW_SHOW);
+			SetWindowPos(hWndProgressBox, HWND_NOTOPMOST, WindowRect.left+50, WindowRect.top+50, 0, 0, SWP_NOSIZE | SWP_SHOWWINDOW);
+			for (BOOL bDone = false; !bDone; )
+			{
+				bDone = pThreadPool->Wait(50);
+				TCHAR szMarked[100];
+				StringCchPrintf(szMarked, 100, _T("Files marked: %d of %d     Failed: %d          "),
+					Renamed.load(), (int)Files.size(), Failed.load());
+				SetBkColor(dc, RGB(240, 240, 240));
+				TextOut(dc, 16, 16, szMarked, lstrlen(szMarked));
+				TextOut(dc, 16, 96, _T("Press ESC to abort."), 19);
+				MSG msg;
+				if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) && msg.message == WM_KEYDOWN && msg.wParam == VK_ESCAPE) bStop = true;
+			}
+			ReleaseDC(hWndProgressBox, dc);
+			ShowWindow(hWndProgressBox, SW_HIDE);
+
 			bMarked = true;
-			MessageBox(hWnd, _T("Mark completed. Rescan to see results."), szTitle, MB_OK);
-			SetCurrentDirectory(szOldDirectoryName);
+			TCHAR szMessage[200];
+			StringCchPrintf(szMessage, 200, _T("Mark %s: %d of %d files renamed, %d could not be. Rescan to see results."),
+				bStop ? _T("stopped") : _T("completed"), Renamed.load(), (int)Files.size(), Failed.load());
+			MessageBox(hWnd, szMessage, szTitle, MB_OK);
 			break;
 		}
 
@@ -775,6 +1068,26 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			break;
 		}
 
+		case ID_SORT_BYWASTE:
+			/////////////////////////////////////////////////////////////////////////////////////////////////
+			// Re-sorts the duplicate groups by wasted bytes, largest first, then by file name, so review
+			// starts with the groups that free the most space. Changes spacing to double.
+			/////////////////////////////////////////////////////////////////////////////////////////////////
+		{
+			if (pCHashedFiles->GetNodeCount() == 0) // Case of no files to process.
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hWnd, _T("Scan first, then resort!"), szTitle, MB_OK | MB_ICONEXCLAMATION);
+				break;
+			}
+			iSortMode = SORT_BY_WASTE; // Flag for sorting, painting, and scrolling.
+			pCHashedFiles->SortAndCheck(iSortMode);
+
+			iStartNode = 0; // Start paint from the first entry in the list.
+			InvalidateRect(hWnd, NULL, true); // Generate paint message.
+			break;
+		}
+
 		case ID_EDIT_COPY: // (Plus accelerator <Ctrl>C) - Copies the selected FileName to the clipboard.
 		{
 			if (pCHashedFiles->GetNodeCount() == 0)
@@ -846,16 +1159,6 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		// Adjust the Starting Node by the scroll amount
 		iStartNode -= GET_WHEEL_DELTA_WPARAM(wParam) / 120 * uScroll;
 		iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-
-		dc = GetDC(hWnd);
-		GetTextMetrics(dc, &tm);
-		GetClientRect(hWnd, &rect);
-		ReleaseDC(hWnd, dc);
-		si.nMax = pCHashedFiles->GetNodeCount() - 1;
-		si.nMin = 0;
-		si.nPage = rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-		si.nPos = iStartNode;
-		SetScrollInfo(hWnd, SB_VERT, &si, true);
 		InvalidateRect(hWnd, NULL, true);
 		break;
 
@@ -874,20 +1177,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			if (iSelectedFile == pCHashedFiles->GetNodeCount() - 1) break; // Case of end of data.
 			
 			++iSelectedFile;
-			if (iSelectedFile >= iStartNode + pCOpenFiles->GetFileCount() - 1) // Case of end of page.
+			if (iSelectedFile >= iLastNode) // Case of end of page.
 			{
 				// Scroll down one line.
-				dc = GetDC(hWnd);
-				GetTextMetrics(dc, &tm);
-				GetClientRect(hWnd, &rect);
-				ReleaseDC(hWnd, dc);
 				++iStartNode;
 				iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-				si.nMax = pCHashedFiles->GetNodeCount() - 1;
-				si.nMin = 0;
-				si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-				si.nPos = iStartNode;
-				SetScrollInfo(hWnd, SB_VERT, &si, true);
 			}
 			
 			InvalidateRect(hWnd, NULL, true); // Repaint.
@@ -900,51 +1194,21 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			if (iSelectedFile < iStartNode) // Case of beginning of page.
 			{
 				// Scroll up one line.
-				dc = GetDC(hWnd);
-				GetTextMetrics(dc, &tm);
-				GetClientRect(hWnd, &rect);
-				ReleaseDC(hWnd, dc);
 				--iStartNode;
 				iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-				si.nMax = pCHashedFiles->GetNodeCount() - 1;
-				si.nMin = 0;
-				si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-				si.nPos = iStartNode;
-				SetScrollInfo(hWnd, SB_VERT, &si, true);
 			}
 			InvalidateRect(hWnd, NULL, true); // Repaint.
 			break;
 
 		case VK_NEXT: // Scroll down one page. Selection bar goes to top.
 
-			dc = GetDC(hWnd);
-			GetTextMetrics(dc, &tm);
-			GetClientRect(hWnd, &rect);
-			ReleaseDC(hWnd, dc);
-			iStartNode += rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1) - 2;
-			iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-			iSelectedFile = iStartNode;
-			si.nMax = pCHashedFiles->GetNodeCount() - 1;
-			si.nMin = 0;
-			si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			si.nPos = iStartNode;
-			SetScrollInfo(hWnd, SB_VERT, &si, true);
+			iStartNode = iSelectedFile = PageNode(iStartNode, 1);
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
 		case VK_PRIOR: // Scroll up one page. Selection bar goes to top.
 
-			dc = GetDC(hWnd);
-			GetTextMetrics(dc, &tm);
-			GetClientRect(hWnd, &rect);
-			ReleaseDC(hWnd, dc);
-			iStartNode -= rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-			iSelectedFile = iStartNode;
-			si.nMin = 0;
-			si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			si.nPos = iStartNode;
-			SetScrollInfo(hWnd, SB_VERT, &si, true);
+			iStartNode = iSelectedFile = PageNode(iStartNode, -1);
 			InvalidateRect(hWnd, NULL, true);
 			break;
 		
@@ -958,18 +1222,30 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
+		case 'N': // N - Jump to the next duplicate group.
+		case 'P': // P - Jump to the previous duplicate group.
+		{
+			int iGroupNode = wParam == 'N' ? pCHashedFiles->GetNextGroup(iSelectedFile)
+			                               : pCHashedFiles->GetPrevGroup(iSelectedFile);
+			if (iGroupNode < 0) // Case of no more groups.
+			{
+				MessageBeep(MB_ICONASTERISK);
+				break;
+			}
+			iStartNode = iSelectedFile = iGroupNode;
+			InvalidateRect(hWnd, NULL, true);
+			break;
+		}
+
 		case VK_RETURN: // The selected file is executed with the shell open verb.
 		case VK_SPACE:  // Space or Return will do it.
 			if (pCHashedFiles->GetFile(iSelectedFile, *pDblClickFile))
 			{
-				GetCurrentDirectory(MAX_PATH, szOldDirectoryName);
-				SetCurrentDirectory(szDirectoryName);
 				HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 				UNREFERENCED_PARAMETER(hr);
 				HINSTANCE hi;
-				hi = ShellExecute(hWnd, _T("open"), pDblClickFile->c_str(), NULL, NULL, SW_SHOWNORMAL);
+				hi = ShellExecute(hWnd, _T("open"), FullPath(*pDblClickFile).c_str(), NULL, szDirectoryName, SW_SHOWNORMAL);
 				CoUninitialize();
-				SetCurrentDirectory(szOldDirectoryName);
 				if (hi <= (HINSTANCE)32)
 				{
 					LPVOID lpMsgBuf;
@@ -1025,17 +1301,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			--iSelectedFile;
 			if (iSelectedFile < iStartNode)
 			{
-				dc = GetDC(hWnd);
-				GetTextMetrics(dc, &tm);
-				GetClientRect(hWnd, &rect);
-				ReleaseDC(hWnd, dc);
 				--iStartNode;
 				iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-				si.nMax = pCHashedFiles->GetNodeCount() - 1;
-				si.nMin = 0;
-				si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-				si.nPos = iStartNode;
-				SetScrollInfo(hWnd, SB_VERT, &si, true);
 			}
 			InvalidateRect(hWnd, NULL, true);
 			break;
@@ -1045,70 +1312,31 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			if (iSelectedFile == pCHashedFiles->GetNodeCount() - 1) break; // Case of end of data.
 
 			++iSelectedFile;
-			if (iSelectedFile >= iStartNode + pCOpenFiles->GetFileCount() - 1) // Case of end of page.
+			if (iSelectedFile >= iLastNode) // Case of end of page.
 			{
-				dc = GetDC(hWnd);
-				GetTextMetrics(dc, &tm);
-				GetClientRect(hWnd, &rect);
-				ReleaseDC(hWnd, dc);
 				++iStartNode;
 				iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-				si.nMax = pCHashedFiles->GetNodeCount() - 1;
-				si.nMin = 0;
-				si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-				si.nPos = iStartNode;
-				SetScrollInfo(hWnd, SB_VERT, &si, true);
 			}
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
 		case SB_PAGEUP: // User clicked the scroll bar shaft above the scroll box.
 
-			dc = GetDC(hWnd);
-			GetTextMetrics(dc, &tm);
-			GetClientRect(hWnd, &rect);
-			ReleaseDC(hWnd, dc);
-			iStartNode -= rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1) - 2;
-			iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-			iSelectedFile = iStartNode;
-			si.nMin = 0;
-			si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			si.nPos = iStartNode;
-			SetScrollInfo(hWnd, SB_VERT, &si, true);
+			iStartNode = iSelectedFile = PageNode(iStartNode, -1);
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
 		case SB_PAGEDOWN: // User clicked the scroll bar shaft below the scroll box.
 
-			dc = GetDC(hWnd);
-			GetTextMetrics(dc, &tm);
-			GetClientRect(hWnd, &rect);
-			ReleaseDC(hWnd, dc);
-			iStartNode += rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1) - 2;
-			iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
-			iSelectedFile = iStartNode;
-			si.nMax = pCHashedFiles->GetNodeCount() - 1;
-			si.nMin = 0;
-			si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			si.nPos = iStartNode;
-			SetScrollInfo(hWnd, SB_VERT, &si, true);
+			iStartNode = iSelectedFile = PageNode(iStartNode, 1);
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
-		case SB_THUMBTRACK: // User dragged the scroll box.
+		case SB_THUMBTRACK: // User dragged the scroll box. The position is a line of the display.
 
-			dc = GetDC(hWnd);
-			GetTextMetrics(dc, &tm);
-			GetClientRect(hWnd, &rect);
-			ReleaseDC(hWnd, dc);
-			iStartNode = si.nTrackPos;
+			iStartNode = pCHashedFiles->GetLayout().GetRowAtLine(si.nTrackPos);
 			iStartNode = max(min(iStartNode, pCHashedFiles->GetNodeCount() - 1), 0);
 			iSelectedFile = iStartNode;
-			si.nMax = pCHashedFiles->GetNodeCount() - 1;
-			si.nMin = 0;
-			si.nPage = (rect.bottom - tm.tmHeight * 2) / tm.tmHeight / (iSortMode == 0 ? 2 : 1);
-			si.nPos = iStartNode;
-			SetScrollInfo(hWnd, SB_VERT, &si, true);
 			InvalidateRect(hWnd, NULL, true);
 			break;
 
@@ -1134,21 +1362,23 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 		GetTextMetrics(hdc, &tm);
 
-		int y = 10 + tm.tmHeight - tm.tmHeight * (iSortMode == 0 ? 2 : 1);
-		BOOL dup;
-		wstring hash, date, time, size, file, line;
-		pCOpenFiles->Reset();
+		int y = 10 + tm.tmHeight - tm.tmHeight * SortSpacing();
+		wstring& line = *pPaintLine;
+		HashedFiles::FileRow row;
+		iLineHeight = tm.tmHeight;
+		iPageLines = max((rect.bottom - tm.tmHeight * 2 - 10) / tm.tmHeight, 1);
+		iLastNode = iStartNode - 1;
 
 		iSelectedFile = max(iSelectedFile, iStartNode);
 
 		// Write header line if nodes to process.
 		if (pCHashedFiles->GetNodeCount() > 0)
 		{
-			wstring header;
-			header += _T("SHA-1 Digest-----------------------------------------------   Date------   Time-   -----Size   D   ");
-			header += _T("File Name------------------------------------------------------------------------------------------");
+			const TCHAR szHeader[] =
+				_T("SHA-1 Digest-----------------------------------------------   Date------   Time-   -----Size   D   ")
+				_T("File Name------------------------------------------------------------------------------------------");
 			SetBkColor(hdc, RGB(191, 255, 191));
-			TextOut(hdc, 10, 10, header.c_str(), (int)header.length());
+			TextOut(hdc, 10, 10, szHeader, lstrlen(szHeader));
 
 			// Draw a grey box around the header line
 			hpenNew = CreatePen(PS_SOLID, 1, RGB(127, 127, 127));
@@ -1165,25 +1395,21 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		// Process nodes for displpay.
 		for (int i = iStartNode; i < pCHashedFiles->GetNodeCount(); ++i)
 		{
-			pCHashedFiles->GetNode(i, dup, hash, date, time, size, file); // Get data for each file.
+			pCHashedFiles->GetRow(i, row); // Get data for each file, without copying it.
 			
-			line = hash + wstring(_T("   ")) +
-				   date + wstring(_T("   ")) +
-				   time + wstring(_T("   ")) +
-				   size + wstring(_T("   ")) + wstring(dup ? _T("X   ") : _T("O   ")) + file;
-
 			// Space or double space depending on the re-sort flag.
-			y += dup ? tm.tmHeight : tm.tmHeight * (iSortMode  == 0 ? 2 : 1);
+			y += row.Duplicate ? tm.tmHeight : tm.tmHeight * SortSpacing();
 			
 			if (y > rect.bottom - tm.tmHeight) break; // Stop painting if at the bottom of the client window.
 
 			// Adjust selected file for scrolling down with the mouse wheel.
-			if (y >= rect.bottom - tm.tmHeight - tm.tmHeight * (iSortMode == 0 ? 2 : 1)) iSelectedFile = min(iSelectedFile, i);
+			if (y >= rect.bottom - tm.tmHeight - tm.tmHeight * SortSpacing()) iSelectedFile = min(iSelectedFile, i);
 
 			// Highlight duplicates.
-			SetBkColor(hdc, dup ? RGB(255, 191, 191) : RGB(255, 255, 255));
+			SetBkColor(hdc, row.Duplicate ? RGB(255, 191, 191) : RGB(255, 255, 255));
 			
-			// Write the line to the window.
+			// Format and write the line to the window.
+			pCHashedFiles->FormatRow(row, line);
 			TextOut(hdc, 10, y, line.c_str(), (int)line.length());
 
 			// Draw a grey box around the selected node.
@@ -1202,8 +1428,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				DeleteObject(hpenNew);
 			}
 
-			// Save the Y limits and Index to the OpenFiles class.
-			pCOpenFiles->AddFile(y, y + tm.tmHeight, file, i);
+			iLastNode = i; // For the hit test and for scrolling a line at the end of the page.
 		}
 
 		// Build the status bar if nodes processed.
@@ -1223,34 +1448,30 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 			FillRect(hdc, &rectFill, hbrNew);
 
-			int iDups = 0;
-			for (int i = 0; i < pCHashedFiles->GetNodeCount(); ++i)
-			{
-				pCHashedFiles->GetNode(i, dup);
-				iDups += dup ? 1 : 0;
-			}
 			const TCHAR* pszSortByText[] = {
 				_T("SHA-1 Digest, then by File Name"  ),
 				_T("File Name, alone"                 ),
 				_T("File Date/Time, then by File Name"),
-				_T("File Size, then by File Name"     )
+				_T("File Size, then by File Name"     ),
+				_T("Wasted Bytes, then by File Name"  )
 			};
 
-			#define	MAX_STATUS_LEN (MAX_PATH + 181 + 4 + 4 + 4 + 33 + 1)
-			TCHAR* pszStatus = new TCHAR[MAX_STATUS_LEN];
-			StringCchPrintf(pszStatus, MAX_STATUS_LEN,
+			#define	MAX_STATUS_LEN (MAX_PATH + 181 + 4 + 4 + 4 + 33 + 1 + 60)
+			TCHAR szStatus[MAX_STATUS_LEN];
+			StringCchPrintf(szStatus, MAX_STATUS_LEN,
 
-				_T("Directory: %s     Files: %d     MBytes: %llu     Duplicates: %d     Sorted by: %s"),
-				//  12345678901  234567890123  4567890123456    78901234567890123  4567890123456789
+				_T("Directory: %s     Files: %d     MBytes: %llu     Duplicates: %d     Groups: %d     ")
+				_T("Reclaimable MBytes: %llu     Sorted by: %s"),
 
 				szDirectoryName, pCHashedFiles->GetNodeCount(), BytesProcessed/1024/1024,
-				iDups, pszSortByText[iSortMode]);
+				pCHashedFiles->GetDuplicateCount(), pCHashedFiles->GetGroupCount(),
+				pCHashedFiles->GetReclaimableBytes()/1024/1024, pszSortByText[iSortMode]);
 
 			// Draw the status bar.
 			SetBkColor(hdc, RGB(0, 0, 255));
 			COLORREF rgbOld = GetTextColor(hdc);
 			SetTextColor(hdc, RGB(255, 255, 255));
-			TextOut(hdc, 10, rect.bottom - tm.tmHeight, pszStatus, lstrlen(pszStatus));
+			TextOut(hdc, 10, rect.bottom - tm.tmHeight, szStatus, lstrlen(szStatus));
 
 			// Draw a grey box around the status bar.
 			hpenNew = CreatePen(PS_SOLID, 1, RGB(127, 127, 127));
@@ -1263,12 +1484,19 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			SelectObject(hdc, hpenOld);
 			DeleteObject(hpenNew);
 			SetTextColor(hdc, rgbOld);
-			delete[] pszStatus;
 		}
 
-		// Show or hide the scroll bar depending on the number of files to display.
+		// Set the scroll bar, in lines of the display, from the row layout.
+		si.fMask = SIF_ALL | SIF_DISABLENOSCROLL;
+		si.nMin = 0;
+		si.nMax = max(pCHashedFiles->GetLayout().GetLineCount() - 1, 0);
+		si.nPage = iPageLines;
+		si.nPos = pCHashedFiles->GetLayout().GetRowLine(iStartNode);
+		SetScrollInfo(hWnd, SB_VERT, &si, true);
+
+		// Show or hide the scroll bar depending on the number of lines to display.
 		ShowScrollBar(hWnd, SB_VERT,
-			pCHashedFiles->GetNodeCount() < rect.bottom / tm.tmHeight / (iSortMode == 0 ? 2 : 1) ? false : true);
+			pCHashedFiles->GetLayout().GetLineCount() <= iPageLines ? false : true);
 
 		if (bChooseFont) SelectObject(hdc, hOldFont);  // Restore original font in the DC.
 
@@ -1278,7 +1506,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 	// Select node.
 	case WM_LBUTTONDOWN:
-		if (pCOpenFiles->GetFile(GET_Y_LPARAM(lParam), *pDblClickFile, iNode))
+		if ((iNode = NodeFromY(GET_Y_LPARAM(lParam), iStartNode)) >= 0)
 		{
 			iSelectedFile = iNode;
 			InvalidateRect(hWnd, NULL, true);
@@ -1288,7 +1516,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 	// Invert Duplicate.
 	case WM_RBUTTONDOWN:
 		BOOL Duplicate;
-		if (pCOpenFiles->GetFile(GET_Y_LPARAM(lParam), *pDblClickFile, iNode))
+		if ((iNode = NodeFromY(GET_Y_LPARAM(lParam), iStartNode)) >= 0)
 		{
 			pCHashedFiles->GetNode(iNode, Duplicate);
 			pCHashedFiles->SetDuplicate(iNode, !Duplicate);
@@ -1298,16 +1526,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 	// Launch file.
 	case WM_LBUTTONDBLCLK:
-		if (pCOpenFiles->GetFile(GET_Y_LPARAM(lParam), *pDblClickFile, iNode))
+		if ((iNode = NodeFromY(GET_Y_LPARAM(lParam), iStartNode)) >= 0 && pCHashedFiles->GetFile(iNode, *pDblClickFile))
 		{
-			GetCurrentDirectory(MAX_PATH, szOldDirectoryName);
-			SetCurrentDirectory(szDirectoryName);
 			HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 			(hr); // Ignored
 			HINSTANCE hi;
-			hi = ShellExecute(hWnd, _T("open"), pDblClickFile->c_str(), NULL, NULL, SW_SHOWNORMAL);
+			hi = ShellExecute(hWnd, _T("open"), FullPath(*pDblClickFile).c_str(), NULL, szDirectoryName, SW_SHOWNORMAL);
 			CoUninitialize();
-			SetCurrentDirectory(szOldDirectoryName);
 			if (hi <= (HINSTANCE)32)
 			{
 				LPVOID lpMsgBuf;
@@ -1373,49 +1598,6 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 
 
-// Worker thread for processing the hashes of the files
-DWORD WINAPI FileHashWorkerThread(LPVOID lpParam)
-{
-	// This is a copy of the structure from the command procedure.
-	// The address of this structure is passed with lParam.
-	typedef struct ThreadProcParameters
-	{
-		HANDLE       hcsMutex;
-		BOOL* pbAbort;
-		HashedFiles* pcsHashedFiles;
-	} THREADPROCPARAMETERS, * PTHREADPROCPARAMETERS;
-	PTHREADPROCPARAMETERS P;
-	P = (PTHREADPROCPARAMETERS)lpParam;
-
-	int Node;
-	wstring FileName;
-	sha1file Sha1File;
-	int cbMessageDigest = Sha1File.GetMessageDigestLength() * 3 + 1;
-	TCHAR* pszFileHash = new TCHAR[cbMessageDigest];
-
-	// Loop until no more work to do.
-	for (;;)
-	{
-		if (*(P->pbAbort)) return 0; // Case of user pressed ESCAPE
-
-		// Retrieve the next FileName from the NodeList.
-		WaitForSingleObject(P->hcsMutex, INFINITE);                          // Begin critical section.
-			BOOL bWorkToDo = P->pcsHashedFiles->GetNextFile(Node, FileName); // Critical Section
-		ReleaseMutex(P->hcsMutex);                                           // End Critical section.
-		if (!bWorkToDo) break;
-
-		// Generate hash and save.
-		Sha1File.Process(FileName.c_str(), 0, pszFileHash, NULL);
-		P->pcsHashedFiles->SaveHash(Node, pszFileHash); // No Critical Section needed.
-	}
-
-	delete[] pszFileHash;
-
-	return 0;
-}
-
-
-
 // Message handler for about box.
 INT_PTR CALLBACK About(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 {
@@ -1448,6 +1630,18 @@ INT_PTR CALLBACK Parameters(HWND hDlg, UINT message, WPARAM wParam, LPARAM lPara
 	case WM_INITDIALOG:
 	{
 		SetDlgItemText(hDlg, IDC_THREADS, iTos(Threads));
+		SetDlgItemText(hDlg, IDC_READERS, iTos(Readers));
+		SetDlgItemText(hDlg, IDC_QUEUEDEPTH, iTos(QueueDepth));
+		SetDlgItemText(hDlg, IDC_CPUSET, ThreadPool::FormatCpuSet(CpuSet).c_str());
+		CheckDlgButton(hDlg, IDC_PINTHREADS, bPinThreads ? BST_CHECKED : BST_UNCHECKED);
+		TCHAR sz[64];
+		StringCchPrintf(sz, 64, _T("%g"), MaxMBytesPerSecond);
+		SetDlgItemText(hDlg, IDC_MAXMBYTES, sz);
+		StringCchPrintf(sz, 64, _T("%g"), MaxOpensPerSecond);
+		SetDlgItemText(hDlg, IDC_MAXOPENS, sz);
+		SetDlgItemText(hDlg, IDC_MAXMEMORY, iTos(MaxMemoryMB));
+		SetDlgItemText(hDlg, IDC_FILESINFLIGHT, iTos(FilesInFlight));
+		CheckDlgButton(hDlg, IDC_LOWPRIORITY, bLowPriority ? BST_CHECKED : BST_UNCHECKED);
 
 		return (INT_PTR)TRUE;
 
@@ -1487,7 +1681,116 @@ INT_PTR CALLBACK Parameters(HWND hDlg, UINT message, WPARAM wParam, LPARAM lPara
 				break;
 			}
 
-			Threads = ThreadsTemp;
+			int ReadersTemp;
+
+			if (GetDlgItemText(hDlg, IDC_READERS, sz, 64) == 0 || swscanf_s(sz, _T("%d"), &ReadersTemp) == 0)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Enter number for Readers."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_READERS), true);
+				break;
+			}
+
+			if (ReadersTemp < 0 || ReadersTemp > MAX_PIPELINE_READERS)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Readers must be 0, to adapt them, up to 64."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_READERS), true);
+				break;
+			}
+
+			int QueueDepthTemp;
+
+			if (GetDlgItemText(hDlg, IDC_QUEUEDEPTH, sz, 64) == 0 || swscanf_s(sz, _T("%d"), &QueueDepthTemp) == 0)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Enter number for Queue depth."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_QUEUEDEPTH), true);
+				break;
+			}
+
+			if (QueueDepthTemp < 1 || QueueDepthTemp > MAX_READ_QUEUE_DEPTH)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Queue depth must be 1, for one read at a time, up to 32."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_QUEUEDEPTH), true);
+				break;
+			}
+
+			uint64_t CpuSetTemp;
+			GetDlgItemText(hDlg, IDC_CPUSET, sz, 64);
+			if (!ThreadPool::ParseCpuSet(sz, CpuSetTemp))
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("CPUs must be a list of CPUs 0 to 63 and ranges, such as 0-7,16-23, or empty for all."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_CPUSET), true);
+				break;
+			}
+			BOOL bPinThreadsTemp = IsDlgButtonChecked(hDlg, IDC_PINTHREADS) == BST_CHECKED;
+
+			double MaxMBytesTemp, MaxOpensTemp;
+
+			if (GetDlgItemText(hDlg, IDC_MAXMBYTES, sz, 64) == 0 || swscanf_s(sz, _T("%lf"), &MaxMBytesTemp) == 0 || MaxMBytesTemp < 0)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("MB/s must be a number, or 0 for no cap."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_MAXMBYTES), true);
+				break;
+			}
+
+			if (GetDlgItemText(hDlg, IDC_MAXOPENS, sz, 64) == 0 || swscanf_s(sz, _T("%lf"), &MaxOpensTemp) == 0 || MaxOpensTemp < 0)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Files/s must be a number, or 0 for no cap."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_MAXOPENS), true);
+				break;
+			}
+
+			int MaxMemoryTemp;
+
+			if (GetDlgItemText(hDlg, IDC_MAXMEMORY, sz, 64) == 0 || swscanf_s(sz, _T("%d"), &MaxMemoryTemp) == 0 || MaxMemoryTemp < 0)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				MessageBox(hDlg, _T("Memory MB must be a number, or 0 for no limit."), _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_MAXMEMORY), true);
+				break;
+			}
+
+			int FilesInFlightTemp;
+
+			if (GetDlgItemText(hDlg, IDC_FILESINFLIGHT, sz, 64) == 0 || swscanf_s(sz, _T("%d"), &FilesInFlightTemp) == 0 ||
+				FilesInFlightTemp < 0 || FilesInFlightTemp > MAX_ASYNC_FILES_IN_FLIGHT)
+			{
+				MessageBeep(MB_ICONEXCLAMATION);
+				StringCchPrintf(sz, 64, _T("Files in flight must be 0, for the pipeline, up to %d."), MAX_ASYNC_FILES_IN_FLIGHT);
+				MessageBox(hDlg, sz, _T("Error"), MB_OK | MB_ICONEXCLAMATION);
+				SendMessage(hDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hDlg, IDC_FILESINFLIGHT), true);
+				break;
+			}
+
+			Readers = ReadersTemp;
+			QueueDepth = QueueDepthTemp;
+			MaxMBytesPerSecond = MaxMBytesTemp;
+			MaxOpensPerSecond = MaxOpensTemp;
+			MaxMemoryMB = MaxMemoryTemp;
+			FilesInFlight = FilesInFlightTemp;
+			bLowPriority = IsDlgButtonChecked(hDlg, IDC_LOWPRIORITY) == BST_CHECKED;
+
+			// Rebuild the pool if its size or its placement changed. Deleting it waits for the workers to finish.
+			if (ThreadsTemp != pThreadPool->GetThreadCount() || CpuSetTemp != CpuSet || bPinThreadsTemp != bPinThreads)
+			{
+				CpuSet = CpuSetTemp;
+				bPinThreads = bPinThreadsTemp;
+				delete pThreadPool;
+				pThreadPool = new ThreadPool(ThreadsTemp, CpuSet, bPinThreads != 0);
+				pCHashedFiles->SetThreadPool(pThreadPool);
+			}
+			Threads = pThreadPool->GetThreadCount();
+
+			// Save the settings, for the next start and for the scans of path lists.
+			ApplicationRegistry* pAppReg = new ApplicationRegistry;
+			if (pAppReg->Init(GetParent(hDlg))) SaveScanSettings(pAppReg);
+			delete pAppReg;
 
 			EndDialog(hDlg, LOWORD(wParam));
 			return (INT_PTR)TRUE;
@@ -1503,6 +1806,43 @@ INT_PTR CALLBACK Parameters(HWND hDlg, UINT message, WPARAM wParam, LPARAM lPara
 
 
 
+// Lines per file in the display. The sort modes that keep the duplicate groups
+// together are double spaced, so that a blank line separates the groups.
+int SortSpacing()
+{
+	return pCHashedFiles->GetRowSpacing();
+}
+
+
+
+// Returns the node painted at the client Y coordinate, or -1 if there is none.
+// Each file is drawn on the last of its lines in the row layout, so the line
+// under Y is found in the layout and checked against the file's last line.
+int NodeFromY(int Y, int iStartNode)
+{
+	if (iLineHeight == 0 || iLastNode < iStartNode || Y < 10) return -1;
+	const RowLayout& Layout = pCHashedFiles->GetLayout();
+	int iLine = (Y - 10) / iLineHeight - 2 + SortSpacing() + Layout.GetRowLine(iStartNode);
+	int iNodeAtLine = Layout.GetRowAtLine(iLine);
+	if (iNodeAtLine < iStartNode || iNodeAtLine > iLastNode) return -1;
+	if (Layout.GetRowLine(iNodeAtLine + 1) - 1 != iLine) return -1; // A blank line between groups.
+	return iNodeAtLine;
+}
+
+
+
+// Returns the node to start painting from after scrolling iPages pages down,
+// or up if negative. A page is the lines of the last paint less two files,
+// which are kept in view.
+int PageNode(int iStartNode, int iPages)
+{
+	const RowLayout& Layout = pCHashedFiles->GetLayout();
+	int iLine = Layout.GetRowLine(iStartNode) + iPages * max(iPageLines - 2 * SortSpacing(), 1);
+	return max(min(Layout.GetRowAtLine(max(iLine, 0)), pCHashedFiles->GetNodeCount() - 1), 0);
+}
+
+
+
 // Convert int to string. Helper for the threads dialog box procedure.
 TCHAR* iTos(int i)
 {
@@ -1511,6 +1851,264 @@ TCHAR* iTos(int i)
 	return sz;
 }
 
+// Load the settings of <Edit><Threads>, each only if it was saved and is in the range the dialog
+// box allows, so that a damaged entry leaves the default.
+void LoadScanSettings(ApplicationRegistry* pAppReg)
+{
+	int i;
+	uint64_t u;
+	double d;
+	BOOL b;
+	if (pAppReg->LoadMemoryBlock(_T("Threads"), (LPBYTE)&i, sizeof(i)) && i > 0 && i < 65) Threads = i;
+	if (pAppReg->LoadMemoryBlock(_T("CpuSet"), (LPBYTE)&u, sizeof(u))) CpuSet = u;
+	if (pAppReg->LoadMemoryBlock(_T("PinThreads"), (LPBYTE)&b, sizeof(b))) bPinThreads = b != 0;
+	if (pAppReg->LoadMemoryBlock(_T("Readers"), (LPBYTE)&i, sizeof(i)) && i >= 0 && i <= MAX_PIPELINE_READERS) Readers = i;
+	if (pAppReg->LoadMemoryBlock(_T("QueueDepth"), (LPBYTE)&i, sizeof(i)) && i >= 1 && i <= MAX_READ_QUEUE_DEPTH) QueueDepth = i;
+	if (pAppReg->LoadMemoryBlock(_T("MaxMBytesPerSecond"), (LPBYTE)&d, sizeof(d)) && d >= 0) MaxMBytesPerSecond = d;
+	if (pAppReg->LoadMemoryBlock(_T("MaxOpensPerSecond"), (LPBYTE)&d, sizeof(d)) && d >= 0) MaxOpensPerSecond = d;
+	if (pAppReg->LoadMemoryBlock(_T("MaxMemoryMB"), (LPBYTE)&i, sizeof(i)) && i >= 0) MaxMemoryMB = i;
+	if (pAppReg->LoadMemoryBlock(_T("FilesInFlight"), (LPBYTE)&i, sizeof(i)) && i >= 0 && i <= MAX_ASYNC_FILES_IN_FLIGHT) FilesInFlight = i;
+	if (pAppReg->LoadMemoryBlock(_T("LowPriority"), (LPBYTE)&b, sizeof(b))) bLowPriority = b != 0;
+}
+
+// Save the settings of <Edit><Threads>.
+void SaveScanSettings(ApplicationRegistry* pAppReg)
+{
+	pAppReg->SaveMemoryBlock(_T("Threads"), (LPBYTE)&Threads, sizeof(Threads));
+	pAppReg->SaveMemoryBlock(_T("CpuSet"), (LPBYTE)&CpuSet, sizeof(CpuSet));
+	pAppReg->SaveMemoryBlock(_T("PinThreads"), (LPBYTE)&bPinThreads, sizeof(bPinThreads));
+	pAppReg->SaveMemoryBlock(_T("Readers"), (LPBYTE)&Readers, sizeof(Readers));
+	pAppReg->SaveMemoryBlock(_T("QueueDepth"), (LPBYTE)&QueueDepth, sizeof(QueueDepth));
+	pAppReg->SaveMemoryBlock(_T("MaxMBytesPerSecond"), (LPBYTE)&MaxMBytesPerSecond, sizeof(MaxMBytesPerSecond));
+	pAppReg->SaveMemoryBlock(_T("MaxOpensPerSecond"), (LPBYTE)&MaxOpensPerSecond, sizeof(MaxOpensPerSecond));
+	pAppReg->SaveMemoryBlock(_T("MaxMemoryMB"), (LPBYTE)&MaxMemoryMB, sizeof(MaxMemoryMB));
+	pAppReg->SaveMemoryBlock(_T("FilesInFlight"), (LPBYTE)&FilesInFlight, sizeof(FilesInFlight));
+	pAppReg->SaveMemoryBlock(_T("LowPriority"), (LPBYTE)&bLowPriority, sizeof(bLowPriority));
+}
+
+// Join a file name of the list to the directory that was scanned, for the mark and the shell open,
+// since the current directory of the process is left alone. A member of an archive opens its archive.
+wstring FullPath(const wstring& FileName)
+{
+	wstring Path = szDirectoryName;
+	if (!Path.empty() && Path.back() != _T('\\') && Path.back() != _T('/')) Path += _T('\\');
+	return Path + FileName.substr(0, TarArchive::FindMember(FileName));
+}
+
+// Create the engine that hashes the files of a scan: coroutines that keep FilesInFlight files in
+// flight over an executor for each hashing thread, as AsyncScan.cpp describes, when it is set, else
+// the pipeline of readers and hashers, with the read length and the starting readers given.
+HashEngine* CreateHashEngine(HashedFiles* pFiles, ThreadPool* pPool, int Hashers, int BufferLen, int StartReaders,
+                             int ReadOptions)
+{
+	if (FilesInFlight > 0) return new AsyncScan(pFiles, pPool, Hashers, FilesInFlight, ReadOptions);
+	return new HashPipeline(pFiles, pPool, Readers, Hashers, BufferLen, StartReaders, QueueDepth, ReadOptions);
+}
+
+// Scan the listed directory within the memory limit, as BoundedScan.cpp describes, to an index file
+// that loads as a saved class does. Only the files that share their size are in the index. Returns
+// false if the scan did not finish.
+BOOL ScanBounded(HWND hWnd, DirectoryEnumerator* pEnumerator, const TuningProfile* pProfile)
+{
+	TCHAR szMessage[600];
+
+	// The process as it is and the pipeline must leave room under the limit.
+	BoundedScan* pScan = new BoundedScan((uint64_t)MaxMemoryMB * 1048576, StorageDevice::GetName(szDirectoryName),
+		SpillSorter::GetTempDirectory());
+	if (!pScan->IsUsable())
+	{
+		StringCchPrintf(szMessage, 600, _T("A memory limit of %d MB leaves too little for a bounded scan.\n")
+			_T("Set it to at least %llu MB, or to 0 for no limit."), MaxMemoryMB, BoundedScan::GetMinimumLimit() / 1048576 + 1);
+		MessageBeep(MB_ICONEXCLAMATION);
+		MessageBox(hWnd, szMessage, szTitle, MB_OK | MB_ICONEXCLAMATION);
+		delete pScan;
+		return false;
+	}
+
+	// Choose the index file first, since the scan may be long.
+	OPENFILENAME ofn;
+	ZeroMemory(&ofn, sizeof(ofn));
+	TCHAR szIndexName[MAX_PATH] = _T("MarkDuplicates.mdc");
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = hWnd;
+	ofn.lpstrFile = szIndexName;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrFilter = _T("MarkDuplicates Class Files (*.mdc)\0*.mdc\0All Files (*.*)\0*.*\0");
+	ofn.lpstrTitle = _T("Save the index of the bounded scan as");
+	ofn.Flags = OFN_OVERWRITEPROMPT | OFN_NOCHANGEDIR;
+	if (!GetSaveFileName(&ofn))
+	{
+		delete pScan;
+		return false;
+	}
+	int LastAPICallLine = __LINE__ + 1;
+	HANDLE hIndex = CreateFile(szIndexName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hIndex == INVALID_HANDLE_VALUE)
+	{
+		StringCchPrintf(szMessage, 600,
+			_T("API Error occurred in CreateFile() at line %ld error code %ld"), LastAPICallLine, GetLastError());
+		MessageBox(hWnd, szMessage, _T("MarkDuplicates.cpp"), MB_OK + MB_ICONSTOP);
+		delete pScan;
+		return false;
+	}
+
+	// Show the progress in the modeless dialog box.
+	LARGE_INTEGER liFrequency, liStart, liEnd;
+	QueryPerformanceFrequency(&liFrequency);
+	QueryPerformanceCounter(&liStart);
+	HDC dc = GetDC(hWndProgressBox);
+	RECT WindowRect;
+	GetWindowRect(hWnd, &WindowRect);
+	ShowWindow(hWndProgressBox, SW_SHOW);
+	SetWindowPos(hWndProgressBox, HWND_NOTOPMOST, WindowRect.left+50, WindowRect.top+50, 0, 0, SWP_NOSIZE | SWP_SHOWWINDOW);
+	SetBkColor(dc, RGB(240, 240, 240));
+	TCHAR szLine[200];
+	auto ShowLine = [&](int Y) { StringCchCat(szLine, 200, _T("          ")); TextOut(dc, 16, Y, szLine, lstrlen(szLine)); };
+	auto Escape = []() { MSG msg; return PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) && msg.message == WM_KEYDOWN && msg.wParam == VK_ESCAPE; };
+	TextOut(dc, 16, 96, _T("Press ESC to abort; the files hashed are kept."), 46);
+
+	// List the directory into the size runs, with the members of the tar archives, as a scan lists them.
+	BOOL bAbort = false, bFailed = false;
+	uint64_t ShownFiles = 0; // Files listed when the progress was last shown; a tar archive adds many at once.
+	DirectoryEntry Entry;
+	FileReader* pListReader = FileReader::Create(READ_ENGINE_SYNC, 1, iReadOptions & READ_NOATIME);
+	TarArchive* pLister = new TarArchive(pListReader, TAR_LIST_BUFFER_LEN, true);
+	while (pEnumerator->Next(Entry))
+	{
+		if (!pScan->AddFile(Entry)) { bFailed = true; break; }
+		if (TarArchive::IsArchive(Entry.Name) && pLister->Open(Entry.Name, pEnumerator))
+		{
+			DirectoryEntry MemberEntry;
+			MemberEntry.FileId = 0;
+			TarMember Member;
+			while (!bFailed && pLister->Next(Member))
+			{
+				MemberEntry.Name = Entry.Name + TAR_SEPARATOR + Member.Name;
+				MemberEntry.Size = Member.Size;
+				MemberEntry.WriteTime = Member.WriteTime;
+				if (!pScan->AddFile(MemberEntry, Member.Offset, true)) bFailed = true;
+			}
+			pLister->Close();
+			if (bFailed) break;
+		}
+		if (pScan->GetFiles() - ShownFiles < BOUNDED_CHECK_INTERVAL) continue;
+		ShownFiles = pScan->GetFiles();
+		StringCchPrintf(szLine, 200, _T("Files listed: %llu     Spilled: %llu MB in %d runs"),
+			pScan->GetFiles(), pScan->GetSpilledBytes() / 1048576, pScan->GetRuns());
+		ShowLine(16);
+		StringCchPrintf(szLine, 200, _T("Memory: %llu MB of %d MB"), SpillSorter::GetResidentBytes() / 1048576, MaxMemoryMB);
+		ShowLine(36);
+		if (Escape()) { bAbort = true; break; }
+	}
+	delete pLister;
+	delete pListReader;
+	if (!bAbort && !bFailed && !pScan->FinishListing()) bFailed = true;
+
+	// Hash the files that share their size, a batch at a time, as a scan hashes its files. The disk
+	// order is not known to a batch, so it is hashed in scan order instead.
+	int ReadOptions = iReadOptions | READ_SEQUENTIAL | (pProfile && pProfile->Unbuffered ? READ_UNBUFFERED : 0);
+	RateLimiter* pLimiter = new RateLimiter(MaxMBytesPerSecond * 1048576, MaxOpensPerSecond);
+	HashedFiles* pBatch;
+	uint64_t Skipped = 0; // Files that could not be read, which SaveBatch leaves out as unhashed.
+	while (!bAbort && !bFailed && (pBatch = pScan->NextBatch()) != NULL)
+	{
+		pBatch->SetHashOrder(iHashOrder == HASH_BY_LOCATION ? HASH_BY_SCAN : iHashOrder);
+		pBatch->SetHashLanes(bHashLanes);
+		HashEngine* pHashEngine = CreateHashEngine(pBatch, pThreadPool, Threads,
+			pProfile ? pProfile->ReadSize : PIPELINE_BUFFER_LEN, pProfile ? pProfile->Readers : PIPELINE_READERS, ReadOptions);
+		pHashEngine->SetLimiter(pLimiter, bLowPriority != 0);
+		pHashEngine->SetDirectory(pEnumerator);
+		pHashEngine->Start();
+		while (!pHashEngine->Wait(50))
+		{
+			QueryPerformanceCounter(&liEnd);
+			StringCchPrintf(szLine, 200, _T("Files listed: %llu     Hashed: %llu     Batch %d: %d of %d files"),
+				pScan->GetFiles(), pScan->GetCandidates() - pBatch->GetNodeCount() + pBatch->GetNodesProcessed(),
+				pScan->GetBatches(), pBatch->GetNodesProcessed(), pBatch->GetNodeCount());
+			ShowLine(16);
+			StringCchPrintf(szLine, 200, _T("Elapsed Time: %.3f seconds     Memory: %llu MB of %d MB     Spilled: %llu MB"),
+				(double)(liEnd.QuadPart - liStart.QuadPart) / liFrequency.QuadPart,
+				SpillSorter::GetResidentBytes() / 1048576, MaxMemoryMB, pScan->GetSpilledBytes() / 1048576);
+			ShowLine(36);
+			if (!Escape()) continue;
+			bAbort = true;
+			pHashEngine->Abort();
+			pHashEngine->Wait();
+			break;
+		}
+		Skipped += pHashEngine->GetSkipped();
+		delete pHashEngine;
+		if (!pScan->SaveBatch()) bFailed = true;
+	}
+	delete pLimiter;
+
+	// Write the index as Save writes a class sorted by hash: the header line, then the hashed
+	// files in hash order, with every file of a hash but the first marked.
+	if (!bFailed && !pScan->FinishHashing()) bFailed = true;
+	wstring Buffer, Line;
+	HashedFiles::FormatHeaderLine(Buffer, 0, 0, 0, szDirectoryName);
+	SpillRecord Record;
+	BOOL bDuplicate, bMore = !bFailed;
+	for (;;)
+	{
+		bMore = bMore && pScan->NextResult(Record, bDuplicate);
+		if (bMore)
+		{
+			HashedFiles::FormatDetailLine(Line, Record.FileHash, Record.WriteTime, Record.Bytes, bDuplicate, Record.FileName);
+			Buffer += Line;
+			if (Buffer.length() < SPILL_IO_BUFFER_LEN) continue;
+		}
+		LastAPICallLine = __LINE__ + 1;
+		if (!WriteFile(hIndex, Buffer.c_str(), (DWORD)Buffer.length() * sizeof(TCHAR), NULL, NULL))
+		{
+			StringCchPrintf(szMessage, 600,
+				_T("API Error occurred in WriteFile() at line %ld error code %ld"), LastAPICallLine, GetLastError());
+			MessageBox(hWnd, szMessage, _T("MarkDuplicates.cpp"), MB_OK + MB_ICONSTOP);
+			bFailed = true;
+			break;
+		}
+		Buffer.clear();
+		if (!bMore) break;
+	}
+	CloseHandle(hIndex);
+	if (pScan->IsOverLimit())
+	{
+		StringCchPrintf(szMessage, 600, _T("The scan stayed over the memory limit of %d MB with its lists spilled, ")
+			_T("and was stopped.\nRaise the limit, or set it to 0 for no limit."), MaxMemoryMB);
+		MessageBox(hWnd, szMessage, _T("MarkDuplicates.cpp"), MB_OK + MB_ICONSTOP);
+		bFailed = true;
+	}
+	else if (pScan->GetError() != 0)
+	{
+		StringCchPrintf(szMessage, 600, _T("The runs of the bounded scan could not be written or read in %s, error %d."),
+			SpillSorter::GetTempDirectory().c_str(), pScan->GetError());
+		MessageBox(hWnd, szMessage, _T("MarkDuplicates.cpp"), MB_OK + MB_ICONSTOP);
+		bFailed = true;
+	}
+
+	// Report how the scan kept to the limit.
+	QueryPerformanceCounter(&liEnd);
+	TCHAR szSqueezes[48] = _T(""), szSkipped[64] = _T("");
+	if (pScan->GetSqueezes() > 0) StringCchPrintf(szSqueezes, 48, _T(", near it %d times"), pScan->GetSqueezes());
+	if (Skipped > 0) StringCchPrintf(szSkipped, 64, _T(" %llu could not be read, and were skipped."), Skipped);
+	StringCchPrintf(szMessage, 600,
+		_T("%s%llu files listed in %.3f seconds. %llu of them share their size, and were hashed in %d batches.%s\n")
+		_T("%llu duplicates hold %llu MB. %d runs spilled %llu MB.\n")
+		_T("Peak memory %llu MB, for a limit of %d MB%s.\n\n")
+		_T("The index is %s. Load it to mark the duplicates.\n"),
+		bFailed ? _T("Failed. ") : bAbort ? _T("Aborted. ") : _T(""), pScan->GetFiles(),
+		(double)(liEnd.QuadPart - liStart.QuadPart) / liFrequency.QuadPart, pScan->GetCandidates(), pScan->GetBatches(),
+		szSkipped, pScan->GetDuplicates(), pScan->GetDuplicateBytes() / 1048576, pScan->GetRuns(), pScan->GetSpilledBytes() / 1048576,
+		SpillSorter::GetPeakResidentBytes() / 1048576, MaxMemoryMB, szSqueezes, szIndexName);
+	OutputDebugString(szMessage);
+	MessageBeep(MB_ICONASTERISK);
+	ReleaseDC(hWnd, dc);
+	MessageBox(hWnd, szMessage, szTitle, MB_OK);
+
+	delete pScan;
+	return !bAbort && !bFailed;
+}
+
 
 
 // Message handler for modeless dialog box.
@@ -1529,3 +2127,165 @@ INT_PTR CALLBACK MDBoxProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam
 	}
 	return false;
 }
+
+// Scan the files of a path list when the command line asks for it, instead of opening the window:
+//
+//   MarkDuplicates /paths <list|-> [/null] [/jsonl] [/output <file|->] [/inflight <files>]
+//
+// The list is read from a file, or from the standard input for -, with one name per line, or with
+// /null each name ended by a NUL, as find -print0 writes them. The duplicate groups are written to
+// the standard output, or to a file, as PathListScan.cpp describes, each batch's as soon as it is
+// hashed. The scan uses the saved hash order and read options, each batch starts from the tuning
+// profile of the volume of its first file, and with /inflight, coroutines keep that many files in
+// flight, for a list of files on a network share. A listed file that cannot be opened or read is
+// named on the standard error and left out of the groups. Returns -1 if the command line does not
+// ask for a path list scan, else the exit code: 0 once the groups are written, 1 on an error.
+int RunPathList()
+{
+	int argc;
+	TCHAR** argv = CommandLineToArgvW(GetCommandLine(), &argc);
+	if (argv == NULL) return -1;
+	const TCHAR* pszList = NULL;
+	const TCHAR* pszOutput = _T("-");
+	const TCHAR* pszBadArgument = NULL;
+	char Delimiter = '\n';
+	int Format = PATHLIST_FORMAT_NUL;
+	int InFlight = -1;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (_tcsicmp(argv[i], _T("/paths")) == 0 && i + 1 < argc) pszList = argv[++i];
+		else if (_tcsicmp(argv[i], _T("/output")) == 0 && i + 1 < argc) pszOutput = argv[++i];
+		else if (_tcsicmp(argv[i], _T("/null")) == 0) Delimiter = '\0';
+		else if (_tcsicmp(argv[i], _T("/jsonl")) == 0) Format = PATHLIST_FORMAT_JSONL;
+		else if (_tcsicmp(argv[i], _T("/inflight")) == 0 && i + 1 < argc) InFlight = max(_wtoi(argv[++i]), 0);
+		else if (pszBadArgument == NULL) pszBadArgument = argv[i];
+	}
+	if (pszList == NULL)
+	{
+		LocalFree(argv);
+		return -1;
+	}
+
+	// The messages go to the standard error when it is redirected, as it is in a pipeline, else to a box.
+	TCHAR szMessage[400];
+	HANDLE hError = GetStdHandle(STD_ERROR_HANDLE);
+	auto Report = [&]()
+	{
+		if (hError == NULL || hError == INVALID_HANDLE_VALUE)
+		{
+			MessageBox(NULL, szMessage, szTitle, MB_OK | MB_ICONEXCLAMATION);
+			return;
+		}
+		char szText[1200];
+		int cbText = WideCharToMultiByte(CP_UTF8, 0, szMessage, -1, szText, 1200, NULL, NULL);
+		DWORD cbWritten;
+		if (cbText > 1) WriteFile(hError, szText, cbText - 1, &cbWritten, NULL);
+	};
+	if (pszBadArgument != NULL)
+	{
+		StringCchPrintf(szMessage, 400, _T("MarkDuplicates: unknown argument %s\n")
+			_T("Usage: MarkDuplicates /paths <list|-> [/null] [/jsonl] [/output <file|->] [/inflight <files>]\n"), pszBadArgument);
+		Report();
+		LocalFree(argv);
+		return 1;
+	}
+	HANDLE hInput = _tcscmp(pszList, _T("-")) == 0 ? GetStdHandle(STD_INPUT_HANDLE) :
+		CreateFile(pszList, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	HANDLE hOutput = _tcscmp(pszOutput, _T("-")) == 0 ? GetStdHandle(STD_OUTPUT_HANDLE) :
+		CreateFile(pszOutput, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hInput == NULL || hInput == INVALID_HANDLE_VALUE || hOutput == NULL || hOutput == INVALID_HANDLE_VALUE)
+	{
+		StringCchPrintf(szMessage, 400, _T("MarkDuplicates: cannot open %s, error code %ld\n"),
+			hInput == NULL || hInput == INVALID_HANDLE_VALUE ? pszList : pszOutput, GetLastError());
+		Report();
+		if (hInput != NULL && hInput != INVALID_HANDLE_VALUE && _tcscmp(pszList, _T("-")) != 0) CloseHandle(hInput);
+		LocalFree(argv);
+		return 1;
+	}
+
+	// Use the hash order, the read options, and the settings of <Edit><Threads> that the window saved,
+	// and the tuning profiles. /inflight overrides the saved files in flight.
+	ApplicationRegistry* pAppReg = new ApplicationRegistry;
+	BOOL bRegistry = pAppReg->Init(NULL);
+	if (bRegistry)
+	{
+		pAppReg->LoadMemoryBlock(_T("HashOrder"), (LPBYTE)&iHashOrder, sizeof(iHashOrder));
+		pAppReg->LoadMemoryBlock(_T("HashLanes"), (LPBYTE)&bHashLanes, sizeof(bHashLanes));
+		pAppReg->LoadMemoryBlock(_T("ReadOptions"), (LPBYTE)&iReadOptions, sizeof(iReadOptions));
+		iReadOptions &= READ_NOATIME | READ_DROPBEHIND | READ_UNBUFFERED;
+		LoadScanSettings(pAppReg);
+	}
+	if (InFlight >= 0) FilesInFlight = InFlight;
+
+	// Read the list, then hash it a batch at a time, writing the groups of each batch once it is hashed.
+	// The disk order is not known for a list, so it is hashed in scan order instead. Each device of a
+	// batch is read by as many readers as the tuning profile of its volume found best, if the volume was
+	// calibrated. The reads of a batch are as long as the longest its profiles ask for, and unbuffered
+	// only if every device of the batch reads faster that way.
+	ThreadPool* pPool = new ThreadPool(Threads, CpuSet, bPinThreads != 0);
+	PathListScan* pScan = new PathListScan(hOutput, Format);
+	RateLimiter* pLimiter = new RateLimiter(MaxMBytesPerSecond * 1048576, MaxOpensPerSecond);
+	BOOL bDone = pScan->ReadList(hInput, Delimiter);
+	HashedFiles* pBatch;
+	uint64_t Skipped = 0;
+	while (bDone && (pBatch = pScan->NextBatch()) != NULL)
+	{
+		pBatch->SetHashOrder(iHashOrder == HASH_BY_LOCATION ? HASH_BY_SCAN : iHashOrder);
+		pBatch->SetHashLanes(bHashLanes);
+		int ReadSize = 0, StartReaders = 0;
+		BOOL bUnbuffered = true;
+		for (int Device = 0; Device < pBatch->GetDeviceCount(); ++Device)
+		{
+			TuningProfile Profile;
+			BOOL bProfile = bRegistry && pAppReg->LoadMemoryBlock(StorageCalibration::GetProfileName(
+				StorageDevice::GetVolumeId(pScan->GetDeviceDirectory(Device))), (LPBYTE)&Profile, sizeof(Profile));
+			if (bProfile) pBatch->SetDeviceLimit(Device, Profile.Readers);
+			ReadSize = max(ReadSize, bProfile ? Profile.ReadSize : PIPELINE_BUFFER_LEN);
+			StartReaders += bProfile ? Profile.Readers : PIPELINE_READERS;
+			bUnbuffered = bUnbuffered && bProfile && Profile.Unbuffered;
+		}
+		int ReadOptions = iReadOptions | READ_SEQUENTIAL | (bUnbuffered ? READ_UNBUFFERED : 0);
+		HashEngine* pHashEngine = CreateHashEngine(pBatch, pPool, pPool->GetThreadCount(),
+			ReadSize, min(StartReaders, MAX_PIPELINE_READERS), ReadOptions);
+		pHashEngine->SetLimiter(pLimiter, bLowPriority != 0);
+		pHashEngine->Start();
+		pHashEngine->Wait();
+		uint64_t BatchSkipped = pHashEngine->GetSkipped();
+		delete pHashEngine;
+
+		// The files that could not be read, deleted or locked since they were listed, have no hash,
+		// which leaves them out of the groups. Each is named on the standard error, if there is one.
+		Skipped += BatchSkipped;
+		for (int i = 0; BatchSkipped > 0 && hError != NULL && hError != INVALID_HANDLE_VALUE && i < pBatch->GetNodeCount(); ++i)
+		{
+			HashedFiles::FileRow Row;
+			pBatch->GetRow(i, Row);
+			if (!Row.FileHash->empty()) continue;
+			StringCchPrintf(szMessage, 400, _T("MarkDuplicates: skipped %s, which could not be read\n"), Row.FileName->c_str());
+			Report();
+		}
+		bDone = pScan->WriteGroups();
+	}
+	if (bDone)
+	{
+		StringCchPrintf(szMessage, 400, _T("MarkDuplicates: %llu names, %llu not files, %llu hashed in %d batches, ")
+			_T("%llu skipped, %llu groups, %llu duplicates of %llu MB\n"), pScan->GetListed(), pScan->GetMissing(),
+			pScan->GetCandidates() - Skipped, pScan->GetBatches(), Skipped, pScan->GetGroups(), pScan->GetDuplicates(),
+			pScan->GetDuplicateBytes() / 1048576);
+	}
+	else
+	{
+		StringCchPrintf(szMessage, 400, _T("MarkDuplicates: cannot %s the %s, error code %ld\n"),
+			pScan->GetBatches() == 0 ? _T("read") : _T("write"), pScan->GetBatches() == 0 ? _T("list") : _T("groups"),
+			pScan->GetError());
+	}
+	Report();
+	delete pLimiter;
+	delete pScan;
+	delete pPool;
+	delete pAppReg;
+	if (_tcscmp(pszList, _T("-")) != 0) CloseHandle(hInput);
+	if (_tcscmp(pszOutput, _T("-")) != 0) CloseHandle(hOutput);
+	LocalFree(argv);
+	return bDone ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+///////////////////////////////////////////////////////////////////////////////
+// PathListScan.cpp - Scans the files named by a list, such as the output of
+//                    find -print0, and writes their duplicate groups as they
+//                    are found, for a shell pipeline.
+//
+// The list is read from a file or a pipe, one UTF-8 name per line, or per
+// NUL terminated record. A name is looked at as it is read, and kept with
+// its size and write time if it is a file; a tar archive brings its members
+// too, as a scan lists them. Once the list has ended, the files are put in
+// size order and those whose size no other file has are dropped, since
+// they cannot have a duplicate. The storage device of each file is found
+// from its directory, once per directory, so that a list that spans disks
+// is read from each disk by readers of its own.
+//
+// The files left are loaded into a HashedFiles a batch at a time, for a
+// HashPipeline to hash. A batch always holds every file of each size in it,
+// so that once it is hashed, its duplicate groups are whole and can be
+// written at once, before the next batch starts. The smallest files come
+// first, so the first groups come out soon. A group is written as its
+// names, each followed by a NUL and the last by one more, or as a line of
+// JSON with the hash, the size of each member, and the names.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PathListScan.h"
+#include "StorageDevice.h"
+#include <algorithm>
+
+//=============================================================================
+// Constructor - The groups are written to hOutput in Format, a
+//               PATHLIST_FORMAT.
+//=============================================================================
+
+PathListScan::PathListScan(HANDLE hOutput, int Format)
+{
+	_Next = 0;
+	_Batch = new HashedFiles;
+	_hOutput = hOutput;
+	_Format = Format;
+	_Listed = 0;
+	_Missing = 0;
+	_Batches = 0;
+	_Groups = 0;
+	_Duplicates = 0;
+	_DuplicateBytes = 0;
+	_Error = 0;
+}
+
+//=============================================================================
+// ReadList - Reads the names of the list from hInput, each ended by
+//            Delimiter or by the end of the input, and keeps the files that
+//            share their size in size order. A carriage return before a
+//            newline is dropped, and so are empty names.
+//=============================================================================
+
+bool PathListScan::ReadList(HANDLE hInput, char Delimiter)
+{
+	FileReader* pListReader = FileReader::Create(READ_ENGINE_SYNC, 1, 0);
+	TarArchive* pLister = new TarArchive(pListReader, TAR_LIST_BUFFER_LEN, true);
+	char* pBuffer = new char[PATHLIST_READ_LEN];
+	std::string Name;
+	DWORD cbRead = 0;
+	for (;;)
+	{
+		if (!ReadFile(hInput, pBuffer, PATHLIST_READ_LEN, &cbRead, NULL))
+		{
+			DWORD Error = GetLastError();
+			if (Error != ERROR_BROKEN_PIPE) _Error = Error; // A pipe ends broken once its writer is done.
+			cbRead = 0;
+		}
+		for (DWORD i = 0; i <= cbRead; ++i)
+		{
+			if (i < cbRead && pBuffer[i] != Delimiter)
+			{
+				Name += pBuffer[i];
+				continue;
+			}
+			if (i == cbRead && cbRead > 0) break; // The name goes on in the next read.
+			if (Delimiter == '\n' && !Name.empty() && Name.back() == '\r') Name.pop_back();
+			if (!Name.empty())
+			{
+				int cchName = MultiByteToWideChar(CP_UTF8, 0, Name.data(), (int)Name.length(), NULL, 0);
+				wstring FileName(cchName, _T('\0'));
+				MultiByteToWideChar(CP_UTF8, 0, Name.data(), (int)Name.length(), &FileName[0], cchName);
+				AddFile(FileName, pLister);
+			}
+			Name.clear();
+		}
+		if (cbRead == 0) break;
+	}
+	delete[] pBuffer;
+	delete pLister;
+	delete pListReader;
+
+	// Only the files that share their size with another file are hashed.
+	std::stable_sort(_Files.begin(), _Files.end(),
+		[](const ListedFile& a, const ListedFile& b) { return a.Bytes < b.Bytes; });
+	size_t Kept = 0;
+	for (size_t i = 0; i < _Files.size(); ++i)
+	{
+		if ((i == 0 || _Files[i - 1].Bytes != _Files[i].Bytes) &&
+		    (i + 1 == _Files.size() || _Files[i + 1].Bytes != _Files[i].Bytes)) continue;
+		if (Kept != i) _Files[Kept] = std::move(_Files[i]);
+		Kept++;
+	}
+	_Files.resize(Kept);
+	return _Error == 0;
+}
+
+//=============================================================================
+// AddFile - Keeps a listed name, with its size and write time, if it is a
+//           file, and the members of a tar archive too.
+//=============================================================================
+
+void PathListScan::AddFile(const wstring& FileName, TarArchive* pLister)
+{
+	_Listed++;
+	WIN32_FILE_ATTRIBUTE_DATA Data;
+	if (!GetFileAttributesEx(FileName.c_str(), GetFileExInfoStandard, &Data) ||
+	    (Data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+	{
+		_Missing++;
+		return;
+	}
+	ListedFile File;
+	File.Bytes = (uint64_t)Data.nFileSizeHigh << 32 | Data.nFileSizeLow;
+	File.WriteTime = (uint64_t)Data.ftLastWriteTime.dwHighDateTime << 32 | Data.ftLastWriteTime.dwLowDateTime;
+	File.Location = 0;
+	File.Member = false;
+	File.Device = FindDevice(FileName);
+	File.FileName = FileName;
+	_Files.push_back(File);
+	if (!TarArchive::IsArchive(FileName) || !pLister->Open(FileName)) return;
+	TarMember Member;
+	while (pLister->Next(Member))
+	{
+		File.Bytes = Member.Size;
+		File.WriteTime = Member.WriteTime;
+		File.Location = Member.Offset;
+		File.Member = true;
+		File.FileName = FileName + TAR_SEPARATOR + Member.Name;
+		_Files.push_back(File);
+	}
+	pLister->Close();
+}
+
+//=============================================================================
+// FindDevice - Returns the index of the storage device that holds a file,
+//              looking up the device of its directory the first time the
+//              directory is seen.
+//=============================================================================
+
+int PathListScan::FindDevice(const wstring& FileName)
+{
+	size_t Slash = FileName.find_last_of(_T("\\/"));
+	wstring Directory = Slash == wstring::npos ? wstring(_T(".")) : FileName.substr(0, Slash + 1);
+	auto Found = _Directories.find(Directory);
+	if (Found != _Directories.end()) return Found->second;
+	wstring Name = StorageDevice::GetName(Directory);
+	int Device = 0;
+	while (Device < (int)_DeviceNames.size() && _DeviceNames[Device] != Name) ++Device;
+	if (Device == (int)_DeviceNames.size())
+	{
+		_DeviceNames.push_back(Name);
+		_DeviceDirectories.push_back(Directory);
+	}
+	_Directories[Directory] = Device;
+	return Device;
+}
+
+//=============================================================================
+// NextBatch - Loads the files of the next sizes into the batch, up to
+//             PATHLIST_BATCH_FILES or PATHLIST_BATCH_BYTES, but always every
+//             file of a size, and returns it for hashing. The batch holds
+//             only the devices of its files. Returns NULL when every file
+//             has been loaded.
+//=============================================================================
+
+HashedFiles* PathListScan::NextBatch()
+{
+	_Batch->Reset();
+	_BatchDevices.clear();
+	std::vector<int> Devices(_DeviceNames.size(), -1); // The index in the batch of each device.
+	size_t First = _Next;
+	uint64_t Bytes = 0;
+	while (_Next < _Files.size() && (_Next == First || (_Next - First < PATHLIST_BATCH_FILES && Bytes < PATHLIST_BATCH_BYTES)))
+	{
+		uint64_t Size = _Files[_Next].Bytes;
+		for (; _Next < _Files.size() && _Files[_Next].Bytes == Size; ++_Next)
+		{
+			const ListedFile& File = _Files[_Next];
+			if (Devices[File.Device] < 0)
+			{
+				Devices[File.Device] = _Batch->AddDevice(_DeviceNames[File.Device]);
+				if (Devices[File.Device] == (int)_BatchDevices.size()) _BatchDevices.push_back(File.Device);
+			}
+			_Batch->AddNode(_T(""), File.WriteTime, File.Bytes, File.FileName, Devices[File.Device], File.Location, File.Member);
+			Bytes += File.Bytes;
+		}
+	}
+	if (_Batch->GetNodeCount() == 0) return NULL;
+	_Batches++;
+	return _Batch;
+}
+
+//=============================================================================
+// WriteGroups - Sorts the hashed batch by hash and writes its duplicate
+//               groups to the output, in one write. Files left unhashed by
+//               an abort are left out. Returns false if the write failed.
+//=============================================================================
+
+bool PathListScan::WriteGroups()
+{
+	_Batch->RemoveUnhashed();
+	_Batch->SortAndCheck(0);
+	_Output.clear();
+	for (int i = 0; i < _Batch->GetNodeCount(); )
+	{
+		int Group = _Batch->GetNodeGroup(i);
+		if (Group < 0)
+		{
+			++i;
+			continue;
+		}
+		int Members;
+		uint64_t Bytes, Reclaimable;
+		_Batch->GetGroup(Group, Members, Bytes, Reclaimable);
+		HashedFiles::FileRow Row;
+		_Batch->GetRow(i, Row);
+		if (_Format == PATHLIST_FORMAT_JSONL)
+		{
+			// The hash as lower case hex, without the spaces between its bytes.
+			_Output += "{\"sha1\":\"";
+			for (TCHAR c : *Row.FileHash) if (c != _T(' ')) _Output += (char)(c >= _T('A') && c <= _T('F') ? c - _T('A') + 'a' : c);
+			_Output += "\",\"size\":" + std::to_string(Bytes) + ",\"files\":[";
+		}
+		for (int Member = 0; Member < Members; ++Member, ++i)
+		{
+			_Batch->GetRow(i, Row);
+			if (_Format == PATHLIST_FORMAT_JSONL && Member > 0) _Output += ',';
+			AppendName(*Row.FileName);
+		}
+		_Output += _Format == PATHLIST_FORMAT_JSONL ? "]}\n" : std::string(1, '\0');
+		_Groups++;
+		_Duplicates += Members - 1;
+		_DuplicateBytes += (Members - 1) * Bytes;
+	}
+	DWORD cbWritten;
+	if (!_Output.empty() && !WriteFile(_hOutput, _Output.data(), (DWORD)_Output.length(), &cbWritten, NULL))
+	{
+		if (_Error == 0) _Error = GetLastError();
+		return false;
+	}
+	return true;
+}
+
+//=============================================================================
+// AppendName - Appends a name to the output in UTF-8, as a JSON string or
+//              ended by a NUL.
+//=============================================================================
+
+void PathListScan::AppendName(const wstring& FileName)
+{
+	int cbName = WideCharToMultiByte(CP_UTF8, 0, FileName.data(), (int)FileName.length(), NULL, 0, NULL, NULL);
+	std::string Name(cbName, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, FileName.data(), (int)FileName.length(), &Name[0], cbName, NULL, NULL);
+	if (_Format != PATHLIST_FORMAT_JSONL)
+	{
+		_Output += Name;
+		_Output += '\0';
+		return;
+	}
+	_Output += '"';
+	for (char c : Name)
+	{
+		if (c == '"' || c == '\\')
+		{
+			_Output += '\\';
+			_Output += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char szEscape[8];
+			sprintf_s(szEscape, 8, "\\u%04x", (unsigned char)c);
+			_Output += szEscape;
+		}
+		else _Output += c;
+	}
+	_Output += '"';
+}
\ No newline at end of file
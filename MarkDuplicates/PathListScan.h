@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+// PathListScan.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "framework.h"
+#include "HashedFiles.h"
+#include "TarArchive.h"
+#include <map>
+#include <string>
+#include <vector>
+
+#define PATHLIST_READ_LEN (64 * 1024)                  // Bytes of the list read at a time.
+#define PATHLIST_BATCH_FILES 4096                      // Files in a batch, unless the files of one size are more.
+#define PATHLIST_BATCH_BYTES (1024ULL * 1024 * 1024)   // Bytes in a batch, unless the files of one size are more.
+#define PATHLIST_FORMAT_NUL 0                          // Each name ends with a NUL, and each group with one more.
+#define PATHLIST_FORMAT_JSONL 1                        // Each group is a JSON object on a line of its own.
+
+class PathListScan
+{
+private:
+	typedef struct tagListedFile
+	{
+		uint64_t Bytes;
+		uint64_t WriteTime; // UTC FILETIME.
+		uint64_t Location;  // Where a member of an archive starts in it, else 0.
+		bool     Member;    // A member of an archive, listed from its headers.
+		int      Device;    // Index in _DeviceNames.
+		wstring  FileName;
+	} ListedFile;
+	std::vector<ListedFile> _Files;    // The listed files that share their size, in size order.
+	std::map<wstring, int> _Directories; // The device of each directory seen, so that each is looked up once.
+	std::vector<wstring> _DeviceNames;
+	std::vector<wstring> _DeviceDirectories; // The first directory seen on each device.
+	std::vector<int> _BatchDevices;    // The index in _DeviceNames of each device of the batch.
+	size_t       _Next;                // The first file not yet in a batch.
+	HashedFiles* _Batch;
+	HANDLE       _hOutput;
+	int          _Format;
+	std::string  _Output;              // The groups of a batch, in UTF-8, reused by every batch.
+	uint64_t     _Listed;
+	uint64_t     _Missing;             // Names that are not files, or could not be looked at.
+	int          _Batches;
+	uint64_t     _Groups;
+	uint64_t     _Duplicates;
+	uint64_t     _DuplicateBytes;
+	DWORD        _Error;               // System error code of the first failed read or write, 0 if none.
+	void         AddFile(const wstring& FileName, TarArchive* pLister);
+	int          FindDevice(const wstring& FileName);
+	void         AppendName(const wstring& FileName);
+public:
+	PathListScan(HANDLE hOutput, int Format);
+	~PathListScan() { delete _Batch; }
+	bool         ReadList(HANDLE hInput, char Delimiter);
+	HashedFiles* NextBatch();
+	bool         WriteGroups();
+	const wstring& GetDeviceDirectory(int Device) const { return _DeviceDirectories[_BatchDevices[Device]]; }
+	uint64_t     GetListed() const { return _Listed; }
+	uint64_t     GetMissing() const { return _Missing; }
+	uint64_t     GetCandidates() const { return _Files.size(); }
+	int          GetBatches() const { return _Batches; }
+	uint64_t     GetGroups() const { return _Groups; }
+	uint64_t     GetDuplicates() const { return _Duplicates; }
+	uint64_t     GetDuplicateBytes() const { return _DuplicateBytes; }
+	DWORD        GetError() const { return _Error; }
+};
\ No newline at end of file
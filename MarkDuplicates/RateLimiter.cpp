@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////////
+// RateLimiter.cpp - Caps the bytes read and the files opened per second by
+//                   all the readers of a scan, so that a scan of a live
+//                   file server leaves it room for its users.
+//
+// Each cap is a token bucket, refilled at the rate and holding at most
+// RATE_BURST_SECONDS of it. A reader takes its tokens after a read, when
+// the size is known. It waits only while the bucket is in debt, so a read
+// larger than the bucket goes through and the readers after it wait until
+// the debt is paid; over time the rate is held whatever the read size. The
+// rates may be changed while the readers run, and the waits are short
+// slices, so a new rate or a cancel is seen within RATE_WAIT_SLICE_MS.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RateLimiter.h"
+#include <thread>
+
+//=============================================================================
+// Constructor - A rate of 0 leaves that cap off.
+//=============================================================================
+
+RateLimiter::RateLimiter(double BytesPerSecond, double OpensPerSecond)
+{
+	_BytesPerSecond = BytesPerSecond > 0 ? BytesPerSecond : 0;
+	_OpensPerSecond = OpensPerSecond > 0 ? OpensPerSecond : 0;
+	_ByteTokens = 0;
+	_OpenTokens = 0;
+	_Refilled = std::chrono::steady_clock::now();
+	_Bytes = 0;
+	_Opens = 0;
+}
+
+//=============================================================================
+// SetRates - Changes the caps, even while readers are waiting. A debt run
+//            up under the old rate is kept, but no more than the new
+//            bucket holds, so that raising a cap takes effect at once.
+//=============================================================================
+
+void RateLimiter::SetRates(double BytesPerSecond, double OpensPerSecond)
+{
+	std::lock_guard<std::mutex> Lock(_Lock);
+	Refill();
+	_BytesPerSecond = BytesPerSecond > 0 ? BytesPerSecond : 0;
+	_OpensPerSecond = OpensPerSecond > 0 ? OpensPerSecond : 0;
+	double ByteBucket = _BytesPerSecond * RATE_BURST_SECONDS, OpenBucket = _OpensPerSecond * RATE_BURST_SECONDS;
+	if (_ByteTokens < -ByteBucket) _ByteTokens = -ByteBucket;
+	if (_OpenTokens < -OpenBucket) _OpenTokens = -OpenBucket;
+}
+
+double RateLimiter::GetBytesPerSecond()
+{
+	std::lock_guard<std::mutex> Lock(_Lock);
+	return _BytesPerSecond;
+}
+
+double RateLimiter::GetOpensPerSecond()
+{
+	std::lock_guard<std::mutex> Lock(_Lock);
+	return _OpensPerSecond;
+}
+
+//=============================================================================
+// TakeBytes - Counts Bytes read, and waits while the byte bucket is in
+//             debt. Returns false if cancelled while waiting.
+// TakeOpen  - The same for a file opened.
+//=============================================================================
+
+bool RateLimiter::TakeBytes(uint64_t Bytes, const std::atomic<bool>* pCancel)
+{
+	_Bytes += Bytes;
+	return Take(_ByteTokens, _BytesPerSecond, (double)Bytes, pCancel);
+}
+
+bool RateLimiter::TakeOpen(const std::atomic<bool>* pCancel)
+{
+	_Opens++;
+	return Take(_OpenTokens, _OpensPerSecond, 1, pCancel);
+}
+
+//=============================================================================
+// TryTakeBytes - Counts Bytes read, unless the byte bucket is in debt, when
+//                it takes nothing and returns false at once, for a caller
+//                that has other work to do instead of waiting.
+// TryTakeOpen  - The same for a file opened.
+//=============================================================================
+
+bool RateLimiter::TryTakeBytes(uint64_t Bytes)
+{
+	if (!TryTake(_ByteTokens, _BytesPerSecond, (double)Bytes)) return false;
+	_Bytes += Bytes;
+	return true;
+}
+
+bool RateLimiter::TryTakeOpen()
+{
+	if (!TryTake(_OpenTokens, _OpensPerSecond, 1)) return false;
+	_Opens++;
+	return true;
+}
+
+//=============================================================================
+// Refill - Adds the tokens earned since the last refill, up to a full
+//          bucket. The lock is held.
+//=============================================================================
+
+void RateLimiter::Refill()
+{
+	auto Now = std::chrono::steady_clock::now();
+	double Seconds = std::chrono::duration<double>(Now - _Refilled).count();
+	_Refilled = Now;
+	double ByteBucket = _BytesPerSecond * RATE_BURST_SECONDS, OpenBucket = _OpensPerSecond * RATE_BURST_SECONDS;
+	_ByteTokens = _ByteTokens + Seconds * _BytesPerSecond > ByteBucket ? ByteBucket : _ByteTokens + Seconds * _BytesPerSecond;
+	_OpenTokens = _OpenTokens + Seconds * _OpensPerSecond > OpenBucket ? OpenBucket : _OpenTokens + Seconds * _OpensPerSecond;
+}
+
+//=============================================================================
+// Take - Waits, in slices, until Tokens is out of debt, then takes Amount.
+//        Rate is read under the lock each time, so that a cap changed or
+//        removed while waiting applies to the wait.
+//=============================================================================
+
+bool RateLimiter::Take(double& Tokens, const double& Rate, double Amount, const std::atomic<bool>* pCancel)
+{
+	for (;;)
+	{
+		double WaitSeconds;
+		{
+			std::lock_guard<std::mutex> Lock(_Lock);
+			if (Rate <= 0) return true;
+			Refill();
+			if (Tokens >= 0)
+			{
+				Tokens -= Amount;
+				return true;
+			}
+			WaitSeconds = -Tokens / Rate;
+		}
+		if (pCancel != NULL && pCancel->load()) return false;
+		int Milliseconds = WaitSeconds * 1000 < RATE_WAIT_SLICE_MS ? (int)(WaitSeconds * 1000) + 1 : RATE_WAIT_SLICE_MS;
+		std::this_thread::sleep_for(std::chrono::milliseconds(Milliseconds));
+	}
+}
+
+//=============================================================================
+// TryTake - Takes Amount if Tokens is out of debt, and otherwise returns
+//           false at once.
+//=============================================================================
+
+bool RateLimiter::TryTake(double& Tokens, const double& Rate, double Amount)
+{
+	std::lock_guard<std::mutex> Lock(_Lock);
+	if (Rate <= 0) return true;
+	Refill();
+	if (Tokens < 0) return false;
+	Tokens -= Amount;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+// RateLimiter.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+#define RATE_BURST_SECONDS 0.1 // Tokens a bucket holds, in seconds of its rate.
+#define RATE_WAIT_SLICE_MS 50  // Longest sleep, so that a cancel or a new rate is seen.
+
+class RateLimiter
+{
+private:
+	std::mutex                            _Lock;
+	double                                _BytesPerSecond; // 0 for no limit.
+	double                                _OpensPerSecond; // 0 for no limit.
+	double                                _ByteTokens;     // Negative while in debt.
+	double                                _OpenTokens;
+	std::chrono::steady_clock::time_point _Refilled;
+	std::atomic<uint64_t>                 _Bytes;          // Bytes taken, limited or not.
+	std::atomic<uint64_t>                 _Opens;
+	void Refill();
+	bool Take(double& Tokens, const double& Rate, double Amount, const std::atomic<bool>* pCancel);
+	bool TryTake(double& Tokens, const double& Rate, double Amount);
+public:
+	RateLimiter(double BytesPerSecond = 0, double OpensPerSecond = 0);
+	void     SetRates(double BytesPerSecond, double OpensPerSecond);
+	double   GetBytesPerSecond();
+	double   GetOpensPerSecond();
+	bool     TakeBytes(uint64_t Bytes, const std::atomic<bool>* pCancel = NULL);
+	bool     TakeOpen(const std::atomic<bool>* pCancel = NULL);
+	bool     TryTakeBytes(uint64_t Bytes);
+	bool     TryTakeOpen();
+	uint64_t GetBytes() const { return _Bytes; }
+	uint64_t GetOpens() const { return _Opens; }
+};
\ No newline at end of file
@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+// RowLayout.cpp - The vertical layout of the rows of the display. Each row
+//                 is one or more lines high; the lines before a row's last
+//                 line are the blank spacing that separates the groups. The
+//                 heights are kept in a Fenwick tree of prefix sums, so that
+//                 finding the first line of a row, finding the row at a
+//                 line, and changing the height of a row when its Duplicate
+//                 flag changes all take O(log n), with no allocation after
+//                 the layout has been built.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RowLayout.h"
+
+//=============================================================================
+// Constructor - Initialize an empty layout.
+//=============================================================================
+
+RowLayout::RowLayout()
+{
+	_Tree = new int[1];
+	_Height = new int[1];
+	_RowCount = 0;
+	_Allocated = 0;
+	_TopStep = 0;
+}
+
+//=============================================================================
+// Reset - Sizes the layout for RowCount rows, all zero lines high. The
+//         arrays are only reallocated when they need to grow. Load the
+//         heights with LoadHeight and then call Build.
+//=============================================================================
+
+void RowLayout::Reset(int RowCount)
+{
+	if (RowCount > _Allocated)
+	{
+		delete[] _Tree;
+		delete[] _Height;
+		_Tree = new int[RowCount + 1];
+		_Height = new int[RowCount + 1];
+		_Allocated = RowCount;
+	}
+	_RowCount = RowCount;
+	for (int i = 0; i < _RowCount; ++i) _Height[i] = 0;
+	for (int i = 0; i <= _RowCount; ++i) _Tree[i] = 0;
+	for (_TopStep = 1; _TopStep * 2 <= _RowCount; _TopStep *= 2);
+	if (_RowCount == 0) _TopStep = 0;
+}
+
+//=============================================================================
+// Build - Builds the tree from the loaded heights in O(n).
+//=============================================================================
+
+void RowLayout::Build()
+{
+	for (int i = 1; i <= _RowCount; ++i) _Tree[i] = _Height[i - 1];
+	for (int i = 1; i <= _RowCount; ++i)
+	{
+		int Parent = i + (i & -i);
+		if (Parent <= _RowCount) _Tree[Parent] += _Tree[i];
+	}
+}
+
+//=============================================================================
+// SetHeight - Changes the height of one row.
+//=============================================================================
+
+void RowLayout::SetHeight(int Row, int Height)
+{
+	if (Row < 0 || Row > _RowCount - 1) return;
+	int Delta = Height - _Height[Row];
+	if (Delta == 0) return;
+	_Height[Row] = Height;
+	for (int i = Row + 1; i <= _RowCount; i += i & -i) _Tree[i] += Delta;
+}
+
+//=============================================================================
+// GetLineCount - Returns the height of all of the rows.
+//=============================================================================
+
+int RowLayout::GetLineCount() const
+{
+	return GetRowLine(_RowCount);
+}
+
+//=============================================================================
+// GetRowLine - Returns the first line of the row, i.e. the height of all of
+//              the rows before it.
+//=============================================================================
+
+int RowLayout::GetRowLine(int Row) const
+{
+	if (Row > _RowCount) Row = _RowCount;
+	int Line = 0;
+	for (int i = Row; i > 0; i -= i & -i) Line += _Tree[i];
+	return Line;
+}
+
+//=============================================================================
+// GetRowAtLine - Returns the row that holds the line. Lines before the first
+//                row or after the last row give the first or the last row.
+//=============================================================================
+
+int RowLayout::GetRowAtLine(int Line) const
+{
+	if (_RowCount == 0) return 0;
+
+	// Find the most rows whose height is not more than Line.
+	int Row = 0;
+	for (int Step = _TopStep; Step > 0; Step /= 2)
+	{
+		if (Row + Step <= _RowCount && _Tree[Row + Step] <= Line)
+		{
+			Row += Step;
+			Line -= _Tree[Row];
+		}
+	}
+	return Row < _RowCount ? Row : _RowCount - 1;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////////
+// RowLayout.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+class RowLayout
+{
+private:
+	int*         _Tree;      // Fenwick tree over _Height, 1-based.
+	int*         _Height;    // Height of each row, in lines.
+	int          _RowCount;
+	int          _Allocated;
+	int          _TopStep;   // Largest power of two <= _RowCount.
+public:
+	RowLayout();
+	~RowLayout() { delete[] _Tree; delete[] _Height; }
+	void Reset(int RowCount);
+	void LoadHeight(int Row, int Height) { _Height[Row] = Height; }
+	void Build();
+	void SetHeight(int Row, int Height);
+	int  GetHeight(int Row) const { return _Height[Row]; }
+	int  GetRowCount() const { return _RowCount; }
+	int  GetLineCount() const;
+	int  GetRowLine(int Row) const;
+	int  GetRowAtLine(int Line) const;
+};
\ No newline at end of file
@@ -0,0 +1,398 @@
+///////////////////////////////////////////////////////////////////////////////
+// SpillSorter.cpp - Sorts more records than fit in memory, for a scan that
+//                   is held to a memory limit.
+//
+// Records are added in any order and kept in memory until they cost
+// MemoryBytes. They are then sorted and spilled to a run, a temporary file
+// of records in order, and memory is freed for the next run. Finish sorts
+// what is left; if no run was spilled the records are returned from
+// memory, and otherwise the last of them are spilled too and the runs are
+// merged as they are read back, the least record of all the runs first.
+// A merge reads MAX_SPILL_MERGE runs at most, each through a buffer of
+// SPILL_IO_BUFFER_LEN bytes, so with more runs the oldest are first merged
+// into longer runs. The runs are deleted as they are merged, and all of
+// them when the sorter is deleted.
+//
+// The cost of a record is an estimate, the characters of its strings plus
+// SPILL_RECORD_OVERHEAD, and the limit can be lowered while records are
+// added, so that a caller that finds the process over its limit can spill
+// at once and keep the later runs smaller.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "SpillSorter.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static std::atomic<int> NextRunId(0); // Numbers the run files of the process.
+
+//=============================================================================
+// Constructor - Order is SPILL_BY_SIZE or SPILL_BY_HASH, and Compare orders
+//               the file names of records of one size or one hash. The runs
+//               are created in TempDirectory.
+//=============================================================================
+
+SpillSorter::SpillSorter(int Order, NameCompare Compare, uint64_t MemoryBytes, const std::wstring& TempDirectory)
+{
+	_Order = Order;
+	_Compare = Compare;
+	_MemoryBytes = MemoryBytes;
+	_TempDirectory = TempDirectory;
+	_RecordBytes = 0;
+	_NextRecord = 0;
+	_Finished = false;
+	_Added = 0;
+	_SpilledBytes = 0;
+	_RunsWritten = 0;
+	_Error = 0;
+}
+
+SpillSorter::~SpillSorter()
+{
+	for (size_t i = 0; i < _Runs.size(); ++i) DeleteRun(_Runs[i]);
+}
+
+//=============================================================================
+// Add - Takes Record, which is left empty, and spills the records in memory
+//       once they cost the limit. Returns false if a run cannot be written.
+//=============================================================================
+
+bool SpillSorter::Add(SpillRecord& Record)
+{
+	_RecordBytes += GetCost(Record);
+	_Records.push_back(std::move(Record));
+	_Added++;
+	return _RecordBytes < _MemoryBytes || Spill();
+}
+
+//=============================================================================
+// Spill - Sorts the records in memory and writes them to a new run, then
+//         frees their memory.
+//=============================================================================
+
+bool SpillSorter::Spill()
+{
+	if (_Finished || _Records.empty()) return true;
+	std::sort(_Records.begin(), _Records.end(),
+		[this](const SpillRecord& Record1, const SpillRecord& Record2) { return Less(Record1, Record2); });
+	Run pRun = CreateRun();
+	if (pRun == NULL) return false;
+	_Runs.push_back(pRun);
+	for (size_t i = 0; i < _Records.size(); ++i) if (!WriteRecord(pRun->File, _Records[i])) return false;
+	if (fclose(pRun->File) != 0 && _Error == 0) _Error = errno != 0 ? errno : EIO;
+	pRun->File = NULL;
+	std::vector<SpillRecord>().swap(_Records);
+	_RecordBytes = 0;
+	_RunsWritten++;
+	return _Error == 0;
+}
+
+//=============================================================================
+// Finish - Ends the adding. Sorts the records in memory, or spills them and
+//          opens the runs for the merge, first merging the oldest runs
+//          while there are more than MAX_SPILL_MERGE of them.
+//=============================================================================
+
+bool SpillSorter::Finish()
+{
+	if (_Finished) return _Error == 0;
+	if (_Runs.empty())
+	{
+		std::sort(_Records.begin(), _Records.end(),
+			[this](const SpillRecord& Record1, const SpillRecord& Record2) { return Less(Record1, Record2); });
+		_Finished = true;
+		return true;
+	}
+	if (!Spill()) return false;
+	_Finished = true;
+	while (_Runs.size() > MAX_SPILL_MERGE)
+	{
+		std::vector<Run> Heap;
+		Run pOut = CreateRun();
+		if (pOut == NULL) return false;
+		if (!StartMerge(0, MAX_SPILL_MERGE, Heap))
+		{
+			DeleteRun(pOut);
+			return false;
+		}
+		SpillRecord Record;
+		while (PopMerged(Heap, Record)) if (!WriteRecord(pOut->File, Record)) break;
+		if (fclose(pOut->File) != 0 && _Error == 0) _Error = errno != 0 ? errno : EIO;
+		pOut->File = NULL;
+		for (int i = 0; i < MAX_SPILL_MERGE; ++i) DeleteRun(_Runs[i]);
+		_Runs.erase(_Runs.begin(), _Runs.begin() + MAX_SPILL_MERGE);
+		_Runs.push_back(pOut);
+		if (_Error != 0) return false;
+	}
+	return StartMerge(0, _Runs.size(), _Heap);
+}
+
+//=============================================================================
+// Next - Returns the next record in order, after Finish. Returns false at
+//        the end, or on a read error, which GetError returns.
+//=============================================================================
+
+bool SpillSorter::Next(SpillRecord& Record)
+{
+	if (!_Finished) return false;
+	if (!_Runs.empty()) return PopMerged(_Heap, Record);
+	if (_NextRecord < _Records.size())
+	{
+		Record = std::move(_Records[_NextRecord++]);
+		return true;
+	}
+	std::vector<SpillRecord>().swap(_Records);
+	return false;
+}
+
+//=============================================================================
+// Less - The order of the records: by size or by hash, then by file name.
+//=============================================================================
+
+bool SpillSorter::Less(const SpillRecord& Record1, const SpillRecord& Record2) const
+{
+	int Diff;
+	if (_Order == SPILL_BY_SIZE)
+		Diff = Record1.Bytes < Record2.Bytes ? -1 : Record1.Bytes > Record2.Bytes ? 1 : 0;
+	else
+		Diff = Record1.FileHash.compare(Record2.FileHash);
+	if (Diff == 0) Diff = _Compare(Record1.FileName, Record2.FileName);
+	return Diff < 0;
+}
+
+//=============================================================================
+// StartMerge - Opens the runs First up to Last for reading, reads the first
+//              record of each, and builds the heap of the runs.
+// PopMerged  - Returns the least record of the heap's runs, and reads the
+//              next record of its run.
+//=============================================================================
+
+bool SpillSorter::StartMerge(size_t First, size_t Last, std::vector<Run>& Heap)
+{
+	auto Greater = [this](Run pRun1, Run pRun2) { return Less(pRun2->Record, pRun1->Record); };
+	Heap.clear();
+	for (size_t i = First; i < Last; ++i)
+	{
+		Run pRun = _Runs[i];
+		pRun->File = OpenRun(pRun->Path, false);
+		if (pRun->File == NULL) return false;
+		if (ReadRecord(pRun)) Heap.push_back(pRun);
+	}
+	std::make_heap(Heap.begin(), Heap.end(), Greater);
+	return _Error == 0;
+}
+
+bool SpillSorter::PopMerged(std::vector<Run>& Heap, SpillRecord& Record)
+{
+	auto Greater = [this](Run pRun1, Run pRun2) { return Less(pRun2->Record, pRun1->Record); };
+	if (Heap.empty() || _Error != 0) return false;
+	std::pop_heap(Heap.begin(), Heap.end(), Greater);
+	Run pRun = Heap.back();
+	Record = std::move(pRun->Record);
+	if (ReadRecord(pRun)) std::push_heap(Heap.begin(), Heap.end(), Greater);
+	else Heap.pop_back();
+	return true;
+}
+
+//=============================================================================
+// WriteRecord - Writes the sizes and the member flag, then the lengths and
+//               the characters of the strings. The runs are only read by
+//               this process, so the characters are written as they are in
+//               memory.
+// ReadRecord  - Reads the next record of a run into its Record. Returns
+//               false at the end of the run, or on an error.
+//=============================================================================
+
+bool SpillSorter::WriteRecord(FILE* File, const SpillRecord& Record)
+{
+	uint64_t Header[5] = { Record.Bytes, Record.WriteTime, Record.Location, Record.Member,
+		(uint64_t)Record.FileHash.length() << 32 | (uint64_t)Record.FileName.length() };
+	if (fwrite(Header, sizeof(Header), 1, File) != 1 ||
+	    fwrite(Record.FileHash.data(), sizeof(wchar_t), Record.FileHash.length(), File) != Record.FileHash.length() ||
+	    fwrite(Record.FileName.data(), sizeof(wchar_t), Record.FileName.length(), File) != Record.FileName.length())
+	{
+		if (_Error == 0) _Error = errno != 0 ? errno : EIO;
+		return false;
+	}
+	_SpilledBytes += sizeof(Header) + (Record.FileHash.length() + Record.FileName.length()) * sizeof(wchar_t);
+	return true;
+}
+
+bool SpillSorter::ReadRecord(Run pRun)
+{
+	uint64_t Header[5];
+	if (fread(Header, sizeof(Header), 1, pRun->File) != 1)
+	{
+		if (ferror(pRun->File) && _Error == 0) _Error = errno != 0 ? errno : EIO;
+		return false;
+	}
+	SpillRecord& Record = pRun->Record;
+	Record.Bytes = Header[0];
+	Record.WriteTime = Header[1];
+	Record.Location = Header[2];
+	Record.Member = Header[3] != 0;
+	Record.FileHash.resize((size_t)(Header[4] >> 32));
+	Record.FileName.resize((size_t)(Header[4] & 0xFFFFFFFF));
+	if (fread(&Record.FileHash[0], sizeof(wchar_t), Record.FileHash.length(), pRun->File) != Record.FileHash.length() ||
+	    fread(&Record.FileName[0], sizeof(wchar_t), Record.FileName.length(), pRun->File) != Record.FileName.length())
+	{
+		if (_Error == 0) _Error = EIO; // A run cut short.
+		return false;
+	}
+	return true;
+}
+
+//=============================================================================
+// GetCost - The memory a record is counted as taking.
+//=============================================================================
+
+uint64_t SpillSorter::GetCost(const SpillRecord& Record)
+{
+	return SPILL_RECORD_OVERHEAD + (Record.FileHash.capacity() + Record.FileName.capacity()) * sizeof(wchar_t);
+}
+
+//=============================================================================
+// The parts for each system. CreateRun creates a run file with a name of
+// its own in the temporary directory, opened for writing. GetTempDirectory
+// returns the system's temporary directory, and GetResidentBytes and
+// GetPeakResidentBytes the memory the process has in use, now and at most.
+//=============================================================================
+
+#ifdef _WIN32
+
+SpillSorter::Run SpillSorter::CreateRun()
+{
+	Run pRun = new tagRun;
+	pRun->Path = _TempDirectory + L"MarkDuplicates-" + std::to_wstring((unsigned long)GetCurrentProcessId()) + L"-" +
+		std::to_wstring(NextRunId.fetch_add(1)) + L".run";
+	pRun->File = OpenRun(pRun->Path, true);
+	if (pRun->File != NULL) return pRun;
+	delete pRun;
+	return NULL;
+}
+
+FILE* SpillSorter::OpenRun(const std::wstring& Path, bool Write)
+{
+	FILE* File = NULL;
+	errno_t err = _wfopen_s(&File, Path.c_str(), Write ? L"wb" : L"rb");
+	if (err != 0 || File == NULL)
+	{
+		if (_Error == 0) _Error = err != 0 ? err : EIO;
+		return NULL;
+	}
+	setvbuf(File, NULL, _IOFBF, SPILL_IO_BUFFER_LEN);
+	return File;
+}
+
+void SpillSorter::DeleteRun(Run pRun)
+{
+	if (pRun->File != NULL) fclose(pRun->File);
+	DeleteFileW(pRun->Path.c_str());
+	delete pRun;
+}
+
+std::wstring SpillSorter::GetTempDirectory()
+{
+	wchar_t szTempPath[MAX_PATH + 1];
+	DWORD cchTempPath = GetTempPathW(MAX_PATH + 1, szTempPath);
+	return cchTempPath > 0 && cchTempPath <= MAX_PATH ? std::wstring(szTempPath) : std::wstring(L".\\");
+}
+
+uint64_t SpillSorter::GetResidentBytes()
+{
+	PROCESS_MEMORY_COUNTERS Counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters))) return 0;
+	return Counters.WorkingSetSize;
+}
+
+uint64_t SpillSorter::GetPeakResidentBytes()
+{
+	PROCESS_MEMORY_COUNTERS Counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters))) return 0;
+	return Counters.PeakWorkingSetSize;
+}
+
+#else
+
+static std::string NarrowPath(const std::wstring& Path)
+{
+	std::string Narrow(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&Narrow[0], Path.c_str(), Narrow.length());
+	Narrow.resize(cbPath == (size_t)-1 ? 0 : cbPath);
+	return Narrow;
+}
+
+SpillSorter::Run SpillSorter::CreateRun()
+{
+	Run pRun = new tagRun;
+	pRun->Path = _TempDirectory + L"MarkDuplicates-" + std::to_wstring(getpid()) + L"-" +
+		std::to_wstring(NextRunId.fetch_add(1)) + L".run";
+	pRun->File = OpenRun(pRun->Path, true);
+	if (pRun->File != NULL) return pRun;
+	delete pRun;
+	return NULL;
+}
+
+FILE* SpillSorter::OpenRun(const std::wstring& Path, bool Write)
+{
+	FILE* File = fopen(NarrowPath(Path).c_str(), Write ? "wbe" : "rbe");
+	if (File == NULL)
+	{
+		if (_Error == 0) _Error = errno != 0 ? errno : EIO;
+		return NULL;
+	}
+	setvbuf(File, NULL, _IOFBF, SPILL_IO_BUFFER_LEN);
+	return File;
+}
+
+void SpillSorter::DeleteRun(Run pRun)
+{
+	if (pRun->File != NULL) fclose(pRun->File);
+	unlink(NarrowPath(pRun->Path).c_str());
+	delete pRun;
+}
+
+std::wstring SpillSorter::GetTempDirectory()
+{
+	const char* pszTempPath = getenv("TMPDIR");
+	std::wstring TempPath(L"/tmp/");
+	if (pszTempPath != NULL && pszTempPath[0] != 0)
+	{
+		TempPath.resize(strlen(pszTempPath) + 1);
+		size_t cchTempPath = mbstowcs(&TempPath[0], pszTempPath, TempPath.length());
+		if (cchTempPath == (size_t)-1) return L"/tmp/";
+		TempPath.resize(cchTempPath);
+		if (TempPath.back() != L'/') TempPath += L'/';
+	}
+	return TempPath;
+}
+
+uint64_t SpillSorter::GetResidentBytes()
+{
+	unsigned long long Pages = 0, ResidentPages = 0;
+	FILE* File = fopen("/proc/self/statm", "re");
+	if (File == NULL) return 0;
+	if (fscanf(File, "%llu %llu", &Pages, &ResidentPages) != 2) ResidentPages = 0;
+	fclose(File);
+	return ResidentPages * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+uint64_t SpillSorter::GetPeakResidentBytes()
+{
+	struct rusage Usage;
+	if (getrusage(RUSAGE_SELF, &Usage) != 0) return 0;
+	return (uint64_t)Usage.ru_maxrss * 1024;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////
+// SpillSorter.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define SPILL_BY_SIZE 0                 // Records in size order, then in file name order.
+#define SPILL_BY_HASH 1                 // Records in hash order, then in file name order, as the view sorts them.
+#define SPILL_RECORD_OVERHEAD 96        // Bytes a record costs in memory besides the characters of its strings.
+#define SPILL_IO_BUFFER_LEN (64 * 1024) // Bytes buffered for each run file written or merged.
+#define MAX_SPILL_MERGE 64              // Runs merged at once; more are merged in passes first.
+
+struct SpillRecord
+{
+	uint64_t     Bytes;
+	uint64_t     WriteTime; // UTC FILETIME.
+	uint64_t     Location;  // Where a member of an archive starts in it, else 0.
+	bool         Member;    // A member of an archive, listed from its headers.
+	std::wstring FileHash;  // Empty until the file is hashed.
+	std::wstring FileName;
+};
+
+typedef int (*NameCompare)(const std::wstring& Name1, const std::wstring& Name2);
+
+class SpillSorter
+{
+private:
+	typedef struct tagRun // A sorted run in a temporary file.
+	{
+		std::wstring Path;
+		FILE*        File;
+		SpillRecord  Record; // The run's next record, while it is merged.
+	} *Run;
+	int                      _Order;
+	NameCompare              _Compare;       // Orders the records of one size or one hash.
+	uint64_t                 _MemoryBytes;   // Cost of the records kept in memory before they are spilled.
+	std::wstring             _TempDirectory; // With a trailing separator.
+	std::vector<SpillRecord> _Records;       // Added and not yet spilled.
+	uint64_t                 _RecordBytes;   // Cost of _Records.
+	size_t                   _NextRecord;    // Next of _Records to return, when no run was spilled.
+	std::vector<Run>         _Runs;
+	std::vector<Run>         _Heap;          // Runs being merged that have a record left, the least on top.
+	bool                     _Finished;
+	uint64_t                 _Added;
+	uint64_t                 _SpilledBytes;
+	int                      _RunsWritten;
+	int                      _Error;         // C runtime error number of the last failure, 0 if none.
+	bool     Less(const SpillRecord& Record1, const SpillRecord& Record2) const;
+	Run      CreateRun();
+	FILE*    OpenRun(const std::wstring& Path, bool Write);
+	void     DeleteRun(Run pRun);
+	bool     WriteRecord(FILE* File, const SpillRecord& Record);
+	bool     ReadRecord(Run pRun);
+	bool     StartMerge(size_t First, size_t Last, std::vector<Run>& Heap);
+	bool     PopMerged(std::vector<Run>& Heap, SpillRecord& Record);
+public:
+	SpillSorter(int Order, NameCompare Compare, uint64_t MemoryBytes, const std::wstring& TempDirectory);
+	~SpillSorter();
+	bool     Add(SpillRecord& Record);
+	bool     Spill();
+	bool     Finish();
+	bool     Next(SpillRecord& Record);
+	void     SetMemory(uint64_t MemoryBytes) { _MemoryBytes = MemoryBytes; }
+	uint64_t GetMemory() const { return _MemoryBytes; }
+	uint64_t GetAdded() const { return _Added; }
+	uint64_t GetSpilledBytes() const { return _SpilledBytes; }
+	int      GetRunsWritten() const { return _RunsWritten; }
+	int      GetError() const { return _Error; }
+	static uint64_t     GetCost(const SpillRecord& Record);
+	static std::wstring GetTempDirectory();
+	static uint64_t     GetResidentBytes();
+	static uint64_t     GetPeakResidentBytes();
+};
\ No newline at end of file
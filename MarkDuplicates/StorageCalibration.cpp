@@ -0,0 +1,287 @@
+///////////////////////////////////////////////////////////////////////////////
+// StorageCalibration.cpp - Measures how a volume is best read, for a
+//                          tuning profile that later scans of the volume
+//                          start from.
+//
+// The largest files of a directory, up to CALIBRATE_SAMPLE_BYTES, are the
+// sample. Each trial reads a part of the sample with a read size, a number
+// of reads in flight, and buffered or unbuffered reads, for up to
+// CALIBRATE_TRIAL_BYTES or CALIBRATE_TRIAL_MS, and each trial starts where
+// the one before stopped, so that no trial reads what another has brought
+// into the file cache. The read sizes are tried first, unbuffered, so that
+// the cache does not hide the device, then the readers at the best size,
+// then buffered reads at the best of both. A larger setting has to be
+// CALIBRATE_GAIN faster to be chosen, and a smaller one is chosen unless it
+// is CALIBRATE_GAIN slower, since a smaller one costs less memory and
+// seeking for the same speed. Buffered reads of files that were
+// cached before the calibration can still look fast; scanning another
+// directory of the volume avoids that.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "StorageCalibration.h"
+#include "DirectoryEnumerator.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================
+// The file primitives of the trials, for each system.
+//=============================================================================
+
+#ifdef _WIN32
+
+typedef HANDLE FileHandle;
+static const FileHandle NO_FILE = INVALID_HANDLE_VALUE;
+
+static FileHandle OpenRead(const std::wstring& Path, bool Unbuffered)
+{
+	return CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		Unbuffered ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
+
+static int64_t ReadAt(FileHandle hFile, void* pBuffer, int cbBuffer, uint64_t Offset)
+{
+	OVERLAPPED Overlapped;
+	ZeroMemory(&Overlapped, sizeof(Overlapped));
+	Overlapped.Offset = (DWORD)Offset;
+	Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+	DWORD cbRead;
+	if (ReadFile(hFile, pBuffer, (DWORD)cbBuffer, &cbRead, &Overlapped)) return cbRead;
+	return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+}
+
+static void  CloseRead(FileHandle hFile) { CloseHandle(hFile); }
+static void* AllocateAligned(size_t cbBuffer) { return _aligned_malloc(cbBuffer, CALIBRATE_ALIGNMENT); }
+static void  FreeAligned(void* pBuffer) { _aligned_free(pBuffer); }
+
+#else
+
+typedef int FileHandle;
+static const FileHandle NO_FILE = -1;
+
+static std::string ToNarrow(const std::wstring& Path)
+{
+	std::string NarrowPath(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Path.c_str(), NarrowPath.length());
+	NarrowPath.resize(cbPath == (size_t)-1 ? 0 : cbPath);
+	return NarrowPath;
+}
+
+static FileHandle OpenRead(const std::wstring& Path, bool Unbuffered)
+{
+	return open(ToNarrow(Path).c_str(), O_RDONLY | O_CLOEXEC | (Unbuffered ? O_DIRECT : 0));
+}
+
+static int64_t ReadAt(FileHandle File, void* pBuffer, int cbBuffer, uint64_t Offset)
+{
+	return pread(File, pBuffer, (size_t)cbBuffer, (off_t)Offset);
+}
+
+static void  CloseRead(FileHandle File) { close(File); }
+static void* AllocateAligned(size_t cbBuffer)
+{
+	void* pBuffer = NULL;
+	return posix_memalign(&pBuffer, CALIBRATE_ALIGNMENT, cbBuffer) == 0 ? pBuffer : NULL;
+}
+static void  FreeAligned(void* pBuffer) { free(pBuffer); }
+
+#endif
+
+//=============================================================================
+// Constructor
+//=============================================================================
+
+StorageCalibration::StorageCalibration(const std::wstring& Directory)
+{
+	_Directory = Directory;
+	while (_Directory.length() > 1 && (_Directory.back() == L'\\' || _Directory.back() == L'/')) _Directory.pop_back();
+	_SampleBytes = 0;
+	_Cursor = 0;
+}
+
+//=============================================================================
+// FindSamples - Takes the largest files of the directory, up to
+//               CALIBRATE_SAMPLE_BYTES. Returns false if they hold fewer
+//               than CALIBRATE_MIN_BYTES.
+//=============================================================================
+
+bool StorageCalibration::FindSamples()
+{
+	std::vector<Sample> Files;
+	DirectoryEnumerator Enumerator;
+	DirectoryEntry Entry;
+	if (Enumerator.Open(_Directory))
+		while (Enumerator.Next(Entry))
+		{
+			Sample File;
+			File.Path = Enumerator.GetPath(Entry.Name);
+			File.Bytes = Entry.Size;
+			Files.push_back(File);
+		}
+	std::sort(Files.begin(), Files.end(), [](const Sample& a, const Sample& b) { return a.Bytes > b.Bytes; });
+	_Samples.clear();
+	_SampleBytes = 0;
+	for (size_t i = 0; i < Files.size() && _SampleBytes < CALIBRATE_SAMPLE_BYTES && Files[i].Bytes > 0; ++i)
+	{
+		_Samples.push_back(Files[i]);
+		_SampleBytes += Files[i].Bytes;
+	}
+	return _SampleBytes >= CALIBRATE_MIN_BYTES;
+}
+
+//=============================================================================
+// Trial - Reads the sample from the cursor with the settings, and returns
+//         the throughput in megabytes per second, or 0 if a read failed.
+//         The readers take the blocks in turn, so Readers reads are in
+//         flight at a time.
+//=============================================================================
+
+double StorageCalibration::Trial(int ReadSize, int Readers, bool Unbuffered)
+{
+	// Plan the blocks, whole blocks of each file, starting at the cursor.
+	typedef struct { int File; uint64_t Offset; } Block;
+	std::vector<Block> Blocks;
+	uint64_t Planned = 0, Position = 0;
+	size_t FileIndex = 0;
+	while (FileIndex < _Samples.size() && Position + _Samples[FileIndex].Bytes <= _Cursor) Position += _Samples[FileIndex++].Bytes;
+	uint64_t Offset = FileIndex < _Samples.size() ? (_Cursor - Position) / ReadSize * ReadSize : 0;
+	for (size_t Files = 0; Planned < CALIBRATE_TRIAL_BYTES && Files <= _Samples.size(); )
+	{
+		if (FileIndex >= _Samples.size()) FileIndex = 0; // Wrap around to the first file.
+		if (Offset >= _Samples[FileIndex].Bytes)
+		{
+			FileIndex++;
+			Files++;
+			Offset = 0;
+			continue;
+		}
+		Block block = { (int)FileIndex, Offset };
+		Blocks.push_back(block);
+		Planned += ReadSize;
+		Offset += ReadSize;
+	}
+	_Cursor = (_Cursor + Planned) % _SampleBytes;
+
+	std::atomic<size_t>   NextBlock(0);
+	std::atomic<uint64_t> BytesRead(0);
+	std::atomic<bool>     Failed(false);
+	auto Start = std::chrono::steady_clock::now();
+	auto Deadline = Start + std::chrono::milliseconds(CALIBRATE_TRIAL_MS);
+	auto Reader = [&]()
+	{
+		void* pBuffer = AllocateAligned(ReadSize);
+		if (pBuffer == NULL)
+		{
+			Failed = true;
+			return;
+		}
+		FileHandle hFile = NO_FILE;
+		int OpenFile = -1;
+		for (size_t i; (i = NextBlock++) < Blocks.size() && !Failed && std::chrono::steady_clock::now() < Deadline; )
+		{
+			if (Blocks[i].File != OpenFile)
+			{
+				if (hFile != NO_FILE) CloseRead(hFile);
+				OpenFile = Blocks[i].File;
+				hFile = OpenRead(_Samples[OpenFile].Path, Unbuffered);
+				if (hFile == NO_FILE)
+				{
+					Failed = true;
+					break;
+				}
+			}
+			int64_t cbRead = ReadAt(hFile, pBuffer, ReadSize, Blocks[i].Offset);
+			if (cbRead < 0) Failed = true;
+			else BytesRead += (uint64_t)cbRead;
+		}
+		if (hFile != NO_FILE) CloseRead(hFile);
+		FreeAligned(pBuffer);
+	};
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < Readers; ++i) Threads.push_back(std::thread(Reader));
+	for (size_t i = 0; i < Threads.size(); ++i) Threads[i].join();
+	double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+	return Failed ? 0 : BytesRead / 1048576.0 / (Seconds > 1e-3 ? Seconds : 1e-3);
+}
+
+//=============================================================================
+// Run - Runs the trials and fills Profile with the best settings. Progress
+//       is called before each trial with its description, and stops the
+//       calibration by returning false. Returns false if the calibration
+//       was stopped or the directory has too little data; the report says
+//       why.
+//=============================================================================
+
+bool StorageCalibration::Run(TuningProfile& Profile, const std::function<bool(const std::wstring&)>& Progress)
+{
+	_Report.clear();
+	if (!FindSamples())
+	{
+		_Report.push_back(L"The directory holds too little data to calibrate; it needs " +
+			std::to_wstring(CALIBRATE_MIN_BYTES / 1048576) + L" MB.");
+		return false;
+	}
+
+	static const int ReadSizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+	static const int ReaderCounts[] = { 1, 2, 4, 8, 16, 32 };
+	static const int SizeReaders = 4; // Readers while the read sizes are tried.
+	Profile.ReadSize = ReadSizes[0];
+	Profile.Readers = SizeReaders;
+	Profile.Unbuffered = 1;
+	Profile.Reserved = 0;
+	Profile.MBps = 0;
+
+	// Runs one trial, reports it, and takes its settings if they win.
+	bool bStopped = false;
+	auto Try = [&](int ReadSize, int Readers, bool Unbuffered) -> double
+	{
+		if (bStopped) return 0;
+		std::wstring Settings = std::to_wstring(ReadSize / 1024) + L" KB reads, " + std::to_wstring(Readers) +
+			(Readers == 1 ? L" reader, " : L" readers, ") + (Unbuffered ? L"unbuffered" : L"buffered");
+		if (!Progress(Settings))
+		{
+			bStopped = true;
+			return 0;
+		}
+		double MBps = Trial(ReadSize, Readers, Unbuffered);
+		wchar_t szResult[32];
+		swprintf(szResult, 32, L": %.1f MB/s", MBps);
+		_Report.push_back(Settings + szResult);
+		bool bSmaller = ReadSize < Profile.ReadSize || Readers < Profile.Readers;
+		if (MBps > Profile.MBps * CALIBRATE_GAIN || (bSmaller && MBps > 0 && MBps * CALIBRATE_GAIN >= Profile.MBps))
+		{
+			Profile.ReadSize = ReadSize;
+			Profile.Readers = Readers;
+			Profile.Unbuffered = Unbuffered;
+			if (MBps > Profile.MBps) Profile.MBps = MBps;
+		}
+		return MBps;
+	};
+
+	// Where the volume does not allow unbuffered reads, everything is measured buffered.
+	bool Unbuffered = true;
+	if (Try(ReadSizes[0], Profile.Readers, true) == 0 && !bStopped)
+	{
+		_Report.push_back(L"Unbuffered reads failed; buffered reads are measured instead.");
+		Unbuffered = false;
+		Try(ReadSizes[0], Profile.Readers, false);
+	}
+	for (size_t i = 1; i < sizeof(ReadSizes) / sizeof(ReadSizes[0]); ++i) Try(ReadSizes[i], Profile.Readers, Unbuffered);
+	int ReadSize = Profile.ReadSize;
+	for (size_t i = 0; i < sizeof(ReaderCounts) / sizeof(ReaderCounts[0]); ++i)
+		if (ReaderCounts[i] != SizeReaders) Try(ReadSize, ReaderCounts[i], Unbuffered);
+	if (Unbuffered) Try(Profile.ReadSize, Profile.Readers, false);
+	if (bStopped) _Report.push_back(L"Stopped.");
+	return !bStopped && Profile.MBps > 0;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////////
+// StorageCalibration.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define CALIBRATE_SAMPLE_BYTES (512ULL * 1024 * 1024) // Most bytes of the largest files sampled.
+#define CALIBRATE_MIN_BYTES (16 * 1024 * 1024)        // Fewer bytes than this are too few to measure.
+#define CALIBRATE_TRIAL_BYTES (64 * 1024 * 1024)      // Most bytes read by one trial.
+#define CALIBRATE_TRIAL_MS 1000                       // Longest time of one trial.
+#define CALIBRATE_ALIGNMENT 4096                      // Buffer alignment for unbuffered reads.
+#define CALIBRATE_GAIN 1.05                           // Speedup needed to prefer a setting.
+
+typedef struct tagTuningProfile // The best settings of a volume, saved as a memory block.
+{
+	int32_t ReadSize;   // Bytes per read.
+	int32_t Readers;    // Reads in flight.
+	int32_t Unbuffered; // Reads bypass the file cache.
+	int32_t Reserved;
+	double  MBps;       // Throughput of the settings.
+} TuningProfile;
+
+class StorageCalibration
+{
+private:
+	typedef struct tagSample
+	{
+		std::wstring Path;
+		uint64_t     Bytes;
+	} Sample;
+	std::wstring              _Directory;
+	std::vector<Sample>       _Samples;
+	uint64_t                  _SampleBytes;
+	uint64_t                  _Cursor;  // Where the next trial starts, so that trials read different data.
+	std::vector<std::wstring> _Report;
+	bool   FindSamples();
+	double Trial(int ReadSize, int Readers, bool Unbuffered);
+public:
+	StorageCalibration(const std::wstring& Directory);
+	bool Run(TuningProfile& Profile, const std::function<bool(const std::wstring&)>& Progress);
+	const std::vector<std::wstring>& GetReport() const { return _Report; }
+	static std::wstring GetProfileName(const std::wstring& VolumeId) { return L"Profile " + VolumeId; }
+};
\ No newline at end of file
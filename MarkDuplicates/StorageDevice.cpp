@@ -0,0 +1,199 @@
+///////////////////////////////////////////////////////////////////////////////
+// StorageDevice.cpp - Names the device that a path is stored on, so that the
+//                     files of a scan can be queued per device. Where it can
+//                     be found, the name is that of the physical disk, so
+//                     two volumes on one disk share a queue; otherwise it is
+//                     the volume, or the share, that holds the path. Also
+//                     finds where a file starts on its device, so that the
+//                     files can be read in disk order, and names the volume
+//                     of a path, for the tuning profiles.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "StorageDevice.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================
+// GetName - Windows: "PhysicalDriveN" for a volume on a single disk, else
+//           the volume path, e.g. "C:\" or "\\server\share\". Linux: the
+//           block device of st_dev, with a partition resolved to its disk,
+//           e.g. "sda", else "dev major:minor".
+//=============================================================================
+
+#ifdef _WIN32
+
+std::wstring StorageDevice::GetName(const std::wstring& Path)
+{
+	WCHAR szVolumePath[MAX_PATH];
+	if (!GetVolumePathNameW(Path.c_str(), szVolumePath, MAX_PATH)) return Path;
+
+	WCHAR szVolumeName[MAX_PATH];
+	if (!GetVolumeNameForVolumeMountPointW(szVolumePath, szVolumeName, MAX_PATH)) return szVolumePath;
+
+	// The volume is opened without the trailing backslash, and without access, just to query it.
+	std::wstring Volume = szVolumeName;
+	if (!Volume.empty() && Volume.back() == L'\\') Volume.pop_back();
+	HANDLE hVolume = CreateFileW(Volume.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hVolume == INVALID_HANDLE_VALUE) return szVolumePath;
+
+	// A volume that spans disks fails with ERROR_MORE_DATA, and is queued as itself.
+	VOLUME_DISK_EXTENTS Extents;
+	DWORD cbReturned;
+	BOOL bExtents = DeviceIoControl(hVolume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS,
+		NULL, 0, &Extents, sizeof(Extents), &cbReturned, NULL);
+	CloseHandle(hVolume);
+	if (!bExtents || Extents.NumberOfDiskExtents != 1) return szVolumePath;
+
+	return L"PhysicalDrive" + std::to_wstring(Extents.Extents[0].DiskNumber);
+}
+
+//=============================================================================
+// GetVolumeId - Windows: the volume GUID path, e.g. "\\?\Volume{...}\",
+//               which stays the same across drive letters, or the volume
+//               path for a share. Linux: the block device of st_dev, e.g.
+//               "sda1", else "dev major:minor".
+//=============================================================================
+
+std::wstring StorageDevice::GetVolumeId(const std::wstring& Path)
+{
+	WCHAR szVolumePath[MAX_PATH];
+	if (!GetVolumePathNameW(Path.c_str(), szVolumePath, MAX_PATH)) return Path;
+
+	WCHAR szVolumeName[MAX_PATH];
+	if (!GetVolumeNameForVolumeMountPointW(szVolumePath, szVolumeName, MAX_PATH)) return szVolumePath;
+	return szVolumeName;
+}
+
+//=============================================================================
+// GetLocation - Windows: the first logical cluster of the file, from
+//               FSCTL_GET_RETRIEVAL_POINTERS, or the file index where the
+//               file system does not map clusters. Linux: the physical
+//               offset of the first extent, from FIEMAP, or the inode.
+//               Files that have no extent, being empty or stored with
+//               their metadata, are at 0. Only a sort key, comparable
+//               between files of one device.
+//=============================================================================
+
+uint64_t StorageDevice::GetLocation(const std::wstring& Path)
+{
+	HANDLE hFile = CreateFileW(Path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) return 0;
+
+	// Only the first extent is wanted, so a fragmented file failing with ERROR_MORE_DATA is fine.
+	STARTING_VCN_INPUT_BUFFER StartingVcn;
+	RETRIEVAL_POINTERS_BUFFER Pointers;
+	DWORD cbReturned;
+	StartingVcn.StartingVcn.QuadPart = 0;
+	BOOL bPointers = DeviceIoControl(hFile, FSCTL_GET_RETRIEVAL_POINTERS,
+		&StartingVcn, sizeof(StartingVcn), &Pointers, sizeof(Pointers), &cbReturned, NULL);
+	DWORD dwError = bPointers ? ERROR_SUCCESS : GetLastError();
+	uint64_t Location = 0;
+	if (bPointers || dwError == ERROR_MORE_DATA)
+	{
+		if (Pointers.ExtentCount > 0 && Pointers.Extents[0].Lcn.QuadPart >= 0) Location = Pointers.Extents[0].Lcn.QuadPart;
+	}
+	else if (dwError != ERROR_HANDLE_EOF) // ERROR_HANDLE_EOF is a file with no clusters.
+	{
+		BY_HANDLE_FILE_INFORMATION Information;
+		if (GetFileInformationByHandle(hFile, &Information))
+			Location = (uint64_t)Information.nFileIndexHigh << 32 | Information.nFileIndexLow;
+	}
+	CloseHandle(hFile);
+	return Location;
+}
+
+#else
+
+std::wstring StorageDevice::GetName(const std::wstring& Path)
+{
+	std::string NarrowPath(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Path.c_str(), NarrowPath.length());
+	if (cbPath == (size_t)-1) return Path;
+	NarrowPath.resize(cbPath);
+
+	struct stat Stat;
+	if (stat(NarrowPath.c_str(), &Stat) != 0) return Path;
+	unsigned Major = major(Stat.st_dev), Minor = minor(Stat.st_dev);
+
+	// /sys/dev/block/major:minor links to the device; a partition is a directory of its disk.
+	char szLink[64], szDevice[PATH_MAX], szPartition[PATH_MAX + 16];
+	snprintf(szLink, sizeof(szLink), "/sys/dev/block/%u:%u", Major, Minor);
+	std::wstring Name = L"dev " + std::to_wstring(Major) + L":" + std::to_wstring(Minor);
+	if (realpath(szLink, szDevice) == NULL) return Name;
+	snprintf(szPartition, sizeof(szPartition), "%s/partition", szDevice);
+	if (access(szPartition, F_OK) == 0)
+	{
+		char* pszSlash = strrchr(szDevice, '/');
+		if (pszSlash != NULL) *pszSlash = '\0';
+	}
+	const char* pszName = strrchr(szDevice, '/');
+	pszName = pszName != NULL ? pszName + 1 : szDevice;
+	return std::wstring(pszName, pszName + strlen(pszName));
+}
+
+std::wstring StorageDevice::GetVolumeId(const std::wstring& Path)
+{
+	std::string NarrowPath(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Path.c_str(), NarrowPath.length());
+	if (cbPath == (size_t)-1) return Path;
+	NarrowPath.resize(cbPath);
+
+	struct stat Stat;
+	if (stat(NarrowPath.c_str(), &Stat) != 0) return Path;
+	unsigned Major = major(Stat.st_dev), Minor = minor(Stat.st_dev);
+
+	char szLink[64], szDevice[PATH_MAX];
+	snprintf(szLink, sizeof(szLink), "/sys/dev/block/%u:%u", Major, Minor);
+	if (realpath(szLink, szDevice) == NULL) return L"dev " + std::to_wstring(Major) + L":" + std::to_wstring(Minor);
+	const char* pszName = strrchr(szDevice, '/');
+	pszName = pszName != NULL ? pszName + 1 : szDevice;
+	return std::wstring(pszName, pszName + strlen(pszName));
+}
+
+uint64_t StorageDevice::GetLocation(const std::wstring& Path)
+{
+	std::string NarrowPath(Path.length() * MB_LEN_MAX + 1, '\0');
+	size_t cbPath = wcstombs(&NarrowPath[0], Path.c_str(), NarrowPath.length());
+	if (cbPath == (size_t)-1) return 0;
+	NarrowPath.resize(cbPath);
+
+	int File = open(NarrowPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (File < 0) return 0;
+
+	// One extent is enough; the map is followed by room for it.
+	union
+	{
+		struct fiemap Map;
+		char          Buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+	} Fiemap;
+	memset(&Fiemap, 0, sizeof(Fiemap));
+	Fiemap.Map.fm_length = FIEMAP_MAX_OFFSET;
+	Fiemap.Map.fm_extent_count = 1;
+	uint64_t Location = 0;
+	struct stat Stat;
+	if (ioctl(File, FS_IOC_FIEMAP, &Fiemap.Map) == 0)
+	{
+		if (Fiemap.Map.fm_mapped_extents > 0) Location = Fiemap.Map.fm_extents[0].fe_physical;
+	}
+	else if (fstat(File, &Stat) == 0) Location = Stat.st_ino;
+	close(File);
+	return Location;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+///////////////////////////////////////////////////////////////////////////////
+// StorageDevice.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <string>
+#include <stdint.h>
+
+class StorageDevice
+{
+public:
+	static std::wstring GetName(const std::wstring& Path);
+	static std::wstring GetVolumeId(const std::wstring& Path);
+	static uint64_t     GetLocation(const std::wstring& Path);
+};
\ No newline at end of file
@@ -0,0 +1,417 @@
+///////////////////////////////////////////////////////////////////////////////
+// TarArchive.cpp - Reads the members of a tar archive in one pass, through a
+//                  FileReader, without extracting them.
+//
+// An archive is a series of TAR_BLOCK_LEN byte headers, each followed by
+// the data of its member padded to a whole block, and ends with a block of
+// zeros, or simply at the end of the file. Next reads the header of the
+// next member that is a file, passing over directories, links and devices,
+// and Read then returns its data. The data that is not read, of the member
+// before or of the entries passed over, is read past, or when the archive
+// was opened to Seek, skipped without a read, which lists the members of a
+// large archive from its headers alone.
+//
+// The old, ustar, GNU and pax forms of the header are understood: names
+// longer than a header holds come from a GNU long name entry or from the
+// path of a pax header, which can also carry the size and the write time,
+// and sizes beyond the octal field are in base 256. Names are UTF-8, as pax
+// has them; a byte that is not part of UTF-8 is taken as Latin-1.
+//
+// The archive is read in whole buffers from its start, so a reader with
+// READ_UNBUFFERED reads it aligned, as long as it does not Seek. A damaged
+// header ends the listing with an error.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TarArchive.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define TAR_FORMAT_ERROR ERROR_BAD_FORMAT
+#else
+#include <errno.h>
+#define TAR_FORMAT_ERROR EILSEQ
+#endif
+
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL // 1970 as a FILETIME.
+
+//=============================================================================
+// Constructor - pReader reads the archives, and stays the caller's. The
+//               data is read BufferLen bytes at a time, and Seek skips the
+//               data that is not read, which pReader must not read
+//               unbuffered for.
+//=============================================================================
+
+TarArchive::TarArchive(FileReader* pReader, uint32_t BufferLen, bool Seek)
+{
+	_Reader = pReader;
+	_Seek = Seek;
+	_BufferLen = BufferLen / TAR_BLOCK_LEN * TAR_BLOCK_LEN;
+	_Buffer = (uint8_t*)FileReader::AllocateBuffer(_BufferLen);
+	_Start = 0;
+	_End = 0;
+	_Offset = 0;
+	_DataLeft = 0;
+	_PadLeft = 0;
+	_Ended = true;
+	_Error = 0;
+}
+
+TarArchive::~TarArchive()
+{
+	FileReader::FreeBuffer(_Buffer);
+}
+
+//=============================================================================
+// Open  - Opens an archive, by its name relative to pDirectory.
+// Close - Closes it.
+//=============================================================================
+
+bool TarArchive::Open(const std::wstring& FileName, const DirectoryEnumerator* pDirectory)
+{
+	_Start = 0;
+	_End = 0;
+	_Offset = 0;
+	_DataLeft = 0;
+	_PadLeft = 0;
+	_Error = 0;
+	_Ended = !_Reader->Open(FileName, pDirectory);
+	if (_Ended) _Error = _Reader->GetError();
+	return !_Ended;
+}
+
+void TarArchive::Close()
+{
+	_Reader->Close();
+	_Ended = true;
+}
+
+//=============================================================================
+// Next - Reads the header of the next member that is a file, after what is
+//        left of the one before. Returns false at the end of the archive,
+//        with GetError 0, or on an error.
+//=============================================================================
+
+bool TarArchive::Next(TarMember& Member, const std::atomic<bool>* pCancel)
+{
+	uint8_t Block[TAR_BLOCK_LEN];
+	std::string LongName, PaxPath;
+	uint64_t PaxSize = 0, PaxTime = 0;
+	bool bPaxSize = false, bPaxTime = false;
+	while (!_Ended)
+	{
+		if (!Discard(_DataLeft + _PadLeft, pCancel)) break;
+		_DataLeft = 0;
+		_PadLeft = 0;
+
+		// A missing header, or one of zeros, ends the archive; a partial one is damage.
+		uint64_t Offset = _Offset;
+		uint32_t cbBlock = ReadBlock(Block, pCancel);
+		if (cbBlock < TAR_BLOCK_LEN)
+		{
+			if (cbBlock > 0 && _Error == 0 && (pCancel == NULL || !pCancel->load())) _Error = TAR_FORMAT_ERROR;
+			break;
+		}
+		uint32_t Sum = 0;
+		int32_t SignedSum = 0;
+		for (int i = 0; i < TAR_BLOCK_LEN; ++i)
+		{
+			uint8_t Byte = i >= 148 && i < 156 ? ' ' : Block[i];
+			Sum += Byte;
+			SignedSum += (int8_t)Byte;
+		}
+		if (Sum == 8 * ' ')
+		{
+			bool bZero = true;
+			for (int i = 0; i < TAR_BLOCK_LEN && bZero; ++i) bZero = Block[i] == 0;
+			if (bZero) break;
+		}
+		uint64_t Checksum = ParseNumber(Block + 148, 8);
+		if (Checksum != Sum && Checksum != (uint64_t)(int64_t)SignedSum)
+		{
+			_Error = TAR_FORMAT_ERROR;
+			break;
+		}
+
+		uint64_t Size = bPaxSize ? PaxSize : ParseNumber(Block + 124, 12);
+		_DataLeft = Size;
+		_PadLeft = (TAR_BLOCK_LEN - Size % TAR_BLOCK_LEN) % TAR_BLOCK_LEN;
+		switch (Block[156])
+		{
+		case 'L': // GNU long name of the next entry.
+			if (!ReadText(LongName, pCancel)) return false;
+			LongName.resize(strnlen(LongName.c_str(), LongName.size()));
+			continue;
+		case 'x': // pax header of the next entry.
+		{
+			std::string Text;
+			if (!ReadText(Text, pCancel)) return false;
+			ParsePax(Text, PaxPath, PaxSize, bPaxSize, PaxTime, bPaxTime);
+			continue;
+		}
+		case 'K': // GNU long link name, and pax global header.
+		case 'g':
+			continue;
+		case '0':
+		case '\0':
+		case '7':
+			break;
+		default:  // Links, directories, devices and the rest, which have no data of a file of their own.
+			LongName.clear();
+			PaxPath.clear();
+			bPaxSize = bPaxTime = false;
+			continue;
+		}
+
+		// A file. The name is the pax path, the GNU long name, or the ustar prefix and name.
+		std::string Name = PaxPath;
+		if (Name.empty()) Name = LongName;
+		if (Name.empty())
+		{
+			Name.assign((const char*)Block, strnlen((const char*)Block, 100));
+			if (memcmp(Block + 257, "ustar", 5) == 0 && Block[345] != 0)
+				Name = std::string((const char*)Block + 345, strnlen((const char*)Block + 345, 155)) + "/" + Name;
+		}
+		LongName.clear();
+		PaxPath.clear();
+		bPaxSize = false;
+		size_t First = 0;
+		while (First < Name.size() && (Name[First] == '/' || Name.compare(First, 2, "./") == 0))
+			First += Name[First] == '/' ? 1 : 2;
+		if (First == Name.size() || Name.back() == '/') // An old form of a directory.
+		{
+			bPaxTime = false;
+			continue;
+		}
+		uint64_t Time = bPaxTime ? PaxTime : ParseNumber(Block + 136, 12);
+		Member.Name = Widen(Name.substr(First));
+		Member.Size = Size;
+		Member.WriteTime = Time * 10000000 + FILETIME_UNIX_EPOCH;
+		Member.Offset = Offset;
+		return true;
+	}
+	_Ended = true;
+	return false;
+}
+
+//=============================================================================
+// Read - Reads the next cbBuffer bytes of the current member into pBuffer.
+//        Returns the bytes read, fewer only at the end of the member or
+//        once pCancel is set, or -1 on an error or a cut off archive.
+//=============================================================================
+
+int64_t TarArchive::Read(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel)
+{
+	uint32_t cbTotal = 0;
+	while (cbTotal < cbBuffer && _DataLeft > 0)
+	{
+		const uint8_t* pData;
+		uint32_t cbData = Take(pData, cbBuffer - cbTotal < _DataLeft ? cbBuffer - cbTotal : _DataLeft, pCancel);
+		if (cbData == 0)
+		{
+			if (pCancel != NULL && pCancel->load()) break;
+			if (_Error == 0) _Error = TAR_FORMAT_ERROR;
+			return -1;
+		}
+		memcpy(pBuffer + cbTotal, pData, cbData);
+		cbTotal += cbData;
+		_DataLeft -= cbData;
+	}
+	return cbTotal;
+}
+
+//=============================================================================
+// Take      - Takes up to Bytes of the buffer, filling it if it is empty.
+//             Returns the bytes taken, at pData, 0 at the end of the file
+//             or on an error.
+// ReadBlock - Reads a header block. Returns the bytes read, fewer at the
+//             end of the file.
+// Discard   - Reads past Bytes, or seeks past those not in the buffer.
+// ReadText  - Reads the data of the current member, the text of a GNU long
+//             name or of a pax header.
+//=============================================================================
+
+uint32_t TarArchive::Take(const uint8_t*& pData, uint64_t Bytes, const std::atomic<bool>* pCancel)
+{
+	if (_Start == _End)
+	{
+		_Start = 0;
+		_End = 0;
+		int64_t cbRead = _Reader->Read(_Buffer, _BufferLen, pCancel);
+		if (cbRead < 0)
+		{
+			_Error = _Reader->GetError();
+			return 0;
+		}
+		_End = (uint32_t)cbRead;
+	}
+	uint32_t cbTake = _End - _Start < Bytes ? _End - _Start : (uint32_t)Bytes;
+	pData = _Buffer + _Start;
+	_Start += cbTake;
+	_Offset += cbTake;
+	return cbTake;
+}
+
+uint32_t TarArchive::ReadBlock(uint8_t* pBlock, const std::atomic<bool>* pCancel)
+{
+	uint32_t cbTotal = 0;
+	while (cbTotal < TAR_BLOCK_LEN)
+	{
+		const uint8_t* pData;
+		uint32_t cbData = Take(pData, TAR_BLOCK_LEN - cbTotal, pCancel);
+		if (cbData == 0) break;
+		memcpy(pBlock + cbTotal, pData, cbData);
+		cbTotal += cbData;
+	}
+	return cbTotal;
+}
+
+bool TarArchive::Discard(uint64_t Bytes, const std::atomic<bool>* pCancel)
+{
+	if (_Seek)
+	{
+		uint32_t cbBuffered = _End - _Start < Bytes ? _End - _Start : (uint32_t)Bytes;
+		_Start += cbBuffered;
+		_Offset += cbBuffered;
+		_Reader->Skip(Bytes - cbBuffered);
+		_Offset += Bytes - cbBuffered;
+		return true;
+	}
+	while (Bytes > 0)
+	{
+		const uint8_t* pData;
+		uint32_t cbData = Take(pData, Bytes, pCancel);
+		if (cbData == 0)
+		{
+			if (_Error == 0 && (pCancel == NULL || !pCancel->load())) _Error = TAR_FORMAT_ERROR;
+			return false;
+		}
+		Bytes -= cbData;
+	}
+	return true;
+}
+
+bool TarArchive::ReadText(std::string& Text, const std::atomic<bool>* pCancel)
+{
+	if (_DataLeft > TAR_MAX_META_LEN)
+	{
+		_Error = TAR_FORMAT_ERROR;
+		_Ended = true;
+		return false;
+	}
+	Text.resize((size_t)_DataLeft);
+	if (Read((uint8_t*)&Text[0], (uint32_t)Text.size(), pCancel) != (int64_t)Text.size())
+	{
+		_Ended = true;
+		return false;
+	}
+	return true;
+}
+
+//=============================================================================
+// ParseNumber - Parses a number field of a header: octal, ended by a space
+//               or a NUL, or base 256 when its first bit is set.
+// ParsePax    - Takes the path, size and write time of a pax header, whose
+//               records are "length key=value\n".
+// Widen       - Converts a UTF-8 name, taking bytes that are not UTF-8 as
+//               Latin-1.
+//=============================================================================
+
+uint64_t TarArchive::ParseNumber(const uint8_t* pField, int Len)
+{
+	uint64_t Value = 0;
+	if (pField[0] & 0x80)
+	{
+		Value = pField[0] & 0x3F;
+		for (int i = 1; i < Len; ++i) Value = Value << 8 | pField[i];
+		return Value;
+	}
+	int i = 0;
+	while (i < Len && (pField[i] == ' ' || pField[i] == 0)) ++i;
+	for (; i < Len && pField[i] >= '0' && pField[i] <= '7'; ++i) Value = Value << 3 | (pField[i] - '0');
+	return Value;
+}
+
+void TarArchive::ParsePax(const std::string& Text, std::string& Path, uint64_t& Size, bool& bSize,
+                          uint64_t& Time, bool& bTime)
+{
+	size_t Position = 0;
+	while (Position < Text.size())
+	{
+		size_t Length = 0, i = Position;
+		for (; i < Text.size() && Text[i] >= '0' && Text[i] <= '9'; ++i) Length = Length * 10 + (Text[i] - '0');
+		if (i >= Text.size() || Text[i] != ' ' || Length <= i - Position || Position + Length > Text.size()) return;
+		size_t Equals = Text.find('=', i);
+		size_t End = Position + Length - 1; // The newline.
+		Position += Length;
+		if (Equals == std::string::npos || Equals >= End) continue;
+		std::string Key = Text.substr(i + 1, Equals - i - 1), Value = Text.substr(Equals + 1, End - Equals - 1);
+		if (Key == "path") Path = Value;
+		else if (Key == "size" || Key == "mtime")
+		{
+			uint64_t Number = 0;
+			size_t d = 0;
+			for (; d < Value.size() && Value[d] >= '0' && Value[d] <= '9'; ++d) Number = Number * 10 + (Value[d] - '0');
+			if (d == 0) continue; // A time before 1970 is left to the header.
+			if (Key == "size") { Size = Number; bSize = true; }
+			else               { Time = Number; bTime = true; }
+		}
+	}
+}
+
+std::wstring TarArchive::Widen(const std::string& Name)
+{
+	std::wstring Wide;
+	Wide.reserve(Name.size());
+	for (size_t i = 0; i < Name.size(); )
+	{
+		uint8_t Lead = (uint8_t)Name[i];
+		int Follow = Lead < 0xC2 ? 0 : Lead < 0xE0 ? 1 : Lead < 0xF0 ? 2 : Lead < 0xF5 ? 3 : 0;
+		uint32_t Code = Follow == 3 ? Lead & 0x07 : Follow == 2 ? Lead & 0x0F : Follow == 1 ? Lead & 0x1F : Lead;
+		int k = 1;
+		for (; k <= Follow && i + k < Name.size() && ((uint8_t)Name[i + k] & 0xC0) == 0x80; ++k)
+			Code = Code << 6 | ((uint8_t)Name[i + k] & 0x3F);
+		bool bValid = k == Follow + 1 && !(Follow == 2 && (Code < 0x800 || (Code >= 0xD800 && Code < 0xE000))) &&
+		              !(Follow == 3 && (Code < 0x10000 || Code > 0x10FFFF));
+		if (Follow == 0 || !bValid)
+		{
+			Wide += (wchar_t)Lead;
+			++i;
+			continue;
+		}
+		if (sizeof(wchar_t) == 2 && Code >= 0x10000)
+		{
+			Wide += (wchar_t)(0xD800 + ((Code - 0x10000) >> 10));
+			Wide += (wchar_t)(0xDC00 + ((Code - 0x10000) & 0x3FF));
+		}
+		else Wide += (wchar_t)Code;
+		i += Follow + 1;
+	}
+	return Wide;
+}
+
+//=============================================================================
+// IsArchive  - Whether a file is named as a tar archive.
+// FindMember - Where the separator of a member's name is in FileName, or
+//              npos for a file that is not a member of an archive. Only a
+//              separator after the name of an archive counts, so an
+//              ordinary path with "!/" in it is not taken for a member.
+//=============================================================================
+
+bool TarArchive::IsArchive(const std::wstring& FileName)
+{
+	if (FileName.size() < 4) return false;
+	const wchar_t* pExtension = FileName.c_str() + FileName.size() - 4;
+	return pExtension[0] == L'.' && (pExtension[1] | 0x20) == L't' && (pExtension[2] | 0x20) == L'a' &&
+	       (pExtension[3] | 0x20) == L'r';
+}
+
+size_t TarArchive::FindMember(const std::wstring& FileName)
+{
+	for (size_t Separator = FileName.find(TAR_SEPARATOR); Separator != std::wstring::npos;
+	     Separator = FileName.find(TAR_SEPARATOR, Separator + 1))
+	{
+		if (IsArchive(FileName.substr(0, Separator))) return Separator;
+	}
+	return std::wstring::npos;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////////
+// TarArchive.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "FileReader.h"
+#include <stdint.h>
+#include <string>
+
+#define TAR_BLOCK_LEN 512               // Headers, and the data of each member, fill whole blocks.
+#define TAR_LIST_BUFFER_LEN (64 * 1024) // Bytes read at a time while listing, which seeks past the data.
+#define TAR_MAX_META_LEN (1024 * 1024)  // Longest GNU long name or pax header that is read.
+#define TAR_SEPARATOR L"!/"             // Joins the name of an archive to the name of one of its members.
+
+struct TarMember
+{
+	std::wstring Name;      // Path within the archive, with '/' between its parts.
+	uint64_t     Size;
+	uint64_t     WriteTime; // UTC FILETIME.
+	uint64_t     Offset;    // Where its header starts in the archive, which tells two members of one name apart.
+};
+
+class TarArchive
+{
+private:
+	FileReader*  _Reader;
+	bool         _Seek;      // Skip the data that is not read without reading it.
+	uint8_t*     _Buffer;
+	uint32_t     _BufferLen;
+	uint32_t     _Start;     // Next byte of _Buffer to take.
+	uint32_t     _End;       // Bytes in _Buffer.
+	uint64_t     _Offset;    // Where _Buffer[_Start] is in the archive.
+	uint64_t     _DataLeft;  // Bytes of the current member not yet read.
+	uint64_t     _PadLeft;   // Bytes after them to the end of the block.
+	bool         _Ended;
+	uint32_t     _Error;     // System error code of the last failure, 0 if none.
+	uint32_t     Take(const uint8_t*& pData, uint64_t Bytes, const std::atomic<bool>* pCancel);
+	uint32_t     ReadBlock(uint8_t* pBlock, const std::atomic<bool>* pCancel);
+	bool         Discard(uint64_t Bytes, const std::atomic<bool>* pCancel);
+	bool         ReadText(std::string& Text, const std::atomic<bool>* pCancel);
+	static uint64_t     ParseNumber(const uint8_t* pField, int Len);
+	static void         ParsePax(const std::string& Text, std::string& Path, uint64_t& Size, bool& bSize,
+	                             uint64_t& Time, bool& bTime);
+	static std::wstring Widen(const std::string& Name);
+public:
+	TarArchive(FileReader* pReader, uint32_t BufferLen, bool Seek);
+	~TarArchive();
+	bool     Open(const std::wstring& FileName, const DirectoryEnumerator* pDirectory = NULL);
+	bool     Next(TarMember& Member, const std::atomic<bool>* pCancel = NULL);
+	int64_t  Read(uint8_t* pBuffer, uint32_t cbBuffer, const std::atomic<bool>* pCancel = NULL);
+	void     Close();
+	uint64_t GetOffset() const { return _Offset; }
+	uint32_t GetError() const { return _Error; }
+	static bool   IsArchive(const std::wstring& FileName);
+	static size_t FindMember(const std::wstring& FileName);
+};
\ No newline at end of file
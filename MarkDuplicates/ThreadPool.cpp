@@ -0,0 +1,342 @@
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool.cpp - A pool of worker threads created once and shared by the
+//                  scan, the hashing, the sorts, and the mark. Each worker
+//                  has its own deque of tasks. A worker takes its newest
+//                  task first and, when its deque is empty, steals the
+//                  oldest task of another worker. Tasks submitted from
+//                  outside the pool are dealt to the deques in turn.
+//
+//                  The workers may be kept to a set of processors, so that
+//                  a scan leaves the others to the rest of the machine, and
+//                  may be pinned, each to one processor of the set, so that
+//                  a hasher stays beside the buffers it first touched.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPool.h"
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static thread_local const ThreadPool* tlsWorkerPool = NULL; // Pool of the calling worker, or NULL.
+static thread_local int tlsWorkerIndex = -1;                 // Index of the calling worker in its pool.
+
+//=============================================================================
+// Constructor - Starts the workers. Threads = 0 sizes the pool from the
+//               processors of the machine, or of CpuSet. CpuSet = 0 lets
+//               the workers run anywhere; otherwise it is a mask of the
+//               processors, 0 to 63, they may run on. Pin puts worker i on
+//               the i-th processor of the set, wrapping around.
+//=============================================================================
+
+ThreadPool::ThreadPool(int Threads, uint64_t CpuSet, bool Pin)
+{
+	_CpuSet = CpuSet & GetAvailableCpus();
+	_Pin = Pin;
+	if (Threads <= 0) Threads = GetDefaultThreads(_CpuSet);
+	if (Threads > MAX_POOL_THREADS) Threads = MAX_POOL_THREADS;
+	_ThreadCount = Threads;
+	_Queued = 0;
+	_Active = 0;
+	_NextWorker = 0;
+	_Stop = false;
+	_Workers = new tagWorker[_ThreadCount];
+	_Threads = new std::thread[_ThreadCount];
+	for (int i = 0; i < _ThreadCount; ++i) _Threads[i] = std::thread(&ThreadPool::WorkerMain, this, i);
+}
+
+//=============================================================================
+// Destructor - Lets the workers finish the queued tasks and joins them.
+//=============================================================================
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> Sleep(_SleepLock);
+		_Stop = true;
+	}
+	_WorkReady.notify_all();
+	for (int i = 0; i < _ThreadCount; ++i) _Threads[i].join();
+	delete[] _Threads;
+	delete[] _Workers;
+}
+
+//=============================================================================
+// GetCallerIndex - Returns the index of the calling worker, or -1 if the
+//                  caller is not a worker of this pool, such as a worker of
+//                  another pool.
+//=============================================================================
+
+int ThreadPool::GetCallerIndex() const
+{
+	return tlsWorkerPool == this ? tlsWorkerIndex : -1;
+}
+
+//=============================================================================
+// GetDefaultThreads - One worker per logical processor, of the machine or of
+//                     CpuSet if that is not 0.
+//=============================================================================
+
+int ThreadPool::GetDefaultThreads(uint64_t CpuSet)
+{
+	int Threads = 0;
+	for (; CpuSet != 0; CpuSet &= CpuSet - 1) ++Threads;
+	if (Threads == 0) Threads = (int)std::thread::hardware_concurrency();
+	if (Threads <= 0) Threads = 1;
+	return Threads < MAX_POOL_THREADS ? Threads : MAX_POOL_THREADS;
+}
+
+//=============================================================================
+// GetAvailableCpus - Returns the mask of the processors, 0 to 63, that the
+//                    process may run on.
+//=============================================================================
+
+uint64_t ThreadPool::GetAvailableCpus()
+{
+#ifdef _WIN32
+	DWORD_PTR ProcessMask, SystemMask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask)) return ~(uint64_t)0;
+	return (uint64_t)ProcessMask;
+#else
+	cpu_set_t Set;
+	CPU_ZERO(&Set);
+	if (sched_getaffinity(0, sizeof(Set), &Set) != 0) return ~(uint64_t)0;
+	uint64_t Mask = 0;
+	for (int i = 0; i < 64; ++i) if (CPU_ISSET(i, &Set)) Mask |= (uint64_t)1 << i;
+	return Mask;
+#endif
+}
+
+//=============================================================================
+// SetThreadCpus - Keeps the calling thread to the processors of CpuSet.
+//                 Returns false if the system refuses.
+//=============================================================================
+
+bool ThreadPool::SetThreadCpus(uint64_t CpuSet)
+{
+	if (CpuSet == 0) return false;
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)CpuSet) != 0;
+#else
+	cpu_set_t Set;
+	CPU_ZERO(&Set);
+	for (int i = 0; i < 64; ++i) if (CpuSet & ((uint64_t)1 << i)) CPU_SET(i, &Set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0;
+#endif
+}
+
+//=============================================================================
+// SetThreadBackground - Gives the I/O of the calling thread the lowest
+//                       priority, so that it yields the disk to everything
+//                       else, or with false returns it to normal. On
+//                       Windows this is background mode, which also lowers
+//                       the priority of the thread; on Linux it is the idle
+//                       I/O class of ioprio_set. Returns false if the system
+//                       refuses.
+//=============================================================================
+
+bool ThreadPool::SetThreadBackground(bool Background)
+{
+#ifdef _WIN32
+	return SetThreadPriority(GetCurrentThread(), Background ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END) != 0;
+#else
+	const int WhoProcess = 1, ClassIdle = 3, ClassShift = 13; // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE, IOPRIO_CLASS_SHIFT
+	return syscall(SYS_ioprio_set, WhoProcess, 0, Background ? ClassIdle << ClassShift : 0) == 0;
+#endif
+}
+
+//=============================================================================
+// ParseCpuSet - Reads a list of processors and ranges, such as "0-7,16-23".
+//               An empty list means any processor, a CpuSet of 0. Returns
+//               false if the list is not valid.
+//=============================================================================
+
+bool ThreadPool::ParseCpuSet(const std::wstring& List, uint64_t& CpuSet)
+{
+	uint64_t Mask = 0;
+	size_t i = 0;
+	while (i < List.size())
+	{
+		if (List[i] == L' ' || List[i] == L',') { ++i; continue; }
+		int First = 0, Last, Digits = 0;
+		for (; i < List.size() && List[i] >= L'0' && List[i] <= L'9' && First < 64; ++i, ++Digits) First = First * 10 + (List[i] - L'0');
+		if (Digits == 0 || First > 63) return false;
+		Last = First;
+		if (i < List.size() && List[i] == L'-')
+		{
+			Last = 0;
+			for (++i, Digits = 0; i < List.size() && List[i] >= L'0' && List[i] <= L'9' && Last < 64; ++i, ++Digits) Last = Last * 10 + (List[i] - L'0');
+			if (Digits == 0 || Last > 63 || Last < First) return false;
+		}
+		for (int Cpu = First; Cpu <= Last; ++Cpu) Mask |= (uint64_t)1 << Cpu;
+	}
+	CpuSet = Mask;
+	return true;
+}
+
+//=============================================================================
+// FormatCpuSet - Writes a CpuSet as ParseCpuSet reads it, empty for 0.
+//=============================================================================
+
+std::wstring ThreadPool::FormatCpuSet(uint64_t CpuSet)
+{
+	std::wstring List;
+	for (int Cpu = 0; Cpu < 64; ++Cpu)
+	{
+		if (!(CpuSet & ((uint64_t)1 << Cpu))) continue;
+		int Last = Cpu;
+		while (Last < 63 && (CpuSet & ((uint64_t)1 << (Last + 1)))) ++Last;
+		if (!List.empty()) List += L',';
+		List += std::to_wstring(Cpu);
+		if (Last > Cpu) List += L'-' + std::to_wstring(Last);
+		Cpu = Last;
+	}
+	return List;
+}
+
+//=============================================================================
+// Submit - Queues a task. A worker queues on its own deque, so the tasks it
+//          spawns stay local unless another worker runs out of work.
+//=============================================================================
+
+void ThreadPool::Submit(std::function<void()> Task)
+{
+	int Index = GetCallerIndex();
+	if (Index < 0) Index = (int)(_NextWorker.fetch_add(1, std::memory_order_relaxed) % _ThreadCount);
+	_Active.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> Lock(_Workers[Index].Lock);
+		_Workers[Index].Tasks.push_back(std::move(Task));
+	}
+	{
+		std::lock_guard<std::mutex> Sleep(_SleepLock);
+		_Queued.fetch_add(1);
+	}
+	_WorkReady.notify_one();
+}
+
+//=============================================================================
+// Wait - Waits until every submitted task has finished, or for up to
+//        Milliseconds if that is not negative. Returns false on a timeout.
+//        Not to be called from a worker; use ParallelFor there.
+//=============================================================================
+
+bool ThreadPool::Wait(int Milliseconds)
+{
+	std::unique_lock<std::mutex> Sleep(_SleepLock);
+	if (Milliseconds < 0)
+	{
+		_AllDone.wait(Sleep, [this] { return _Active.load() == 0; });
+		return true;
+	}
+	return _AllDone.wait_for(Sleep, std::chrono::milliseconds(Milliseconds),
+		[this] { return _Active.load() == 0; });
+}
+
+//=============================================================================
+// ParallelFor - Calls Body(First, Last) over chunks of at most Grain items
+//               of First up to but not including Last, and returns when all
+//               of them are done. The caller runs tasks while it waits, so
+//               a worker may call it without starving the pool.
+//=============================================================================
+
+void ThreadPool::ParallelFor(int First, int Last, int Grain, const std::function<void(int, int)>& Body)
+{
+	if (Last - First <= 0) return;
+	if (Grain < 1) Grain = 1;
+	if (Last - First <= Grain)
+	{
+		Body(First, Last);
+		return;
+	}
+
+	std::atomic<int> Remaining((Last - First + Grain - 1) / Grain);
+	for (int Chunk = First; Chunk < Last; Chunk += Grain)
+	{
+		int ChunkLast = Last - Chunk > Grain ? Chunk + Grain : Last;
+		Submit([&Body, &Remaining, Chunk, ChunkLast]
+			{
+				Body(Chunk, ChunkLast);
+				Remaining.fetch_sub(1);
+			});
+	}
+	while (Remaining.load() > 0)
+	{
+		if (!RunOne(GetCallerIndex())) std::this_thread::yield();
+	}
+}
+
+//=============================================================================
+// RunOne - Runs the newest task of the worker's own deque or, failing that,
+//          the oldest task of another deque. Returns false if there was no
+//          task to run.
+//=============================================================================
+
+bool ThreadPool::RunOne(int Index)
+{
+	std::function<void()> Task;
+	bool bFound = false;
+	if (Index >= 0)
+	{
+		std::lock_guard<std::mutex> Lock(_Workers[Index].Lock);
+		if (!_Workers[Index].Tasks.empty())
+		{
+			Task = std::move(_Workers[Index].Tasks.back());
+			_Workers[Index].Tasks.pop_back();
+			bFound = true;
+		}
+	}
+	for (int i = 1; i <= _ThreadCount && !bFound; ++i)
+	{
+		int Victim = ((Index < 0 ? 0 : Index) + i) % _ThreadCount;
+		std::lock_guard<std::mutex> Lock(_Workers[Victim].Lock);
+		if (!_Workers[Victim].Tasks.empty())
+		{
+			Task = std::move(_Workers[Victim].Tasks.front());
+			_Workers[Victim].Tasks.pop_front();
+			bFound = true;
+		}
+	}
+	if (!bFound) return false;
+
+	_Queued.fetch_sub(1);
+	Task();
+	if (_Active.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> Sleep(_SleepLock);
+		_AllDone.notify_all();
+	}
+	return true;
+}
+
+//=============================================================================
+// WorkerMain - Places the worker on its processors, then runs tasks until
+//              the pool is destroyed, sleeping while there are none.
+//=============================================================================
+
+void ThreadPool::WorkerMain(int Index)
+{
+	tlsWorkerPool = this;
+	tlsWorkerIndex = Index;
+	if (_Pin)
+	{
+		uint64_t Cpus = _CpuSet != 0 ? _CpuSet : GetAvailableCpus();
+		int Count = GetDefaultThreads(Cpus), Nth = Index % (Count > 0 ? Count : 1);
+		for (; Nth > 0 && Cpus != 0; --Nth) Cpus &= Cpus - 1;
+		SetThreadCpus(Cpus & (~Cpus + 1)); // The lowest processor left.
+	}
+	else if (_CpuSet != 0) SetThreadCpus(_CpuSet);
+	for (;;)
+	{
+		if (RunOne(Index)) continue;
+		std::unique_lock<std::mutex> Sleep(_SleepLock);
+		_WorkReady.wait(Sleep, [this] { return _Stop || _Queued.load() > 0; });
+		if (_Stop && _Queued.load() == 0) return;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool.h
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+#define MAX_POOL_THREADS 64
+
+class ThreadPool
+{
+private:
+	typedef struct tagWorker
+	{
+		std::mutex                        Lock;
+		std::deque<std::function<void()>> Tasks; // The owner works from the back, thieves steal from the front.
+	} *Worker;
+	Worker                  _Workers;
+	std::thread*            _Threads;
+	int                     _ThreadCount;
+	std::atomic<int>        _Queued;      // Tasks waiting in the deques.
+	std::atomic<int>        _Active;      // Tasks submitted and not yet finished.
+	std::atomic<unsigned>   _NextWorker;  // Deque for the next task submitted from outside the pool.
+	std::mutex              _SleepLock;
+	std::condition_variable _WorkReady;
+	std::condition_variable _AllDone;
+	bool                    _Stop;
+	uint64_t                _CpuSet;      // Processors the workers may run on, 0 for any.
+	bool                    _Pin;         // Each worker runs on one processor of the set.
+	void WorkerMain(int Index);
+	bool RunOne(int Index);
+	int  GetCallerIndex() const;
+public:
+	ThreadPool(int Threads = 0, uint64_t CpuSet = 0, bool Pin = false);
+	~ThreadPool();
+	int  GetThreadCount() const { return _ThreadCount; }
+	uint64_t GetCpuSet() const { return _CpuSet; }
+	bool IsPinned() const { return _Pin; }
+	static int GetDefaultThreads(uint64_t CpuSet = 0);
+	static uint64_t GetAvailableCpus();
+	static bool SetThreadCpus(uint64_t CpuSet);
+	static bool SetThreadBackground(bool Background);
+	static bool ParseCpuSet(const std::wstring& List, uint64_t& CpuSet);
+	static std::wstring FormatCpuSet(uint64_t CpuSet);
+	void Submit(std::function<void()> Task);
+	bool Wait(int Milliseconds = -1);
+	void ParallelFor(int First, int Last, int Grain, const std::function<void(int, int)>& Body);
+};
\ No newline at end of file
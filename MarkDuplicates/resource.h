@@ -16,6 +16,15 @@
 #define IDD_DIALOG1                     129
 #define IDD_DIALOG2                     130
 #define IDC_THREADS                     1000
+#define IDC_READERS                     1001
+#define IDC_CPUSET                      1002
+#define IDC_PINTHREADS                  1003
+#define IDC_QUEUEDEPTH                  1004
+#define IDC_MAXMBYTES                   1005
+#define IDC_MAXOPENS                    1006
+#define IDC_LOWPRIORITY                 1007
+#define IDC_MAXMEMORY                   1008
+#define IDC_FILESINFLIGHT               1009
 #define ID_FILE_TEST                    32771
 #define ID_FILE_SCAN                    32772
 #define ID_EDIT_FONT                    32773
@@ -30,6 +39,18 @@
 #define ID_FILE_LOAD                    32782
 #define ID_EDIT_COPY                    32783
 #define ID_EDIT_THREADS                 32786
+#define ID_SORT_BYWASTE                 32787
+#define ID_EDIT_LOCALTIME               32788
+#define ID_HASHORDER_SCAN               32789
+#define ID_HASHORDER_LARGEST            32790
+#define ID_HASHORDER_SMALLEST           32791
+#define ID_HASHORDER_NAME               32792
+#define ID_HASHORDER_DISK               32793
+#define ID_HASHORDER_LANES              32794
+#define ID_FILE_CALIBRATE               32795
+#define ID_READOPTIONS_NOATIME          32796
+#define ID_READOPTIONS_DROPBEHIND       32797
+#define ID_READOPTIONS_UNBUFFERED       32798
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -38,8 +59,8 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        131
-#define _APS_NEXT_COMMAND_VALUE         32787
-#define _APS_NEXT_CONTROL_VALUE         1001
+#define _APS_NEXT_COMMAND_VALUE         32799
+#define _APS_NEXT_CONTROL_VALUE         1010
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
 #endif
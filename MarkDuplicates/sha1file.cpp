@@ -40,8 +40,11 @@ sha1file::~sha1file()
 // 
 // Digest    - 61 character (SHA_DIGEST_LEN * 3 + 1) array to hold the hash.
 // pszSummary   - If iRepeatCount > 0, the summary of the testing performed.
+// pCancel      - If not NULL, checked before each block is read. Once it is set, the file is
+//                closed and false is returned, with no digest or summary.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool sha1file::Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDigest, TCHAR* pszSummary)
+bool sha1file::Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDigest, TCHAR* pszSummary,
+                       const std::atomic<bool>* pCancel)
 {
 	int i, err, iRepeat;
 	BOOL bDataError = false;
@@ -112,7 +115,7 @@ bool sha1file::Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDig
 	{
 		// Open data file for shared reading.
 		_LastAPILine = __LINE__ + 1;
-		HANDLE hFile = CreateFile(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		HANDLE hFile = CreateFile(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
 		if (hFile == INVALID_HANDLE_VALUE)
 		{
 			FormatErrorAndAbort(_T("sha1file::Process::CreateFileDat"), GetLastError(), pszFileName);
@@ -134,6 +137,13 @@ bool sha1file::Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDig
 
 		while (true) // Until EOF.
 		{
+			// Stop between blocks if cancelled.
+			if (pCancel != NULL && pCancel->load(std::memory_order_relaxed))
+			{
+				CloseHandle(hFile);
+				return false;
+			}
+
 			// Read a buffer.
 			_LastAPILine = __LINE__ + 1;
 			bRead = ReadFile(hFile, FileBuffer, FILE_BLOCK_LEN, &cbFileBuffer, NULL);
@@ -223,6 +233,48 @@ bool sha1file::Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDig
 	return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hash a file a block at a time: Begin, then Input for each block in order, then End.
+// The blocks may be read elsewhere, e.g. by a FileReader on another thread.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool sha1file::Begin()
+{
+	_LastAPILine = __LINE__ + 1;
+	int err = SHA1Reset(&_Context);
+	if (err) FormatErrorAndAbort(_T("sha1file::Begin::SHA1Reset"), err);
+	return true;
+}
+
+bool sha1file::Input(const uint8_t* pBuffer, DWORD cbBuffer)
+{
+	if (cbBuffer == 0) return true;
+	_LastAPILine = __LINE__ + 1;
+	int err = SHA1Input(&_Context, pBuffer, cbBuffer);
+	if (err) FormatErrorAndAbort(_T("sha1file::Input::SHA1Input"), err);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Digest - 61 character (SHA_DIGEST_LEN * 3 + 1) array to hold the hash, formatted as by Process.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool sha1file::End(TCHAR* pszDigest)
+{
+	uint8_t MessageDigest[SHA_DIGEST_LEN];
+	_LastAPILine = __LINE__ + 1;
+	int err = SHA1Result(&_Context, MessageDigest);
+	if (err) FormatErrorAndAbort(_T("sha1file::End::SHA1Result"), err);
+
+	const TCHAR* pszHex = _T("0123456789ABCDEF");
+	for (int i = 0; i < SHA_DIGEST_LEN; ++i)
+	{
+		pszDigest[i * 3]     = pszHex[MessageDigest[i] >> 4];
+		pszDigest[i * 3 + 1] = pszHex[MessageDigest[i] & 15];
+		pszDigest[i * 3 + 2] = _T(' ');
+	}
+	pszDigest[SHA_DIGEST_LEN * 3 - 1] = _T('\0'); // Change last space to a null
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Format error message for a WinAPI caLL
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2,7 +2,12 @@
 // sha1file.h : Header for the sha1file class
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#pragma once
 #include "framework.h"
+#include <atomic>
+extern "C" {
+#include "sha1.h"
+}
 
 #define MAX_ERROR_LEN 128
 #define FILE_BLOCK_LEN 1024
@@ -15,15 +20,20 @@ private:
 	int          _LastAPILine;
 	DWORD        _LastAPIError;
 	bool         _IsOK;
-	void         FormatErrorAndAbort(const TCHAR* pszSource, int err); // for SHA1 errors
-	void         FormatErrorAndAbort(const TCHAR* pszFunction, DWORD Error, const TCHAR* pszFileName);   // for SHA1 errors with a file name
-	void         FormatErrorAndAbort(const TCHAR* pszFunction, DWORD Error); // for API errors
+	SHA1Context  _Context; // For hashing a file a block at a time, see Begin.
+	[[noreturn]] void FormatErrorAndAbort(const TCHAR* pszSource, int err); // for SHA1 errors
+	[[noreturn]] void FormatErrorAndAbort(const TCHAR* pszFunction, DWORD Error, const TCHAR* pszFileName);   // for SHA1 errors with a file name
+	[[noreturn]] void FormatErrorAndAbort(const TCHAR* pszFunction, DWORD Error); // for API errors
 public:
 	sha1file();
 	~sha1file();
 	int          GetMessageDigestLength() { return SHA_DIGEST_LEN; }
 	int          GetMessageSummaryLength() { return SHA_SUMMARY_LEN; }
-	bool         Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDigest, TCHAR* pszSummary);
+	bool         Process(const TCHAR* pszFileName, int iRepeatCount, TCHAR* pszDigest, TCHAR* pszSummary,
+	                     const std::atomic<bool>* pCancel = NULL);
+	bool         Begin();
+	bool         Input(const uint8_t* pBuffer, DWORD cbBuffer);
+	bool         End(TCHAR* pszDigest);
 	int          GetLastAPILine() { return _LastAPILine; }
 	int          GetLastAPIError() { return _LastAPIError; }
 	bool         IsOK() { return _IsOK; }